@@ -2,12 +2,14 @@
 #include "screen.h"
 #include "mm.h"
 #include "interrupts.h"
+#include "irq.h"
+#include "pci.h"
 #include <string.h>
 
 // RTL8139 network card driver
 
-#define RTL8139_PORT_BASE 0xC000
-#define RTL8139_IRQ 32
+#define RTL8139_VENDOR_ID 0x10EC
+#define RTL8139_DEVICE_ID 0x8139
 
 // RTL8139 registers
 #define RTL8139_IDR 0x00
@@ -25,6 +27,13 @@
 #define RTL8139_RBSTOP 0x34
 #define RTL8139_RBLEN 0x3A
 
+// RTL8139 interrupt status bits
+#define RTL8139_ISR_ROK 0x01
+#define RTL8139_ISR_TOK 0x04
+
+// Interrupts taken while receive is not being polled
+#define RTL8139_INTR_MASK (RTL8139_ISR_ROK | RTL8139_ISR_TOK)
+
 // RTL8139 commands
 #define RTL8139_CMD_RESET 0x10
 #define RTL8139_CMD_TX_ENABLE 0x04
@@ -38,41 +47,11 @@ static net_device_t rtl8139_dev;
 static uint8_t* rx_buffer;
 static uint8_t* tx_buffers[4];
 static int current_tx_buffer = 0;
+static unsigned int rtl8139_irq;
+static struct napi_struct rtl8139_napi;
 
-// PCI configuration space access
-static uint16_t pci_config_read_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
-    uint32_t address = (uint32_t)((bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC) | 0x80000000);
-    
-    outl(0xCF8, address);
-    return (uint16_t)((inl(0xCFC) >> ((offset & 2) * 8)) & 0xFFFF);
-}
-
-static void pci_config_write_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value) {
-    uint32_t address = (uint32_t)((bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC) | 0x80000000);
-    
-    outl(0xCF8, address);
-    outw(0xCFC, value);
-}
-
-// Find RTL8139 device
-static bool find_rtl8139(uint8_t* bus, uint8_t* slot, uint8_t* func) {
-    for (uint8_t b = 0; b < 256; b++) {
-        for (uint8_t s = 0; s < 32; s++) {
-            for (uint8_t f = 0; f < 8; f++) {
-                uint16_t vendor = pci_config_read_word(b, s, f, 0x00);
-                uint16_t device = pci_config_read_word(b, s, f, 0x02);
-                
-                if (vendor == 0x10EC && device == 0x8139) {
-                    *bus = b;
-                    *slot = s;
-                    *func = f;
-                    return true;
-                }
-            }
-        }
-    }
-    return false;
-}
+// Register window, from BAR0 (I/O space)
+static uint16_t rtl8139_iobase;
 
 // RTL8139 device operations
 static int rtl8139_open(net_device_t* dev) {
@@ -91,22 +70,23 @@ static int rtl8139_open(net_device_t* dev) {
     }
     
     // Reset the card
-    outb(RTL8139_PORT_BASE + RTL8139_CMD, RTL8139_CMD_RESET);
-    while (inb(RTL8139_PORT_BASE + RTL8139_CMD) & RTL8139_CMD_RESET) {
+    outb(rtl8139_iobase + RTL8139_CMD, RTL8139_CMD_RESET);
+    while (inb(rtl8139_iobase + RTL8139_CMD) & RTL8139_CMD_RESET) {
         // Wait for reset to complete
     }
     
     // Set receive buffer
-    outl(RTL8139_PORT_BASE + RTL8139_RBSTART, (uint32_t)rx_buffer);
+    outl(rtl8139_iobase + RTL8139_RBSTART, (uint32_t)rx_buffer);
     
     // Enable receive and transmit
-    outb(RTL8139_PORT_BASE + RTL8139_CMD, RTL8139_CMD_TX_ENABLE | RTL8139_CMD_RX_ENABLE);
+    outb(rtl8139_iobase + RTL8139_CMD, RTL8139_CMD_TX_ENABLE | RTL8139_CMD_RX_ENABLE);
     
     // Set receive configuration
-    outl(RTL8139_PORT_BASE + RTL8139_RCR, 0x0F | (1 << 7));  // Accept all packets
+    outl(rtl8139_iobase + RTL8139_RCR, 0x0F | (1 << 7));  // Accept all packets
     
     // Enable interrupts
-    outw(RTL8139_PORT_BASE + RTL8139_IMR, 0x0005);  // RX OK and TX OK
+    napi_enable(&rtl8139_napi);
+    outw(rtl8139_iobase + RTL8139_IMR, RTL8139_INTR_MASK);
     
     dev->up = true;
     
@@ -116,7 +96,9 @@ static int rtl8139_open(net_device_t* dev) {
 
 static int rtl8139_close(net_device_t* dev) {
     // Disable card
-    outb(RTL8139_PORT_BASE + RTL8139_CMD, 0x00);
+    outw(rtl8139_iobase + RTL8139_IMR, 0);
+    outb(rtl8139_iobase + RTL8139_CMD, 0x00);
+    napi_disable(&rtl8139_napi);
     
     // Free buffers
     kfree(rx_buffer);
@@ -137,7 +119,7 @@ static int rtl8139_transmit(net_device_t* dev, void* data, size_t len) {
     memcpy(tx_buffers[current_tx_buffer], data, len);
     
     // Set transmit status descriptor
-    outl(RTL8139_PORT_BASE + RTL8139_TSD + current_tx_buffer * 4, len);
+    outl(rtl8139_iobase + RTL8139_TSD + current_tx_buffer * 4, len);
     
     // Move to next buffer
     current_tx_buffer = (current_tx_buffer + 1) % 4;
@@ -150,61 +132,112 @@ static void rtl8139_receive(net_device_t* dev, void* data, size_t len) {
     // Actual packet processing is done in the interrupt handler
 }
 
-// RTL8139 interrupt handler
-static void rtl8139_handler(interrupt_frame_t* frame) {
-    uint16_t status = inw(RTL8139_PORT_BASE + RTL8139_ISR);
-    
-    if (status & 0x01) {  // RX OK
-        // Process received packets
-        uint16_t capr = inw(RTL8139_PORT_BASE + RTL8139_CAPR);
-        uint16_t cbr = inw(RTL8139_PORT_BASE + RTL8139_CBA);
+// RTL8139 interrupt handler: acknowledge, and on receive mask RX and
+// leave the ring to the handler thread so a flood cannot keep us in
+// hard-IRQ context
+static irqreturn_t rtl8139_interrupt(unsigned int irq, void* dev_id) {
+    uint16_t status = inw(rtl8139_iobase + RTL8139_ISR);
+    
+    if (!status) {
+        return IRQ_NONE;  // Shared line, not ours
+    }
+    
+    // Acknowledge interrupts
+    outw(rtl8139_iobase + RTL8139_ISR, status);
+    
+    if (status & RTL8139_ISR_TOK) {
+        // Transmit complete
+    }
+    
+    if (status & RTL8139_ISR_ROK) {
+        outw(rtl8139_iobase + RTL8139_IMR, RTL8139_INTR_MASK & ~RTL8139_ISR_ROK);
+        return IRQ_WAKE_THREAD;
+    }
+    
+    return IRQ_HANDLED;
+}
+
+// RTL8139 NAPI poll: hand up to budget frames from the ring to the
+// stack, and unmask RX only once the ring is empty
+static int rtl8139_poll(struct napi_struct* napi, int budget) {
+    uint16_t capr = inw(rtl8139_iobase + RTL8139_CAPR);
+    int work = 0;
+    
+    while (work < budget && capr != inw(rtl8139_iobase + RTL8139_CBA)) {
+        // Get packet header
+        uint16_t* header = (uint16_t*)(rx_buffer + capr + 2);
+        uint16_t packet_len = ntohs(header[0]);
+        uint16_t packet_status = ntohs(header[1]);
+        
+        if (packet_len > 0 && packet_len < RTL8139_RX_BUFFER_SIZE) {
+            netif_receive_skb(&rtl8139_dev, rx_buffer + capr + 4, packet_len - 4);
+        }
+        work++;
         
-        while (capr != cbr) {
-            // Get packet header
-            uint16_t* header = (uint16_t*)(rx_buffer + capr + 2);
-            uint16_t packet_len = ntohs(header[0]);
-            uint16_t packet_status = ntohs(header[1]);
-            
-            if (packet_len > 0 && packet_len < RTL8139_RX_BUFFER_SIZE) {
-                // Pass packet to network stack
-                eth_receive(&rtl8139_dev, rx_buffer + capr + 4, packet_len - 4);
-            }
-            
-            // Move to next packet
-            capr = (capr + packet_len + 4 + 3) & ~3;
-            if (capr >= RTL8139_RX_BUFFER_SIZE) {
-                capr -= RTL8139_RX_BUFFER_SIZE;
-            }
-            
-            outw(RTL8139_PORT_BASE + RTL8139_CAPR, capr - 16);
+        // Move to next packet
+        capr = (capr + packet_len + 4 + 3) & ~3;
+        if (capr >= RTL8139_RX_BUFFER_SIZE) {
+            capr -= RTL8139_RX_BUFFER_SIZE;
         }
+        
+        outw(rtl8139_iobase + RTL8139_CAPR, capr - 16);
     }
     
-    if (status & 0x04) {  // TX OK
-        // Transmit complete
+    // Frames that land after the last check set ROK again, which fires
+    // as soon as RX is unmasked
+    if (work < budget && napi_complete_done(napi, work)) {
+        outw(rtl8139_iobase + RTL8139_IMR, RTL8139_INTR_MASK);
     }
     
-    // Acknowledge interrupts
-    outw(RTL8139_PORT_BASE + RTL8139_ISR, status);
+    return work;
 }
 
-// Initialize RTL8139 driver
-int rtl8139_init(void) {
-    uint8_t bus, slot, func;
+// RTL8139 RX handler thread: one NAPI-sized pass at the thread's
+// priority and on the IRQ's CPUs. A flood is left to NET_RX_SOFTIRQ,
+// whose budget and time limit keep it from holding the CPU. Owning the
+// NAPI instance keeps this out of the way of napi_disable() on close
+static irqreturn_t rtl8139_rx_thread(unsigned int irq, void* dev_id) {
+    if (!napi_schedule_prep(&rtl8139_napi)) {
+        return IRQ_HANDLED;
+    }
     
-    if (!find_rtl8139(&bus, &slot, &func)) {
-        screen_print("RTL8139 network card not found\n");
-        return -1;
+    // A full pass leaves the instance scheduled: more frames are waiting
+    if (rtl8139_poll(&rtl8139_napi, NAPI_POLL_WEIGHT) == NAPI_POLL_WEIGHT) {
+        __napi_schedule(&rtl8139_napi);
+    }
+    
+    return IRQ_HANDLED;
+}
+
+// Bind to the first RTL8139 found by the PCI scan
+static int rtl8139_probe(struct pci_dev* pdev, const struct pci_device_id* id) {
+    int irq;
+    
+    if (rtl8139_iobase) {
+        return -EBUSY;  // One eth0 only
     }
     
-    // Enable bus mastering
-    uint16_t command = pci_config_read_word(bus, slot, func, 0x04);
-    command |= 0x04;  // Enable bus mastering
-    pci_config_write_word(bus, slot, func, 0x04, command);
+    if (!(pci_resource_flags(pdev, 0) & IORESOURCE_IO)) {
+        screen_print("RTL8139: BAR0 is not an I/O port range\n");
+        return -ENODEV;
+    }
+    rtl8139_iobase = pci_resource_start(pdev, 0);
+    
+    pci_enable_device(pdev);
+    pci_set_master(pdev);
+    
+    // The 8139 has no MSI capability, so this settles on its INTx line
+    if (pci_alloc_irq_vectors(pdev, 1, 1, PCI_IRQ_ALL_TYPES) < 0 ||
+        (irq = pci_irq_vector(pdev, 0)) < 0) {
+        screen_print("RTL8139: no interrupt assigned\n");
+        rtl8139_iobase = 0;
+        return -ENODEV;
+    }
+    rtl8139_irq = irq;
     
     // Get MAC address
-    uint32_t mac0 = inl(RTL8139_PORT_BASE + RTL8139_IDR);
-    uint16_t mac4 = inw(RTL8139_PORT_BASE + RTL8139_IDR + 4);
+    uint32_t mac0 = inl(rtl8139_iobase + RTL8139_IDR);
+    uint16_t mac4 = inw(rtl8139_iobase + RTL8139_IDR + 4);
     
     rtl8139_dev.mac[0] = mac0 & 0xFF;
     rtl8139_dev.mac[1] = (mac0 >> 8) & 0xFF;
@@ -224,8 +257,19 @@ int rtl8139_init(void) {
     rtl8139_dev.transmit = rtl8139_transmit;
     rtl8139_dev.receive = rtl8139_receive;
     
-    // Register interrupt handler
-    register_interrupt_handler(RTL8139_IRQ, rtl8139_handler);
+    // Receive runs from the IRQ's handler thread, not the interrupt
+    // handler; the line stays masked until the thread is done
+    netif_napi_add(&rtl8139_dev, &rtl8139_napi, rtl8139_poll, NAPI_POLL_WEIGHT);
+    
+    if (request_threaded_irq(rtl8139_irq, rtl8139_interrupt, rtl8139_rx_thread,
+                             IRQF_SHARED | IRQF_ONESHOT, "eth0", &rtl8139_dev) < 0) {
+        screen_print("RTL8139: cannot get IRQ\n");
+        pci_free_irq_vectors(pdev);
+        rtl8139_iobase = 0;
+        return -EBUSY;
+    }
+    
+    pci_set_drvdata(pdev, &rtl8139_dev);
     
     // Register device with network stack
     net_register_device(&rtl8139_dev);
@@ -233,6 +277,27 @@ int rtl8139_init(void) {
     return 0;
 }
 
+static const struct pci_device_id rtl8139_pci_tbl[] = {
+    { PCI_DEVICE(RTL8139_VENDOR_ID, RTL8139_DEVICE_ID) },
+    { 0 }
+};
+
+static struct pci_driver rtl8139_pci_driver = {
+    .name = "8139too",
+    .id_table = rtl8139_pci_tbl,
+    .probe = rtl8139_probe,
+};
+
+// Initialize RTL8139 driver
+int rtl8139_init(void) {
+    if (pci_register_driver(&rtl8139_pci_driver) < 0) {
+        screen_print("RTL8139 network card not found\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
 // I/O port functions
 static inline void outb(uint16_t port, uint8_t value) {
     __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
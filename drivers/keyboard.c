@@ -1,6 +1,7 @@
 #include "keyboard.h"
 #include "screen.h"
 #include "interrupts.h"
+#include "wait.h"
 
 // Keyboard state
 static char keyboard_buffer[256];
@@ -8,6 +9,7 @@ static int buffer_head = 0;
 static int buffer_tail = 0;
 static bool shift_pressed = false;
 static bool caps_lock = false;
+static DECLARE_WAIT_QUEUE_HEAD(keyboard_wait);
 
 // US keyboard layout
 static const char scancode_to_char[128] = {
@@ -101,6 +103,7 @@ void keyboard_handler(void) {
             if (next_head != buffer_tail) {
                 keyboard_buffer[buffer_head] = c;
                 buffer_head = next_head;
+                wake_up(&keyboard_wait);
             }
         }
     }
@@ -108,10 +111,8 @@ void keyboard_handler(void) {
 
 // Get character from keyboard buffer
 char keyboard_getchar(void) {
-    while (buffer_head == buffer_tail) {
-        // Wait for key press
-        __asm__ volatile("hlt");
-    }
+    // Sleep until the interrupt handler queues a key press
+    wait_event(keyboard_wait, buffer_head != buffer_tail);
     
     char c = keyboard_buffer[buffer_tail];
     buffer_tail = (buffer_tail + 1) % 256;
@@ -0,0 +1,357 @@
+#include "pci.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "irq.h"
+#include "mm.h"
+#include "printk.h"
+#include "spinlock.h"
+
+/**
+ * MSI and MSI-X Interrupts
+ * A message-signalled interrupt is a memory write straight to the local
+ * APICs, so it needs no I/O APIC pin: each vector gets a free IRQ
+ * number, a vector from assign_irq_vector() and a message naming its
+ * affinity as a logical destination. MSI-X vectors are masked through
+ * their table entry; plain MSI only when the device has per-vector
+ * mask bits.
+ */
+
+// Guards the search for free IRQ numbers
+static DEFINE_SPINLOCK(msi_irq_lock);
+
+static void msi_compose_msg(struct msi_desc *entry) {
+    struct irq_desc *desc = IRQ_TO_DESC(entry->irq);
+    struct cpumask dest;
+    int vector = assign_irq_vector(entry->irq);
+
+    if (!cpumask_and(&dest, &desc->affinity, cpu_online_mask)) {
+        cpumask_clear(&dest);
+        cpumask_set_cpu(0, &dest);
+    }
+
+    entry->msg_address = MSI_ADDR_BASE | MSI_ADDR_DEST_LOGICAL | MSI_ADDR_REDIR_LOWPRI |
+                         MSI_ADDR_DEST_ID(cpumask_bits(&dest) & 0xFF);
+    entry->msg_data = MSI_DATA_DELIVERY_LOWPRI | (vector & 0xFF);
+}
+
+static volatile uint32_t *msix_entry(struct msi_desc *entry, unsigned int reg) {
+    return (volatile uint32_t *)(entry->dev->msix_base +
+                                 entry->entry * PCI_MSIX_ENTRY_SIZE + reg);
+}
+
+static void msi_write_msg(struct msi_desc *entry) {
+    struct pci_dev *dev = entry->dev;
+    uint16_t ctrl;
+
+    if (entry->msix) {
+        *msix_entry(entry, PCI_MSIX_ENTRY_ADDR_LO) = entry->msg_address;
+        *msix_entry(entry, PCI_MSIX_ENTRY_ADDR_HI) = 0;
+        *msix_entry(entry, PCI_MSIX_ENTRY_DATA) = entry->msg_data;
+        return;
+    }
+
+    ctrl = pci_read_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS);
+    pci_write_config_dword(dev, dev->msi_cap + PCI_MSI_ADDRESS_LO, entry->msg_address);
+    if (ctrl & PCI_MSI_FLAGS_64BIT) {
+        pci_write_config_dword(dev, dev->msi_cap + PCI_MSI_ADDRESS_HI, 0);
+        pci_write_config_word(dev, dev->msi_cap + PCI_MSI_DATA_64, entry->msg_data);
+    } else {
+        pci_write_config_word(dev, dev->msi_cap + PCI_MSI_DATA_32, entry->msg_data);
+    }
+}
+
+static void msi_set_mask_bit(unsigned int irq, bool masked) {
+    struct msi_desc *entry = IRQ_TO_DESC(irq)->chip_data;
+    struct pci_dev *dev = entry->dev;
+    uint16_t ctrl;
+    uint8_t reg;
+
+    if (entry->msix) {
+        volatile uint32_t *vctrl = msix_entry(entry, PCI_MSIX_ENTRY_CTRL);
+
+        *vctrl = masked ? (*vctrl | PCI_MSIX_ENTRY_CTRL_MASKBIT)
+                        : (*vctrl & ~PCI_MSIX_ENTRY_CTRL_MASKBIT);
+        (void)*vctrl;   // Flush the posted write
+        return;
+    }
+
+    ctrl = pci_read_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS);
+    if (!(ctrl & PCI_MSI_FLAGS_MASKBIT)) {
+        return;
+    }
+    reg = dev->msi_cap + ((ctrl & PCI_MSI_FLAGS_64BIT) ? PCI_MSI_MASK_64 : PCI_MSI_MASK_32);
+    pci_write_config_dword(dev, reg, masked ? 1 : 0);
+}
+
+static void msi_mask(unsigned int irq) {
+    msi_set_mask_bit(irq, true);
+}
+
+static void msi_unmask(unsigned int irq) {
+    msi_set_mask_bit(irq, false);
+}
+
+static void msi_eoi(unsigned int irq) {
+    apic_eoi();
+}
+
+/**
+ * Called with desc->affinity not yet updated, so build the message from
+ * the requested CPUs directly
+ */
+static int msi_set_affinity(unsigned int irq, const struct cpumask *dest) {
+    struct msi_desc *entry = IRQ_TO_DESC(irq)->chip_data;
+    uint32_t cpus = cpumask_bits(dest) & 0xFF;
+
+    if (!cpus) {
+        return -EINVAL;
+    }
+
+    entry->msg_address = MSI_ADDR_BASE | MSI_ADDR_DEST_LOGICAL | MSI_ADDR_REDIR_LOWPRI |
+                         MSI_ADDR_DEST_ID(cpus);
+    msi_write_msg(entry);
+    return 0;
+}
+
+static struct irq_chip msi_chip = {
+    .name = "PCI-MSI",
+    .startup = msi_unmask,
+    .shutdown = msi_mask,
+    .enable = msi_unmask,
+    .disable = msi_mask,
+    .mask = msi_mask,
+    .unmask = msi_unmask,
+    .eoi = msi_eoi,
+    .set_affinity = msi_set_affinity,
+};
+
+/**
+ * Claim an IRQ number no controller uses; I/O APIC pins hold theirs by
+ * having their chip set
+ */
+static int msi_alloc_irq(struct msi_desc *entry) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&msi_irq_lock, flags);
+    for (unsigned int irq = NR_LEGACY_IRQS; irq < APIC_ERROR_IRQ; irq++) {
+        struct irq_desc *desc = IRQ_TO_DESC(irq);
+
+        if (desc->chip != &dummy_irq_chip) {
+            continue;
+        }
+
+        spin_lock(&desc->lock);
+        desc->chip = &msi_chip;
+        desc->chip_data = entry;
+        spin_unlock(&desc->lock);
+
+        spin_unlock_irqrestore(&msi_irq_lock, flags);
+        entry->irq = irq;
+        return irq;
+    }
+    spin_unlock_irqrestore(&msi_irq_lock, flags);
+
+    return -ENOSPC;
+}
+
+static void msi_free_irqs(struct pci_dev *dev) {
+    struct msi_desc *entry, *tmp;
+
+    list_for_each_entry_safe(entry, tmp, &dev->msi_list, list) {
+        struct irq_desc *desc = IRQ_TO_DESC(entry->irq);
+        unsigned long flags;
+
+        free_irq_vector(entry->irq);
+
+        spin_lock_irqsave(&desc->lock, flags);
+        desc->chip = &dummy_irq_chip;
+        desc->chip_data = NULL;
+        spin_unlock_irqrestore(&desc->lock, flags);
+
+        list_del(&entry->list);
+        kfree(entry);
+    }
+}
+
+/**
+ * Allocate nvec descriptors and IRQs, spreading them over the online
+ * CPUs if asked; returns 0 or a negative error with nothing left behind
+ */
+static int msi_setup_irqs(struct pci_dev *dev, unsigned int nvec, bool msix,
+                          bool spread) {
+    unsigned int cpu = cpumask_first(cpu_online_mask);
+
+    for (unsigned int i = 0; i < nvec; i++) {
+        struct msi_desc *entry = kmalloc(sizeof(*entry));
+
+        if (!entry) {
+            msi_free_irqs(dev);
+            return -ENOMEM;
+        }
+        memset(entry, 0, sizeof(*entry));
+        entry->dev = dev;
+        entry->entry = i;
+        entry->msix = msix;
+
+        if (msi_alloc_irq(entry) < 0) {
+            kfree(entry);
+            msi_free_irqs(dev);
+            return -ENOSPC;
+        }
+        list_add_tail(&entry->list, &dev->msi_list);
+
+        if (assign_irq_vector(entry->irq) < 0) {
+            msi_free_irqs(dev);
+            return -ENOSPC;
+        }
+
+        if (spread) {
+            struct irq_desc *desc = IRQ_TO_DESC(entry->irq);
+
+            cpumask_clear(&desc->affinity);
+            cpumask_set_cpu(cpu, &desc->affinity);
+            cpu = cpumask_next(cpu, cpu_online_mask);
+            if (cpu >= NR_CPUS) {
+                cpu = cpumask_first(cpu_online_mask);
+            }
+        }
+
+        msi_compose_msg(entry);
+    }
+
+    return 0;
+}
+
+static int msix_capability_init(struct pci_dev *dev, unsigned int nvec, bool spread) {
+    uint16_t ctrl = pci_read_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS);
+    uint32_t table = pci_read_config_dword(dev, dev->msix_cap + PCI_MSIX_TABLE);
+    volatile uint8_t *base;
+    struct msi_desc *entry;
+    int ret;
+
+    base = pci_iomap(dev, table & PCI_MSIX_TABLE_BIR);
+    if (!base) {
+        return -ENOMEM;
+    }
+    dev->msix_base = base + (table & PCI_MSIX_TABLE_OFFSET);
+
+    // Function-masked while the table is written
+    pci_write_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS,
+                          ctrl | PCI_MSIX_FLAGS_ENABLE | PCI_MSIX_FLAGS_MASKALL);
+
+    ret = msi_setup_irqs(dev, nvec, true, spread);
+    if (ret < 0) {
+        pci_write_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS, ctrl);
+        return ret;
+    }
+
+    list_for_each_entry(entry, &dev->msi_list, list) {
+        *msix_entry(entry, PCI_MSIX_ENTRY_CTRL) = PCI_MSIX_ENTRY_CTRL_MASKBIT;
+        msi_write_msg(entry);
+    }
+
+    pci_write_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS,
+                          (ctrl & ~PCI_MSIX_FLAGS_MASKALL) | PCI_MSIX_FLAGS_ENABLE);
+    dev->msix_enabled = true;
+    return 0;
+}
+
+static int msi_capability_init(struct pci_dev *dev, bool spread) {
+    uint16_t ctrl = pci_read_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS);
+    struct msi_desc *entry;
+    int ret;
+
+    ret = msi_setup_irqs(dev, 1, false, spread);
+    if (ret < 0) {
+        return ret;
+    }
+
+    entry = list_first_entry(&dev->msi_list, struct msi_desc, list);
+    msi_write_msg(entry);
+    msi_set_mask_bit(entry->irq, true);
+
+    // One message enabled (QSIZE 0)
+    ctrl &= ~PCI_MSI_FLAGS_QSIZE;
+    pci_write_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS, ctrl | PCI_MSI_FLAGS_ENABLE);
+    dev->msi_enabled = true;
+    return 0;
+}
+
+static void pci_intx(struct pci_dev *dev, bool enable) {
+    uint16_t cmd = pci_read_config_word(dev, PCI_COMMAND);
+
+    cmd = enable ? (cmd & ~PCI_COMMAND_INTX_DISABLE) : (cmd | PCI_COMMAND_INTX_DISABLE);
+    pci_write_config_word(dev, PCI_COMMAND, cmd);
+}
+
+int pci_alloc_irq_vectors(struct pci_dev *dev, unsigned int min_vecs,
+                          unsigned int max_vecs, unsigned int flags) {
+    bool spread = flags & PCI_IRQ_AFFINITY;
+
+    if (!min_vecs || min_vecs > max_vecs || dev->msi_enabled || dev->msix_enabled) {
+        return -EINVAL;
+    }
+
+    // Messages go to the local APICs, so they need one to be mapped
+    if (lapic_base && (flags & PCI_IRQ_MSIX) && dev->msix_cap) {
+        uint16_t ctrl = pci_read_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS);
+        unsigned int nvec = (ctrl & PCI_MSIX_FLAGS_QSIZE) + 1;
+
+        if (nvec > max_vecs) {
+            nvec = max_vecs;
+        }
+        if (nvec >= min_vecs && msix_capability_init(dev, nvec, spread) == 0) {
+            pci_intx(dev, false);
+            return nvec;
+        }
+    }
+
+    if (lapic_base && (flags & PCI_IRQ_MSI) && dev->msi_cap && min_vecs == 1) {
+        if (msi_capability_init(dev, spread) == 0) {
+            pci_intx(dev, false);
+            return 1;
+        }
+    }
+
+    if ((flags & PCI_IRQ_LEGACY) && dev->pin && min_vecs == 1) {
+        pci_intx(dev, true);
+        return 1;
+    }
+
+    return -ENOSPC;
+}
+
+void pci_free_irq_vectors(struct pci_dev *dev) {
+    if (dev->msix_enabled) {
+        uint16_t ctrl = pci_read_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS);
+
+        pci_write_config_word(dev, dev->msix_cap + PCI_MSIX_FLAGS,
+                              ctrl & ~PCI_MSIX_FLAGS_ENABLE);
+        dev->msix_enabled = false;
+    }
+    if (dev->msi_enabled) {
+        uint16_t ctrl = pci_read_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS);
+
+        pci_write_config_word(dev, dev->msi_cap + PCI_MSI_FLAGS,
+                              ctrl & ~PCI_MSI_FLAGS_ENABLE);
+        dev->msi_enabled = false;
+    }
+
+    msi_free_irqs(dev);
+    pci_intx(dev, true);
+}
+
+int pci_irq_vector(struct pci_dev *dev, unsigned int nr) {
+    struct msi_desc *entry;
+
+    if (dev->msi_enabled || dev->msix_enabled) {
+        list_for_each_entry(entry, &dev->msi_list, list) {
+            if (entry->entry == nr) {
+                return entry->irq;
+            }
+        }
+        return -EINVAL;
+    }
+
+    return nr == 0 && dev->pin ? (int)dev->irq : -EINVAL;
+}
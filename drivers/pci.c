@@ -0,0 +1,410 @@
+#include "pci.h"
+#include "mm.h"
+#include "printk.h"
+#include "screen.h"
+#include "spinlock.h"
+
+/**
+ * PCI Enumeration and Driver Binding
+ * Configuration space is reached through mechanism #1 ports, one
+ * address/data pair for the whole machine. The scan starts at bus 0 and
+ * follows PCI-to-PCI bridges to their secondary buses. BARs are sized
+ * by writing all ones with decoding off, so the scan runs before any
+ * driver touches the device.
+ */
+
+LIST_HEAD(pci_devices);
+static LIST_HEAD(pci_drivers);
+
+// Serializes the CONFIG_ADDRESS/CONFIG_DATA pair
+static DEFINE_SPINLOCK(pci_config_lock);
+
+// Guards pci_drivers and device binding
+static DEFINE_SPINLOCK(pci_bus_lock);
+
+static int nr_pci_devices;
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static uint32_t pci_conf1_address(uint8_t bus, uint8_t devfn, uint8_t where) {
+    return 0x80000000 | (bus << 16) | (devfn << 8) | (where & 0xFC);
+}
+
+static uint32_t pci_conf1_read(uint8_t bus, uint8_t devfn, uint8_t where) {
+    unsigned long flags;
+    uint32_t val;
+
+    spin_lock_irqsave(&pci_config_lock, flags);
+    outl(PCI_CONFIG_ADDRESS, pci_conf1_address(bus, devfn, where));
+    val = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+
+    return val;
+}
+
+/**
+ * Read-modify-write of the aligned dword holding the field
+ */
+static void pci_conf1_write(uint8_t bus, uint8_t devfn, uint8_t where,
+                            int size, uint32_t val) {
+    unsigned int shift = (where & 3) * 8;
+    uint32_t mask = size == 4 ? 0xFFFFFFFF : ((1U << (size * 8)) - 1) << shift;
+    unsigned long flags;
+    uint32_t old;
+
+    spin_lock_irqsave(&pci_config_lock, flags);
+    outl(PCI_CONFIG_ADDRESS, pci_conf1_address(bus, devfn, where));
+    old = size == 4 ? 0 : inl(PCI_CONFIG_DATA);
+    outl(PCI_CONFIG_DATA, (old & ~mask) | ((val << shift) & mask));
+    spin_unlock_irqrestore(&pci_config_lock, flags);
+}
+
+uint8_t pci_read_config_byte(struct pci_dev *dev, uint8_t where) {
+    return pci_conf1_read(dev->bus, dev->devfn, where) >> ((where & 3) * 8);
+}
+
+uint16_t pci_read_config_word(struct pci_dev *dev, uint8_t where) {
+    return pci_conf1_read(dev->bus, dev->devfn, where) >> ((where & 2) * 8);
+}
+
+uint32_t pci_read_config_dword(struct pci_dev *dev, uint8_t where) {
+    return pci_conf1_read(dev->bus, dev->devfn, where);
+}
+
+void pci_write_config_byte(struct pci_dev *dev, uint8_t where, uint8_t val) {
+    pci_conf1_write(dev->bus, dev->devfn, where, 1, val);
+}
+
+void pci_write_config_word(struct pci_dev *dev, uint8_t where, uint16_t val) {
+    pci_conf1_write(dev->bus, dev->devfn, where, 2, val);
+}
+
+void pci_write_config_dword(struct pci_dev *dev, uint8_t where, uint32_t val) {
+    pci_conf1_write(dev->bus, dev->devfn, where, 4, val);
+}
+
+/**
+ * Size each BAR; a 64-bit memory BAR uses the next slot for its upper
+ * half, which must be zero as the kernel only maps 32-bit addresses
+ */
+static void pci_read_bases(struct pci_dev *dev, int nr_bars) {
+    uint16_t cmd = pci_read_config_word(dev, PCI_COMMAND);
+
+    pci_write_config_word(dev, PCI_COMMAND,
+                          cmd & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (int bar = 0; bar < nr_bars; bar++) {
+        uint8_t reg = PCI_BASE_ADDRESS_0 + bar * 4;
+        struct resource *res = &dev->resource[bar];
+        uint32_t base, size;
+
+        base = pci_read_config_dword(dev, reg);
+        pci_write_config_dword(dev, reg, 0xFFFFFFFF);
+        size = pci_read_config_dword(dev, reg);
+        pci_write_config_dword(dev, reg, base);
+
+        if (!size || size == 0xFFFFFFFF) {
+            continue;
+        }
+
+        if (base & PCI_BASE_ADDRESS_SPACE_IO) {
+            res->start = base & PCI_BASE_ADDRESS_IO_MASK;
+            res->len = (~(size & PCI_BASE_ADDRESS_IO_MASK) & 0xFFFF) + 1;
+            res->flags = IORESOURCE_IO;
+            continue;
+        }
+
+        res->start = base & PCI_BASE_ADDRESS_MEM_MASK;
+        res->len = ~(size & PCI_BASE_ADDRESS_MEM_MASK) + 1;
+        res->flags = IORESOURCE_MEM;
+        if (base & PCI_BASE_ADDRESS_MEM_PREFETCH) {
+            res->flags |= IORESOURCE_PREFETCH;
+        }
+        if (base & PCI_BASE_ADDRESS_MEM_TYPE_64) {
+            res->flags |= IORESOURCE_MEM_64;
+            if (pci_read_config_dword(dev, reg + 4)) {
+                pr_warn("pci: %d:%d.%d BAR%d above 4GB, ignored\n", dev->bus,
+                        PCI_SLOT(dev->devfn), PCI_FUNC(dev->devfn), bar);
+                res->flags = 0;
+                res->len = 0;
+            }
+            bar++;
+        }
+    }
+
+    pci_write_config_word(dev, PCI_COMMAND, cmd);
+}
+
+static void pci_scan_bus(uint8_t bus);
+
+static void pci_scan_function(uint8_t bus, uint8_t devfn) {
+    uint32_t id = pci_conf1_read(bus, devfn, PCI_VENDOR_ID);
+    struct pci_dev *dev;
+    uint32_t class_rev;
+
+    if ((id & 0xFFFF) == 0xFFFF || (id & 0xFFFF) == 0) {
+        return;
+    }
+
+    dev = kmalloc(sizeof(*dev));
+    if (!dev) {
+        return;
+    }
+    memset(dev, 0, sizeof(*dev));
+
+    dev->bus = bus;
+    dev->devfn = devfn;
+    dev->vendor = id & 0xFFFF;
+    dev->device = id >> 16;
+    class_rev = pci_read_config_dword(dev, PCI_CLASS_REVISION);
+    dev->class = class_rev >> 8;
+    dev->revision = class_rev & 0xFF;
+    dev->hdr_type = pci_read_config_byte(dev, PCI_HEADER_TYPE) & PCI_HEADER_TYPE_MASK;
+    dev->pin = pci_read_config_byte(dev, PCI_INTERRUPT_PIN);
+    // Firmware routed INTx to this line; it doubles as the I/O APIC GSI
+    dev->irq = dev->pin ? pci_read_config_byte(dev, PCI_INTERRUPT_LINE) : 0;
+    INIT_LIST_HEAD(&dev->msi_list);
+
+    pci_read_bases(dev, dev->hdr_type == PCI_HEADER_TYPE_BRIDGE ? 2 : PCI_NUM_RESOURCES);
+    dev->msi_cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    dev->msix_cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+
+    list_add_tail(&dev->bus_list, &pci_devices);
+    nr_pci_devices++;
+
+    if (dev->hdr_type == PCI_HEADER_TYPE_BRIDGE && (dev->class >> 8) == PCI_CLASS_BRIDGE_PCI) {
+        uint8_t secondary = pci_read_config_byte(dev, PCI_SECONDARY_BUS);
+
+        if (secondary > bus) {
+            pci_scan_bus(secondary);
+        }
+    }
+}
+
+static void pci_scan_bus(uint8_t bus) {
+    for (uint8_t slot = 0; slot < 32; slot++) {
+        uint8_t devfn = PCI_DEVFN(slot, 0);
+        uint8_t hdr;
+
+        if ((pci_conf1_read(bus, devfn, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) {
+            continue;
+        }
+
+        pci_scan_function(bus, devfn);
+
+        hdr = pci_conf1_read(bus, devfn, PCI_HEADER_TYPE) >> ((PCI_HEADER_TYPE & 3) * 8);
+        if (!(hdr & PCI_HEADER_MULTI_FUNC)) {
+            continue;
+        }
+        for (uint8_t func = 1; func < 8; func++) {
+            pci_scan_function(bus, PCI_DEVFN(slot, func));
+        }
+    }
+}
+
+uint8_t pci_find_capability(struct pci_dev *dev, uint8_t cap) {
+    uint8_t pos;
+    int ttl = 48;   // Bounds a malformed, looping list
+
+    if (!(pci_read_config_word(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    pos = pci_read_config_byte(dev, PCI_CAPABILITY_LIST);
+    while (pos >= 0x40 && ttl--) {
+        pos &= ~3;
+        if (pci_read_config_byte(dev, pos) == cap) {
+            return pos;
+        }
+        pos = pci_read_config_byte(dev, pos + 1);
+    }
+
+    return 0;
+}
+
+int pci_enable_device(struct pci_dev *dev) {
+    uint16_t cmd = pci_read_config_word(dev, PCI_COMMAND);
+
+    for (int bar = 0; bar < PCI_NUM_RESOURCES; bar++) {
+        if (dev->resource[bar].flags & IORESOURCE_IO) {
+            cmd |= PCI_COMMAND_IO;
+        } else if (dev->resource[bar].flags & IORESOURCE_MEM) {
+            cmd |= PCI_COMMAND_MEMORY;
+        }
+    }
+    pci_write_config_word(dev, PCI_COMMAND, cmd);
+
+    return 0;
+}
+
+void pci_disable_device(struct pci_dev *dev) {
+    uint16_t cmd = pci_read_config_word(dev, PCI_COMMAND);
+
+    pci_write_config_word(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MASTER);
+}
+
+void pci_set_master(struct pci_dev *dev) {
+    uint16_t cmd = pci_read_config_word(dev, PCI_COMMAND);
+
+    if (!(cmd & PCI_COMMAND_MASTER)) {
+        pci_write_config_word(dev, PCI_COMMAND, cmd | PCI_COMMAND_MASTER);
+    }
+}
+
+volatile void *pci_iomap(struct pci_dev *dev, int bar) {
+    if (bar < 0 || bar >= PCI_NUM_RESOURCES ||
+        !(dev->resource[bar].flags & IORESOURCE_MEM)) {
+        return NULL;
+    }
+
+    return ioremap(dev->resource[bar].start, dev->resource[bar].len);
+}
+
+struct pci_dev *pci_get_device(uint16_t vendor, uint16_t device, struct pci_dev *from) {
+    struct list_head *pos = from ? from->bus_list.next : pci_devices.next;
+
+    for (; pos != &pci_devices; pos = pos->next) {
+        struct pci_dev *dev = list_entry(pos, struct pci_dev, bus_list);
+
+        if ((vendor == PCI_ANY_ID || dev->vendor == vendor) &&
+            (device == PCI_ANY_ID || dev->device == device)) {
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+static const struct pci_device_id *pci_match_id(const struct pci_device_id *ids,
+                                                struct pci_dev *dev) {
+    for (; ids->vendor; ids++) {
+        if ((ids->vendor == PCI_ANY_ID || ids->vendor == dev->vendor) &&
+            (ids->device == PCI_ANY_ID || ids->device == dev->device) &&
+            !((ids->class ^ dev->class) & ids->class_mask)) {
+            return ids;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Probe runs without pci_bus_lock held so it may sleep; binding is
+ * claimed first so no other driver probes the same device meanwhile
+ */
+int pci_register_driver(struct pci_driver *drv) {
+    struct pci_dev *dev;
+    unsigned long flags;
+    int bound = 0;
+
+    spin_lock_irqsave(&pci_bus_lock, flags);
+    list_add_tail(&drv->node, &pci_drivers);
+    spin_unlock_irqrestore(&pci_bus_lock, flags);
+
+    list_for_each_entry(dev, &pci_devices, bus_list) {
+        const struct pci_device_id *id;
+
+        spin_lock_irqsave(&pci_bus_lock, flags);
+        id = dev->driver ? NULL : pci_match_id(drv->id_table, dev);
+        if (id) {
+            dev->driver = drv;
+        }
+        spin_unlock_irqrestore(&pci_bus_lock, flags);
+
+        if (!id) {
+            continue;
+        }
+        if (drv->probe(dev, id) < 0) {
+            dev->driver = NULL;
+            continue;
+        }
+        bound++;
+    }
+
+    pr_info("pci: driver %s bound to %d device(s)\n", drv->name, bound);
+    return bound ? 0 : -ENODEV;
+}
+
+void pci_unregister_driver(struct pci_driver *drv) {
+    struct pci_dev *dev;
+    unsigned long flags;
+
+    list_for_each_entry(dev, &pci_devices, bus_list) {
+        if (dev->driver != drv) {
+            continue;
+        }
+        if (drv->remove) {
+            drv->remove(dev);
+        }
+        dev->driver = NULL;
+    }
+
+    spin_lock_irqsave(&pci_bus_lock, flags);
+    list_del(&drv->node);
+    spin_unlock_irqrestore(&pci_bus_lock, flags);
+}
+
+static void pci_print_hex(uint32_t value, int digits) {
+    const char hex_chars[] = "0123456789abcdef";
+
+    while (digits--) {
+        screen_putc(hex_chars[(value >> (digits * 4)) & 0xF]);
+    }
+}
+
+/**
+ * Print one line per device: address, class, IDs, IRQ and driver
+ */
+void pci_show(void) {
+    struct pci_dev *dev;
+
+    list_for_each_entry(dev, &pci_devices, bus_list) {
+        pci_print_hex(dev->bus, 2);
+        screen_putc(':');
+        pci_print_hex(PCI_SLOT(dev->devfn), 2);
+        screen_putc('.');
+        pci_print_hex(PCI_FUNC(dev->devfn), 1);
+        screen_print(" ");
+        pci_print_hex(dev->class >> 8, 4);
+        screen_print(": ");
+        pci_print_hex(dev->vendor, 4);
+        screen_putc(':');
+        pci_print_hex(dev->device, 4);
+
+        if (dev->msix_enabled) {
+            screen_print(" MSI-X");
+        } else if (dev->msi_enabled) {
+            screen_print(" MSI");
+        } else if (dev->pin) {
+            screen_print(" IRQ ");
+            screen_print_dec(dev->irq);
+        }
+        if (dev->msix_cap && !dev->msix_enabled) {
+            screen_print(" [msix]");
+        }
+        if (dev->msi_cap && !dev->msi_enabled) {
+            screen_print(" [msi]");
+        }
+        if (dev->driver) {
+            screen_print(" ");
+            screen_print(dev->driver->name);
+        }
+        screen_print("\n");
+    }
+}
+
+/**
+ * Enumerate every bus once; drivers bind as they register
+ */
+void pci_init(void) {
+    pci_scan_bus(0);
+    pr_info("pci: %d devices found\n", nr_pci_devices);
+}
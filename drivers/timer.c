@@ -1,17 +1,14 @@
 #include "timer.h"
 #include "interrupts.h"
 #include "screen.h"
+#include "clocksource.h"
 
 // Timer state
 static volatile uint32_t timer_ticks = 0;
 
-// Initialize timer (PIT)
-void timer_init(void) {
-    // Register timer interrupt handler
-    irq_register_handler(IRQ_TIMER, timer_handler);
-    
-    // Set timer frequency
-    uint32_t divisor = 1193180 / TIMER_FREQUENCY;
+// Program PIT channel 0 for the periodic tick
+static int pit_set_periodic(struct clock_event_device *dev) {
+    uint32_t divisor = PIT_TICK_RATE / TIMER_FREQUENCY;
     
     // Send command to PIT
     outb(0x43, 0x36);
@@ -20,12 +17,37 @@ void timer_init(void) {
     outb(0x40, divisor & 0xFF);
     outb(0x40, (divisor >> 8) & 0xFF);
     
+    return 0;
+}
+
+// PIT as a periodic-only clockevent device
+static struct clock_event_device pit_clockevent = {
+    .name = "pit",
+    .features = CLOCK_EVT_FEAT_PERIODIC,
+    .rating = 100,
+    .irq = IRQ_TIMER,
+    .cpumask = 0x1,
+    .set_state_periodic = pit_set_periodic,
+};
+
+// Initialize timer (PIT)
+void timer_init(void) {
     timer_ticks = 0;
+    
+    // Register timer interrupt handler
+    irq_register_handler(IRQ_TIMER, timer_handler);
+    
+    // Register with the clockevent layer, which programs the PIT
+    clockevents_register_device(&pit_clockevent);
 }
 
 // Timer interrupt handler
 void timer_handler(void) {
     timer_ticks++;
+    
+    if (pit_clockevent.event_handler) {
+        pit_clockevent.event_handler(&pit_clockevent);
+    }
 }
 
 // Get current tick count
@@ -33,10 +55,11 @@ uint32_t timer_get_ticks(void) {
     return timer_ticks;
 }
 
-// Wait for specified number of ticks
+// Sleep for specified number of ticks
 void timer_wait(uint32_t ticks) {
-    uint32_t start = timer_ticks;
-    while (timer_ticks - start < ticks) {
-        __asm__ volatile("hlt");
+    long remaining = ticks;
+    
+    while (remaining > 0) {
+        remaining = schedule_timeout_uninterruptible(remaining);
     }
 }
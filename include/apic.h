@@ -0,0 +1,176 @@
+#ifndef SOLIX_APIC_H
+#define SOLIX_APIC_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Local APIC and Interrupt Topology for SolixOS
+ * Per-CPU local APIC access, inter-processor interrupts and the CPU /
+ * I/O APIC layout reported by firmware (ACPI MADT or MP tables)
+ * Based on Linux x86 APIC design principles
+ */
+
+// IA32_APIC_BASE MSR
+#define MSR_IA32_APICBASE           0x1B
+#define MSR_IA32_APICBASE_BSP       (1 << 8)
+#define MSR_IA32_APICBASE_ENABLE    (1 << 11)
+#define MSR_IA32_APICBASE_BASE      0xFFFFF000
+
+#define APIC_DEFAULT_PHYS_BASE      0xFEE00000
+
+// Local APIC registers (byte offsets)
+#define APIC_ID         0x20
+#define APIC_LVR        0x30
+#define APIC_TASKPRI    0x80
+#define APIC_EOI        0xB0
+#define APIC_LDR        0xD0
+#define APIC_DFR        0xE0
+#define APIC_SPIV       0xF0
+#define APIC_ESR        0x280
+#define APIC_ICR        0x300
+#define APIC_ICR2       0x310
+#define APIC_LVTT       0x320
+#define APIC_LVT0       0x350
+#define APIC_LVT1       0x360
+#define APIC_LVTERR     0x370
+#define APIC_TMICT      0x380
+#define APIC_TMCCT      0x390
+#define APIC_TDCR       0x3E0
+
+// Spurious vector register
+#define APIC_SPIV_APIC_ENABLED      (1 << 8)
+#define SPURIOUS_APIC_VECTOR        0xFF
+
+// Flat logical destination mode: one LDR bit per CPU, up to 8 CPUs
+#define APIC_DFR_FLAT               0xFFFFFFFF
+#define SET_APIC_LOGICAL_ID(x)      ((x) << 24)
+
+// Local APIC interrupts, vectors from FIRST_SYSTEM_VECTOR up, and the
+// IRQ numbers above the GSI and MSI range they are handled as
+#define LOCAL_TIMER_VECTOR          0xEF
+#define RESCHEDULE_VECTOR           0xFD
+#define ERROR_APIC_VECTOR           0xFE
+#define APIC_ERROR_IRQ              240     // LVT error entry
+#define LOCAL_TIMER_IRQ             241     // LVT timer entry
+#define RESCHEDULE_IRQ              242     // Reschedule IPI
+
+// Interrupt command register
+#define APIC_DM_INIT        0x00500
+#define APIC_DM_STARTUP     0x00600
+#define APIC_DM_FIXED       0x00000
+#define APIC_DM_LOWEST      0x00100
+#define APIC_DM_NMI         0x00400
+#define APIC_ICR_BUSY       0x01000
+#define APIC_INT_ASSERT     0x04000
+#define APIC_DEST_LOGICAL   0x00800
+#define APIC_INT_LEVELTRIG  0x08000
+#define APIC_DEST_SELF      0x40000
+#define APIC_DEST_ALLBUT    0xC0000
+#define SET_APIC_DEST_FIELD(x)  ((x) << 24)
+
+#define APIC_LVT_MASKED     (1 << 16)
+
+// Timer LVT mode and divide configuration
+#define APIC_LVT_TIMER_PERIODIC     (1 << 17)
+#define APIC_TDR_DIV_16             0x3
+
+// Firmware topology limits
+#define MAX_LOCAL_APIC      256
+#define MAX_IO_APICS        8
+#define MAX_IRQ_OVERRIDES   16
+#define BAD_APICID          0xFF
+
+/**
+ * I/O APIC reported by firmware
+ */
+struct mp_ioapic {
+    uint8_t id;
+    uint32_t addr;          // Physical MMIO base
+    uint32_t gsi_base;      // First global system interrupt it serves
+};
+
+/**
+ * ISA IRQ redirected to a different GSI or polarity/trigger
+ */
+struct mp_irq_override {
+    uint8_t bus_irq;
+    uint32_t gsi;
+    uint16_t flags;         // MPS INTI flags: polarity bits 1:0, trigger bits 3:2
+};
+
+struct irq_chip;
+
+// Masks and unmasks an LVT entry (the IRQ's chip data) on the calling CPU
+extern struct irq_chip lapic_chip;
+
+// Local APIC MMIO window, NULL until apic_init()
+extern volatile uint32_t *lapic_base;
+
+// Firmware topology
+extern uint32_t mp_lapic_addr;
+extern struct mp_ioapic mp_ioapics[MAX_IO_APICS];
+extern int nr_ioapics;
+extern struct mp_irq_override mp_irq_overrides[MAX_IRQ_OVERRIDES];
+extern int nr_irq_overrides;
+
+// Logical CPU <-> local APIC ID
+extern uint8_t x86_cpu_to_apicid[NR_CPUS];
+extern uint8_t apicid_to_cpu[MAX_LOCAL_APIC];
+extern unsigned int nr_cpu_ids;
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)val),
+                     "d" ((uint32_t)(val >> 32)));
+}
+
+static inline uint32_t apic_read(uint32_t reg) {
+    return lapic_base[reg >> 2];
+}
+
+static inline void apic_write(uint32_t reg, uint32_t val) {
+    lapic_base[reg >> 2] = val;
+}
+
+static inline void apic_eoi(void) {
+    apic_write(APIC_EOI, 0);
+}
+
+/**
+ * Firmware table registration
+ */
+int apic_register_cpu(uint8_t apic_id);
+void apic_register_ioapic(uint8_t id, uint32_t addr, uint32_t gsi_base);
+void apic_register_override(uint8_t bus_irq, uint32_t gsi, uint16_t flags);
+
+/**
+ * Local APIC interface
+ */
+int apic_init(void);
+void apic_setup_local(void);
+uint8_t read_apic_id(void);
+int apic_send_init(uint8_t apicid);
+int apic_send_startup(uint8_t apicid, uint8_t vector);
+void apic_send_ipi(unsigned int cpu, uint8_t vector);
+
+/**
+ * Local APIC timer, the tick of every CPU but the boot CPU
+ * apic_timer_init() calibrates it on the boot CPU against the PIT
+ * tick; each AP then starts its own with apic_timer_setup_cpu()
+ */
+void apic_timer_init(void);
+void apic_timer_setup_cpu(void);
+
+/**
+ * Firmware table parsers
+ */
+int acpi_parse_madt(void);
+int mp_parse_tables(void);
+
+#endif
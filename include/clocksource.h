@@ -0,0 +1,119 @@
+#ifndef SOLIX_CLOCKSOURCE_H
+#define SOLIX_CLOCKSOURCE_H
+
+#include "types.h"
+#include "ktime.h"
+
+/**
+ * Clocksource and Clockevent Framework for SolixOS
+ * Free-running counters for timekeeping and programmable event devices
+ * Based on Linux clocksource/clockevents design principles
+ */
+
+// PIT input clock
+#define PIT_TICK_RATE       1193182UL
+
+// Clocksource ratings (higher is better)
+#define CLOCKSOURCE_RATING_JIFFIES  1
+#define CLOCKSOURCE_RATING_TSC      300
+
+// Clocksource flags
+#define CLOCK_SOURCE_IS_CONTINUOUS  0x01
+#define CLOCK_SOURCE_UNSTABLE       0x02
+
+#define CLOCKSOURCE_MASK(bits) \
+    ((bits) >= 64 ? ~0ULL : (1ULL << (bits)) - 1)
+
+/**
+ * Clocksource - a free-running counter converted to ns by mult/shift
+ */
+struct clocksource {
+    const char *name;
+    uint64_t (*read)(struct clocksource *cs);
+    uint64_t mask;              // Counter width mask
+    uint32_t mult;              // Cycle to ns multiplier
+    uint32_t shift;             // Cycle to ns shift
+    uint32_t rating;            // Selection preference
+    uint32_t flags;
+    uint64_t max_idle_ns;       // Longest safe interval between updates
+    uint32_t vdso_clock_mode;   // How the vDSO reads it, VDSO_CLOCKMODE_*
+    struct clocksource *next;   // Registered clocksource list
+};
+
+// Clocksources user space can read itself through the vDSO
+#define VDSO_CLOCKMODE_NONE     0   // Tick resolution from the data page
+#define VDSO_CLOCKMODE_TSC      1   // rdtsc scaled by the data page
+
+// Clockevent features
+#define CLOCK_EVT_FEAT_PERIODIC     0x01
+#define CLOCK_EVT_FEAT_ONESHOT      0x02
+
+// Clockevent states
+#define CLOCK_EVT_STATE_DETACHED    0
+#define CLOCK_EVT_STATE_SHUTDOWN    1
+#define CLOCK_EVT_STATE_PERIODIC    2
+#define CLOCK_EVT_STATE_ONESHOT     3
+
+/**
+ * Clockevent device - hardware that raises an interrupt at a chosen time
+ */
+struct clock_event_device {
+    const char *name;
+    uint32_t features;
+    uint32_t rating;
+    uint32_t state;
+    unsigned int irq;
+    uint32_t cpumask;           // CPUs this device can serve
+
+    // Programming limits in nanoseconds
+    uint64_t min_delta_ns;
+    uint64_t max_delta_ns;
+
+    // Device operations
+    int (*set_next_event)(uint64_t delta_ns, struct clock_event_device *dev);
+    int (*set_state_periodic)(struct clock_event_device *dev);
+    int (*set_state_oneshot)(struct clock_event_device *dev);
+    int (*set_state_shutdown)(struct clock_event_device *dev);
+
+    // Called from the device interrupt
+    void (*event_handler)(struct clock_event_device *dev);
+
+    ktime_t next_event;
+    unsigned long event_count;
+    struct clock_event_device *next;
+};
+
+/**
+ * Clocksource management
+ */
+extern int clocksource_register(struct clocksource *cs);
+extern void clocksource_calc_mult_shift(struct clocksource *cs, uint32_t freq_khz,
+                                        uint32_t maxsec);
+extern struct clocksource *clocksource_current(void);
+
+/**
+ * Clockevent management
+ */
+extern void clockevents_register_device(struct clock_event_device *dev);
+extern void clockevents_register_percpu_device(struct clock_event_device *dev);
+extern int clockevents_program_event(struct clock_event_device *dev, ktime_t expires);
+extern struct clock_event_device *clockevents_tick_device(void);
+extern struct clock_event_device *clockevents_oneshot_device(void);
+extern void tick_handle_periodic(struct clock_event_device *dev);
+extern bool tick_cpu_running(unsigned int cpu);
+
+/**
+ * Timekeeping
+ */
+extern void timekeeping_init(void);
+extern void timekeeping_update(void);
+
+/**
+ * TSC support (kernel/tsc.c)
+ */
+extern uint32_t tsc_khz;
+extern bool tsc_init(void);
+extern uint64_t tsc_cycles_to_ns(uint64_t cycles);
+extern uint64_t tsc_delta_to_ns(uint64_t delta);
+
+#endif
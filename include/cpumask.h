@@ -0,0 +1,127 @@
+#ifndef SOLIX_CPUMASK_H
+#define SOLIX_CPUMASK_H
+
+#include "types.h"
+
+/**
+ * CPU Masks for SolixOS
+ * Sets of CPUs for task affinity, IRQ routing and CPU isolation
+ * Based on Linux cpumask design principles
+ */
+
+#define NR_CPUS     4           // CONFIG_NR_CPUS
+
+/**
+ * One bit per CPU; NR_CPUS fits in a single word
+ */
+struct cpumask {
+    uint32_t bits;
+};
+
+typedef struct cpumask cpumask_t;
+
+#define CPU_MASK_NONE       { 0 }
+#define CPU_MASK_ALL        { (1U << NR_CPUS) - 1 }
+#define cpumask_bits(maskp) ((maskp)->bits)
+
+extern struct cpumask __cpu_possible_mask;
+extern struct cpumask __cpu_online_mask;
+#define cpu_possible_mask   ((const struct cpumask *)&__cpu_possible_mask)
+#define cpu_online_mask     ((const struct cpumask *)&__cpu_online_mask)
+
+static inline void cpumask_clear(struct cpumask *dst) {
+    dst->bits = 0;
+}
+
+static inline void cpumask_copy(struct cpumask *dst, const struct cpumask *src) {
+    dst->bits = src->bits;
+}
+
+static inline void cpumask_set_cpu(unsigned int cpu, struct cpumask *dst) {
+    if (cpu < NR_CPUS) dst->bits |= 1U << cpu;
+}
+
+static inline void cpumask_clear_cpu(unsigned int cpu, struct cpumask *dst) {
+    if (cpu < NR_CPUS) dst->bits &= ~(1U << cpu);
+}
+
+static inline bool cpumask_test_cpu(unsigned int cpu, const struct cpumask *mask) {
+    return cpu < NR_CPUS && (mask->bits & (1U << cpu));
+}
+
+static inline bool cpumask_empty(const struct cpumask *mask) {
+    return !(mask->bits & ((1U << NR_CPUS) - 1));
+}
+
+/**
+ * Returns true if the result is non-empty
+ */
+static inline bool cpumask_and(struct cpumask *dst, const struct cpumask *a,
+                               const struct cpumask *b) {
+    dst->bits = a->bits & b->bits;
+    return !cpumask_empty(dst);
+}
+
+static inline void cpumask_or(struct cpumask *dst, const struct cpumask *a,
+                              const struct cpumask *b) {
+    dst->bits = a->bits | b->bits;
+}
+
+static inline void cpumask_andnot(struct cpumask *dst, const struct cpumask *a,
+                                  const struct cpumask *b) {
+    dst->bits = a->bits & ~b->bits;
+}
+
+static inline bool cpumask_intersects(const struct cpumask *a, const struct cpumask *b) {
+    return (a->bits & b->bits) != 0;
+}
+
+static inline bool cpumask_equal(const struct cpumask *a, const struct cpumask *b) {
+    return a->bits == b->bits;
+}
+
+static inline unsigned int cpumask_weight(const struct cpumask *mask) {
+    return __builtin_popcount(mask->bits & ((1U << NR_CPUS) - 1));
+}
+
+/**
+ * Lowest CPU in the mask, NR_CPUS if empty
+ */
+static inline unsigned int cpumask_first(const struct cpumask *mask) {
+    return cpumask_empty(mask) ? NR_CPUS : __builtin_ctz(mask->bits);
+}
+
+static inline unsigned int cpumask_next(int cpu, const struct cpumask *mask) {
+    for (cpu++; cpu < NR_CPUS; cpu++) {
+        if (cpumask_test_cpu(cpu, mask)) {
+            return cpu;
+        }
+    }
+    return NR_CPUS;
+}
+
+#define for_each_cpu(cpu, mask)                         \
+    for ((cpu) = cpumask_first(mask); (cpu) < NR_CPUS;  \
+         (cpu) = cpumask_next((cpu), (mask)))
+
+#define for_each_possible_cpu(cpu)  for_each_cpu((cpu), cpu_possible_mask)
+#define for_each_online_cpu(cpu)    for_each_cpu((cpu), cpu_online_mask)
+
+static inline bool cpu_online(unsigned int cpu) {
+    return cpumask_test_cpu(cpu, cpu_online_mask);
+}
+
+void set_cpu_online(unsigned int cpu, bool online);
+void set_cpu_possible(unsigned int cpu, bool possible);
+
+static inline unsigned int num_online_cpus(void) {
+    return cpumask_weight(cpu_online_mask);
+}
+
+/**
+ * Parse a CPU list such as "1,3-5" into a mask
+ * Stops at the first character that is not part of the list
+ */
+int cpulist_parse(const char *buf, struct cpumask *dstp);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SOLIX_FUTEX_H
+#define SOLIX_FUTEX_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+#include "slab.h"
+
+/**
+ * Fast Userspace Mutexes for SolixOS
+ * Blocking keyed on a user address so user-level locks and condition
+ * variables only enter the kernel when contended
+ * Based on Linux futex design principles
+ */
+
+// Operations
+#define FUTEX_WAIT      0   // Sleep if *uaddr == val
+#define FUTEX_WAKE      1   // Wake up to val waiters on uaddr
+
+// Hash table geometry
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+/**
+ * Futex key: address space plus address, so private futexes in different
+ * processes never collide
+ */
+union futex_key {
+    struct {
+        uint32_t mm;        // Address space of the owning process
+        uint32_t address;
+    } private;
+    uint64_t both;
+};
+
+/**
+ * A process waiting on a futex
+ */
+struct futex_q {
+    struct list_head list;
+    process_t *task;
+    union futex_key key;
+};
+
+/**
+ * Hash bucket with its own lock, so unrelated futexes do not contend
+ */
+struct futex_hash_bucket {
+    spinlock_t lock;
+    struct list_head chain;
+};
+
+/**
+ * Futex interface
+ */
+void futex_init(void);
+int futex_wait(uint32_t *uaddr, uint32_t val, long timeout);
+int futex_wake(uint32_t *uaddr, int nr_wake);
+void futex_remove_task(process_t *p);
+int sys_futex(uint32_t *uaddr, int op, uint32_t val);
+
+#endif
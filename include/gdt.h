@@ -0,0 +1,97 @@
+#ifndef SOLIX_GDT_H
+#define SOLIX_GDT_H
+
+#include "types.h"
+
+/**
+ * Global Descriptor Table for SolixOS
+ * Per-CPU GDT and task-state segment; each CPU needs its own TSS so a
+ * ring transition lands on that CPU's kernel stack, and its own %fs
+ * segment based at its per-CPU area
+ * Based on Linux x86 GDT design principles
+ */
+
+// Segment selectors (index << 3 | RPL)
+#define GDT_ENTRY_KERNEL_CS     1
+#define GDT_ENTRY_KERNEL_DS     2
+#define GDT_ENTRY_USER_CS       3
+#define GDT_ENTRY_USER_DS       4
+#define GDT_ENTRY_TSS           5
+#define GDT_ENTRY_PERCPU        6
+#define GDT_ENTRY_DOUBLEFAULT_TSS 7
+#define GDT_ENTRIES             8
+
+#define __KERNEL_CS     (GDT_ENTRY_KERNEL_CS * 8)
+#define __KERNEL_DS     (GDT_ENTRY_KERNEL_DS * 8)
+#define __USER_CS       (GDT_ENTRY_USER_CS * 8 + 3)
+#define __USER_DS       (GDT_ENTRY_USER_DS * 8 + 3)
+#define GDT_ENTRY_TSS_SEL   (GDT_ENTRY_TSS * 8)
+#define __KERNEL_PERCPU     (GDT_ENTRY_PERCPU * 8)     // Loaded into %fs
+#define GDT_ENTRY_DOUBLEFAULT_TSS_SEL (GDT_ENTRY_DOUBLEFAULT_TSS * 8)
+
+struct desc_struct {
+    uint16_t limit0;
+    uint16_t base0;
+    uint8_t base1;
+    uint8_t access;
+    uint8_t limit1_flags;
+    uint8_t base2;
+} __attribute__((packed));
+
+struct desc_ptr {
+    uint16_t size;
+    uint32_t address;
+} __attribute__((packed));
+
+/**
+ * 32-bit hardware task-state segment
+ * A CPU's main TSS only supplies ss0:esp0, until a double fault switches
+ * to the double-fault task and saves the faulting state into it
+ */
+struct tss_struct {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax, ecx, edx, ebx;
+    uint32_t esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t io_bitmap_base;
+} __attribute__((packed));
+
+/**
+ * Build and load the GDT and TSS of a CPU on that CPU
+ */
+void gdt_init_cpu(unsigned int cpu, uint32_t esp0);
+
+/**
+ * Stack the CPU switches to on entry from user mode
+ */
+void tss_set_kernel_stack(unsigned int cpu, uint32_t esp0);
+
+/**
+ * Where a CPU's TSS keeps esp0; SYSENTER_ESP points here so the entry
+ * code can load the kernel stack from it
+ */
+uint32_t *tss_esp0_ptr(unsigned int cpu);
+
+/**
+ * Set up the CPU's double-fault task on that CPU, with paging enabled;
+ * vector 8 is a task gate to it
+ */
+void doublefault_init_cpu(unsigned int cpu);
+
+/**
+ * A CPU's main TSS, holding the interrupted state after a double fault
+ */
+const struct tss_struct *cpu_tss_state(unsigned int cpu);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SOLIX_HRTIMER_H
+#define SOLIX_HRTIMER_H
+
+#include "types.h"
+#include "kernel.h"
+#include "ktime.h"
+#include "clocksource.h"
+#include "rbtree.h"
+#include "slab.h"
+
+/**
+ * High-Resolution Timers for SolixOS
+ * Nanosecond timers kept in a per-CPU red-black tree ordered by expiry
+ * Based on Linux hrtimer design principles
+ */
+
+// Timer modes
+#define HRTIMER_MODE_ABS    0x00    // Expiry is absolute ktime_get() time
+#define HRTIMER_MODE_REL    0x01    // Expiry is relative to now
+
+// Timer states
+#define HRTIMER_STATE_INACTIVE  0x00
+#define HRTIMER_STATE_ENQUEUED  0x01
+#define HRTIMER_STATE_CALLBACK  0x02
+
+// Callback return values
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART,
+};
+
+struct hrtimer_cpu_base;
+
+/**
+ * High-resolution timer
+ */
+struct hrtimer {
+    struct rb_node node;
+    ktime_t expires;
+    enum hrtimer_restart (*function)(struct hrtimer *timer);
+    struct hrtimer_cpu_base *base;
+    uint32_t state;
+};
+
+/**
+ * Per-CPU timer base
+ */
+struct hrtimer_cpu_base {
+    spinlock_t lock;
+    struct rb_root_cached active;   // Pending timers, leftmost expires first
+    unsigned int cpu;
+    ktime_t expires_next;           // Next programmed event
+    struct hrtimer *running;        // Timer whose callback is executing
+
+    // Statistics
+    unsigned int nr_events;
+    unsigned int nr_expired;
+};
+
+/**
+ * Timer interface
+ */
+extern void hrtimers_init(void);
+extern void hrtimer_init(struct hrtimer *timer,
+                         enum hrtimer_restart (*function)(struct hrtimer *));
+extern void hrtimer_start(struct hrtimer *timer, ktime_t tim, uint32_t mode);
+extern void hrtimer_start_on(struct hrtimer *timer, unsigned int cpu, ktime_t tim, uint32_t mode);
+extern int hrtimer_try_to_cancel(struct hrtimer *timer);
+extern int hrtimer_cancel(struct hrtimer *timer);
+extern uint64_t hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval);
+extern ktime_t hrtimer_get_remaining(const struct hrtimer *timer);
+extern void hrtimer_run_queues(void);
+extern void hrtimer_interrupt(struct clock_event_device *dev);
+
+static inline bool hrtimer_active(const struct hrtimer *timer) {
+    return timer->state != HRTIMER_STATE_INACTIVE;
+}
+
+static inline bool hrtimer_is_queued(const struct hrtimer *timer) {
+    return timer->state & HRTIMER_STATE_ENQUEUED;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SOLIX_IDR_H
+#define SOLIX_IDR_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "rcupdate.h"
+
+/**
+ * ID Allocator for SolixOS
+ * Maps small integer IDs to pointers through a radix tree of 32-slot
+ * layers. Each layer keeps a bitmap of full slots, so allocation skips
+ * full subtrees and lookup is a fixed walk of at most IDR_MAX_LAYERS
+ * levels. Lookups are lockless under rcu_read_lock()
+ * Based on Linux IDR design principles
+ */
+
+#define IDR_BITS        5
+#define IDR_SIZE        (1 << IDR_BITS)
+#define IDR_MASK        (IDR_SIZE - 1)
+#define IDR_FULL        0xffffffffU
+
+// IDs are below 2^30, keeping them positive ints
+#define IDR_MAX_LAYERS  6
+#define IDR_MAX_ID      (1 << (IDR_BITS * IDR_MAX_LAYERS))
+
+struct idr_layer {
+    uint32_t bitmap;            // Slot full: leaf ID in use, or subtree full
+    void *ary[IDR_SIZE];        // Leaf: user pointers; inner: child layers
+    int count;                  // Slots in use
+    int layer;                  // 0 for leaves
+    struct rcu_head rcu;
+};
+
+struct idr {
+    struct idr_layer *top;
+    int next;                   // Where idr_alloc_cyclic() resumes
+    spinlock_t lock;            // Serializes updates
+};
+
+#define IDR_INIT(name)      { .top = NULL, .next = 0, .lock = __SPIN_LOCK_UNLOCKED(#name) }
+#define DEFINE_IDR(name)    struct idr name = IDR_INIT(name)
+
+/**
+ * Allocate the lowest free ID in [start, end); end <= 0 means no limit
+ * ptr may be NULL to reserve an ID and fill it later with idr_replace()
+ * Returns the ID, -ENOSPC if the range is full or -ENOMEM
+ */
+int idr_alloc(struct idr *idr, void *ptr, int start, int end);
+
+/**
+ * Like idr_alloc(), but search from just past the last ID handed out
+ * and wrap around, so freed IDs are not reused right away
+ */
+int idr_alloc_cyclic(struct idr *idr, void *ptr, int start, int end);
+
+/**
+ * Pointer stored for id, or NULL; callers hold rcu_read_lock()
+ */
+void *idr_find(struct idr *idr, int id);
+
+/**
+ * Store ptr for an allocated id; returns the old pointer
+ */
+void *idr_replace(struct idr *idr, void *ptr, int id);
+
+/**
+ * Free id; returns the pointer it held
+ */
+void *idr_remove(struct idr *idr, int id);
+
+void idr_init(struct idr *idr);
+
+#endif
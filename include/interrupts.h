@@ -57,14 +57,45 @@ typedef void (*interrupt_handler_t)(void);
 #define IRQ_ATA1 14
 #define IRQ_ATA2 15
 
+#define NR_LEGACY_IRQS 16
+
 // System call interrupt
 #define SYSCALL_INT 0x80
 
+// Interrupt vectors
+#define NR_VECTORS 256
+#define FIRST_EXTERNAL_VECTOR 0x20      // First vector past the exceptions
+#define ISA_IRQ_VECTOR(irq) (FIRST_EXTERNAL_VECTOR + (irq))    // 8259 mode
+#define FIRST_DEVICE_VECTOR 0x30        // assign_irq_vector() hands out from here
+#define FIRST_SYSTEM_VECTOR 0xEF        // Local APIC interrupts from here up
+
+// IRQ behind each vector, -1 if none
+extern int vector_irq[NR_VECTORS];
+
 // Functions
 void interrupts_init(void);
+void idt_load(void);
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags);
-void irq_handler(uint8_t irq);
+void irq_handler(uint32_t vector);
 void exception_handler(uint8_t exc_num);
+void doublefault_fn(void);
+void irq_register_handler(uint8_t irq, interrupt_handler_t handler);
+
+/**
+ * Give an IRQ its own vector for delivery through the local APIC
+ * Returns the vector (the same one on later calls) or -ENOSPC
+ */
+int assign_irq_vector(unsigned int irq);
+void free_irq_vector(unsigned int irq);
+
+// Legacy 8259 PIC pair, the "XT-PIC" chip of IRQs 0-15 until the I/O
+// APIC takes over
+extern struct irq_chip i8259A_chip;
+void disable_8259A(void);
+
+// Port I/O
+void outb(uint16_t port, uint8_t value);
+uint8_t inb(uint16_t port);
 
 // Assembly interrupt handlers
 extern void isr0(void);
@@ -88,21 +119,7 @@ extern void isr17(void);
 extern void isr18(void);
 extern void isr19(void);
 
-extern void irq0(void);
-extern void irq1(void);
-extern void irq2(void);
-extern void irq3(void);
-extern void irq4(void);
-extern void irq5(void);
-extern void irq6(void);
-extern void irq7(void);
-extern void irq8(void);
-extern void irq9(void);
-extern void irq10(void);
-extern void irq11(void);
-extern void irq12(void);
-extern void irq13(void);
-extern void irq14(void);
-extern void irq15(void);
+// Entry stubs for vectors FIRST_EXTERNAL_VECTOR..NR_VECTORS-1
+extern uint32_t irq_entries[];
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef SOLIX_IO_APIC_H
+#define SOLIX_IO_APIC_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * I/O APIC Support for SolixOS
+ * Once the CPUs are up, device interrupts move from the 8259 PIC pair to
+ * the I/O APICs firmware reported. Each input pin has a redirection
+ * table entry holding its vector, trigger mode and destination CPUs, so
+ * an IRQ gets a vector of its own, can be masked without touching other
+ * lines and is delivered to the lowest-priority CPU of its affinity mask
+ * Based on Linux x86 I/O APIC design principles
+ */
+
+// Indirect register window (MMIO, 32-bit index)
+#define IO_APIC_REGSEL      0x00
+#define IO_APIC_IOWIN       0x04
+
+// Registers
+#define IO_APIC_ID          0x00
+#define IO_APIC_VER         0x01
+#define IO_APIC_REDTBL(pin) (0x10 + 2 * (pin))
+
+// Redirection table entry, low dword
+#define IO_APIC_DM_LOWEST       0x00100
+#define IO_APIC_DEST_LOGICAL    0x00800
+#define IO_APIC_POLARITY_LOW    0x02000
+#define IO_APIC_TRIGGER_LEVEL   0x08000
+#define IO_APIC_MASKED          0x10000
+
+// Redirection table entry, high dword: logical destination bits 31:24
+#define IO_APIC_DEST(mask)      ((mask) << 24)
+
+// MPS INTI flags of an interrupt source override
+#define MP_IRQPOL_MASK          0x03
+#define MP_IRQPOL_ACTIVE_HIGH   0x01
+#define MP_IRQPOL_ACTIVE_LOW    0x03
+#define MP_IRQTRIG_MASK         0x0C
+#define MP_IRQTRIG_EDGE         0x04
+#define MP_IRQTRIG_LEVEL        0x0C
+
+// Set once the I/O APICs deliver device interrupts instead of the PIC
+extern bool io_apic_enabled;
+
+/**
+ * IRQ number of a global system interrupt, -1 if it has none
+ * ISA IRQs follow the firmware overrides; other GSIs map one to one
+ */
+int io_apic_gsi_to_irq(uint32_t gsi);
+
+/**
+ * Route every I/O APIC pin and mask the 8259 PIC
+ * Runs on the boot CPU after the secondaries are online; lines that
+ * were enabled on the PIC stay enabled
+ */
+void setup_io_apic(void);
+
+#endif
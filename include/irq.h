@@ -2,7 +2,9 @@
 #define SOLIX_IRQ_H
 
 #include "types.h"
+#include "list.h"
 #include "kernel.h"
+#include "cpumask.h"
 
 /**
  * Linux-Inspired IRQ Subsystem for SolixOS
@@ -31,6 +33,14 @@
 #define IRQ_WAITING       0x20
 #define IRQ_AUTODETECT    0x40
 #define IRQ_SPURIOUS      0x80
+#define IRQ_ONESHOT_MASKED 0x100  // Masked until the handler thread is done
+
+// IRQ thread flags
+#define IRQTF_RUNTHREAD   0x01    // Primary handler woke the thread
+#define IRQTF_AFFINITY    0x02    // Affinity changed, thread must follow
+
+// Real-time priority of new IRQ threads; chrt adjusts one thread
+#define IRQ_THREAD_PRIO   50
 
 // IRQ trigger types
 #define IRQ_TRIGGER_NONE      0x000
@@ -41,18 +51,42 @@
 #define IRQ_TRIGGER_MASK     (IRQ_TYPE_EDGE_RISING | IRQ_TYPE_EDGE_FALLING | \
                               IRQ_TYPE_LEVEL_HIGH | IRQ_TYPE_LEVEL_LOW)
 
-// IRQ affinity masks
-#define IRQ_AFFINITY_DEFAULT 0xFFFFFFFF
-
 // IRQ statistics
+// Handler run times, bucketed by log2 microseconds
+#define IRQ_HIST_BUCKETS    16
+
+// Bumped whenever the irqstat dump format changes
+#define IRQSTAT_VERSION     1
+
 struct irq_desc_stats {
     unsigned int irqs;          // Total interrupts
     unsigned int spurious;      // Spurious interrupts
     unsigned int unhandled;     // Unhandled interrupts
     unsigned int retriggered;   // Retriggered interrupts
     unsigned int missed;        // Missed interrupts
+
+    // Handler timing, from sched_clock()
+    uint64_t time_ns;           // Total time in handlers
+    uint64_t max_ns;            // Longest single run
+    uint64_t max_stamp;         // When the longest run started
+    unsigned int max_cpu;       // CPU it ran on
+    uint32_t hist[IRQ_HIST_BUCKETS];
+
+    // Sampled once a second
+    unsigned int rate;          // Interrupts in the last second
+    unsigned int rate_base;     // irqs at the previous sample
 };
 
+// Return values of IRQ handlers
+typedef enum irqreturn {
+    IRQ_NONE        = 0,    // Not raised by our device
+    IRQ_HANDLED     = 1,
+    IRQ_WAKE_THREAD = 2,    // Run the handler thread
+} irqreturn_t;
+
+// IRQ handler function type
+typedef irqreturn_t (*irq_handler_t)(unsigned int irq, void *dev_id);
+
 // IRQ descriptor structure
 struct irq_desc {
     // IRQ management
@@ -75,11 +109,13 @@ struct irq_desc {
     struct irq_flow_control *flow_control;
     
     // IRQ affinity
-    unsigned int affinity;      // CPU affinity mask
+    struct cpumask affinity;    // CPUs the IRQ may be delivered to
     
     // Threaded IRQ support
-    struct task_struct *thread; // IRQ thread
-    unsigned int thread_flags;  // Thread flags
+    irq_handler_t thread_fn;    // Runs in thread after IRQ_WAKE_THREAD
+    process_t *thread;          // IRQ thread
+    volatile unsigned long thread_flags; // IRQTF_* bits
+    unsigned long irqflags;     // IRQF_* flags of the handler
     
     // Statistics
     struct irq_desc_stats stats;
@@ -163,9 +199,6 @@ struct irq_flow_control {
     int (*retrigger)(struct irq_desc *desc);
 };
 
-// IRQ handler function type
-typedef void (*irq_handler_t)(unsigned int irq, void *dev_id);
-
 // IRQ action structure
 struct irqaction {
     irq_handler_t handler;     // IRQ handler function
@@ -242,6 +275,9 @@ extern void irq_eoi(unsigned int irq);
 // IRQ request/free
 extern int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
                       const char *name, void *dev);
+extern int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+                                irq_handler_t thread_fn, unsigned long flags,
+                                const char *name, void *dev);
 extern void free_irq(unsigned int irq, void *dev_id);
 
 // IRQ affinity
@@ -253,6 +289,21 @@ extern void irq_stat_add(unsigned int irq);
 extern void irq_stat_spurious(unsigned int irq);
 extern void irq_stat_unhandled(unsigned int irq);
 extern void irq_print_stats(unsigned int irq);
+extern unsigned int kstat_irqs_cpu(unsigned int irq, unsigned int cpu);
+
+/**
+ * Account a handler run that bypassed do_IRQ() (the legacy
+ * irq_register_handler() lines); start is sched_clock() before it ran
+ */
+extern void irq_account_legacy(unsigned int irq, uint64_t start);
+
+/**
+ * Per-IRQ counts for each online CPU plus rate and timing, one line per
+ * IRQ in a machine-readable format; irqstat_show_irq() adds the handler
+ * run-time histogram of one IRQ
+ */
+extern void irqstat_show(void);
+extern void irqstat_show_irq(unsigned int irq);
 
 // IRQ domain management
 extern struct irq_domain *irq_domain_add_linear(struct device_node *of_node,
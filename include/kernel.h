@@ -2,6 +2,11 @@
 #define SOLIX_KERNEL_H
 
 #include "types.h"
+#include "list.h"
+#include "cpumask.h"
+#include "percpu.h"
+#include "rcupdate.h"
+#include "spinlock.h"
 
 /**
  * SolixOS Kernel Header
@@ -13,7 +18,7 @@
 #define KERNEL_VIRTUAL_BASE 0xC0000000
 #define PAGE_SIZE 4096
 #define KERNEL_STACK_SIZE 16384  // Increased for better stack safety
-#define MAX_PROCESSES 256        // Increased for modern workloads
+#define PID_MAX_DEFAULT 32768    // PIDs run from 1 to PID_MAX_DEFAULT - 1
 #define MAX_OPEN_FILES 32        // More file descriptors per process
 #define KERNEL_VERSION_MAJOR 2
 #define KERNEL_VERSION_MINOR 0
@@ -27,13 +32,29 @@
 #define PAGE_PRESENT 0x1
 #define PAGE_WRITE 0x2
 #define PAGE_USER 0x4
+#define PAGE_PWT 0x8
+#define PAGE_PCD 0x10
+
+/**
+ * True if [addr, addr + size) lies entirely below the kernel
+ * Only the range is checked; the pages may still be unmapped
+ */
+static inline bool access_ok(const void *addr, uint32_t size) {
+    uint32_t a = (uint32_t)addr;
+    return a < KERNEL_VIRTUAL_BASE && size <= KERNEL_VIRTUAL_BASE - a;
+}
 
 // CPU and scheduling constants
-#define CPU_COUNT 4               // Support for multi-core
+#define CPU_COUNT NR_CPUS         // Support for multi-core
 #define TIMESLICE_MS 10           // Preemptive scheduling timeslice
 #define PRIORITY_LEVELS 8         // More granular priorities
 #define NICE_LEVELS 20            // Unix-style nice levels
 
+// Logical number of the running CPU
+static inline unsigned int smp_processor_id(void) {
+    return this_cpu_read(cpu_number);
+}
+
 // Security constants
 #define USER_UID_START 1000
 #define ROOT_UID 0
@@ -85,6 +106,23 @@
 #define SYS_NANOSLEEP   29
 #define SYS_CLOCK_GETTIME 30
 #define SYS_GETTIMEOFDAY 31
+#define SYS_FUTEX       32
+#define SYS_SCHED_SETAFFINITY 33
+#define SYS_SCHED_GETAFFINITY 34
+
+// Clone flags: what a new task shares with the one creating it
+#define CLONE_VM        0x00000100  // Address space
+#define CLONE_FILES     0x00000400  // File descriptor table
+#define CLONE_SIGHAND   0x00000800  // Signal handlers, needs CLONE_VM
+#define CLONE_THREAD    0x00010000  // Thread group, needs CLONE_SIGHAND
+
+// Process flags
+#define PF_IDLE         0x00000002  // Per-CPU idle task, never on the task list
+#define PF_WQ_WORKER    0x00000020  // Workqueue worker
+#define PF_KTHREAD      0x00200000  // Kernel thread, no user address space
+
+#define NSIG 32
+#define SIG_DFL 0
 
 /**
  * Process Control Block (PCB)
@@ -93,6 +131,7 @@
 typedef struct pcb {
     uint32_t pid;           // Process ID
     uint32_t ppid;          // Parent Process ID
+    uint32_t tgid;          // Thread group ID, the PID of its first thread
     uint32_t state;         // Current process state
     uint32_t esp;           // Stack pointer
     uint32_t ebp;           // Base pointer
@@ -106,6 +145,84 @@ typedef struct pcb {
     struct pcb* next;       // Next process in scheduling queue
 } pcb_t;
 
+// Log2 latency histogram: bucket n counts delays in [2^(n-1), 2^n) us
+#define SCHED_HIST_BUCKETS 24
+
+/**
+ * Per-task scheduling statistics
+ * Times are sched_clock() nanoseconds, TSC-based once calibrated
+ */
+struct sched_info {
+    uint64_t last_queued;       // When made runnable, 0 if not waiting
+    uint64_t last_arrival;      // When put on the CPU, 0 if not running
+    uint64_t run_delay;         // Total time runnable but not running
+    uint64_t max_run_delay;
+    uint64_t cpu_time;          // Total time on the CPU
+    uint64_t max_slice;         // Longest single stint on the CPU
+    uint32_t pcount;            // Times put on the CPU
+    uint32_t nr_wakeups;
+    uint32_t nvcsw;             // Voluntary switches (blocked)
+    uint32_t nivcsw;            // Involuntary switches (preempted)
+    bool from_wakeup;           // Current wait started with a wakeup
+    uint32_t wakeup_hist[SCHED_HIST_BUCKETS];   // Wakeup-to-run latency
+};
+
+/**
+ * Per-entity load tracking (PELT) state
+ * Runnable and running time in ~1ms (1024us) periods, decayed so that a
+ * period 32 periods ago counts half as much as the current one
+ */
+struct sched_avg {
+    uint64_t last_update_time;  // sched_clock() at last update
+    uint64_t load_sum;          // Decayed runnable time
+    uint32_t util_sum;          // Decayed running time, capacity scaled
+    uint32_t period_contrib;    // Time accrued in the current period (us)
+    uint32_t load_avg;          // Runnable load, 0..1024
+    uint32_t util_avg;          // CPU utilization, 0..1024
+    bool runnable;              // State accrued since last_update_time
+    bool running;
+    unsigned int cpu;           // CPU whose rq carries the task's weight
+};
+
+/**
+ * Per-task scheduling entity
+ * Times are sched_clock() nanoseconds
+ */
+struct sched_entity {
+    // Virtual runtime for CFS-inspired scheduling
+    uint64_t vruntime;
+    uint64_t exec_start;        // sched_clock() when last put on CPU
+    uint64_t sum_exec_runtime;
+    uint64_t prev_sum_exec_runtime;
+    uint64_t nr_migrations;
+    
+    // Load weight
+    uint64_t load_weight;
+    uint32_t inv_weight;
+    
+    // Sleep statistics
+    uint64_t sleep_start;
+    uint64_t block_start;
+    uint64_t sleep_runtime;
+    
+    // Time slice
+    uint32_t time_slice;
+    uint32_t first_time_slice;
+    
+    // Scheduling class
+    uint32_t policy;
+    uint32_t rt_priority;
+    
+    // Priority
+    uint32_t prio;
+    uint32_t static_prio;
+    uint32_t normal_prio;
+    
+    // Runqueue placement
+    struct list_head run_list;
+    struct runqueue* rq;
+};
+
 /**
  * File descriptor structure
  * Represents an open file or device
@@ -118,16 +235,73 @@ typedef struct fd {
     uint32_t ref_count;     // Reference count for dup operations
 } fd_t;
 
+/**
+ * Resources threads share
+ * Each is reference counted by the tasks using it; a task created
+ * without the matching clone flag gets its own copy
+ */
+struct mm_struct {
+    volatile uint32_t mm_users;
+    uint32_t pgd;           // Page directory physical address
+};
+
+struct files_struct {
+    volatile uint32_t count;
+    spinlock_t file_lock;
+    fd_t fd_array[MAX_OPEN_FILES];
+};
+
+struct sighand_struct {
+    volatile uint32_t count;
+    spinlock_t siglock;
+    uint32_t action[NSIG];  // User handler address, SIG_DFL if none
+};
+
+struct task_group;
+struct rt_mutex_waiter;
+struct kthread_exit;
+struct pt_regs;
+struct wait_queue_head;
+struct wait_queue_entry;
+struct timer_list;
+struct futex_q;
+
 /**
  * Process structure
  * Combines PCB with file descriptor table and other process data
  */
 typedef struct process {
     pcb_t pcb;                           // Process control block
-    fd_t fd_table[MAX_OPEN_FILES];       // File descriptor table
+    uint32_t flags;                      // PF_* flags
+    struct mm_struct* mm;                // Address space, NULL for kernel threads
+    struct files_struct* files;          // Open files
+    struct sighand_struct* sighand;      // Signal handlers
+    int (*kthread_fn)(void* data);       // Kernel thread body
+    void* kthread_data;
+    volatile bool kthread_should_stop;   // Set by kthread_stop()
+    struct kthread_exit* kthread_exit;   // kthread_stop() waiting for the exit
+    volatile bool on_cpu;                // Running, or still being switched out
     uint32_t cwd_inode;                  // Current working directory inode
     char name[32];                       // Process name
     uint32_t priority;                   // Process scheduling priority
+    uint32_t policy;                     // SCHED_NORMAL, SCHED_FIFO, SCHED_RR
+    int prio;                            // Effective priority, lower is more urgent
+    int normal_prio;                     // Priority without PI boosting
+    struct list_head pi_waiters;         // Top waiter of each rt_mutex held
+    struct list_head pi_held_locks;      // Every rt_mutex held
+    struct rt_mutex_waiter* pi_blocked_on; // rt_mutex being waited for
+    struct wait_queue_head* wait_head;   // Queue prepare_to_wait() put it on
+    struct wait_queue_entry* wait_entry;
+    struct timer_list* sleep_timer;      // Pending schedule_timeout() wake-up
+    struct futex_q* futex_q;             // Queued by futex_wait()
+    struct cpumask cpus_allowed;         // CPUs the process may run on
+    struct sched_info sched_info;        // Scheduler statistics
+    struct sched_avg avg;                // Load tracking
+    struct sched_entity se;              // Runtime accounting
+    struct task_group* sched_task_group; // CPU bandwidth group
+    struct list_head tasks;              // task_list linkage (RCU-protected)
+    struct rcu_head rcu;                 // Deferred free after exit
+    uint32_t usage;                      // References to this process_t
 } process_t;
 
 /**
@@ -142,10 +316,16 @@ struct debug_info {
 };
 
 // Kernel globals
-extern process_t* current_process;
-extern uint32_t next_pid;
+DECLARE_PER_CPU(process_t*, current_task);
+#define current_process this_cpu_read(current_task)
+extern struct list_head task_list;
+extern uint32_t nr_processes;
 extern struct debug_info debug_state;
 
+// Walk every live process; callers hold rcu_read_lock()
+#define for_each_process(p) \
+    list_for_each_entry_rcu(p, &task_list, tasks)
+
 // Core kernel functions
 void kmain(void* multiboot_info);
 void kernel_init(void);
@@ -155,14 +335,24 @@ void kernel_halt(void) __attribute__((noreturn));
 // Process management
 void process_init(void);
 uint32_t process_create(void);
-void process_switch(void);
+int do_clone(uint32_t clone_flags, uint32_t user_stack, struct pt_regs* regs);
+process_t* kernel_thread(int (*fn)(void* data), void* data);
 void process_schedule(void);
+void schedule_tail(void);
+void cpu_idle_loop(void) __attribute__((noreturn));
 void process_exit(uint32_t exit_code);
+void process_sleep(void);
+int wake_up_process(process_t* proc);
+int process_kill(uint32_t pid);
+process_t* alloc_process(void);
+void get_task_struct(process_t* proc);
+void put_task_struct(process_t* proc);
+void attach_process(process_t* proc);
+process_t* process_by_pid(uint32_t pid);
 uint32_t process_get_time(void);
 void process_set_priority(uint32_t pid, uint32_t priority);
-
-// System calls
-void syscall_handler(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx);
+int sched_setaffinity(uint32_t pid, const struct cpumask* new_mask);
+int sched_getaffinity(uint32_t pid, struct cpumask* mask);
 
 // Debug and diagnostics
 void debug_init(void);
@@ -170,6 +360,7 @@ void debug_print(uint32_t level, const char* fmt, ...);
 void debug_dump_memory(uint32_t addr, uint32_t size);
 void debug_dump_process(process_t* proc);
 void debug_trace_stack(uint32_t max_frames);
+uint32_t debug_save_stack(uint32_t* entries, uint32_t max_frames, uint32_t skip);
 void debug_assert(bool condition, const char* msg);
 
 // Utility functions
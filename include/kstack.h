@@ -0,0 +1,47 @@
+#ifndef SOLIX_KSTACK_H
+#define SOLIX_KSTACK_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Kernel Stack Allocator for SolixOS
+ * Task stacks live in a dedicated virtual region, one fixed-size slot
+ * each: an unmapped guard page followed by KERNEL_STACK_SIZE bytes of
+ * mapped stack, so running off the bottom faults instead of silently
+ * corrupting the heap. Freed stacks stay mapped in a small per-CPU cache
+ * and are handed to the next task created on that CPU; past that, their
+ * slot is freed but stays mapped for reuse
+ * Based on Linux vmapped stack design principles
+ */
+
+#define KSTACK_START        0xD0000000
+#define KSTACK_END          0xE0000000
+
+#define KSTACK_GUARD_SIZE   PAGE_SIZE
+#define KSTACK_SLOT_SIZE    (KERNEL_STACK_SIZE + KSTACK_GUARD_SIZE)
+#define KSTACK_SLOTS        ((KSTACK_END - KSTACK_START) / KSTACK_SLOT_SIZE)
+
+// Freed stacks each CPU keeps mapped for reuse
+#define NR_CACHED_STACKS    2
+
+/**
+ * Lowest address of a KERNEL_STACK_SIZE stack, or 0 when out of slots
+ * or memory; the stack grows down from base + KERNEL_STACK_SIZE
+ */
+uint32_t alloc_kernel_stack(void);
+
+/**
+ * Release a stack from alloc_kernel_stack(); safe from any context
+ */
+void free_kernel_stack(uint32_t stack);
+
+/**
+ * addr falls in the guard page below some kernel stack
+ */
+static inline bool kstack_guard_page(uint32_t addr) {
+    return addr >= KSTACK_START && addr < KSTACK_END &&
+           (addr - KSTACK_START) % KSTACK_SLOT_SIZE < KSTACK_GUARD_SIZE;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SOLIX_KTHREAD_H
+#define SOLIX_KTHREAD_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Kernel Threads for SolixOS
+ * Workers that run a kernel function on their own stack and are
+ * scheduled like any other task. They have no user address space, open
+ * files or signal handlers, so creating one costs a PID, a process_t
+ * and a kernel stack
+ * Based on Linux kthread design principles
+ */
+
+/**
+ * Create a kernel thread running threadfn(data), named name
+ * It starts blocked; wake it with wake_up_process() once set up.
+ * Returns NULL when out of PIDs or memory
+ */
+process_t* kthread_create(int (*threadfn)(void* data), void* data, const char* name);
+
+/**
+ * Create a kernel thread and start it right away
+ */
+#define kthread_run(threadfn, data, name)                       \
+({                                                              \
+    process_t* __k = kthread_create(threadfn, data, name);      \
+    if (__k)                                                    \
+        wake_up_process(__k);                                   \
+    __k;                                                        \
+})
+
+/**
+ * Restrict a thread that has not started yet to one CPU
+ */
+void kthread_bind(process_t* k, unsigned int cpu);
+
+/**
+ * Ask a kernel thread to return from threadfn, wake it to notice and
+ * wait until it has exited. Returns what threadfn returned
+ * Callers must keep the thread from exiting on its own before this
+ */
+int kthread_stop(process_t* k);
+
+/**
+ * Called by process_exit() of a thread kthread_stop() is waiting for
+ */
+void kthread_exited(process_t* k, int ret);
+
+/**
+ * A thread's loop checks this and returns once it is set
+ */
+bool kthread_should_stop(void);
+
+#endif
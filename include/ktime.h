@@ -0,0 +1,117 @@
+#ifndef SOLIX_KTIME_H
+#define SOLIX_KTIME_H
+
+#include "types.h"
+
+/**
+ * Kernel Time Representation for SolixOS
+ * Nanosecond-resolution monotonic time values and conversion helpers
+ * Based on Linux ktime_t design principles
+ */
+
+// Nanosecond monotonic time
+typedef int64_t ktime_t;
+
+// Unit conversions
+#define NSEC_PER_USEC   1000UL
+#define NSEC_PER_MSEC   1000000UL
+#define NSEC_PER_SEC    1000000000UL
+#define USEC_PER_SEC    1000000UL
+#define MSEC_PER_SEC    1000UL
+
+#define KTIME_MAX       ((ktime_t)~((uint64_t)1 << 63))
+
+/**
+ * 64-by-32 division without libgcc helpers
+ * The kernel links with -nostdlib, so 64-bit '/' and '%' must be avoided
+ */
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor,
+                                   uint32_t *remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t q_high = high / divisor;
+    uint32_t q_low, rem;
+
+    high %= divisor;
+    __asm__("divl %4"
+            : "=a" (q_low), "=d" (rem)
+            : "a" (low), "d" (high), "rm" (divisor));
+
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    return div_u64_rem(dividend, divisor, NULL);
+}
+
+/**
+ * (a * mul) >> shift with a 96-bit intermediate, for cycle to ns scaling
+ */
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t ah = (uint32_t)(a >> 32);
+    uint32_t al = (uint32_t)a;
+    uint64_t ret = ((uint64_t)al * mul) >> shift;
+
+    if (ah) {
+        ret += ((uint64_t)ah * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+/**
+ * Construction and conversion
+ */
+static inline ktime_t ktime_set(uint32_t secs, uint32_t nsecs) {
+    return (ktime_t)secs * NSEC_PER_SEC + nsecs;
+}
+
+static inline ktime_t ktime_add_ns(ktime_t kt, uint64_t nsec) {
+    return kt + (ktime_t)nsec;
+}
+
+static inline ktime_t ktime_add_us(ktime_t kt, uint64_t usec) {
+    return kt + (ktime_t)(usec * NSEC_PER_USEC);
+}
+
+static inline ktime_t ktime_add_ms(ktime_t kt, uint64_t msec) {
+    return kt + (ktime_t)(msec * NSEC_PER_MSEC);
+}
+
+static inline int64_t ktime_to_ns(ktime_t kt) {
+    return kt;
+}
+
+static inline uint64_t ktime_to_us(ktime_t kt) {
+    return div_u64((uint64_t)kt, NSEC_PER_USEC);
+}
+
+static inline uint64_t ktime_to_ms(ktime_t kt) {
+    return div_u64((uint64_t)kt, NSEC_PER_MSEC);
+}
+
+#define ktime_add(a, b)     ((a) + (b))
+#define ktime_sub(a, b)     ((a) - (b))
+#define ktime_compare(a, b) ((a) < (b) ? -1 : ((a) > (b) ? 1 : 0))
+#define ktime_after(a, b)   ((a) > (b))
+#define ktime_before(a, b)  ((a) < (b))
+
+/**
+ * Time stamp counter access
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Core time queries (kernel/time.c)
+ */
+extern ktime_t ktime_get(void);
+extern uint64_t ktime_get_ns(void);
+extern uint64_t sched_clock(void);
+
+#endif
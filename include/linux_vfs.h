@@ -2,7 +2,10 @@
 #define SOLIX_LINUX_VFS_H
 
 #include "types.h"
+#include "list.h"
 #include "vfs.h"
+#include "spinlock.h"
+#include "rcupdate.h"
 
 /**
  * Linux-Inspired Virtual File System (VFS) Layer for SolixOS
@@ -203,10 +206,13 @@ struct inode {
     uint32_t i_count;
     
     // List linkage
-    struct list_head i_hash;
+    struct list_head i_hash;    // RCU-protected
     struct list_head i_list;
     struct list_head i_sb_list;
     struct list_head i_dentry;
+    
+    // Deferred free after unhashing
+    struct rcu_head i_rcu;
 };
 
 // Inode operations structure
@@ -266,12 +272,13 @@ struct dentry {
     struct inode *d_inode;  // Associated inode
     struct dentry *d_parent; // Parent directory
     struct list_head d_subdirs; // List of subdirectories
-    struct list_head d_child; // List of child entries
+    struct list_head d_child; // List of child entries (RCU-protected)
     struct list_head d_hash; // Hash list
     struct super_block *d_sb; // Superblock
     unsigned int d_flags;   // Dentry flags
     spinlock_t d_lock;      // Dentry lock
     uint32_t d_count;       // Reference count
+    struct rcu_head d_rcu;  // Deferred free
 };
 
 // Superblock structure
@@ -329,7 +336,7 @@ struct file_system_type {
     struct dentry *(*mount) (struct file_system_type *, int, const char *, void *);
     void (*kill_sb) (struct super_block *);
     struct module *owner;
-    struct file_system_type * next;
+    struct list_head next;      // Registered filesystems (RCU-protected)
     struct hlist_head fs_supers;
 };
 
@@ -398,6 +405,7 @@ int generic_permission(struct inode *inode, int mask);
 // Dentry operations
 struct dentry *d_lookup(struct dentry *parent, struct qstr *name);
 int d_add(struct dentry *dentry, struct inode *inode);
+void dput(struct dentry *dentry);
 void d_invalidate(struct dentry *dentry);
 
 // File system registration
@@ -411,20 +419,4 @@ int path_lookup(const char *name, unsigned int flags, struct nameidata *nd);
 int user_path_at_empty(int dfd, const char __user *name, unsigned flags,
                       struct path *path, int *empty);
 
-// Helper macros
-#define INIT_LIST_HEAD(ptr) do { (ptr)->next = (ptr); (ptr)->prev = (ptr); } while (0)
-#define list_entry(ptr, type, member) \
-    ((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
-
-#define list_for_each_entry(pos, head, member) \
-    for (pos = list_entry((head)->next, typeof(*pos), member); \
-         &pos->member != (head); \
-         pos = list_entry(pos->member.next, typeof(*pos), member))
-
-#define list_for_each_entry_safe(pos, n, head, member) \
-    for (pos = list_entry((head)->next, typeof(*pos), member), \
-        n = list_entry(pos->member.next, typeof(*pos), member); \
-         &pos->member != (head); \
-         pos = n, n = list_entry(n->member.next, typeof(*pos), member))
-
 #endif
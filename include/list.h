@@ -0,0 +1,121 @@
+#ifndef SOLIX_LIST_H
+#define SOLIX_LIST_H
+
+#include "types.h"
+
+/**
+ * Intrusive Doubly Linked Lists for SolixOS
+ * The node is embedded in the object and the object is recovered with
+ * container_of(); an empty list is a head that points at itself. None
+ * of these take a lock, callers serialize with the list's own lock
+ * Based on Linux list design principles
+ */
+
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+#define LIST_HEAD(name) \
+    struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+                              struct list_head *next) {
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+/**
+ * Insert after head, for stacks
+ */
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+/**
+ * Insert before head, for queues
+ */
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next) {
+    next->prev = prev;
+    prev->next = next;
+}
+
+/**
+ * Unlink an entry; it is left pointing nowhere, so a second list_del()
+ * faults instead of corrupting the list
+ */
+static inline void list_del(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+/**
+ * Unlink an entry and make it an empty list, safe to delete again
+ */
+static inline void list_del_init(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    INIT_LIST_HEAD(entry);
+}
+
+static inline bool list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+#define list_entry(ptr, type, member) \
+    container_of(ptr, type, member)
+
+// The list must not be empty
+#define list_first_entry(ptr, type, member) \
+    list_entry((ptr)->next, type, member)
+
+#define list_for_each_entry(pos, head, member)                                  \
+    for (pos = list_entry((head)->next, __typeof__(*pos), member);              \
+         &pos->member != (head);                                                \
+         pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+/**
+ * Iterate while the body may unlink or free pos
+ */
+#define list_for_each_entry_safe(pos, n, head, member)                          \
+    for (pos = list_entry((head)->next, __typeof__(*pos), member),              \
+         n = list_entry(pos->member.next, __typeof__(*pos), member);            \
+         &pos->member != (head);                                                \
+         pos = n, n = list_entry(n->member.next, __typeof__(*n), member))
+
+/**
+ * Singly headed lists for hash tables, one pointer per bucket
+ */
+struct hlist_node {
+    struct hlist_node *next;
+    struct hlist_node **pprev;
+};
+
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+#define HLIST_HEAD_INIT { .first = NULL }
+
+static inline void INIT_HLIST_HEAD(struct hlist_head *h) {
+    h->first = NULL;
+}
+
+static inline bool hlist_empty(const struct hlist_head *h) {
+    return !h->first;
+}
+
+#endif
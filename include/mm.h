@@ -46,6 +46,10 @@ void* alloc_frame(void);
 void free_frame(void* frame);
 void map_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
 void unmap_page(page_directory_t* dir, uint32_t virt_addr);
+void map_user_page(uint32_t virt_addr, uint32_t phys_addr, bool writable);
+void* ioremap(uint32_t phys_addr, uint32_t size);
+int map_kernel_range(uint32_t virt_addr, uint32_t pages);
+void unmap_kernel_range(uint32_t virt_addr, uint32_t pages);
 
 // Heap management
 void heap_init(void);
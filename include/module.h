@@ -2,7 +2,10 @@
 #define SOLIX_MODULE_H
 
 #include "types.h"
+#include "list.h"
 #include "kernel.h"
+#include "spinlock.h"
+#include "rcupdate.h"
 
 /**
  * Linux-Inspired Module System for SolixOS
@@ -67,7 +70,9 @@ struct module_symbol {
     char name[256];
     void *value;
     uint32_t size;
-    struct module_symbol *next;
+    struct module_symbol *next;     // Owning module's symbols
+    struct list_head list;  // Global symbol table (RCU-protected)
+    struct rcu_head rcu;    // Deferred free
 };
 
 // Module dependency structure
@@ -113,7 +118,7 @@ struct module {
     struct module_author *authors;   // List of authors
     struct module_alias *aliases;    // List of aliases
     struct module_param *parameters; // List of parameters
-    struct module_symbol *symbols;   // List of exported symbols
+    struct module_symbol *symbols;   // Exported symbols, chained by next
     struct module_dependency *deps;   // List of dependencies
     
     // Module statistics
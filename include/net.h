@@ -2,6 +2,8 @@
 #define SOLIX_NET_H
 
 #include "types.h"
+#include "list.h"
+#include "timer.h"
 
 // Ethernet constants
 #define ETH_ALEN 6
@@ -25,6 +27,15 @@
 #define TCP_HDR_SIZE 20
 #define TCP_MAX_WINDOW 65535
 
+// TCP states
+#define TCP_CLOSED 0
+#define TCP_SYN_RECEIVED 1
+#define TCP_ESTABLISHED 2
+
+// TCP timeouts (ticks)
+#define TCP_TIMEOUT_INIT (1 * TIMER_FREQUENCY)  // Initial retransmit timeout
+#define TCP_SYNACK_RETRIES 5
+
 // TCP flags
 #define TCP_FLAG_FIN 0x01
 #define TCP_FLAG_SYN 0x02
@@ -41,6 +52,10 @@
 #define ARP_REQUEST 1
 #define ARP_REPLY 2
 
+// ARP cache aging (ticks)
+#define ARP_ENTRY_TIMEOUT (300 * TIMER_FREQUENCY)  // Entry lifetime
+#define ARP_GC_INTERVAL (60 * TIMER_FREQUENCY)     // Garbage collection period
+
 // Network device structure
 typedef struct net_device {
     char name[16];
@@ -130,6 +145,9 @@ typedef struct socket {
     uint32_t remote_ip;
     uint16_t remote_port;
     uint32_t state;     // TCP state
+    uint32_t rcv_nxt;   // Next sequence number expected from peer
+    uint8_t retries;    // Retransmissions of the current segment
+    struct timer_list retransmit_timer;
     void* private_data;
 } socket_t;
 
@@ -143,6 +161,53 @@ net_device_t* net_get_device(const char* name);
 int eth_transmit(net_device_t* dev, uint8_t* dest, uint16_t type, void* data, size_t len);
 void eth_receive(net_device_t* dev, void* data, size_t len);
 
+// Deferred receive: drivers queue frames, NET_RX_SOFTIRQ delivers them
+#define NET_RX_SUCCESS 0
+#define NET_RX_DROP    1
+int netif_rx(net_device_t* dev, void* data, size_t len);
+
+// NAPI: a driver's RX interrupt masks the device and schedules its poll;
+// NET_RX_SOFTIRQ calls the poll with a frame budget until the ring is
+// drained, and only then does the driver unmask the interrupt again
+#define NAPI_POLL_WEIGHT 64     // Frames per poll call
+
+#define NAPI_STATE_SCHED   0x01 // On a poll list, or owned by napi_disable()
+#define NAPI_STATE_DISABLE 0x02 // napi_disable() pending
+
+struct napi_struct {
+    struct list_head poll_list;
+    volatile unsigned long state;
+    int weight;
+    // Returns frames handled; less than budget means it completed
+    int (*poll)(struct napi_struct* napi, int budget);
+    net_device_t* dev;
+};
+
+void netif_napi_add(net_device_t* dev, struct napi_struct* napi,
+                    int (*poll)(struct napi_struct* napi, int budget), int weight);
+void netif_napi_del(struct napi_struct* napi);
+
+// Claim the poll; false if already scheduled or being disabled
+bool napi_schedule_prep(struct napi_struct* napi);
+void __napi_schedule(struct napi_struct* napi);
+
+static inline void napi_schedule(struct napi_struct* napi) {
+    if (napi_schedule_prep(napi)) {
+        __napi_schedule(napi);
+    }
+}
+
+// Called by a poll that handled fewer than budget frames, before it
+// unmasks the device; returns false if the device must stay masked
+bool napi_complete_done(struct napi_struct* napi, int work_done);
+
+// Wait out a running poll and keep the instance off the poll list
+void napi_disable(struct napi_struct* napi);
+void napi_enable(struct napi_struct* napi);
+
+// Hand a frame to the stack from a poll routine, without the backlog copy
+int netif_receive_skb(net_device_t* dev, void* data, size_t len);
+
 // IP functions
 int ip_transmit(uint32_t src, uint32_t dest, uint8_t protocol, void* data, size_t len);
 void ip_receive(net_device_t* dev, void* data, size_t len);
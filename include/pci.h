@@ -0,0 +1,254 @@
+#ifndef SOLIX_PCI_H
+#define SOLIX_PCI_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+
+/**
+ * PCI Bus Support for SolixOS
+ * The buses are scanned once at boot into a device list; drivers
+ * register a match table and are probed against it instead of walking
+ * configuration space themselves. BARs are sized during the scan and
+ * capability lists are parsed on demand. Devices that support MSI or
+ * MSI-X get one IRQ, with its own vector and affinity, per queue
+ * Based on Linux PCI and MSI design principles
+ */
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+// Configuration space header
+#define PCI_VENDOR_ID           0x00
+#define PCI_DEVICE_ID           0x02
+#define PCI_COMMAND             0x04
+#define PCI_STATUS              0x06
+#define PCI_CLASS_REVISION      0x08    // Class in the top 24 bits
+#define PCI_HEADER_TYPE         0x0E
+#define PCI_BASE_ADDRESS_0      0x10
+#define PCI_SECONDARY_BUS       0x19    // Bridges only
+#define PCI_CAPABILITY_LIST     0x34
+#define PCI_INTERRUPT_LINE      0x3C
+#define PCI_INTERRUPT_PIN       0x3D
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_STATUS_CAP_LIST     0x0010
+
+#define PCI_HEADER_TYPE_MASK    0x7F
+#define PCI_HEADER_TYPE_BRIDGE  0x01
+#define PCI_HEADER_MULTI_FUNC   0x80
+
+#define PCI_CLASS_BRIDGE_PCI    0x0604
+
+#define PCI_BASE_ADDRESS_SPACE_IO       0x01
+#define PCI_BASE_ADDRESS_MEM_TYPE_64    0x04
+#define PCI_BASE_ADDRESS_MEM_PREFETCH   0x08
+#define PCI_BASE_ADDRESS_IO_MASK        (~0x03U)
+#define PCI_BASE_ADDRESS_MEM_MASK       (~0x0FU)
+
+// Capability IDs
+#define PCI_CAP_ID_PM           0x01
+#define PCI_CAP_ID_MSI          0x05
+#define PCI_CAP_ID_EXP          0x10
+#define PCI_CAP_ID_MSIX         0x11
+
+// MSI capability
+#define PCI_MSI_FLAGS           0x02
+#define PCI_MSI_FLAGS_ENABLE    0x0001
+#define PCI_MSI_FLAGS_QSIZE     0x0070  // Messages enabled, log2
+#define PCI_MSI_FLAGS_64BIT     0x0080
+#define PCI_MSI_FLAGS_MASKBIT   0x0100  // Per-vector masking
+#define PCI_MSI_ADDRESS_LO      0x04
+#define PCI_MSI_ADDRESS_HI      0x08    // 64-bit only
+#define PCI_MSI_DATA_32         0x08
+#define PCI_MSI_DATA_64         0x0C
+#define PCI_MSI_MASK_32         0x0C
+#define PCI_MSI_MASK_64         0x10
+
+// MSI-X capability and table
+#define PCI_MSIX_FLAGS          0x02
+#define PCI_MSIX_FLAGS_QSIZE    0x07FF  // Table size - 1
+#define PCI_MSIX_FLAGS_MASKALL  0x4000
+#define PCI_MSIX_FLAGS_ENABLE   0x8000
+#define PCI_MSIX_TABLE          0x04
+#define PCI_MSIX_TABLE_BIR      0x07
+#define PCI_MSIX_TABLE_OFFSET   (~0x07U)
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_ADDR_LO  0x00
+#define PCI_MSIX_ENTRY_ADDR_HI  0x04
+#define PCI_MSIX_ENTRY_DATA     0x08
+#define PCI_MSIX_ENTRY_CTRL     0x0C
+#define PCI_MSIX_ENTRY_CTRL_MASKBIT 0x01
+
+// MSI message for the local APIC: logical destination, lowest priority
+#define MSI_ADDR_BASE           0xFEE00000
+#define MSI_ADDR_DEST_LOGICAL   0x00000004
+#define MSI_ADDR_REDIR_LOWPRI   0x00000008
+#define MSI_ADDR_DEST_ID(dest)  ((dest) << 12)
+#define MSI_DATA_DELIVERY_LOWPRI 0x00000100
+
+#define PCI_NUM_RESOURCES       6
+#define PCI_ANY_ID              0xFFFF
+
+// Resource flags
+#define IORESOURCE_IO           0x01
+#define IORESOURCE_MEM          0x02
+#define IORESOURCE_PREFETCH     0x04
+#define IORESOURCE_MEM_64       0x08
+
+struct pci_driver;
+
+struct resource {
+    uint32_t start;
+    uint32_t len;
+    unsigned int flags;         // IORESOURCE_*
+};
+
+struct pci_dev {
+    struct list_head bus_list;  // pci_devices linkage
+    uint8_t bus;
+    uint8_t devfn;              // Slot << 3 | function
+    uint16_t vendor;
+    uint16_t device;
+    uint32_t class;             // Base class, subclass, prog-if
+    uint8_t revision;
+    uint8_t hdr_type;
+    uint8_t pin;                // INTx pin, 0 if none
+    unsigned int irq;           // Legacy INTx IRQ
+
+    struct resource resource[PCI_NUM_RESOURCES];
+
+    uint8_t msi_cap;            // Capability offsets, 0 if absent
+    uint8_t msix_cap;
+    bool msi_enabled;
+    bool msix_enabled;
+    struct list_head msi_list;  // struct msi_desc, one per vector
+    volatile uint8_t *msix_base;
+
+    struct pci_driver *driver;
+    void *driver_data;
+};
+
+#define PCI_SLOT(devfn)     (((devfn) >> 3) & 0x1F)
+#define PCI_FUNC(devfn)     ((devfn) & 0x07)
+#define PCI_DEVFN(s, f)     ((((s) & 0x1F) << 3) | ((f) & 0x07))
+
+#define pci_resource_start(dev, bar)    ((dev)->resource[(bar)].start)
+#define pci_resource_len(dev, bar)      ((dev)->resource[(bar)].len)
+#define pci_resource_flags(dev, bar)    ((dev)->resource[(bar)].flags)
+
+/**
+ * Driver match entry; PCI_ANY_ID matches any vendor or device and a
+ * zero class_mask ignores the class
+ */
+struct pci_device_id {
+    uint16_t vendor;
+    uint16_t device;
+    uint32_t class;
+    uint32_t class_mask;
+    unsigned long driver_data;
+};
+
+#define PCI_DEVICE(vend, dev) \
+    .vendor = (vend), .device = (dev), .class = 0, .class_mask = 0
+
+struct pci_driver {
+    struct list_head node;
+    const char *name;
+    const struct pci_device_id *id_table;   // Ends with a zero vendor
+    int (*probe)(struct pci_dev *dev, const struct pci_device_id *id);
+    void (*remove)(struct pci_dev *dev);
+};
+
+static inline void pci_set_drvdata(struct pci_dev *dev, void *data) {
+    dev->driver_data = data;
+}
+
+static inline void *pci_get_drvdata(struct pci_dev *dev) {
+    return dev->driver_data;
+}
+
+// Every function found by the boot scan
+extern struct list_head pci_devices;
+
+/**
+ * Configuration space access
+ */
+uint8_t pci_read_config_byte(struct pci_dev *dev, uint8_t where);
+uint16_t pci_read_config_word(struct pci_dev *dev, uint8_t where);
+uint32_t pci_read_config_dword(struct pci_dev *dev, uint8_t where);
+void pci_write_config_byte(struct pci_dev *dev, uint8_t where, uint8_t val);
+void pci_write_config_word(struct pci_dev *dev, uint8_t where, uint16_t val);
+void pci_write_config_dword(struct pci_dev *dev, uint8_t where, uint32_t val);
+
+/**
+ * Turn on I/O and memory decoding for every BAR the device has
+ */
+int pci_enable_device(struct pci_dev *dev);
+void pci_disable_device(struct pci_dev *dev);
+void pci_set_master(struct pci_dev *dev);
+
+/**
+ * Map a memory BAR; I/O BARs are used through pci_resource_start()
+ * Returns NULL for an empty or I/O BAR
+ */
+volatile void *pci_iomap(struct pci_dev *dev, int bar);
+
+/**
+ * Offset of a capability in configuration space, 0 if absent
+ */
+uint8_t pci_find_capability(struct pci_dev *dev, uint8_t cap);
+
+/**
+ * Bind a driver to every present device in its table, and to nothing
+ * found later; probe errors leave the device unbound
+ */
+int pci_register_driver(struct pci_driver *drv);
+void pci_unregister_driver(struct pci_driver *drv);
+
+struct pci_dev *pci_get_device(uint16_t vendor, uint16_t device, struct pci_dev *from);
+
+/**
+ * Interrupt vectors
+ * pci_alloc_irq_vectors() tries MSI-X, then MSI, then the INTx line, as
+ * flags allow, and returns how many vectors (min..max) the device got.
+ * MSI is limited to one vector. With PCI_IRQ_AFFINITY vector n is bound
+ * to the n-th online CPU, round robin, for one queue per CPU
+ */
+#define PCI_IRQ_LEGACY      0x01
+#define PCI_IRQ_MSI         0x02
+#define PCI_IRQ_MSIX        0x04
+#define PCI_IRQ_AFFINITY    0x08
+#define PCI_IRQ_ALL_TYPES   (PCI_IRQ_LEGACY | PCI_IRQ_MSI | PCI_IRQ_MSIX)
+
+int pci_alloc_irq_vectors(struct pci_dev *dev, unsigned int min_vecs,
+                          unsigned int max_vecs, unsigned int flags);
+void pci_free_irq_vectors(struct pci_dev *dev);
+
+/**
+ * IRQ of vector nr, for request_irq(); -EINVAL if there is no such vector
+ */
+int pci_irq_vector(struct pci_dev *dev, unsigned int nr);
+
+/**
+ * Per-vector state of an MSI or MSI-X IRQ (the IRQ's chip data)
+ */
+struct msi_desc {
+    struct list_head list;      // pci_dev->msi_list
+    struct pci_dev *dev;
+    unsigned int irq;
+    unsigned int entry;         // MSI-X table index, 0 for MSI
+    bool msix;
+    uint32_t msg_address;
+    uint32_t msg_data;
+};
+
+void pci_init(void);
+void pci_show(void);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SOLIX_PERCPU_H
+#define SOLIX_PERCPU_H
+
+#include "types.h"
+#include "cpumask.h"
+
+/**
+ * Per-CPU Variables for SolixOS
+ * Variables defined with DEFINE_PER_CPU are linked into .data..percpu;
+ * each CPU gets its own copy of that section and addresses it through
+ * %fs, whose segment base is the CPU's offset from the link-time image.
+ * this_cpu_*() operations on 1, 2 and 4 byte scalars are then a single
+ * instruction, safe against interrupts on the local CPU without locks.
+ * Based on Linux x86 percpu design principles
+ */
+
+#define PER_CPU_SECTION     ".data..percpu"
+
+#define DECLARE_PER_CPU(type, name) \
+    extern __typeof__(type) name
+
+#define DEFINE_PER_CPU(type, name) \
+    __attribute__((section(PER_CPU_SECTION))) __typeof__(type) name
+
+// Keeps a variable on its own cache line to avoid false sharing
+#define DEFINE_PER_CPU_ALIGNED(type, name) \
+    __attribute__((section(PER_CPU_SECTION), aligned(64))) __typeof__(type) name
+
+// Bounds of the link-time image (linker.ld)
+extern char __per_cpu_start[];
+extern char __per_cpu_end[];
+
+// Distance from the link-time image to each CPU's copy
+extern uint32_t __per_cpu_offset[NR_CPUS];
+
+DECLARE_PER_CPU(uint32_t, this_cpu_off);
+DECLARE_PER_CPU(unsigned int, cpu_number);
+
+#define per_cpu_offset(cpu)     (__per_cpu_offset[cpu])
+
+#define per_cpu_ptr(ptr, cpu) \
+    ((__typeof__(ptr))((uint32_t)(ptr) + per_cpu_offset(cpu)))
+
+#define per_cpu(var, cpu)       (*per_cpu_ptr(&(var), (cpu)))
+
+static inline uint32_t __my_cpu_offset(void) {
+    uint32_t off;
+    __asm__ volatile("movl %%fs:%1, %0" : "=r" (off) : "m" (this_cpu_off));
+    return off;
+}
+
+#define this_cpu_ptr(ptr) \
+    ((__typeof__(ptr))((uint32_t)(ptr) + __my_cpu_offset()))
+
+/**
+ * %fs-relative accessors
+ * 8-byte reads and writes go through this_cpu_ptr() and can tear if an
+ * interrupt updates the same variable; 8-byte adds use add/adc, which
+ * stays correct because the carry is saved with EFLAGS
+ */
+#define this_cpu_read(var)                                              \
+({                                                                      \
+    unsigned long pcp_val__;                                            \
+    __typeof__(var) pcp_ret__;                                          \
+    switch (sizeof(var)) {                                              \
+    case 1:                                                             \
+        __asm__ volatile("movzbl %%fs:%1, %0" : "=r" (pcp_val__) : "m" (var)); \
+        pcp_ret__ = (__typeof__(var))pcp_val__;                         \
+        break;                                                          \
+    case 2:                                                             \
+        __asm__ volatile("movzwl %%fs:%1, %0" : "=r" (pcp_val__) : "m" (var)); \
+        pcp_ret__ = (__typeof__(var))pcp_val__;                         \
+        break;                                                          \
+    case 4:                                                             \
+        __asm__ volatile("movl %%fs:%1, %0" : "=r" (pcp_val__) : "m" (var)); \
+        pcp_ret__ = (__typeof__(var))pcp_val__;                         \
+        break;                                                          \
+    default:                                                            \
+        pcp_ret__ = *this_cpu_ptr(&(var));                              \
+        break;                                                          \
+    }                                                                   \
+    pcp_ret__;                                                          \
+})
+
+#define this_cpu_write(var, val)                                        \
+do {                                                                    \
+    unsigned long pcp_val__ = (unsigned long)(val);                     \
+    switch (sizeof(var)) {                                              \
+    case 1:                                                             \
+        __asm__ volatile("movb %b1, %%fs:%0" : "+m" (var) : "q" (pcp_val__)); \
+        break;                                                          \
+    case 2:                                                             \
+        __asm__ volatile("movw %w1, %%fs:%0" : "+m" (var) : "r" (pcp_val__)); \
+        break;                                                          \
+    case 4:                                                             \
+        __asm__ volatile("movl %1, %%fs:%0" : "+m" (var) : "r" (pcp_val__)); \
+        break;                                                          \
+    default:                                                            \
+        *this_cpu_ptr(&(var)) = (val);                                  \
+        break;                                                          \
+    }                                                                   \
+} while (0)
+
+#define this_cpu_add(var, val)                                          \
+do {                                                                    \
+    unsigned long pcp_val__ = (unsigned long)(val);                     \
+    switch (sizeof(var)) {                                              \
+    case 1:                                                             \
+        __asm__ volatile("addb %b1, %%fs:%0" : "+m" (var) : "qi" (pcp_val__)); \
+        break;                                                          \
+    case 2:                                                             \
+        __asm__ volatile("addw %w1, %%fs:%0" : "+m" (var) : "ri" (pcp_val__)); \
+        break;                                                          \
+    case 4:                                                             \
+        __asm__ volatile("addl %1, %%fs:%0" : "+m" (var) : "ri" (pcp_val__)); \
+        break;                                                          \
+    default: {                                                          \
+        uint64_t pcp_val64__ = (uint64_t)(val);                         \
+        __asm__ volatile("addl %1, %%fs:%0\n\t"                         \
+                         "adcl %2, %%fs:4+%0"                           \
+                         : "+m" (var)                                   \
+                         : "r" ((uint32_t)pcp_val64__),                 \
+                           "r" ((uint32_t)(pcp_val64__ >> 32)));        \
+        break;                                                          \
+    }                                                                   \
+    }                                                                   \
+} while (0)
+
+#define this_cpu_sub(var, val)  this_cpu_add(var, -(__typeof__(var))(val))
+#define this_cpu_inc(var)       this_cpu_add(var, 1)
+#define this_cpu_dec(var)       this_cpu_add(var, -1)
+
+/**
+ * Give every CPU its own copy of the per-CPU section
+ * Until this runs, %fs is flat and every CPU uses the link-time image
+ */
+void setup_per_cpu_areas(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SOLIX_PREEMPT_H
+#define SOLIX_PREEMPT_H
+
+#include "types.h"
+#include "percpu.h"
+#include "trace_irqsoff.h"
+
+/**
+ * Preemption Control for SolixOS
+ * A per-CPU count of sections the tick must not switch away from. Every
+ * spinlock holder raises it, so a lock holder is never preempted or
+ * migrated to another CPU. A tick that lands inside such a section
+ * leaves the switch to the next one. Nothing may block with it raised
+ * Based on Linux preempt_count design principles
+ */
+
+DECLARE_PER_CPU(uint32_t, __preempt_count);
+
+static inline uint32_t preempt_count(void) {
+    return this_cpu_read(__preempt_count);
+}
+
+static inline bool preemptible(void) {
+    return preempt_count() == 0;
+}
+
+/**
+ * The preemptoff tracer times the outermost section on each CPU
+ */
+static inline void preempt_disable(void) {
+    this_cpu_inc(__preempt_count);
+    __asm__ volatile("" ::: "memory");
+    trace_preempt_off();
+}
+
+static inline void preempt_enable(void) {
+    trace_preempt_on();
+    __asm__ volatile("" ::: "memory");
+    this_cpu_dec(__preempt_count);
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "kernel.h"
+#include "slab.h"
 
 /**
  * Linux-Inspired printk System for SolixOS
@@ -121,7 +122,7 @@ extern int log_buf_read(char *buf, int len);
 /**
  * Timestamp support
  */
-extern unsigned long printk_timestamp(void);
+extern uint64_t printk_timestamp(void);
 extern void printk_enable_timestamps(void);
 extern void printk_disable_timestamps(void);
 
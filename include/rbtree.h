@@ -0,0 +1,87 @@
+#ifndef SOLIX_RBTREE_H
+#define SOLIX_RBTREE_H
+
+#include "types.h"
+
+/**
+ * Red-Black Tree for SolixOS
+ * Intrusive balanced binary tree used for timer and scheduler ordering
+ * Based on the Linux lib/rbtree.c interface
+ */
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    unsigned int rb_color;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+/**
+ * Root with a cached pointer to the leftmost node, so the minimum
+ * (earliest timer, smallest vruntime) is available in O(1)
+ */
+struct rb_root_cached {
+    struct rb_root rb_root;
+    struct rb_node *rb_leftmost;
+};
+
+#define RB_ROOT             (struct rb_root) { NULL }
+#define RB_ROOT_CACHED      (struct rb_root_cached) { { NULL }, NULL }
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define RB_EMPTY_ROOT(root)  ((root)->rb_node == NULL)
+#define RB_EMPTY_NODE(node)  ((node)->rb_parent == (node))
+#define RB_CLEAR_NODE(node)  ((node)->rb_parent = (node))
+
+/**
+ * Link a new node at the position found by the caller's search
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+                                struct rb_node **rb_link) {
+    node->rb_parent = parent;
+    node->rb_color = RB_RED;
+    node->rb_left = node->rb_right = NULL;
+    *rb_link = node;
+}
+
+/**
+ * Tree operations
+ */
+extern void rb_insert_color(struct rb_node *node, struct rb_root *root);
+extern void rb_erase(struct rb_node *node, struct rb_root *root);
+extern struct rb_node *rb_first(const struct rb_root *root);
+extern struct rb_node *rb_last(const struct rb_root *root);
+extern struct rb_node *rb_next(const struct rb_node *node);
+extern struct rb_node *rb_prev(const struct rb_node *node);
+
+/**
+ * Leftmost-cached variants
+ */
+static inline void rb_insert_color_cached(struct rb_node *node,
+                                          struct rb_root_cached *root,
+                                          bool leftmost) {
+    if (leftmost) {
+        root->rb_leftmost = node;
+    }
+    rb_insert_color(node, &root->rb_root);
+}
+
+static inline void rb_erase_cached(struct rb_node *node,
+                                   struct rb_root_cached *root) {
+    if (root->rb_leftmost == node) {
+        root->rb_leftmost = rb_next(node);
+    }
+    rb_erase(node, &root->rb_root);
+}
+
+#define rb_first_cached(root) ((root)->rb_leftmost)
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef SOLIX_RCUPDATE_H
+#define SOLIX_RCUPDATE_H
+
+#include "types.h"
+#include "list.h"
+#include "percpu.h"
+
+/**
+ * Read-Copy-Update for SolixOS
+ * Readers of read-mostly lists take no lock and write no shared memory;
+ * updaters unlink an element, then free it with call_rcu() once every
+ * CPU has passed a quiescent state (context switch, idle, or a tick
+ * outside any read-side critical section)
+ * Based on Linux classic RCU design principles
+ */
+
+/**
+ * Deferred callback, embedded in the object it frees
+ */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+/**
+ * Per-CPU grace-period bookkeeping
+ * Callbacks move nxtlist -> curlist -> donelist as grace periods start
+ * and end; only the owning CPU touches its lists
+ */
+struct rcu_data {
+    unsigned long quiescbatch;  // Grace period we report a quiescent state for
+    bool passed_quiesce;        // Quiescent state seen since quiescbatch began
+    bool qs_pending;            // quiescbatch still needs our report
+    unsigned long batch;        // Grace period curlist waits for
+    struct rcu_head *nxtlist;   // Queued, no grace period assigned yet
+    struct rcu_head **nxttail;
+    struct rcu_head *curlist;   // Waiting for batch to complete
+    struct rcu_head **curtail;
+    struct rcu_head *donelist;  // Ready to invoke
+    struct rcu_head **donetail;
+    uint32_t qlen;
+};
+
+DECLARE_PER_CPU(struct rcu_data, rcu_data);
+DECLARE_PER_CPU(int, rcu_read_lock_nesting);
+
+/**
+ * Read-side critical section
+ * The timer tick does not preempt a task inside one, so a CPU with a
+ * nesting count of zero holds no RCU-protected pointers
+ */
+static inline void rcu_read_lock(void) {
+    this_cpu_inc(rcu_read_lock_nesting);
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline void rcu_read_unlock(void) {
+    __asm__ volatile("" ::: "memory");
+    this_cpu_dec(rcu_read_lock_nesting);
+}
+
+static inline int rcu_preempt_depth(void) {
+    return this_cpu_read(rcu_read_lock_nesting);
+}
+
+/**
+ * Pointer publication and subscription
+ * x86 keeps stores ordered and does not reorder dependent loads, so
+ * only the compiler has to be held back
+ */
+#define rcu_dereference(p)                                      \
+({                                                              \
+    __typeof__(p) rcu_p__ = *(volatile __typeof__(p) *)&(p);    \
+    __asm__ volatile("" ::: "memory");                          \
+    rcu_p__;                                                    \
+})
+
+#define rcu_assign_pointer(p, v)                                \
+do {                                                            \
+    __asm__ volatile("" ::: "memory");                          \
+    *(volatile __typeof__(p) *)&(p) = (v);                      \
+} while (0)
+
+/**
+ * RCU-safe list operations
+ * Updaters still serialize among themselves with the list's lock
+ */
+static inline void list_add_rcu(struct list_head *new, struct list_head *head) {
+    struct list_head *next = head->next;
+
+    new->next = next;
+    new->prev = head;
+    rcu_assign_pointer(head->next, new);
+    next->prev = new;
+}
+
+static inline void list_add_tail_rcu(struct list_head *new, struct list_head *head) {
+    struct list_head *prev = head->prev;
+
+    new->next = head;
+    new->prev = prev;
+    rcu_assign_pointer(prev->next, new);
+    head->prev = new;
+}
+
+/**
+ * Unlink an entry; its next pointer stays valid for readers still on it
+ */
+static inline void list_del_rcu(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    rcu_assign_pointer(entry->prev->next, entry->next);
+    entry->prev = NULL;
+}
+
+#define list_for_each_entry_rcu(pos, head, member)                              \
+    for (pos = container_of(rcu_dereference((head)->next), __typeof__(*pos), member); \
+         &pos->member != (head);                                                \
+         pos = container_of(rcu_dereference(pos->member.next), __typeof__(*pos), member))
+
+/**
+ * Take a reference unless the count already dropped to zero, i.e. the
+ * object is on its way to call_rcu()
+ */
+static inline bool refcount_inc_not_zero(volatile uint32_t *count) {
+    uint32_t old = *count;
+
+    while (old) {
+        uint32_t seen = __sync_val_compare_and_swap(count, old, old + 1);
+        if (seen == old) {
+            return true;
+        }
+        old = seen;
+    }
+    return false;
+}
+
+/**
+ * Update side
+ */
+void rcu_init(void);
+void call_rcu(struct rcu_head *head, rcu_callback_t func);
+void synchronize_rcu(void);
+
+/**
+ * Quiescent-state hooks for the scheduler, idle loops and interrupt entry
+ */
+void rcu_note_context_switch(void);
+void rcu_check_callbacks(void);
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+void rcu_irq_enter(void);
+void rcu_irq_exit(void);
+
+#endif
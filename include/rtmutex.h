@@ -0,0 +1,70 @@
+#ifndef SOLIX_RTMUTEX_H
+#define SOLIX_RTMUTEX_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+#include "scheduler.h"
+#include "slab.h"
+
+/**
+ * Priority-Inheritance Mutexes for SolixOS
+ * Sleeping locks whose owner runs at the priority of its most urgent
+ * waiter, so a low-priority holder cannot block a real-time task
+ * indefinitely behind medium-priority work
+ * Based on Linux rt_mutex design principles
+ */
+
+// Longest lock chain walked before assuming a deadlock
+#define RT_MUTEX_MAX_LOCK_DEPTH 1024
+
+/**
+ * Sleeping lock with priority inheritance
+ */
+struct rt_mutex {
+    process_t *owner;
+    struct list_head held_entry;    // On owner->pi_held_locks
+    struct list_head waiters;       // Sorted by priority, most urgent first
+    const char *name;
+};
+
+/**
+ * A process blocked on an rt_mutex, lives on the waiter's stack
+ */
+struct rt_mutex_waiter {
+    struct list_head list_entry;    // On lock->waiters
+    struct list_head pi_list_entry; // On owner->pi_waiters while top waiter
+    process_t *task;
+    struct rt_mutex *lock;
+    int prio;
+};
+
+#define __RT_MUTEX_INITIALIZER(mutexname) {                             \
+    .owner = NULL,                                                      \
+    .held_entry = { &(mutexname).held_entry, &(mutexname).held_entry }, \
+    .waiters = { &(mutexname).waiters, &(mutexname).waiters },          \
+    .name = #mutexname }
+
+#define DEFINE_RT_MUTEX(mutexname) \
+    struct rt_mutex mutexname = __RT_MUTEX_INITIALIZER(mutexname)
+
+/**
+ * Lock interface
+ */
+void rt_mutex_init(struct rt_mutex *lock, const char *name);
+void rt_mutex_lock(struct rt_mutex *lock);
+int rt_mutex_trylock(struct rt_mutex *lock);
+void rt_mutex_unlock(struct rt_mutex *lock);
+
+static inline bool rt_mutex_is_locked(struct rt_mutex *lock) {
+    return lock->owner != NULL;
+}
+
+/**
+ * Per-task PI state
+ */
+void rt_mutex_init_task(process_t *p);
+void rt_mutex_adjust_pi(process_t *p);
+void rt_mutex_remove_task(process_t *p);
+
+#endif
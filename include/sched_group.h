@@ -0,0 +1,102 @@
+#ifndef SOLIX_SCHED_GROUP_H
+#define SOLIX_SCHED_GROUP_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+#include "hrtimer.h"
+#include "slab.h"
+
+/**
+ * CPU Task Groups for SolixOS
+ * Hierarchical groups sharing the CPU by weight, optionally capped by a
+ * quota of runtime per period
+ * Based on Linux CFS group scheduling and bandwidth control principles
+ */
+
+// Group weights
+#define ROOT_TASK_GROUP_SHARES  1024
+#define MIN_SHARES              2
+#define MAX_SHARES              (1 << 18)
+
+// Bandwidth limits
+#define RUNTIME_INF             ((uint64_t)~0ULL)
+#define DEFAULT_CFS_PERIOD_US   100000UL    // 100ms
+#define MIN_CFS_PERIOD_US       1000UL      // 1ms
+#define MAX_CFS_PERIOD_US       1000000UL   // 1s
+#define MIN_CFS_QUOTA_US        1000UL
+
+// Fixed-point scale of the hierarchical weights
+#define TG_WEIGHT_SHIFT         20
+
+#define TASK_GROUP_NAME_LEN     32
+
+/**
+ * Per-group CPU bandwidth
+ */
+struct cfs_bandwidth {
+    spinlock_t lock;
+    uint64_t period;            // ns
+    uint64_t quota;             // ns per period, RUNTIME_INF if unlimited
+    int64_t runtime;            // Left in the current period
+    bool throttled;
+    uint64_t throttled_clock;   // sched_clock() when throttled
+    struct hrtimer period_timer;
+
+    // Statistics
+    uint32_t nr_periods;
+    uint32_t nr_throttled;
+    uint64_t throttled_time;
+};
+
+/**
+ * Task group
+ */
+struct task_group {
+    char name[TASK_GROUP_NAME_LEN];
+    struct task_group *parent;
+    struct list_head siblings;
+    struct list_head children;
+
+    uint32_t shares;            // Weight relative to siblings
+    uint32_t children_shares;   // Sum of children's shares
+    uint32_t h_weight;          // Fraction of the CPU the group is entitled to
+    uint32_t h_own_weight;      // ... of which its own tasks are entitled to
+    uint64_t vruntime;          // Runtime of its own tasks scaled by h_own_weight
+
+    uint32_t nr_tasks;
+    uint64_t usage;             // Total runtime of the subtree, ns
+
+    struct cfs_bandwidth cfs_b;
+};
+
+extern struct task_group root_task_group;
+
+/**
+ * Group management
+ */
+void sched_group_init(void);
+struct task_group *sched_create_group(struct task_group *parent, const char *name);
+int sched_destroy_group(struct task_group *tg);
+struct task_group *sched_find_group(const char *name);
+int sched_group_set_shares(struct task_group *tg, uint32_t shares);
+int tg_set_cfs_bandwidth(struct task_group *tg, uint32_t period_us, int64_t quota_us);
+int sched_move_task(process_t *p, struct task_group *tg);
+void sched_group_print(void);
+
+/**
+ * Scheduler hooks
+ */
+void sched_group_fork(process_t *p, process_t *parent);
+void sched_group_exit(process_t *p);
+void task_group_charge(process_t *p);
+void task_group_place(process_t *p);
+bool task_group_throttled(process_t *p);
+uint64_t task_group_vruntime(process_t *p);
+void task_group_set_min_vruntime(uint64_t vruntime);
+
+static inline struct task_group *task_group(process_t *p) {
+    return p->sched_task_group ? p->sched_task_group : &root_task_group;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SOLIX_SCHED_ISOLATION_H
+#define SOLIX_SCHED_ISOLATION_H
+
+#include "types.h"
+#include "cpumask.h"
+
+/**
+ * CPU Isolation for SolixOS
+ * CPUs listed in the isolcpus= boot parameter are kept free of unbound
+ * tasks, timers and device interrupts; only work explicitly pinned there
+ * runs on them
+ * Based on Linux housekeeping/isolcpus design principles
+ */
+
+void housekeeping_init(const char *cmdline);
+const struct cpumask *housekeeping_cpumask(void);
+unsigned int housekeeping_any_cpu(void);
+bool housekeeping_cpu(unsigned int cpu);
+
+static inline bool cpu_is_isolated(unsigned int cpu) {
+    return !housekeeping_cpu(cpu);
+}
+
+#endif
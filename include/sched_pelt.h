@@ -0,0 +1,54 @@
+#ifndef SOLIX_SCHED_PELT_H
+#define SOLIX_SCHED_PELT_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Per-Entity Load Tracking for SolixOS
+ * Geometric-series load and utilization signals per task and per CPU
+ * Based on Linux PELT design principles
+ */
+
+// Utilization scale: a CPU that is always busy has util_avg 1024
+#define SCHED_CAPACITY_SHIFT    10
+#define SCHED_CAPACITY_SCALE    (1 << SCHED_CAPACITY_SHIFT)
+
+// Weight every task contributes while runnable
+#define PELT_TASK_WEIGHT        1024
+
+// y^LOAD_AVG_PERIOD = 1/2; LOAD_AVG_MAX is the sum of the full series
+#define LOAD_AVG_PERIOD         32
+#define LOAD_AVG_MAX            47742
+
+/**
+ * Per-CPU aggregate
+ * A runnable task counts on the CPU it last ran on until it runs
+ * somewhere else; wakers and killers update it from other CPUs
+ */
+struct pelt_rq {
+    spinlock_t lock;
+    struct sched_avg avg;
+    uint32_t runnable_weight;   // Sum of weights of runnable tasks
+    uint32_t nr_running;        // Tasks currently on the CPU (0 or 1)
+};
+
+/**
+ * Load tracking interface
+ */
+void pelt_init(void);
+void pelt_init_task(process_t *p);
+void update_task_load(process_t *p, bool runnable, bool running);
+void pelt_tick(process_t *curr);
+uint32_t cpu_load_avg(unsigned int cpu);
+uint32_t cpu_util_avg(unsigned int cpu);
+
+static inline uint32_t task_util(process_t *p) {
+    return p->avg.util_avg;
+}
+
+static inline uint32_t task_load(process_t *p) {
+    return p->avg.load_avg;
+}
+
+#endif
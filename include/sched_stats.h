@@ -0,0 +1,43 @@
+#ifndef SOLIX_SCHED_STATS_H
+#define SOLIX_SCHED_STATS_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Scheduler Statistics for SolixOS
+ * Per-task and per-runqueue run delay, switch counts and wakeup latency
+ * Based on Linux schedstats design principles
+ */
+
+// Bumped whenever the dump format changes
+#define SCHEDSTAT_VERSION   1
+
+/**
+ * Per-runqueue statistics
+ */
+struct rq_sched_info {
+    uint32_t pcount;            // Tasks put on this CPU
+    uint32_t nr_wakeups;
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    uint64_t run_delay;         // Total queue wait of all tasks
+    uint64_t max_run_delay;
+    uint32_t delay_hist[SCHED_HIST_BUCKETS];    // Queue-to-run latency
+};
+
+#ifdef CONFIG_SCHEDSTATS
+void sched_info_init(process_t *p);
+void sched_info_queued(process_t *p, bool wakeup);
+void sched_info_arrive(process_t *p);
+void sched_info_depart(process_t *p, bool voluntary);
+void schedstat_show(void);
+#else
+static inline void sched_info_init(process_t *p) { }
+static inline void sched_info_queued(process_t *p, bool wakeup) { }
+static inline void sched_info_arrive(process_t *p) { }
+static inline void sched_info_depart(process_t *p, bool voluntary) { }
+static inline void schedstat_show(void) { }
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #define SOLIX_SCHEDULER_H
 
 #include "types.h"
+#include "list.h"
 #include "kernel.h"
 
 /**
@@ -32,6 +33,16 @@
 #define MIN_TIMESLICE   (20 * HZ / 1000)   // 20ms minimum
 #define MAX_TIMESLICE   (200 * HZ / 1000)  // 200ms maximum
 
+// Load weight of a nice-0 task
+#define NICE_0_LOAD     1024
+
+/**
+ * Priority array bitmap helpers
+ */
+#define BITMAP_SIZE     ((MAX_PRIO + 31) / 32)
+#define BITMAP_WORD(bit)    ((bit) / 32)
+#define BITMAP_BIT(bit)      (1UL << ((bit) % 32))
+
 /**
  * Runqueue structure - Linux O(1) scheduler design
  */
@@ -51,58 +62,14 @@ typedef struct runqueue {
     uint32_t expired_timestamp;
     uint32_t best_expired_prio;
     
-    // Load balancing
-    uint32_t cpu_load;
+    // Load balancing (PELT)
+    uint32_t cpu_load;          // Runnable load, 1000 per busy task
+    uint32_t cpu_util;          // Utilization, 0..SCHED_CAPACITY_SCALE
     uint32_t nr_uninterruptible;
 } runqueue_t;
 
-/**
- * Priority array bitmap helpers
- */
-#define BITMAP_SIZE     ((MAX_PRIO + 31) / 32)
-#define BITMAP_WORD(bit)    ((bit) / 32)
-#define BITMAP_BIT(bit)      (1UL << ((bit) % 32))
-
-/**
- * Task structure enhancements for Linux-style scheduling
- */
-struct sched_entity {
-    // Virtual runtime for CFS-inspired scheduling
-    uint64_t vruntime;
-    uint64_t exec_start;
-    uint64_t sum_exec_runtime;
-    uint64_t prev_sum_exec_runtime;
-    uint64_t nr_migrations;
-    
-    // Load weight
-    uint64_t load_weight;
-    uint32_t inv_weight;
-    
-    // Sleep statistics
-    uint64_t sleep_start;
-    uint64_t block_start;
-    uint64_t sleep_runtime;
-    
-    // Time slice
-    uint32_t time_slice;
-    uint32_t first_time_slice;
-    
-    // Scheduling class
-    uint32_t policy;
-    uint32_t rt_priority;
-    
-    // Priority
-    uint32_t prio;
-    uint32_t static_prio;
-    uint32_t normal_prio;
-    
-    // Runqueue placement
-    struct list_head run_list;
-    runqueue_t* rq;
-};
-
-// Extend process structure with scheduling entity
-#define sched_entity(proc) ((struct sched_entity*)&(proc)->sched_data)
+// Scheduling entity embedded in the process (kernel.h)
+#define sched_entity(proc) (&(proc)->se)
 
 /**
  * Scheduler classes (Linux-inspired)
@@ -164,6 +131,7 @@ int rt_task(process_t *p);
 int task_has_rt_policy(process_t *p);
 int rt_mutex_getprio(process_t *p);
 void rt_mutex_setprio(process_t *p, int prio);
+int sched_setscheduler(process_t *p, uint32_t policy, uint32_t rt_priority);
 
 /**
  * Completely Fair Scheduler (CFS) inspired functions
@@ -184,7 +152,6 @@ void sched_debug_show(void);
  * Idle process management
  */
 process_t* get_idle_process(void);
-void cpu_idle_loop(void);
 void init_idle_process(void);
 
 /**
@@ -216,9 +183,4 @@ void migrate_task(process_t *p, int dest_cpu);
 #define task_is_stopped(p)      ((p)->pcb.state == TASK_STOPPED)
 #define task_is_traced(p)       ((p)->pcb.state == TASK_TRACED)
 
-#define list_for_each_entry(pos, head, member) \
-    for (pos = list_entry((head)->next, typeof(*pos), member); \
-         &pos->member != (head); \
-         pos = list_entry(pos->member.next, typeof(*pos), member))
-
 #endif
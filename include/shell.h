@@ -35,6 +35,17 @@ char cmd_mkdir(int argc, char** argv);
 char cmd_touch(int argc, char** argv);
 char cmd_rm(int argc, char** argv);
 char cmd_ps(int argc, char** argv);
+char cmd_schedstat(int argc, char** argv);
+char cmd_cgroup(int argc, char** argv);
+char cmd_chrt(int argc, char** argv);
+char cmd_taskset(int argc, char** argv);
+char cmd_irqaffinity(int argc, char** argv);
+char cmd_irqstat(int argc, char** argv);
+char cmd_lockstat(int argc, char** argv);
+char cmd_latency(int argc, char** argv);
+char cmd_softirqs(int argc, char** argv);
+char cmd_workqueues(int argc, char** argv);
+char cmd_lspci(int argc, char** argv);
 char cmd_kill(int argc, char** argv);
 char cmd_reboot(int argc, char** argv);
 char cmd_halt(int argc, char** argv);
@@ -2,7 +2,9 @@
 #define SOLIX_SLAB_H
 
 #include "types.h"
+#include "list.h"
 #include "mm.h"
+#include "spinlock.h"
 
 /**
  * Linux-Inspired SLAB Allocator for SolixOS
@@ -170,6 +172,7 @@ static inline void kfree_slab(void *objp) {
  */
 extern void slab_init(void);
 extern void kmem_cache_init(void);
+extern void kmem_cache_init_late(void);
 
 /**
  * Memory reclaim and management
@@ -240,27 +243,4 @@ extern void slab_debug_info(void);
 #define smp_rmb()          __asm__ volatile("lfence" ::: "memory")
 #define smp_wmb()          __asm__ volatile("sfence" ::: "memory")
 
-/**
- * Locking primitives for SLAB
- */
-typedef struct {
-    volatile unsigned int lock;
-} spinlock_t;
-
-#define SPIN_LOCK_UNLOCKED  { 0 }
-
-static inline void spin_lock(spinlock_t *lock) {
-    while (__sync_lock_test_and_set(&lock->lock, 1)) {
-        // Spin until lock is acquired
-    }
-}
-
-static inline void spin_unlock(spinlock_t *lock) {
-    __sync_lock_release(&lock->lock);
-}
-
-static inline int spin_trylock(spinlock_t *lock) {
-    return !__sync_lock_test_and_set(&lock->lock, 1);
-}
-
 #endif
@@ -0,0 +1,49 @@
+#ifndef SOLIX_SMP_H
+#define SOLIX_SMP_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * Symmetric Multiprocessing for SolixOS
+ * Discovery and startup of application processors
+ * Based on Linux x86 smpboot design principles
+ */
+
+// Real-mode page the startup trampoline is copied to (STARTUP vector 0x08)
+#define TRAMPOLINE_BASE     0x8000
+
+// Trampoline symbols (kernel/trampoline.S)
+extern char trampoline_start[];
+extern char trampoline_end[];
+extern uint32_t trampoline_cr3;
+extern uint32_t trampoline_stack;
+extern uint32_t trampoline_entry;
+
+/**
+ * Find the CPUs in firmware tables and start every one of them
+ */
+void smp_init(void);
+
+/**
+ * Per-CPU idle task, which the CPU runs when it has nothing else to do
+ */
+process_t* idle_task(unsigned int cpu);
+
+/**
+ * Set up cpu's idle task on kernel_stack
+ */
+void init_idle(unsigned int cpu, uint32_t kernel_stack);
+
+/**
+ * Send cpu a reschedule IPI, so it picks up work made ready for it
+ * now rather than at its next tick
+ */
+void smp_send_reschedule(unsigned int cpu);
+
+/**
+ * Busy-wait for at least usecs microseconds
+ */
+void udelay(uint32_t usecs);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SOLIX_SOFTIRQ_H
+#define SOLIX_SOFTIRQ_H
+
+#include "types.h"
+#include "percpu.h"
+
+/**
+ * Softirqs and Tasklets for SolixOS
+ * Interrupt handlers only quiet the device and raise a softirq; the
+ * bulk of the work runs on interrupt exit with interrupts enabled, in
+ * vector order, on the CPU that raised it. Work that keeps coming back
+ * past a time budget is handed to that CPU's ksoftirqd thread so it
+ * cannot starve tasks. Tasklets are one-shot driver callbacks run from
+ * a softirq, never concurrently with themselves
+ * Based on Linux softirq design principles
+ */
+
+enum {
+    HI_SOFTIRQ = 0,     // High-priority tasklets
+    TIMER_SOFTIRQ,      // Timer wheel expiry
+    NET_TX_SOFTIRQ,     // Transmit completion
+    NET_RX_SOFTIRQ,     // Receive backlog to the protocol stack
+    BLOCK_SOFTIRQ,      // Block request completion
+    TASKLET_SOFTIRQ,    // Normal tasklets
+    RCU_SOFTIRQ,        // RCU callbacks
+    NR_SOFTIRQS
+};
+
+struct softirq_action {
+    void (*action)(struct softirq_action *h);
+};
+
+DECLARE_PER_CPU(uint32_t, softirq_pending);
+DECLARE_PER_CPU(uint32_t, hardirq_count);
+DECLARE_PER_CPU(uint32_t, softirq_count);
+
+static inline uint32_t local_softirq_pending(void) {
+    return this_cpu_read(softirq_pending);
+}
+
+// Running a softirq or with bottom halves disabled
+static inline bool in_softirq(void) {
+    return this_cpu_read(softirq_count) != 0;
+}
+
+// In a hard interrupt handler or a softirq
+static inline bool in_interrupt(void) {
+    return this_cpu_read(hardirq_count) || this_cpu_read(softirq_count);
+}
+
+void softirq_init(void);
+void open_softirq(int nr, void (*action)(struct softirq_action *h));
+
+/**
+ * Mark a softirq pending on this CPU
+ * Outside interrupt context ksoftirqd is woken to run it
+ */
+void raise_softirq(unsigned int nr);
+void raise_softirq_irqoff(unsigned int nr);
+
+/**
+ * Run pending softirqs now unless already in interrupt context
+ */
+void do_softirq(void);
+
+/**
+ * Hard interrupt entry and exit; irq_exit() runs pending softirqs
+ */
+void irq_enter(void);
+void irq_exit(void);
+
+/**
+ * Keep softirqs off this CPU, e.g. around data they share with a task
+ * local_bh_enable() runs whatever was raised in between
+ */
+void local_bh_disable(void);
+void local_bh_enable(void);
+
+void softirq_show(void);
+
+/**
+ * Tasklets
+ * count > 0 disables a tasklet: it stays queued but does not run
+ */
+#define TASKLET_STATE_SCHED 0x01    // Queued to run
+#define TASKLET_STATE_RUN   0x02    // Running on some CPU
+
+struct tasklet_struct {
+    struct tasklet_struct *next;
+    volatile unsigned long state;
+    volatile uint32_t count;
+    void (*func)(unsigned long data);
+    unsigned long data;
+};
+
+#define DECLARE_TASKLET(name, func, data) \
+    struct tasklet_struct name = { NULL, 0, 0, func, data }
+
+void tasklet_init(struct tasklet_struct *t, void (*func)(unsigned long data),
+                  unsigned long data);
+void tasklet_schedule(struct tasklet_struct *t);
+void tasklet_hi_schedule(struct tasklet_struct *t);
+
+/**
+ * Disable waits for a running instance to finish; process context only,
+ * as is tasklet_kill(), which also waits out a queued run
+ */
+void tasklet_disable(struct tasklet_struct *t);
+void tasklet_enable(struct tasklet_struct *t);
+void tasklet_kill(struct tasklet_struct *t);
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef SOLIX_SPINLOCK_H
+#define SOLIX_SPINLOCK_H
+
+#include "types.h"
+#include "preempt.h"
+
+/**
+ * Spinlocks for SolixOS
+ * Fair ticket spinlocks, queued reader-writer locks and sequence locks,
+ * with per-lock contention statistics when built with CONFIG_LOCK_STAT.
+ * Holding any of them disables preemption on the local CPU
+ * Based on Linux locking design principles
+ */
+
+#ifdef DEBUG
+#define CONFIG_DEBUG_SPINLOCK
+#endif
+
+#define SPINLOCK_MAGIC      0xdead4ead
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("pause" ::: "memory");
+}
+
+/**
+ * Interrupt flag save/restore
+ */
+static inline unsigned long arch_local_irq_save(void) {
+    unsigned long flags;
+    __asm__ volatile("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void arch_local_irq_restore(unsigned long flags) {
+    __asm__ volatile("pushl %0; popfl" : : "g" (flags) : "memory", "cc");
+}
+
+/**
+ * Traced variants: only real off/on transitions reach the tracer
+ */
+#define local_irq_save(flags)                           \
+    do {                                                \
+        (flags) = arch_local_irq_save();                \
+        if ((flags) & X86_EFLAGS_IF) {                  \
+            trace_hardirqs_off();                       \
+        }                                               \
+    } while (0)
+
+#define local_irq_restore(flags)                        \
+    do {                                                \
+        if ((flags) & X86_EFLAGS_IF) {                  \
+            trace_hardirqs_on();                        \
+        }                                               \
+        arch_local_irq_restore(flags);                  \
+    } while (0)
+
+#define local_irq_disable()                             \
+    do {                                                \
+        __asm__ volatile("cli" ::: "memory");           \
+        trace_hardirqs_off();                           \
+    } while (0)
+
+#define local_irq_enable()                              \
+    do {                                                \
+        trace_hardirqs_on();                            \
+        __asm__ volatile("sti" ::: "memory");           \
+    } while (0)
+
+static inline bool irqs_disabled(void) {
+    unsigned long flags;
+    __asm__ volatile("pushfl; popl %0" : "=r" (flags));
+    return !(flags & X86_EFLAGS_IF);
+}
+
+#ifdef CONFIG_LOCK_STAT
+/**
+ * Contention statistics of one lock
+ * A lock is listed by lock_stat_show() after its first contention
+ */
+struct lock_class_stats {
+    const char *name;
+    uint32_t acquisitions;
+    uint32_t contentions;       // Acquisitions that had to wait
+    uint64_t wait_cycles;       // TSC cycles spent waiting, total
+    uint64_t max_wait_cycles;
+    bool registered;
+    struct lock_class_stats *next;
+};
+
+#define __LOCK_STAT_INIT(lockname)  , .stat = { .name = lockname }
+#else
+#define __LOCK_STAT_INIT(lockname)
+#endif
+
+#ifdef CONFIG_DEBUG_SPINLOCK
+#define __SPIN_DEBUG_INIT           , .magic = SPINLOCK_MAGIC, .owner_cpu = -1
+#else
+#define __SPIN_DEBUG_INIT
+#endif
+
+/**
+ * Ticket spinlock
+ * Each locker takes the next ticket from tail and waits until head
+ * reaches it, so the lock is granted in FIFO order
+ */
+typedef struct {
+    union {
+        volatile uint32_t slock;
+        struct {
+            volatile uint16_t head;     // Ticket being served
+            volatile uint16_t tail;     // Next ticket to hand out
+        } tickets;
+    };
+#ifdef CONFIG_DEBUG_SPINLOCK
+    uint32_t magic;
+    int owner_cpu;
+#endif
+#ifdef CONFIG_LOCK_STAT
+    struct lock_class_stats stat;
+#endif
+} spinlock_t;
+
+#define TICKET_SHIFT        16
+
+#define __SPIN_LOCK_UNLOCKED(lockname) \
+    { .slock = 0 __SPIN_DEBUG_INIT __LOCK_STAT_INIT(lockname) }
+
+#define SPIN_LOCK_UNLOCKED  __SPIN_LOCK_UNLOCKED(NULL)
+
+#define DEFINE_SPINLOCK(x)  spinlock_t x = __SPIN_LOCK_UNLOCKED(#x)
+
+void spin_lock_slowpath(spinlock_t *lock, uint16_t ticket);
+
+#ifdef CONFIG_DEBUG_SPINLOCK
+void spin_debug_lock(spinlock_t *lock);
+void spin_debug_unlock(spinlock_t *lock);
+#else
+static inline void spin_debug_lock(spinlock_t *lock) { }
+static inline void spin_debug_unlock(spinlock_t *lock) { }
+#endif
+
+static inline void spin_lock_init(spinlock_t *lock) {
+    *lock = (spinlock_t)SPIN_LOCK_UNLOCKED;
+}
+
+static inline bool spin_is_locked(spinlock_t *lock) {
+    uint32_t val = lock->slock;
+    return (uint16_t)val != (uint16_t)(val >> TICKET_SHIFT);
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    uint16_t ticket;
+
+    preempt_disable();
+    ticket = __sync_fetch_and_add(&lock->tickets.tail, 1);
+    if (unlikely(lock->tickets.head != ticket)) {
+        spin_lock_slowpath(lock, ticket);
+    }
+#ifdef CONFIG_LOCK_STAT
+    lock->stat.acquisitions++;
+#endif
+    spin_debug_lock(lock);
+}
+
+static inline int spin_trylock(spinlock_t *lock) {
+    uint32_t old = lock->slock;
+
+    if ((uint16_t)old != (uint16_t)(old >> TICKET_SHIFT)) {
+        return 0;
+    }
+    preempt_disable();
+    if (!__sync_bool_compare_and_swap(&lock->slock, old, old + (1U << TICKET_SHIFT))) {
+        preempt_enable();
+        return 0;
+    }
+#ifdef CONFIG_LOCK_STAT
+    lock->stat.acquisitions++;
+#endif
+    spin_debug_lock(lock);
+    return 1;
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    spin_debug_unlock(lock);
+    // Only the holder writes head; x86 stores are release ordered
+    __asm__ volatile("incw %0" : "+m" (lock->tickets.head) : : "memory", "cc");
+    preempt_enable();
+}
+
+#define spin_lock_irqsave(lock, flags)                  \
+    do {                                                \
+        local_irq_save(flags);                          \
+        spin_lock(lock);                                \
+    } while (0)
+
+#define spin_unlock_irqrestore(lock, flags)             \
+    do {                                                \
+        spin_unlock(lock);                              \
+        local_irq_restore(flags);                       \
+    } while (0)
+
+static inline void spin_lock_irq(spinlock_t *lock) {
+    local_irq_disable();
+    spin_lock(lock);
+}
+
+static inline void spin_unlock_irq(spinlock_t *lock) {
+    spin_unlock(lock);
+    local_irq_enable();
+}
+
+/**
+ * Queued reader-writer lock
+ * Readers share the lock while no writer holds or waits for it; a
+ * contended reader or writer queues on wait_lock, so a stream of readers
+ * cannot starve a writer
+ */
+typedef struct {
+    volatile uint32_t cnts;     // Reader count << 9 | waiting | locked
+    spinlock_t wait_lock;
+} rwlock_t;
+
+#define _QW_LOCKED      0x0ff   // Writer holds the lock
+#define _QW_WAITING     0x100   // Writer waits for readers to drain
+#define _QW_WMASK       0x1ff
+#define _QR_SHIFT       9
+#define _QR_BIAS        (1U << _QR_SHIFT)
+
+#define __RW_LOCK_UNLOCKED(lockname) \
+    { .cnts = 0, .wait_lock = __SPIN_LOCK_UNLOCKED(lockname) }
+
+#define RW_LOCK_UNLOCKED    __RW_LOCK_UNLOCKED(NULL)
+#define DEFINE_RWLOCK(x)    rwlock_t x = __RW_LOCK_UNLOCKED(#x)
+
+void queued_read_lock_slowpath(rwlock_t *lock);
+void queued_write_lock_slowpath(rwlock_t *lock);
+
+static inline void rwlock_init(rwlock_t *lock) {
+    *lock = (rwlock_t)RW_LOCK_UNLOCKED;
+}
+
+static inline void read_lock(rwlock_t *lock) {
+    uint32_t cnts;
+
+    preempt_disable();
+    cnts = __sync_add_and_fetch(&lock->cnts, _QR_BIAS);
+    if (likely(!(cnts & _QW_WMASK))) {
+        return;
+    }
+    queued_read_lock_slowpath(lock);
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    __sync_fetch_and_sub(&lock->cnts, _QR_BIAS);
+    preempt_enable();
+}
+
+static inline void write_lock(rwlock_t *lock) {
+    preempt_disable();
+    if (likely(__sync_bool_compare_and_swap(&lock->cnts, 0, _QW_LOCKED))) {
+        return;
+    }
+    queued_write_lock_slowpath(lock);
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    // Clear the locked byte only; readers may have added their bias
+    __asm__ volatile("movb $0, %0" : "+m" (*(volatile uint8_t *)&lock->cnts) : : "memory");
+    preempt_enable();
+}
+
+#define read_lock_irqsave(lock, flags)      do { local_irq_save(flags); read_lock(lock); } while (0)
+#define read_unlock_irqrestore(lock, flags) do { read_unlock(lock); local_irq_restore(flags); } while (0)
+#define write_lock_irqsave(lock, flags)     do { local_irq_save(flags); write_lock(lock); } while (0)
+#define write_unlock_irqrestore(lock, flags) do { write_unlock(lock); local_irq_restore(flags); } while (0)
+
+/**
+ * Sequence counter and lock
+ * Writers bump the sequence to odd before and to even after an update;
+ * readers never block writers and retry if the sequence moved
+ */
+typedef struct {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+typedef struct {
+    seqcount_t seqcount;
+    spinlock_t lock;            // Serializes writers
+} seqlock_t;
+
+#define SEQCNT_ZERO                 { .sequence = 0 }
+#define __SEQLOCK_UNLOCKED(lockname) \
+    { .seqcount = SEQCNT_ZERO, .lock = __SPIN_LOCK_UNLOCKED(lockname) }
+#define DEFINE_SEQLOCK(x)           seqlock_t x = __SEQLOCK_UNLOCKED(#x)
+
+static inline void seqlock_init(seqlock_t *sl) {
+    sl->seqcount.sequence = 0;
+    spin_lock_init(&sl->lock);
+}
+
+static inline uint32_t read_seqcount_begin(const seqcount_t *s) {
+    uint32_t seq;
+
+    while ((seq = s->sequence) & 1) {
+        cpu_relax();
+    }
+    // x86 does not reorder loads with loads
+    __asm__ volatile("" ::: "memory");
+    return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_t *s, uint32_t start) {
+    __asm__ volatile("" ::: "memory");
+    return s->sequence != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s) {
+    s->sequence++;
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline void write_seqcount_end(seqcount_t *s) {
+    __asm__ volatile("" ::: "memory");
+    s->sequence++;
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t *sl) {
+    return read_seqcount_begin(&sl->seqcount);
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, uint32_t start) {
+    return read_seqcount_retry(&sl->seqcount, start);
+}
+
+static inline void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    write_seqcount_begin(&sl->seqcount);
+}
+
+static inline void write_sequnlock(seqlock_t *sl) {
+    write_seqcount_end(&sl->seqcount);
+    spin_unlock(&sl->lock);
+}
+
+#define write_seqlock_irqsave(sl, flags)        \
+    do {                                        \
+        local_irq_save(flags);                  \
+        write_seqlock(sl);                      \
+    } while (0)
+
+#define write_sequnlock_irqrestore(sl, flags)   \
+    do {                                        \
+        write_sequnlock(sl);                    \
+        local_irq_restore(flags);               \
+    } while (0)
+
+#ifdef CONFIG_LOCK_STAT
+void lock_stat_show(void);
+void lock_stat_reset(void);
+#else
+static inline void lock_stat_show(void) { }
+static inline void lock_stat_reset(void) { }
+#endif
+
+#endif
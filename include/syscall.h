@@ -0,0 +1,89 @@
+#ifndef SOLIX_SYSCALL_H
+#define SOLIX_SYSCALL_H
+
+#include "types.h"
+#include "kernel.h"
+
+/**
+ * System Call Entry for SolixOS
+ * The number goes in EAX and arguments in EBX, ECX, EDX, ESI and EDI;
+ * the result comes back in EAX. Both entry paths save the same register
+ * frame and index sys_call_table[] with the number
+ *
+ *   int $0x80      works everywhere, costs an IDT gate and an iret
+ *   sysenter       no gate, no hardware frame, on CPUs with SEP
+ *
+ * SYSEXIT takes its return EIP and ESP from EDX and ECX, so a SYSENTER
+ * caller pushes its return address, points EBP at it and expects EBP,
+ * ECX and EDX to be clobbered. An EBP outside user space fails the call
+ * with -EFAULT and ends the process:
+ *
+ *       push  $1f
+ *       mov   %esp, %ebp
+ *       sysenter
+ *   1:
+ *
+ * Based on Linux i386 system call design principles
+ */
+
+#define NR_syscalls     (SYS_SCHED_GETAFFINITY + 1)
+
+// SYSENTER target, loaded per CPU
+#define MSR_IA32_SYSENTER_CS    0x174
+#define MSR_IA32_SYSENTER_ESP   0x175
+#define MSR_IA32_SYSENTER_EIP   0x176
+
+/**
+ * Registers saved on system call entry, lowest address first
+ * The last five are the interrupt frame; SYSENTER builds one by hand
+ */
+struct pt_regs {
+    uint32_t bx;
+    uint32_t cx;
+    uint32_t dx;
+    uint32_t si;
+    uint32_t di;
+    uint32_t bp;
+    uint32_t ax;                // Return value on the way out
+    uint32_t ds;
+    uint32_t es;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t orig_ax;           // System call number
+    uint32_t ip;
+    uint32_t cs;
+    uint32_t flags;
+    uint32_t sp;                // From user mode only
+    uint32_t ss;
+};
+
+typedef int (*sys_call_ptr_t)(struct pt_regs *regs);
+
+// Handlers by number; empty slots return -ENOSYS
+extern const sys_call_ptr_t sys_call_table[NR_syscalls];
+
+/**
+ * Entry stubs (kernel/isr.asm)
+ */
+extern void system_call(void);
+extern void sysenter_entry(void);
+extern void ret_from_fork(void);
+
+/**
+ * Called by both stubs with the saved frame; sets regs->ax
+ */
+void do_syscall(struct pt_regs *regs);
+
+/**
+ * Called by sysenter_entry instead when EBP is not a user address;
+ * never returns
+ */
+void sysenter_bad_frame(struct pt_regs *regs);
+
+/**
+ * Point this CPU's SYSENTER MSRs at sysenter_entry and its TSS
+ * Returns false if the CPU has no SEP, leaving int $0x80 only
+ */
+bool syscall_init_cpu(unsigned int cpu);
+
+#endif
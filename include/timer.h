@@ -2,6 +2,8 @@
 #define SOLIX_TIMER_H
 
 #include "types.h"
+#include "list.h"
+#include "slab.h"
 
 // Timer frequency
 #define TIMER_FREQUENCY 100    // 100 Hz (10ms intervals)
@@ -12,4 +14,82 @@ void timer_handler(void);
 uint32_t timer_get_ticks(void);
 void timer_wait(uint32_t ticks);
 
+/**
+ * Kernel Timer Wheel
+ * Tick-resolution timeouts hashed into a cascading wheel so that arm and
+ * cancel are O(1) regardless of how many timers are pending
+ * Based on Linux kernel/timer.c design principles
+ */
+
+// Wheel geometry: one 256-slot root level and four 64-slot levels
+#define TVN_BITS    6
+#define TVR_BITS    8
+#define TVN_SIZE    (1 << TVN_BITS)
+#define TVR_SIZE    (1 << TVR_BITS)
+#define TVN_MASK    (TVN_SIZE - 1)
+#define TVR_MASK    (TVR_SIZE - 1)
+
+struct tvec_base;
+
+/**
+ * Tick-based timer
+ */
+struct timer_list {
+    struct list_head entry;         // Slot linkage, empty when not pending
+    uint32_t expires;               // Absolute expiry in ticks
+    void (*function)(unsigned long data);
+    unsigned long data;
+    struct tvec_base *base;
+};
+
+/**
+ * Per-CPU wheel
+ */
+struct tvec_base {
+    spinlock_t lock;
+    struct timer_list *running_timer;   // Callback currently executing
+    uint32_t timer_jiffies;             // Next tick to be processed
+    struct list_head tv1[TVR_SIZE];
+    struct list_head tv2[TVN_SIZE];
+    struct list_head tv3[TVN_SIZE];
+    struct list_head tv4[TVN_SIZE];
+    struct list_head tv5[TVN_SIZE];
+
+    // Statistics
+    unsigned int nr_active;
+    unsigned int nr_expired;
+    unsigned int nr_cascades;
+};
+
+/**
+ * Timer interface
+ */
+void init_timers(void);
+void init_timer(struct timer_list *timer);
+void setup_timer(struct timer_list *timer, void (*function)(unsigned long),
+                 unsigned long data);
+void add_timer(struct timer_list *timer);
+int mod_timer(struct timer_list *timer, uint32_t expires);
+int del_timer(struct timer_list *timer);
+int del_timer_sync(struct timer_list *timer);
+void run_local_timers(void);
+
+// Sleeping with a timeout
+#define MAX_SCHEDULE_TIMEOUT    0x7FFFFFFFL
+
+long schedule_timeout(long timeout);
+long schedule_timeout_uninterruptible(long timeout);
+
+static inline bool timer_pending(const struct timer_list *timer) {
+    return !list_empty(&timer->entry);
+}
+
+static inline uint32_t msecs_to_jiffies(uint32_t msecs) {
+    return (msecs * TIMER_FREQUENCY + 999) / 1000;
+}
+
+static inline uint32_t jiffies_to_msecs(uint32_t ticks) {
+    return ticks * (1000 / TIMER_FREQUENCY);
+}
+
 #endif
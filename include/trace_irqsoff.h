@@ -0,0 +1,95 @@
+#ifndef SOLIX_TRACE_IRQSOFF_H
+#define SOLIX_TRACE_IRQSOFF_H
+
+#include "types.h"
+
+/**
+ * Critical Section Latency Tracer for SolixOS
+ * Times, with the TSC, every stretch a CPU runs with interrupts disabled
+ * (irqsoff) or with preemption disabled, as every spinlock holder has
+ * it (preemptoff). The longest windows are kept per pair of code sites
+ * that opened and closed them, each with the stack at the point it
+ * closed. Tracing is off until started from the shell
+ * Based on Linux irqsoff/preemptoff tracer design principles
+ */
+
+#define CONFIG_IRQSOFF_TRACER
+
+#define X86_EFLAGS_IF           0x200
+
+// Tracers, also the window types
+#define TRACE_IRQSOFF           0x01
+#define TRACE_PREEMPTOFF        0x02
+
+#define LATENCY_MAX_ENTRIES     8       // Worst windows kept
+#define LATENCY_STACK_DEPTH     8
+
+/**
+ * One of the worst windows seen
+ */
+struct latency_entry {
+    unsigned int type;                  // TRACE_IRQSOFF or TRACE_PREEMPTOFF
+    uint32_t start_ip;                  // Where the window opened
+    uint32_t end_ip;                    // Where it closed
+    uint64_t cycles;                    // Length
+    uint64_t stamp;                     // TSC when it closed
+    unsigned int cpu;
+    unsigned int nr_frames;
+    uint32_t stack[LATENCY_STACK_DEPTH];    // Return addresses at close
+};
+
+#ifdef CONFIG_IRQSOFF_TRACER
+// TRACE_* bits of the tracers that are running
+extern volatile unsigned int latency_tracers;
+
+void tracer_hardirqs_off(void);
+void tracer_hardirqs_on(void);
+void tracer_irq_enter(void);
+void tracer_preempt_off(void);
+void tracer_preempt_on(void);
+
+/**
+ * Hooks for the places interrupts are turned off and on or preemption
+ * is disabled and enabled; one branch when the tracer is stopped
+ */
+static inline void trace_hardirqs_off(void) {
+    if (unlikely(latency_tracers & TRACE_IRQSOFF)) tracer_hardirqs_off();
+}
+
+static inline void trace_hardirqs_on(void) {
+    if (unlikely(latency_tracers & TRACE_IRQSOFF)) tracer_hardirqs_on();
+}
+
+/**
+ * An interrupt gate cleared IF: irq_handler() opens a window on entry
+ * and closes it with trace_hardirqs_on() before the iret
+ */
+static inline void trace_irq_enter(void) {
+    if (unlikely(latency_tracers & TRACE_IRQSOFF)) tracer_irq_enter();
+}
+
+static inline void trace_preempt_off(void) {
+    if (unlikely(latency_tracers & TRACE_PREEMPTOFF)) tracer_preempt_off();
+}
+
+static inline void trace_preempt_on(void) {
+    if (unlikely(latency_tracers & TRACE_PREEMPTOFF)) tracer_preempt_on();
+}
+
+/**
+ * Start the given tracers with an empty table, or stop them all
+ * Starting fails with -ENODEV if there is no calibrated TSC
+ */
+int latency_trace_start(unsigned int tracers);
+void latency_trace_stop(void);
+void latency_trace_reset(void);
+void latency_trace_show(void);
+#else
+static inline void trace_hardirqs_off(void) { }
+static inline void trace_hardirqs_on(void) { }
+static inline void trace_irq_enter(void) { }
+static inline void trace_preempt_off(void) { }
+static inline void trace_preempt_on(void) { }
+#endif
+
+#endif
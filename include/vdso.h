@@ -0,0 +1,61 @@
+#ifndef SOLIX_VDSO_H
+#define SOLIX_VDSO_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "clocksource.h"
+
+/**
+ * vDSO for SolixOS
+ * Two pages mapped read-only into user space at fixed addresses: a data
+ * page the timekeeper rewrites on every tick, and a code page whose
+ * functions read it. Monotonic time then costs a few loads and an rdtsc
+ * instead of a kernel entry. The code page functions are found through
+ * the entry[] table in the data page:
+ *
+ *   const struct vdso_data *vd = (void *)VDSO_DATA_ADDR;
+ *   uint64_t (*now)(void) = (void *)vd->entry[VDSO_ENTRY_MONOTONIC_NS];
+ *
+ * Based on Linux vDSO design principles
+ */
+
+#define VDSO_DATA_ADDR          0xFFFFD000
+#define VDSO_TEXT_ADDR          0xFFFFE000
+
+// Code page functions
+#define VDSO_ENTRY_MONOTONIC_NS 0       // uint64_t (void): ns since boot
+#define VDSO_ENTRY_TICKS        1       // uint32_t (void): timer ticks
+#define VDSO_NR_ENTRIES         2
+
+/**
+ * Data page layout, shared with user space
+ * Readers take a snapshot between two equal, even seq values. With
+ * VDSO_CLOCKMODE_TSC the time is
+ *   base_ns + (((rdtsc() - cycle_last) * mult + frac) >> shift)
+ * and with VDSO_CLOCKMODE_NONE just base_ns
+ */
+struct vdso_data {
+    seqcount_t seq;             // Odd while the kernel updates
+    uint32_t clock_mode;        // VDSO_CLOCKMODE_*
+    uint64_t cycle_last;        // Clocksource value at the last update
+    uint64_t base_ns;           // Monotonic ns at cycle_last
+    uint64_t frac;              // Sub-ns remainder, in 2^-shift ns
+    uint32_t mult;              // Cycle to ns scale
+    uint32_t shift;
+    uint32_t tick;              // Timer ticks at the last update
+    uint32_t hz;                // Ticks per second
+    uint32_t entry[VDSO_NR_ENTRIES];    // User addresses, VDSO_ENTRY_*
+};
+
+/**
+ * Copy the code page and map both pages into user space
+ */
+void vdso_init(void);
+
+/**
+ * Publish the timekeeper's state; called under its write seqlock
+ */
+void update_vsyscall(const struct clocksource *cs, uint64_t cycle_last,
+                     uint64_t base_ns, uint64_t frac);
+
+#endif
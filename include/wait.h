@@ -0,0 +1,132 @@
+#ifndef SOLIX_WAIT_H
+#define SOLIX_WAIT_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+#include "slab.h"
+#include "timer.h"
+
+/**
+ * Wait Queues for SolixOS
+ * Lets a process block until an event instead of spinning on hlt
+ * Based on Linux wait queue design principles
+ */
+
+// Entry flags
+#define WQ_FLAG_EXCLUSIVE   0x01    // Woken one at a time, after all non-exclusive waiters
+
+typedef struct wait_queue_entry wait_queue_entry_t;
+typedef int (*wait_queue_func_t)(wait_queue_entry_t *wq_entry, void *key);
+
+/**
+ * A process waiting on a queue
+ */
+struct wait_queue_entry {
+    unsigned int flags;
+    process_t *private;             // Process to wake
+    wait_queue_func_t func;         // Wake callback
+    struct list_head entry;
+};
+
+/**
+ * Wait queue head
+ */
+typedef struct wait_queue_head {
+    spinlock_t lock;
+    struct list_head head;
+} wait_queue_head_t;
+
+#define __WAIT_QUEUE_HEAD_INITIALIZER(name) {           \
+    .lock = __SPIN_LOCK_UNLOCKED(#name),                \
+    .head = { &(name).head, &(name).head } }
+
+#define DECLARE_WAIT_QUEUE_HEAD(name) \
+    wait_queue_head_t name = __WAIT_QUEUE_HEAD_INITIALIZER(name)
+
+#define DEFINE_WAIT(name)                               \
+    wait_queue_entry_t name = {                         \
+        .flags = 0,                                     \
+        .private = current_process,                     \
+        .func = autoremove_wake_function,               \
+        .entry = { &(name).entry, &(name).entry } }
+
+/**
+ * Wait queue interface
+ */
+void init_waitqueue_head(wait_queue_head_t *wq_head);
+void init_waitqueue_entry(wait_queue_entry_t *wq_entry, process_t *p);
+void add_wait_queue(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void add_wait_queue_exclusive(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void remove_wait_queue(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void prepare_to_wait(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void prepare_to_wait_exclusive(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void finish_wait(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry);
+void remove_wait_queue_task(process_t *p);
+int default_wake_function(wait_queue_entry_t *wq_entry, void *key);
+int autoremove_wake_function(wait_queue_entry_t *wq_entry, void *key);
+void __wake_up(wait_queue_head_t *wq_head, int nr_exclusive, void *key);
+
+#define wake_up(x)          __wake_up(x, 1, NULL)
+#define wake_up_nr(x, nr)   __wake_up(x, nr, NULL)
+#define wake_up_all(x)      __wake_up(x, 0, NULL)
+
+static inline bool waitqueue_active(wait_queue_head_t *wq_head) {
+    return !list_empty(&wq_head->head);
+}
+
+/**
+ * Sleep until condition is true
+ * The condition is re-checked after queueing, so a wake-up racing with
+ * the first check is never lost
+ */
+#define ___wait_event(wq_head, condition, prepare)      \
+do {                                                    \
+    DEFINE_WAIT(__wait);                                \
+    for (;;) {                                          \
+        prepare(&(wq_head), &__wait);                   \
+        if (condition)                                  \
+            break;                                      \
+        process_sleep();                                \
+    }                                                   \
+    finish_wait(&(wq_head), &__wait);                   \
+} while (0)
+
+#define wait_event(wq_head, condition)                  \
+do {                                                    \
+    if (!(condition))                                   \
+        ___wait_event(wq_head, condition, prepare_to_wait); \
+} while (0)
+
+#define wait_event_exclusive(wq_head, condition)        \
+do {                                                    \
+    if (!(condition))                                   \
+        ___wait_event(wq_head, condition, prepare_to_wait_exclusive); \
+} while (0)
+
+/**
+ * Sleep until condition is true or timeout ticks elapse
+ * Evaluates to 0 on timeout, otherwise the ticks left (at least 1)
+ */
+#define wait_event_timeout(wq_head, condition, timeout) \
+({                                                      \
+    long __ret = (timeout);                             \
+    if (!(condition)) {                                 \
+        DEFINE_WAIT(__wait);                            \
+        for (;;) {                                      \
+            prepare_to_wait(&(wq_head), &__wait);       \
+            if (condition)                              \
+                break;                                  \
+            __ret = schedule_timeout(__ret);            \
+            if (!__ret) {                               \
+                if (condition)                          \
+                    __ret = 1;                          \
+                break;                                  \
+            }                                           \
+        }                                               \
+        finish_wait(&(wq_head), &__wait);               \
+    }                                                   \
+    __ret;                                              \
+})
+
+#endif
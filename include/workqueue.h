@@ -0,0 +1,173 @@
+#ifndef SOLIX_WORKQUEUE_H
+#define SOLIX_WORKQUEUE_H
+
+#include "types.h"
+#include "list.h"
+#include "kernel.h"
+#include "timer.h"
+
+/**
+ * Workqueues for SolixOS
+ * Deferred work that must run in process context, i.e. may sleep, goes
+ * on a workqueue instead of each subsystem keeping its own thread. Work
+ * runs on kworker threads shared by all queues: one pool per CPU plus an
+ * unbound pool. A per-CPU pool keeps one worker running at a time and
+ * starts another only when that one blocks, growing on demand and
+ * reaping workers that stay idle
+ * Based on Linux concurrency-managed workqueue design principles
+ */
+
+struct work_struct;
+struct pool_workqueue;
+struct workqueue_struct;
+
+typedef void (*work_func_t)(struct work_struct *work);
+
+// Work item flags
+#define WORK_STRUCT_PENDING 0x01    // Queued or waiting on its timer
+#define WORK_STRUCT_DELAYED 0x02    // Held back by the queue's max_active
+
+// Queue on whatever CPU the caller runs on
+#define WORK_CPU_UNBOUND    NR_CPUS
+
+struct work_struct {
+    struct list_head entry;         // Pool worklist or pwq delayed list
+    work_func_t func;
+    volatile unsigned long flags;   // WORK_STRUCT_*
+    struct pool_workqueue *pwq;     // Queue it was last put on
+};
+
+struct delayed_work {
+    struct work_struct work;
+    struct timer_list timer;
+    struct workqueue_struct *wq;    // Target once the timer fires
+    int cpu;
+};
+
+static inline struct delayed_work *to_delayed_work(struct work_struct *work) {
+    return container_of(work, struct delayed_work, work);
+}
+
+#define __WORK_INITIALIZER(n, f) { LIST_HEAD_INIT((n).entry), (f), 0, NULL }
+
+#define DECLARE_WORK(n, f) \
+    struct work_struct n = __WORK_INITIALIZER(n, f)
+
+#define INIT_WORK(_work, _func)                 \
+do {                                            \
+    INIT_LIST_HEAD(&(_work)->entry);            \
+    (_work)->func = (_func);                    \
+    (_work)->flags = 0;                         \
+    (_work)->pwq = NULL;                        \
+} while (0)
+
+void delayed_work_timer_fn(unsigned long data);
+
+#define INIT_DELAYED_WORK(_dwork, _func)                                \
+do {                                                                    \
+    INIT_WORK(&(_dwork)->work, (_func));                                \
+    setup_timer(&(_dwork)->timer, delayed_work_timer_fn,                \
+                (unsigned long)(_dwork));                               \
+} while (0)
+
+static inline bool work_pending(struct work_struct *work) {
+    return work->flags & WORK_STRUCT_PENDING;
+}
+
+#define delayed_work_pending(dwork) work_pending(&(dwork)->work)
+
+// Workqueue flags
+#define WQ_UNBOUND      0x0002      // Run on the unbound pool, any CPU
+#define __WQ_ORDERED    0x20000     // One item at a time, in queue order
+
+#define WQ_MAX_ACTIVE   256         // Items in flight per CPU
+#define WQ_DFL_ACTIVE   (WQ_MAX_ACTIVE / 2)
+
+/**
+ * Create a workqueue
+ * max_active caps how many of its items run at once per CPU (in total
+ * for WQ_UNBOUND); 0 means WQ_DFL_ACTIVE. Returns NULL on failure
+ */
+struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags,
+                                         int max_active);
+
+/**
+ * Unbound queue that runs its items one at a time in queue order
+ */
+#define alloc_ordered_workqueue(name, flags) \
+    alloc_workqueue((name), WQ_UNBOUND | __WQ_ORDERED | (flags), 1)
+
+/**
+ * Drain and free a workqueue; nothing may queue on it any more
+ */
+void destroy_workqueue(struct workqueue_struct *wq);
+
+/**
+ * Queue work; returns false if it was already pending
+ * Safe from any context. A bound queue runs it on the given CPU, or the
+ * caller's for queue_work()
+ */
+bool queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work);
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                           struct delayed_work *dwork, uint32_t delay);
+
+/**
+ * Requeue delayed work delay ticks from now, pending or not
+ * Returns true if it was pending
+ */
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                         struct delayed_work *dwork, uint32_t delay);
+
+static inline bool queue_work(struct workqueue_struct *wq, struct work_struct *work) {
+    return queue_work_on(WORK_CPU_UNBOUND, wq, work);
+}
+
+static inline bool queue_delayed_work(struct workqueue_struct *wq,
+                                      struct delayed_work *dwork, uint32_t delay) {
+    return queue_delayed_work_on(WORK_CPU_UNBOUND, wq, dwork, delay);
+}
+
+static inline bool mod_delayed_work(struct workqueue_struct *wq,
+                                    struct delayed_work *dwork, uint32_t delay) {
+    return mod_delayed_work_on(WORK_CPU_UNBOUND, wq, dwork, delay);
+}
+
+/**
+ * Wait for work, or everything queued on wq, to finish
+ * Process context only
+ */
+bool flush_work(struct work_struct *work);
+bool flush_delayed_work(struct delayed_work *dwork);
+void flush_workqueue(struct workqueue_struct *wq);
+
+/**
+ * Take work off its queue; the _sync variants also wait for a running
+ * instance and are process context only. Return true if it was pending
+ */
+bool cancel_work_sync(struct work_struct *work);
+bool cancel_delayed_work(struct delayed_work *dwork);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+// Shared queues for work that does not need its own
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
+static inline bool schedule_work(struct work_struct *work) {
+    return queue_work(system_wq, work);
+}
+
+static inline bool schedule_delayed_work(struct delayed_work *dwork, uint32_t delay) {
+    return queue_delayed_work(system_wq, dwork, delay);
+}
+
+/**
+ * Scheduler hooks for kworkers blocking in and returning from
+ * process_sleep(), so a pool can start another worker meanwhile
+ */
+void wq_worker_sleeping(process_t *task);
+void wq_worker_waking_up(process_t *task);
+
+void workqueue_init(void);
+void workqueue_show(void);
+
+#endif
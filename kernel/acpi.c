@@ -0,0 +1,227 @@
+#include "apic.h"
+#include "kernel.h"
+#include "mm.h"
+#include "printk.h"
+
+/**
+ * ACPI MADT Parsing
+ * Locates the RSDP in the BIOS areas, walks the RSDT to the Multiple
+ * APIC Description Table and registers its local APICs, I/O APICs and
+ * interrupt source overrides
+ */
+
+// MADT entry types
+#define ACPI_MADT_LOCAL_APIC            0
+#define ACPI_MADT_IO_APIC               1
+#define ACPI_MADT_INTERRUPT_OVERRIDE    2
+#define ACPI_MADT_LOCAL_APIC_OVERRIDE   5
+
+#define ACPI_MADT_ENABLED               (1 << 0)
+#define ACPI_MADT_ONLINE_CAPABLE        (1 << 1)
+
+struct acpi_rsdp {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct acpi_table_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t asl_compiler_id;
+    uint32_t asl_compiler_revision;
+} __attribute__((packed));
+
+struct acpi_table_madt {
+    struct acpi_table_header header;
+    uint32_t address;           // Local APIC address
+    uint32_t flags;
+} __attribute__((packed));
+
+struct acpi_subtable_header {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct acpi_madt_local_apic {
+    struct acpi_subtable_header header;
+    uint8_t processor_id;
+    uint8_t id;
+    uint32_t lapic_flags;
+} __attribute__((packed));
+
+struct acpi_madt_io_apic {
+    struct acpi_subtable_header header;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t global_irq_base;
+} __attribute__((packed));
+
+struct acpi_madt_interrupt_override {
+    struct acpi_subtable_header header;
+    uint8_t bus;
+    uint8_t source_irq;
+    uint32_t global_irq;
+    uint16_t inti_flags;
+} __attribute__((packed));
+
+struct acpi_madt_local_apic_override {
+    struct acpi_subtable_header header;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+static bool acpi_checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+
+    while (len--) {
+        sum += *b++;
+    }
+    return sum == 0;
+}
+
+static bool sig_match(const char *a, const char *b, int len) {
+    for (int i = 0; i < len; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+static struct acpi_rsdp *acpi_scan_rsdp(uint32_t start, uint32_t length) {
+    for (uint32_t addr = start; addr < start + length; addr += 16) {
+        struct acpi_rsdp *rsdp = (struct acpi_rsdp *)addr;
+
+        if (sig_match(rsdp->signature, "RSD PTR ", 8) &&
+            acpi_checksum_ok(rsdp, sizeof(struct acpi_rsdp))) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Search the first KB of the EBDA, then the BIOS ROM area
+ */
+static struct acpi_rsdp *acpi_find_rsdp(void) {
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t *)0x40E) << 4;
+    struct acpi_rsdp *rsdp = NULL;
+
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x20000);
+    }
+    return rsdp;
+}
+
+/**
+ * Map a table wherever firmware placed it and validate it
+ */
+static struct acpi_table_header *acpi_map_table(uint32_t phys) {
+    struct acpi_table_header *hdr = ioremap(phys, sizeof(struct acpi_table_header));
+
+    ioremap(phys, hdr->length);
+    if (!acpi_checksum_ok(hdr, hdr->length)) {
+        return NULL;
+    }
+    return hdr;
+}
+
+static struct acpi_table_header *acpi_find_table(const char *sig) {
+    struct acpi_rsdp *rsdp = acpi_find_rsdp();
+    struct acpi_table_header *rsdt;
+    uint32_t *entries;
+    uint32_t count;
+
+    if (!rsdp) return NULL;
+
+    rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (!rsdt || !sig_match(rsdt->signature, "RSDT", 4)) return NULL;
+
+    entries = (uint32_t *)(rsdt + 1);
+    count = (rsdt->length - sizeof(struct acpi_table_header)) / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct acpi_table_header *hdr = acpi_map_table(entries[i]);
+
+        if (hdr && sig_match(hdr->signature, sig, 4)) {
+            return hdr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Register CPUs and interrupt routing from the MADT
+ * Returns the number of enabled CPUs found, or -ENODEV without a MADT
+ */
+int acpi_parse_madt(void) {
+    struct acpi_table_madt *madt = (struct acpi_table_madt *)acpi_find_table("APIC");
+    uint8_t *p, *end;
+    int cpus = 0;
+
+    if (!madt) {
+        return -ENODEV;
+    }
+
+    mp_lapic_addr = madt->address;
+
+    p = (uint8_t *)(madt + 1);
+    end = (uint8_t *)madt + madt->header.length;
+
+    while (p + sizeof(struct acpi_subtable_header) <= end) {
+        struct acpi_subtable_header *sub = (struct acpi_subtable_header *)p;
+
+        if (sub->length < sizeof(struct acpi_subtable_header)) {
+            break;
+        }
+
+        switch (sub->type) {
+            case ACPI_MADT_LOCAL_APIC: {
+                struct acpi_madt_local_apic *lapic = (void *)sub;
+
+                if ((lapic->lapic_flags & ACPI_MADT_ENABLED) &&
+                    apic_register_cpu(lapic->id) >= 0) {
+                    cpus++;
+                }
+                break;
+            }
+            case ACPI_MADT_IO_APIC: {
+                struct acpi_madt_io_apic *ioapic = (void *)sub;
+
+                apic_register_ioapic(ioapic->id, ioapic->address, ioapic->global_irq_base);
+                break;
+            }
+            case ACPI_MADT_INTERRUPT_OVERRIDE: {
+                struct acpi_madt_interrupt_override *ovr = (void *)sub;
+
+                apic_register_override(ovr->source_irq, ovr->global_irq, ovr->inti_flags);
+                break;
+            }
+            case ACPI_MADT_LOCAL_APIC_OVERRIDE: {
+                struct acpi_madt_local_apic_override *ovr = (void *)sub;
+
+                mp_lapic_addr = (uint32_t)ovr->address;
+                break;
+            }
+            default:
+                break;
+        }
+
+        p += sub->length;
+    }
+
+    pr_info("acpi: MADT lists %d CPUs, %d I/O APICs, %d overrides\n",
+            cpus, nr_ioapics, nr_irq_overrides);
+    return cpus;
+}
@@ -0,0 +1,368 @@
+#include "apic.h"
+#include "kernel.h"
+#include "clocksource.h"
+#include "interrupts.h"
+#include "irq.h"
+#include "mm.h"
+#include "printk.h"
+#include "smp.h"
+#include "timer.h"
+
+/**
+ * Local APIC Support
+ * Maps the local APIC, records the CPUs and I/O APICs found in firmware
+ * tables and sends the INIT/STARTUP IPIs used to wake secondary CPUs.
+ * Interrupts raised by the local APIC itself are IRQs on lapic_chip;
+ * its timer is the tick of each secondary CPU.
+ */
+
+// CPUID leaf 1 EDX feature bit
+#define X86_FEATURE_APIC    (1 << 9)
+
+// Polls of the ICR delivery status before giving up
+#define APIC_ICR_TIMEOUT    100000
+
+// PIT ticks the local APIC timer is calibrated over
+#define LAPIC_CAL_TICKS     10
+
+volatile uint32_t *lapic_base;
+uint32_t mp_lapic_addr = APIC_DEFAULT_PHYS_BASE;
+
+struct mp_ioapic mp_ioapics[MAX_IO_APICS];
+int nr_ioapics;
+struct mp_irq_override mp_irq_overrides[MAX_IRQ_OVERRIDES];
+int nr_irq_overrides;
+
+uint8_t x86_cpu_to_apicid[NR_CPUS];
+uint8_t apicid_to_cpu[MAX_LOCAL_APIC];
+unsigned int nr_cpu_ids = 1;
+
+static uint8_t boot_cpu_apicid;
+
+// Local APIC timer counts per tick at divide-by-16, 0 if uncalibrated
+static uint32_t lapic_timer_period;
+
+static DEFINE_PER_CPU(struct clock_event_device, lapic_events);
+
+static bool cpu_has_apic(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+    return (edx & X86_FEATURE_APIC) != 0;
+}
+
+uint8_t read_apic_id(void) {
+    return apic_read(APIC_ID) >> 24;
+}
+
+/**
+ * Local APIC interrupt chip
+ * Each CPU has its own LVT, so mask and unmask only reach the calling
+ * CPU; apic_setup_local() copies the IRQ's state to a CPU coming up
+ */
+static void lapic_mask(unsigned int irq) {
+    uint32_t lvt = (uint32_t)IRQ_TO_DESC(irq)->chip_data;
+
+    apic_write(lvt, apic_read(lvt) | APIC_LVT_MASKED);
+}
+
+static void lapic_unmask(unsigned int irq) {
+    uint32_t lvt = (uint32_t)IRQ_TO_DESC(irq)->chip_data;
+
+    apic_write(lvt, apic_read(lvt) & ~APIC_LVT_MASKED);
+}
+
+static void lapic_eoi(unsigned int irq) {
+    apic_eoi();
+}
+
+struct irq_chip lapic_chip = {
+    .name = "LAPIC",
+    .startup = lapic_unmask,
+    .shutdown = lapic_mask,
+    .enable = lapic_unmask,
+    .disable = lapic_mask,
+    .mask = lapic_mask,
+    .unmask = lapic_unmask,
+    .eoi = lapic_eoi,
+};
+
+/**
+ * IPIs have no LVT entry to mask; they only need the EOI
+ */
+static struct irq_chip ipi_chip = {
+    .name = "IPI",
+    .eoi = lapic_eoi,
+};
+
+static irqreturn_t apic_error_interrupt(unsigned int irq, void *dev_id) {
+    uint32_t esr;
+
+    // ESR latches on write
+    apic_write(APIC_ESR, 0);
+    esr = apic_read(APIC_ESR);
+
+    pr_err("apic: CPU%d error interrupt, ESR 0x%x\n", smp_processor_id(), esr);
+    return IRQ_HANDLED;
+}
+
+// irq_handler() runs the scheduler on the way out
+static irqreturn_t reschedule_interrupt(unsigned int irq, void *dev_id) {
+    return IRQ_HANDLED;
+}
+
+/**
+ * Enable and map the boot CPU's local APIC
+ * The boot CPU is always logical CPU 0
+ */
+int apic_init(void) {
+    uint64_t msr;
+
+    if (!cpu_has_apic()) {
+        return -ENODEV;
+    }
+
+    msr = rdmsr(MSR_IA32_APICBASE);
+    if (!(msr & MSR_IA32_APICBASE_ENABLE)) {
+        msr |= MSR_IA32_APICBASE_ENABLE;
+        wrmsr(MSR_IA32_APICBASE, msr);
+    }
+
+    mp_lapic_addr = (uint32_t)msr & MSR_IA32_APICBASE_BASE;
+    lapic_base = ioremap(mp_lapic_addr, PAGE_SIZE);
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        x86_cpu_to_apicid[cpu] = BAD_APICID;
+    }
+
+    boot_cpu_apicid = read_apic_id();
+    x86_cpu_to_apicid[0] = boot_cpu_apicid;
+    apicid_to_cpu[boot_cpu_apicid] = 0;
+
+    pr_info("apic: local APIC at 0x%x, boot CPU APIC ID %d\n",
+            mp_lapic_addr, boot_cpu_apicid);
+
+    // Error reporting; the LVT entry needs its vector before the unmask
+    apic_write(APIC_LVTERR, ERROR_APIC_VECTOR | APIC_LVT_MASKED);
+    irq_set_chip(APIC_ERROR_IRQ, &lapic_chip);
+    irq_set_chip_data(APIC_ERROR_IRQ, (void *)APIC_LVTERR);
+    vector_irq[ERROR_APIC_VECTOR] = APIC_ERROR_IRQ;
+    request_irq(APIC_ERROR_IRQ, apic_error_interrupt, IRQF_PERCPU, "apic-error", NULL);
+
+    irq_set_chip(RESCHEDULE_IRQ, &ipi_chip);
+    vector_irq[RESCHEDULE_VECTOR] = RESCHEDULE_IRQ;
+    request_irq(RESCHEDULE_IRQ, reschedule_interrupt, IRQF_PERCPU, "resched", NULL);
+
+    return 0;
+}
+
+/**
+ * Software-enable the running CPU's local APIC
+ * The boot CPU keeps LINT0/LINT1 as left by firmware (the 8259 PIC is
+ * wired through LINT0) until the I/O APIC takes over; secondaries mask
+ * them. Each CPU gets one bit of the flat logical destination, which is
+ * how I/O APIC entries name their target CPUs
+ */
+void apic_setup_local(void) {
+    unsigned int cpu = smp_processor_id();
+    uint32_t lvterr = ERROR_APIC_VECTOR;
+
+    apic_write(APIC_TASKPRI, 0);
+    apic_write(APIC_DFR, APIC_DFR_FLAT);
+    apic_write(APIC_LDR, SET_APIC_LOGICAL_ID(1U << cpu));
+
+    if (cpu != 0) {
+        apic_write(APIC_LVT0, APIC_LVT_MASKED);
+        apic_write(APIC_LVT1, APIC_LVT_MASKED);
+    }
+    apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR | APIC_LVT_MASKED);
+
+    if (IRQ_TO_DESC(APIC_ERROR_IRQ)->status & IRQ_DISABLED) {
+        lvterr |= APIC_LVT_MASKED;
+    }
+    apic_write(APIC_LVTERR, lvterr);
+
+    // Clear latched errors (ESR must be written before it is read)
+    apic_write(APIC_ESR, 0);
+    apic_write(APIC_ESR, 0);
+
+    apic_write(APIC_SPIV, APIC_SPIV_APIC_ENABLED | SPURIOUS_APIC_VECTOR);
+}
+
+/**
+ * Record a CPU from firmware tables, assigning the next logical number
+ * Returns the logical CPU or a negative error if it does not fit
+ */
+int apic_register_cpu(uint8_t apic_id) {
+    unsigned int cpu;
+
+    if (apic_id == boot_cpu_apicid) {
+        return 0;
+    }
+
+    for (cpu = 1; cpu < nr_cpu_ids; cpu++) {
+        if (x86_cpu_to_apicid[cpu] == apic_id) {
+            return cpu;
+        }
+    }
+
+    if (nr_cpu_ids >= NR_CPUS) {
+        pr_warn("apic: NR_CPUS=%d reached, ignoring APIC ID %d\n", NR_CPUS, apic_id);
+        return -ENOSPC;
+    }
+
+    cpu = nr_cpu_ids++;
+    x86_cpu_to_apicid[cpu] = apic_id;
+    apicid_to_cpu[apic_id] = cpu;
+
+    return cpu;
+}
+
+void apic_register_ioapic(uint8_t id, uint32_t addr, uint32_t gsi_base) {
+    if (nr_ioapics >= MAX_IO_APICS) {
+        pr_warn("apic: too many I/O APICs, ignoring ID %d\n", id);
+        return;
+    }
+
+    mp_ioapics[nr_ioapics].id = id;
+    mp_ioapics[nr_ioapics].addr = addr;
+    mp_ioapics[nr_ioapics].gsi_base = gsi_base;
+    nr_ioapics++;
+}
+
+void apic_register_override(uint8_t bus_irq, uint32_t gsi, uint16_t flags) {
+    if (nr_irq_overrides >= MAX_IRQ_OVERRIDES) {
+        return;
+    }
+
+    mp_irq_overrides[nr_irq_overrides].bus_irq = bus_irq;
+    mp_irq_overrides[nr_irq_overrides].gsi = gsi;
+    mp_irq_overrides[nr_irq_overrides].flags = flags;
+    nr_irq_overrides++;
+}
+
+static int apic_wait_icr_idle(void) {
+    for (int i = 0; i < APIC_ICR_TIMEOUT; i++) {
+        if (!(apic_read(APIC_ICR) & APIC_ICR_BUSY)) {
+            return 0;
+        }
+        __asm__ volatile("pause");
+    }
+
+    return -ETIMEDOUT;
+}
+
+/**
+ * Assert then de-assert INIT on a target CPU
+ */
+int apic_send_init(uint8_t apicid) {
+    apic_write(APIC_ESR, 0);
+
+    apic_write(APIC_ICR2, SET_APIC_DEST_FIELD(apicid));
+    apic_write(APIC_ICR, APIC_INT_LEVELTRIG | APIC_INT_ASSERT | APIC_DM_INIT);
+    if (apic_wait_icr_idle() < 0) {
+        return -ETIMEDOUT;
+    }
+
+    apic_write(APIC_ICR2, SET_APIC_DEST_FIELD(apicid));
+    apic_write(APIC_ICR, APIC_INT_LEVELTRIG | APIC_DM_INIT);
+    return apic_wait_icr_idle();
+}
+
+/**
+ * Start a CPU in real mode at vector << 12
+ */
+int apic_send_startup(uint8_t apicid, uint8_t vector) {
+    apic_write(APIC_ESR, 0);
+
+    apic_write(APIC_ICR2, SET_APIC_DEST_FIELD(apicid));
+    apic_write(APIC_ICR, APIC_DM_STARTUP | vector);
+    return apic_wait_icr_idle();
+}
+
+/**
+ * Send a fixed-vector IPI to another online CPU
+ * An interrupt handler sending its own must not split ICR2 from ICR
+ */
+void apic_send_ipi(unsigned int cpu, uint8_t vector) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    apic_wait_icr_idle();
+    apic_write(APIC_ICR2, SET_APIC_DEST_FIELD(x86_cpu_to_apicid[cpu]));
+    apic_write(APIC_ICR, APIC_DM_FIXED | vector);
+    local_irq_restore(flags);
+}
+
+static int lapic_timer_set_periodic(struct clock_event_device *dev) {
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR | APIC_LVT_TIMER_PERIODIC);
+    apic_write(APIC_TMICT, lapic_timer_period);
+    return 0;
+}
+
+static int lapic_timer_shutdown(struct clock_event_device *dev) {
+    apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR | APIC_LVT_MASKED);
+    apic_write(APIC_TMICT, 0);
+    return 0;
+}
+
+static irqreturn_t apic_timer_interrupt(unsigned int irq, void *dev_id) {
+    struct clock_event_device *evt = this_cpu_ptr(&lapic_events);
+
+    if (evt->event_handler) {
+        evt->event_handler(evt);
+    }
+    return IRQ_HANDLED;
+}
+
+/**
+ * Measure the local APIC timer against the PIT-driven clock
+ * Runs on the boot CPU with interrupts on; the timer ticks at the bus
+ * clock, which is the same on every CPU. Until the IRQ is started on a
+ * CPU its initial count is 0, so unmasking the LVT entry is harmless
+ */
+void apic_timer_init(void) {
+    uint32_t elapsed;
+
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR | APIC_LVT_MASKED);
+    apic_write(APIC_TMICT, 0xFFFFFFFF);
+    udelay(LAPIC_CAL_TICKS * (1000000 / TIMER_FREQUENCY));
+    elapsed = 0xFFFFFFFF - apic_read(APIC_TMCCT);
+    apic_write(APIC_TMICT, 0);
+
+    lapic_timer_period = elapsed / LAPIC_CAL_TICKS;
+    if (!lapic_timer_period) {
+        pr_warn("apic: timer did not count, secondary CPUs run without a tick\n");
+        return;
+    }
+
+    irq_set_chip(LOCAL_TIMER_IRQ, &lapic_chip);
+    irq_set_chip_data(LOCAL_TIMER_IRQ, (void *)APIC_LVTT);
+    vector_irq[LOCAL_TIMER_VECTOR] = LOCAL_TIMER_IRQ;
+    request_irq(LOCAL_TIMER_IRQ, apic_timer_interrupt, IRQF_PERCPU, "lapic-timer", NULL);
+
+    pr_info("apic: timer calibrated, %u counts per tick\n", lapic_timer_period);
+}
+
+/**
+ * Start the calling CPU's periodic local APIC timer
+ */
+void apic_timer_setup_cpu(void) {
+    struct clock_event_device *evt = this_cpu_ptr(&lapic_events);
+    unsigned int cpu = smp_processor_id();
+
+    if (!lapic_timer_period) {
+        return;
+    }
+
+    evt->name = "lapic";
+    evt->features = CLOCK_EVT_FEAT_PERIODIC;
+    evt->rating = 100;
+    evt->irq = LOCAL_TIMER_IRQ;
+    evt->cpumask = 1U << cpu;
+    evt->set_state_periodic = lapic_timer_set_periodic;
+    evt->set_state_shutdown = lapic_timer_shutdown;
+    clockevents_register_percpu_device(evt);
+}
@@ -0,0 +1,84 @@
+#include "cpumask.h"
+#include "kernel.h"
+
+/**
+ * CPU Mask Implementation
+ * Global possible/online masks and CPU list parsing
+ */
+
+struct cpumask __cpu_possible_mask = CPU_MASK_ALL;
+
+// Only the boot CPU is online until SMP bring-up
+struct cpumask __cpu_online_mask = { 1 };
+
+void set_cpu_online(unsigned int cpu, bool online) {
+    if (online) {
+        cpumask_set_cpu(cpu, &__cpu_online_mask);
+    } else {
+        cpumask_clear_cpu(cpu, &__cpu_online_mask);
+    }
+}
+
+void set_cpu_possible(unsigned int cpu, bool possible) {
+    if (possible) {
+        cpumask_set_cpu(cpu, &__cpu_possible_mask);
+    } else {
+        cpumask_clear_cpu(cpu, &__cpu_possible_mask);
+    }
+}
+
+static const char *parse_cpu(const char *p, unsigned int *cpu) {
+    unsigned int val = 0;
+
+    if (*p < '0' || *p > '9') {
+        return NULL;
+    }
+
+    while (*p >= '0' && *p <= '9') {
+        val = val * 10 + (*p++ - '0');
+    }
+
+    *cpu = val;
+    return p;
+}
+
+/**
+ * Parse a CPU list such as "1,3-5" into a mask
+ * Returns 0 on success, -EINVAL on malformed lists or CPUs >= NR_CPUS
+ */
+int cpulist_parse(const char *buf, struct cpumask *dstp) {
+    const char *p = buf;
+
+    cpumask_clear(dstp);
+
+    if (!p || !*p || *p == ' ') {
+        return -EINVAL;
+    }
+
+    while (*p && *p != ' ') {
+        unsigned int first, last;
+
+        p = parse_cpu(p, &first);
+        if (!p) return -EINVAL;
+
+        last = first;
+        if (*p == '-') {
+            p = parse_cpu(p + 1, &last);
+            if (!p) return -EINVAL;
+        }
+
+        if (first > last || last >= NR_CPUS) return -EINVAL;
+
+        for (unsigned int cpu = first; cpu <= last; cpu++) {
+            cpumask_set_cpu(cpu, dstp);
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p && *p != ' ') {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "kernel.h"
 #include "../include/screen.h"
 #include "../include/mm.h"
+#include "../include/ktime.h"
+#include "../include/kstack.h"
 
 /**
  * Debug and diagnostic functions implementation
@@ -152,6 +154,17 @@ void debug_dump_process(process_t* proc) {
     screen_print("\n");
 }
 
+/**
+ * A frame pointer worth following: in low memory, where the boot stack
+ * lives, or on a task's kernel stack above its guard page
+ */
+static bool stack_frame_valid(uint32_t fp) {
+    if (fp >= 0x100000 && fp <= 0x80000000) {
+        return true;
+    }
+    return fp >= KSTACK_START && fp < KSTACK_END - 8 && !kstack_guard_page(fp);
+}
+
 /**
  * Simple stack trace for debugging
  */
@@ -175,13 +188,39 @@ void debug_trace_stack(uint32_t max_frames) {
         ebp = (uint32_t*)ebp[0];
         
         // Basic sanity check
-        if ((uint32_t)ebp < 0x100000 || (uint32_t)ebp > 0x80000000) {
+        if (!stack_frame_valid((uint32_t)ebp)) {
             screen_print("  Invalid stack frame, stopping trace\n");
             break;
         }
     }
 }
 
+/**
+ * Unwind like debug_trace_stack() into entries instead of the screen,
+ * leaving out the innermost skip frames
+ * Returns the number of return addresses saved
+ */
+uint32_t debug_save_stack(uint32_t* entries, uint32_t max_frames, uint32_t skip) {
+    uint32_t* ebp;
+    uint32_t n = 0;
+    __asm__ volatile("mov %%ebp, %0" : "=r" (ebp));
+    
+    while (n < max_frames && ebp) {
+        if (skip) {
+            skip--;
+        } else {
+            entries[n++] = ebp[1];
+        }
+        
+        ebp = (uint32_t*)ebp[0];
+        if (!stack_frame_valid((uint32_t)ebp)) {
+            break;
+        }
+    }
+    
+    return n;
+}
+
 /**
  * Debug assertion with panic on failure
  */
@@ -210,10 +249,7 @@ void kernel_delay(uint32_t milliseconds) {
  * Get system timestamp in milliseconds
  */
 uint32_t kernel_get_timestamp(void) {
-    // Simple timestamp based on timer ticks
-    // In a real implementation, this would read from hardware timer
-    static uint32_t timestamp = 0;
-    return timestamp++;
+    return (uint32_t)ktime_to_ms(ktime_get());
 }
 
 /**
@@ -238,32 +274,22 @@ void print_hex(uint32_t value) {
  * Enhanced process creation with validation
  */
 uint32_t process_create_enhanced(const char* name) {
-    uint32_t index = find_free_pid();
-    if (index == 0) {
-        debug_print(DEBUG_WARN, "No free process slots available");
+    process_t* proc;
+    int pid = do_clone(0, 0, NULL);
+    if (pid < 0) {
+        debug_print(DEBUG_WARN, "No free PIDs or memory for a new process");
         return 0;
     }
-    
-    process_t* proc = &process_table[index];
-
-    // Initialize PCB with enhanced fields
-    proc->pcb.pid = next_pid++;
-    proc->pcb.ppid = current_process ? current_process->pcb.pid : 0;
-    proc->pcb.state = PROCESS_READY;
-    proc->pcb.kernel_stack = (uint32_t)kmalloc(KERNEL_STACK_SIZE);
-    proc->pcb.user_stack = 0x7FFFF000;
-    proc->pcb.exit_code = 0;
-    proc->pcb.creation_time = kernel_get_timestamp();
-    proc->pcb.cpu_time = 0;
 
-    // Initialize file descriptor table
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        proc->fd_table[i].inode = 0;
-        proc->fd_table[i].ref_count = 0;
+    rcu_read_lock();
+    proc = process_by_pid(pid);
+    if (!proc) {
+        // Already gone again
+        rcu_read_unlock();
+        return pid;
     }
 
-    // Set current working directory to root
-    proc->cwd_inode = 1;
+    proc->pcb.creation_time = kernel_get_timestamp();
     
     // Set process name
     if (name) {
@@ -281,25 +307,6 @@ uint32_t process_create_enhanced(const char* name) {
     proc->priority = 5; // Medium priority
 
     debug_print(DEBUG_INFO, "Created process PID %d: %s", proc->pcb.pid, proc->name);
-    return proc->pcb.pid;
-}
-
-/**
- * Find free PID with optimization
- */
-static uint32_t find_free_pid(void) {
-    static uint32_t last_search = 0;
-    
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        uint32_t index = (last_search + i) % MAX_PROCESSES;
-        uint32_t bitmap_index = index / 32;
-        uint32_t bit_index = index % 32;
-
-        if (!(process_bitmap[bitmap_index] & (1 << bit_index))) {
-            process_bitmap[bitmap_index] |= (1 << bit_index);
-            last_search = index;
-            return index;
-        }
-    }
-    return 0; // No free PIDs
+    rcu_read_unlock();
+    return pid;
 }
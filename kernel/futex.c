@@ -0,0 +1,173 @@
+#include "futex.h"
+#include "kernel.h"
+#include "timer.h"
+#include "printk.h"
+
+/**
+ * Futex Implementation
+ * Waiters are hashed by (address space, address) into per-bucket queues;
+ * the futex word is re-checked under the bucket lock so a FUTEX_WAKE
+ * racing with FUTEX_WAIT is never lost
+ */
+
+static struct futex_hash_bucket futex_queues[FUTEX_HASH_SIZE];
+
+static inline uint32_t futex_hash(union futex_key *key) {
+    uint32_t val = key->private.address ^ (key->private.mm >> 12);
+    return (val * 0x9E3779B9U) >> (32 - FUTEX_HASH_BITS);
+}
+
+static inline bool match_futex(union futex_key *a, union futex_key *b) {
+    return a->both == b->both;
+}
+
+static int get_futex_key(uint32_t *uaddr, union futex_key *key) {
+    uint32_t address = (uint32_t)uaddr;
+
+    // Futex words are naturally aligned 32-bit values
+    if (!address || (address & 3)) {
+        return -EINVAL;
+    }
+
+    // Never dereference a kernel address on a user's behalf
+    if (!access_ok(uaddr, sizeof(uint32_t))) {
+        return -EFAULT;
+    }
+
+    key->both = 0;
+    key->private.mm = (uint32_t)current_process->mm;
+    key->private.address = address;
+    return 0;
+}
+
+/**
+ * Initialize the futex hash table
+ */
+void futex_init(void) {
+    for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spin_lock_init(&futex_queues[i].lock);
+        INIT_LIST_HEAD(&futex_queues[i].chain);
+    }
+
+    pr_info("futex: hash table entries: %d\n", FUTEX_HASH_SIZE);
+}
+
+/**
+ * Sleep on uaddr if it still holds val
+ * Returns 0 when woken, -EAGAIN if the value changed, -ETIMEDOUT on timeout
+ */
+int futex_wait(uint32_t *uaddr, uint32_t val, long timeout) {
+    struct futex_hash_bucket *hb;
+    struct futex_q q;
+    unsigned long flags;
+    long remaining;
+    int ret;
+
+    ret = get_futex_key(uaddr, &q.key);
+    if (ret) {
+        return ret;
+    }
+
+    q.task = current_process;
+    hb = &futex_queues[futex_hash(&q.key)];
+
+    spin_lock_irqsave(&hb->lock, flags);
+
+    if (*(volatile uint32_t *)uaddr != val) {
+        spin_unlock_irqrestore(&hb->lock, flags);
+        return -EAGAIN;
+    }
+
+    list_add_tail(&q.list, &hb->chain);
+    q.task->futex_q = &q;
+    q.task->pcb.state = PROCESS_BLOCKED;
+
+    spin_unlock_irqrestore(&hb->lock, flags);
+
+    remaining = schedule_timeout(timeout);
+
+    // A waker unqueues us before waking; still queued means we were not woken
+    ret = 0;
+    spin_lock_irqsave(&hb->lock, flags);
+    q.task->futex_q = NULL;
+    if (!list_empty(&q.list)) {
+        list_del_init(&q.list);
+        if (!remaining) {
+            ret = -ETIMEDOUT;
+        }
+    }
+    spin_unlock_irqrestore(&hb->lock, flags);
+
+    return ret;
+}
+
+/**
+ * Wake up to nr_wake processes waiting on uaddr
+ * Returns the number woken
+ */
+int futex_wake(uint32_t *uaddr, int nr_wake) {
+    struct futex_hash_bucket *hb;
+    struct futex_q *this, *next;
+    union futex_key key;
+    unsigned long flags;
+    int ret;
+
+    ret = get_futex_key(uaddr, &key);
+    if (ret) {
+        return ret;
+    }
+
+    hb = &futex_queues[futex_hash(&key)];
+
+    spin_lock_irqsave(&hb->lock, flags);
+
+    list_for_each_entry_safe(this, next, &hb->chain, list) {
+        if (!match_futex(&this->key, &key)) {
+            continue;
+        }
+
+        list_del_init(&this->list);
+        wake_up_process(this->task);
+
+        if (++ret >= nr_wake) {
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&hb->lock, flags);
+
+    return ret;
+}
+
+/**
+ * Dequeue a killed process that sleeps in futex_wait()
+ * The queue entry lives on its stack, which is about to be freed
+ */
+void futex_remove_task(process_t *p) {
+    struct futex_hash_bucket *hb;
+    unsigned long flags;
+
+    if (!p->futex_q) {
+        return;
+    }
+
+    hb = &futex_queues[futex_hash(&p->futex_q->key)];
+    spin_lock_irqsave(&hb->lock, flags);
+    list_del_init(&p->futex_q->list);
+    p->futex_q = NULL;
+    spin_unlock_irqrestore(&hb->lock, flags);
+}
+
+/**
+ * futex system call
+ */
+int sys_futex(uint32_t *uaddr, int op, uint32_t val) {
+    switch (op) {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, val, MAX_SCHEDULE_TIMEOUT);
+        case FUTEX_WAKE:
+            return futex_wake(uaddr, (int)val);
+        default:
+            return -ENOSYS;
+    }
+}
@@ -0,0 +1,125 @@
+#include "gdt.h"
+#include "kernel.h"
+#include "percpu.h"
+#include "interrupts.h"
+
+/**
+ * Per-CPU Global Descriptor Tables
+ * Replaces the bootloader's GDT; every CPU gets identical flat code and
+ * data segments plus a TSS of its own, and a second TSS for the task
+ * that handles double faults
+ */
+
+// Access bytes
+#define DESC_KERNEL_CODE    0x9A    // Present, ring 0, code, readable
+#define DESC_KERNEL_DATA    0x92    // Present, ring 0, data, writable
+#define DESC_USER_CODE      0xFA
+#define DESC_USER_DATA      0xF2
+#define DESC_TSS            0x89    // Present, 32-bit available TSS
+
+// 4KB granularity, 32-bit
+#define DESC_FLAGS_FLAT     0xC0
+
+#define DOUBLEFAULT_STACK_SIZE  PAGE_SIZE
+
+static struct desc_struct cpu_gdt[NR_CPUS][GDT_ENTRIES] __attribute__((aligned(8)));
+static struct tss_struct cpu_tss[NR_CPUS];
+static struct tss_struct cpu_doublefault_tss[NR_CPUS];
+static uint8_t doublefault_stack[NR_CPUS][DOUBLEFAULT_STACK_SIZE] __attribute__((aligned(16)));
+
+static void set_desc(struct desc_struct *d, uint32_t base, uint32_t limit,
+                     uint8_t access, uint8_t flags) {
+    d->limit0 = limit & 0xFFFF;
+    d->base0 = base & 0xFFFF;
+    d->base1 = (base >> 16) & 0xFF;
+    d->access = access;
+    d->limit1_flags = ((limit >> 16) & 0x0F) | flags;
+    d->base2 = (base >> 24) & 0xFF;
+}
+
+/**
+ * Build and load the GDT and TSS of a CPU; must run on that CPU
+ */
+void gdt_init_cpu(unsigned int cpu, uint32_t esp0) {
+    struct desc_struct *gdt = cpu_gdt[cpu];
+    struct tss_struct *tss = &cpu_tss[cpu];
+    struct desc_ptr gdt_descr;
+
+    memset(tss, 0, sizeof(*tss));
+    tss->ss0 = __KERNEL_DS;
+    tss->esp0 = esp0;
+    // No I/O permission bitmap: point past the end of the segment
+    tss->io_bitmap_base = sizeof(*tss);
+
+    memset(&gdt[0], 0, sizeof(gdt[0]));
+    set_desc(&gdt[GDT_ENTRY_KERNEL_CS], 0, 0xFFFFF, DESC_KERNEL_CODE, DESC_FLAGS_FLAT);
+    set_desc(&gdt[GDT_ENTRY_KERNEL_DS], 0, 0xFFFFF, DESC_KERNEL_DATA, DESC_FLAGS_FLAT);
+    set_desc(&gdt[GDT_ENTRY_USER_CS], 0, 0xFFFFF, DESC_USER_CODE, DESC_FLAGS_FLAT);
+    set_desc(&gdt[GDT_ENTRY_USER_DS], 0, 0xFFFFF, DESC_USER_DATA, DESC_FLAGS_FLAT);
+    set_desc(&gdt[GDT_ENTRY_TSS], (uint32_t)tss, sizeof(*tss) - 1, DESC_TSS, 0);
+    // Flat data segment offset to this CPU's copy of .data..percpu
+    set_desc(&gdt[GDT_ENTRY_PERCPU], per_cpu_offset(cpu), 0xFFFFF,
+             DESC_KERNEL_DATA, DESC_FLAGS_FLAT);
+    set_desc(&gdt[GDT_ENTRY_DOUBLEFAULT_TSS], (uint32_t)&cpu_doublefault_tss[cpu],
+             sizeof(struct tss_struct) - 1, DESC_TSS, 0);
+
+    gdt_descr.size = sizeof(cpu_gdt[cpu]) - 1;
+    gdt_descr.address = (uint32_t)gdt;
+
+    __asm__ volatile(
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "movw %2, %%ax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%gs\n\t"
+        "movw %%ax, %%ss\n\t"
+        "movw %3, %%ax\n\t"
+        "movw %%ax, %%fs\n\t"
+        : : "m" (gdt_descr), "i" (__KERNEL_CS), "i" (__KERNEL_DS),
+            "i" (__KERNEL_PERCPU)
+        : "eax", "memory");
+
+    __asm__ volatile("ltr %w0" : : "r" (GDT_ENTRY_TSS_SEL));
+}
+
+void tss_set_kernel_stack(unsigned int cpu, uint32_t esp0) {
+    if (cpu < NR_CPUS) {
+        cpu_tss[cpu].esp0 = esp0;
+    }
+}
+
+uint32_t *tss_esp0_ptr(unsigned int cpu) {
+    // esp0 is 4-byte aligned even though the struct is packed
+    return (uint32_t *)((uint8_t *)&cpu_tss[cpu] + offsetof(struct tss_struct, esp0));
+}
+
+/**
+ * The double-fault task starts afresh on a stack of its own every time,
+ * so a fault on an overflowed kernel stack can still be reported. It
+ * keeps the page directory loaded now, which maps the kernel like all
+ * others do
+ */
+void doublefault_init_cpu(unsigned int cpu) {
+    struct tss_struct *tss = &cpu_doublefault_tss[cpu];
+    uint32_t cr3;
+
+    __asm__ volatile("mov %%cr3, %0" : "=r" (cr3));
+
+    memset(tss, 0, sizeof(*tss));
+    tss->cr3 = cr3;
+    tss->eip = (uint32_t)doublefault_fn;
+    tss->eflags = 0x2;          // Reserved bit; interrupts stay off
+    tss->esp = (uint32_t)&doublefault_stack[cpu][DOUBLEFAULT_STACK_SIZE];
+    tss->ss0 = __KERNEL_DS;
+    tss->esp0 = tss->esp;
+    tss->cs = __KERNEL_CS;
+    tss->ds = tss->es = tss->ss = tss->gs = __KERNEL_DS;
+    tss->fs = __KERNEL_PERCPU;
+    tss->io_bitmap_base = sizeof(*tss);
+}
+
+const struct tss_struct *cpu_tss_state(unsigned int cpu) {
+    return &cpu_tss[cpu];
+}
@@ -0,0 +1,293 @@
+#include "hrtimer.h"
+#include "kernel.h"
+#include "printk.h"
+
+/**
+ * High-Resolution Timer Implementation
+ * Per-CPU red-black trees of pending timers, expired from the oneshot
+ * clockevent interrupt or, without one, from the periodic tick
+ */
+
+static struct hrtimer_cpu_base hrtimer_bases[CPU_COUNT];
+
+static inline struct hrtimer_cpu_base *this_cpu_base(void) {
+    return &hrtimer_bases[smp_processor_id()];
+}
+
+/**
+ * Insert a timer ordered by expiry; equal expiries keep FIFO order
+ * Returns true if the timer became the earliest one
+ */
+static bool enqueue_hrtimer(struct hrtimer *timer, struct hrtimer_cpu_base *base) {
+    struct rb_node **link = &base->active.rb_root.rb_node;
+    struct rb_node *parent = NULL;
+    bool leftmost = true;
+
+    while (*link) {
+        struct hrtimer *entry;
+
+        parent = *link;
+        entry = rb_entry(parent, struct hrtimer, node);
+        if (timer->expires < entry->expires) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&timer->node, parent, link);
+    rb_insert_color_cached(&timer->node, &base->active, leftmost);
+
+    timer->base = base;
+    timer->state |= HRTIMER_STATE_ENQUEUED;
+
+    return leftmost;
+}
+
+static void dequeue_hrtimer(struct hrtimer *timer, struct hrtimer_cpu_base *base) {
+    rb_erase_cached(&timer->node, &base->active);
+    RB_CLEAR_NODE(&timer->node);
+    timer->state &= ~HRTIMER_STATE_ENQUEUED;
+}
+
+static inline struct hrtimer *hrtimer_first(struct hrtimer_cpu_base *base) {
+    struct rb_node *next = rb_first_cached(&base->active);
+    return next ? rb_entry(next, struct hrtimer, node) : NULL;
+}
+
+/**
+ * Program the oneshot device for the earliest pending timer
+ */
+static void hrtimer_reprogram(struct hrtimer_cpu_base *base) {
+    struct clock_event_device *dev = clockevents_oneshot_device();
+    struct hrtimer *first = hrtimer_first(base);
+    ktime_t expires = first ? first->expires : KTIME_MAX;
+
+    base->expires_next = expires;
+
+    if (dev && expires != KTIME_MAX) {
+        clockevents_program_event(dev, expires);
+    }
+}
+
+/**
+ * Initialize the per-CPU timer bases
+ */
+void hrtimers_init(void) {
+    for (int cpu = 0; cpu < CPU_COUNT; cpu++) {
+        struct hrtimer_cpu_base *base = &hrtimer_bases[cpu];
+
+        spin_lock_init(&base->lock);
+        base->active = RB_ROOT_CACHED;
+        base->cpu = cpu;
+        base->expires_next = KTIME_MAX;
+        base->running = NULL;
+        base->nr_events = 0;
+        base->nr_expired = 0;
+    }
+
+    pr_info("hrtimer: %d per-CPU timer bases initialized\n", CPU_COUNT);
+}
+
+/**
+ * Initialize a timer before first use
+ */
+void hrtimer_init(struct hrtimer *timer,
+                  enum hrtimer_restart (*function)(struct hrtimer *)) {
+    memset(timer, 0, sizeof(struct hrtimer));
+    RB_CLEAR_NODE(&timer->node);
+    timer->function = function;
+    timer->state = HRTIMER_STATE_INACTIVE;
+}
+
+/**
+ * (Re)arm a timer on the given CPU
+ */
+void hrtimer_start_on(struct hrtimer *timer, unsigned int cpu, ktime_t tim, uint32_t mode) {
+    struct hrtimer_cpu_base *base = &hrtimer_bases[cpu];
+    struct hrtimer_cpu_base *old = timer->base;
+    unsigned long flags;
+    bool first;
+
+    if (mode & HRTIMER_MODE_REL) {
+        tim = ktime_add(ktime_get(), tim);
+    }
+
+    // Pull it off whichever base it was queued on
+    if (old && old != base && hrtimer_is_queued(timer)) {
+        spin_lock_irqsave(&old->lock, flags);
+        if (hrtimer_is_queued(timer)) {
+            dequeue_hrtimer(timer, old);
+        }
+        spin_unlock_irqrestore(&old->lock, flags);
+    }
+
+    spin_lock_irqsave(&base->lock, flags);
+
+    if (hrtimer_is_queued(timer)) {
+        dequeue_hrtimer(timer, base);
+    }
+
+    timer->expires = tim;
+    first = enqueue_hrtimer(timer, base);
+
+    if (first) {
+        hrtimer_reprogram(base);
+    }
+
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/**
+ * (Re)arm a timer on the current CPU
+ */
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, uint32_t mode) {
+    hrtimer_start_on(timer, smp_processor_id(), tim, mode);
+}
+
+/**
+ * Try to deactivate a timer
+ * Returns 1 if it was queued, 0 if inactive, -1 if its callback is running
+ */
+int hrtimer_try_to_cancel(struct hrtimer *timer) {
+    struct hrtimer_cpu_base *base = timer->base;
+    unsigned long flags;
+    int ret = 0;
+
+    if (!base) return 0;
+
+    spin_lock_irqsave(&base->lock, flags);
+
+    if (base->running == timer) {
+        ret = -1;
+    } else if (hrtimer_is_queued(timer)) {
+        bool was_first = rb_first_cached(&base->active) == &timer->node;
+
+        dequeue_hrtimer(timer, base);
+        if (was_first) {
+            hrtimer_reprogram(base);
+        }
+        ret = 1;
+    }
+
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    return ret;
+}
+
+/**
+ * Cancel a timer and wait for a running callback to finish
+ */
+int hrtimer_cancel(struct hrtimer *timer) {
+    int ret;
+
+    while ((ret = hrtimer_try_to_cancel(timer)) < 0) {
+        __asm__ volatile("pause");
+    }
+
+    return ret;
+}
+
+/**
+ * Push expiry forward by whole intervals until it is after now
+ * Returns the number of intervals skipped (overruns)
+ */
+uint64_t hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval) {
+    ktime_t delta = ktime_sub(now, timer->expires);
+    uint64_t orun = 1;
+
+    if (delta < 0 || interval <= 0) return 0;
+
+    if (delta >= interval) {
+        if ((uint64_t)interval <= 0xFFFFFFFFULL) {
+            orun = div_u64((uint64_t)delta, (uint32_t)interval);
+        } else {
+            orun = 0;
+            while (delta >= interval) {
+                delta -= interval;
+                orun++;
+            }
+        }
+        timer->expires = ktime_add(timer->expires, interval * (ktime_t)orun);
+        if (timer->expires > now) {
+            return orun;
+        }
+        orun++;
+    }
+
+    timer->expires = ktime_add(timer->expires, interval);
+    return orun;
+}
+
+/**
+ * Time left until the timer fires
+ */
+ktime_t hrtimer_get_remaining(const struct hrtimer *timer) {
+    return ktime_sub(timer->expires, ktime_get());
+}
+
+/**
+ * Run one expired timer with the base lock dropped around the callback
+ */
+static void __run_hrtimer(struct hrtimer_cpu_base *base, struct hrtimer *timer,
+                          unsigned long *flags) {
+    enum hrtimer_restart restart;
+
+    dequeue_hrtimer(timer, base);
+    timer->state |= HRTIMER_STATE_CALLBACK;
+    base->running = timer;
+    base->nr_expired++;
+
+    spin_unlock_irqrestore(&base->lock, *flags);
+    restart = timer->function(timer);
+    spin_lock_irqsave(&base->lock, *flags);
+
+    // The callback may have re-armed the timer itself
+    if (restart == HRTIMER_RESTART && !hrtimer_is_queued(timer)) {
+        enqueue_hrtimer(timer, base);
+    }
+
+    timer->state &= ~HRTIMER_STATE_CALLBACK;
+    base->running = NULL;
+}
+
+static void __hrtimer_run_queues(struct hrtimer_cpu_base *base, ktime_t now) {
+    struct hrtimer *timer;
+    unsigned long flags;
+
+    spin_lock_irqsave(&base->lock, flags);
+
+    base->nr_events++;
+    while ((timer = hrtimer_first(base)) && timer->expires <= now) {
+        __run_hrtimer(base, timer, &flags);
+    }
+
+    hrtimer_reprogram(base);
+
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/**
+ * Oneshot clockevent handler (high-resolution mode)
+ */
+void hrtimer_interrupt(struct clock_event_device *dev) {
+    dev->event_count++;
+    dev->next_event = KTIME_MAX;
+
+    __hrtimer_run_queues(this_cpu_base(), ktime_get());
+}
+
+/**
+ * Tick-driven expiry (low-resolution mode)
+ */
+void hrtimer_run_queues(void) {
+    struct hrtimer_cpu_base *base = this_cpu_base();
+    struct hrtimer *first = hrtimer_first(base);
+
+    if (!first || first->expires > ktime_get()) {
+        return;
+    }
+
+    __hrtimer_run_queues(base, ktime_get());
+}
@@ -0,0 +1,283 @@
+#include "idr.h"
+#include "kernel.h"
+#include "mm.h"
+
+/**
+ * Radix-Tree ID Allocator
+ * Updates run under idr->lock and publish new layers with
+ * rcu_assign_pointer(); emptied layers are freed after a grace period so
+ * lockless idr_find() walkers never touch freed memory
+ */
+
+// Largest ID the tree rooted at p can hold, plus one
+static inline int idr_capacity(struct idr_layer *p) {
+    return p ? 1 << (IDR_BITS * (p->layer + 1)) : 0;
+}
+
+static struct idr_layer *idr_layer_alloc(int layer) {
+    struct idr_layer *p = kmalloc(sizeof(*p));
+
+    if (p) {
+        memset(p, 0, sizeof(*p));
+        p->layer = layer;
+    }
+    return p;
+}
+
+static void idr_layer_free_rcu(struct rcu_head *head) {
+    kfree(container_of(head, struct idr_layer, rcu));
+}
+
+/**
+ * Add a layer on top so the tree holds at least id
+ */
+static int idr_grow(struct idr *idr, int id) {
+    while (id >= idr_capacity(idr->top)) {
+        struct idr_layer *top = idr->top;
+        struct idr_layer *p = idr_layer_alloc(top ? top->layer + 1 : 0);
+
+        if (!p) {
+            return -ENOMEM;
+        }
+        if (top) {
+            // The old tree becomes slot 0
+            p->ary[0] = top;
+            p->count = 1;
+            if (top->bitmap == IDR_FULL) {
+                p->bitmap = 1;
+            }
+        }
+        rcu_assign_pointer(idr->top, p);
+    }
+    return 0;
+}
+
+/**
+ * Claim the lowest free ID >= start in the subtree p, whose first ID is
+ * base; returns the ID or -1 if the subtree has none, -ENOMEM on failure
+ */
+static int idr_claim(struct idr_layer *p, int base, int start, void *ptr) {
+    int shift = IDR_BITS * p->layer;
+    int n = start > base ? (start - base) >> shift : 0;
+
+    for (; n < IDR_SIZE; n++) {
+        struct idr_layer *child;
+        int id;
+
+        if (p->bitmap & (1U << n)) {
+            continue;
+        }
+
+        if (p->layer == 0) {
+            p->bitmap |= 1U << n;
+            p->count++;
+            rcu_assign_pointer(p->ary[n], ptr);
+            return base + n;
+        }
+
+        child = p->ary[n];
+        if (!child) {
+            child = idr_layer_alloc(p->layer - 1);
+            if (!child) {
+                return -ENOMEM;
+            }
+            p->count++;
+            rcu_assign_pointer(p->ary[n], child);
+        }
+
+        id = idr_claim(child, base + (n << shift), start, ptr);
+        if (id == -1) {
+            continue;
+        }
+        if (id >= 0 && child->bitmap == IDR_FULL) {
+            p->bitmap |= 1U << n;
+        }
+        return id;
+    }
+    return -1;
+}
+
+/**
+ * Free id and return its pointer; prunes layers left empty
+ * Called with idr->lock held
+ */
+static void *idr_remove_locked(struct idr *idr, int id) {
+    struct idr_layer *path[IDR_MAX_LAYERS];
+    struct idr_layer *p = idr->top;
+    void *ptr;
+    int depth = 0;
+    int n;
+
+    if (!p || id < 0 || id >= idr_capacity(p)) {
+        return NULL;
+    }
+
+    while (p->layer > 0) {
+        path[depth++] = p;
+        p = p->ary[(id >> (IDR_BITS * p->layer)) & IDR_MASK];
+        if (!p) {
+            return NULL;
+        }
+    }
+
+    n = id & IDR_MASK;
+    if (!(p->bitmap & (1U << n))) {
+        return NULL;
+    }
+
+    ptr = p->ary[n];
+    p->bitmap &= ~(1U << n);
+    p->count--;
+    rcu_assign_pointer(p->ary[n], NULL);
+
+    // Walk back up: no ancestor is full any more, and empty layers
+    // other than the top go away
+    while (depth > 0) {
+        struct idr_layer *parent = path[--depth];
+
+        n = (id >> (IDR_BITS * parent->layer)) & IDR_MASK;
+        parent->bitmap &= ~(1U << n);
+
+        if (p->count == 0) {
+            rcu_assign_pointer(parent->ary[n], NULL);
+            parent->count--;
+            call_rcu(&p->rcu, idr_layer_free_rcu);
+        }
+        p = parent;
+    }
+
+    return ptr;
+}
+
+/**
+ * Claim the lowest free ID in [start, end) for ptr
+ * Called with idr->lock held
+ */
+static int idr_alloc_locked(struct idr *idr, void *ptr, int start, int end) {
+    int ret, id = -1;
+
+    if (start >= end) {
+        return -ENOSPC;
+    }
+
+    ret = idr_grow(idr, start);
+    while (ret == 0) {
+        id = idr_claim(idr->top, 0, start, ptr);
+        if (id != -1) {
+            break;
+        }
+        // Everything the tree holds from start on is taken
+        if (idr_capacity(idr->top) >= end) {
+            id = -ENOSPC;
+            break;
+        }
+        ret = idr_grow(idr, idr_capacity(idr->top));
+    }
+    if (ret) {
+        id = ret;
+    }
+
+    if (id >= end) {
+        idr_remove_locked(idr, id);
+        id = -ENOSPC;
+    }
+
+    return id;
+}
+
+int idr_alloc(struct idr *idr, void *ptr, int start, int end) {
+    unsigned long flags;
+    int id;
+
+    if (start < 0) {
+        return -EINVAL;
+    }
+    if (end <= 0 || end > IDR_MAX_ID) {
+        end = IDR_MAX_ID;
+    }
+
+    spin_lock_irqsave(&idr->lock, flags);
+    id = idr_alloc_locked(idr, ptr, start, end);
+    spin_unlock_irqrestore(&idr->lock, flags);
+    return id;
+}
+
+int idr_alloc_cyclic(struct idr *idr, void *ptr, int start, int end) {
+    unsigned long flags;
+    int id;
+
+    if (start < 0) {
+        return -EINVAL;
+    }
+    if (end <= 0 || end > IDR_MAX_ID) {
+        end = IDR_MAX_ID;
+    }
+
+    // next is read and advanced under the lock, so two callers cannot
+    // both start from the same hint
+    spin_lock_irqsave(&idr->lock, flags);
+    id = idr_alloc_locked(idr, ptr, idr->next > start ? idr->next : start, end);
+    if (id == -ENOSPC && idr->next > start) {
+        id = idr_alloc_locked(idr, ptr, start, end);
+    }
+    if (id >= 0) {
+        idr->next = id + 1;
+    }
+    spin_unlock_irqrestore(&idr->lock, flags);
+    return id;
+}
+
+void *idr_find(struct idr *idr, int id) {
+    struct idr_layer *p = rcu_dereference(idr->top);
+
+    if (!p || id < 0 || id >= idr_capacity(p)) {
+        return NULL;
+    }
+
+    while (p->layer > 0) {
+        p = rcu_dereference(p->ary[(id >> (IDR_BITS * p->layer)) & IDR_MASK]);
+        if (!p) {
+            return NULL;
+        }
+    }
+    return rcu_dereference(p->ary[id & IDR_MASK]);
+}
+
+void *idr_replace(struct idr *idr, void *ptr, int id) {
+    struct idr_layer *p;
+    unsigned long flags;
+    void *old = NULL;
+
+    spin_lock_irqsave(&idr->lock, flags);
+
+    p = idr->top;
+    if (p && id >= 0 && id < idr_capacity(p)) {
+        while (p && p->layer > 0) {
+            p = p->ary[(id >> (IDR_BITS * p->layer)) & IDR_MASK];
+        }
+        if (p && (p->bitmap & (1U << (id & IDR_MASK)))) {
+            old = p->ary[id & IDR_MASK];
+            rcu_assign_pointer(p->ary[id & IDR_MASK], ptr);
+        }
+    }
+
+    spin_unlock_irqrestore(&idr->lock, flags);
+    return old;
+}
+
+void *idr_remove(struct idr *idr, int id) {
+    unsigned long flags;
+    void *ptr;
+
+    spin_lock_irqsave(&idr->lock, flags);
+    ptr = idr_remove_locked(idr, id);
+    spin_unlock_irqrestore(&idr->lock, flags);
+
+    return ptr;
+}
+
+void idr_init(struct idr *idr) {
+    idr->top = NULL;
+    idr->next = 0;
+    spin_lock_init(&idr->lock);
+}
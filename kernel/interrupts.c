@@ -1,5 +1,16 @@
 #include "interrupts.h"
 #include "kernel.h"
+#include "timer.h"
+#include "futex.h"
+#include "rcupdate.h"
+#include "kstack.h"
+#include "irq.h"
+#include "softirq.h"
+#include "apic.h"
+#include "io_apic.h"
+#include "ktime.h"
+#include "syscall.h"
+#include "gdt.h"
 #include "../include/screen.h"
 
 // IDT table
@@ -31,7 +42,163 @@ static const char* exception_messages[] = {
 };
 
 // IRQ handlers
-static interrupt_handler_t irq_handlers[16];
+static interrupt_handler_t irq_handlers[NR_LEGACY_IRQS];
+
+// 8259 PIC ports
+#define PIC1_CMD    0x20
+#define PIC1_DATA   0x21
+#define PIC2_CMD    0xA0
+#define PIC2_DATA   0xA1
+#define PIC_EOI     0x20
+
+int vector_irq[NR_VECTORS];
+
+// Vector assigned to each IRQ by assign_irq_vector(), 0 if none
+static uint8_t irq_vector[NR_IRQS];
+static DEFINE_SPINLOCK(vector_lock);
+
+// IMR contents, bit per IRQ; the cascade line stays open
+static uint16_t cached_irq_mask = 0xFFFB;
+static DEFINE_SPINLOCK(i8259A_lock);
+
+static void i8259A_write_imr(void) {
+    outb(PIC1_DATA, cached_irq_mask & 0xFF);
+    outb(PIC2_DATA, cached_irq_mask >> 8);
+}
+
+static void i8259A_mask(unsigned int irq) {
+    unsigned long flags;
+    
+    spin_lock_irqsave(&i8259A_lock, flags);
+    cached_irq_mask |= 1 << irq;
+    i8259A_write_imr();
+    spin_unlock_irqrestore(&i8259A_lock, flags);
+}
+
+static void i8259A_unmask(unsigned int irq) {
+    unsigned long flags;
+    
+    spin_lock_irqsave(&i8259A_lock, flags);
+    cached_irq_mask &= ~(1 << irq);
+    i8259A_write_imr();
+    spin_unlock_irqrestore(&i8259A_lock, flags);
+}
+
+static void i8259A_eoi(unsigned int irq) {
+    if (irq >= 8) {
+        outb(PIC2_CMD, PIC_EOI);   // Slave PIC
+    }
+    outb(PIC1_CMD, PIC_EOI);       // Master PIC
+}
+
+// The PIC pair is wired to the boot CPU's LINT0 only
+static int i8259A_set_affinity(unsigned int irq, const struct cpumask *dest) {
+    return cpumask_test_cpu(0, dest) ? 0 : -EINVAL;
+}
+
+struct irq_chip i8259A_chip = {
+    .name = "XT-PIC",
+    .startup = i8259A_unmask,
+    .shutdown = i8259A_mask,
+    .enable = i8259A_unmask,
+    .disable = i8259A_mask,
+    .mask = i8259A_mask,
+    .unmask = i8259A_unmask,
+    .eoi = i8259A_eoi,
+    .set_affinity = i8259A_set_affinity,
+};
+
+// Remap the PICs to vectors 32-47 and give them IRQs 0-15; every line
+// starts masked until a handler enables it
+static void init_8259A(void) {
+    outb(PIC1_CMD, 0x11);   // Start initialization sequence
+    outb(PIC2_CMD, 0x11);
+    outb(PIC1_DATA, ISA_IRQ_VECTOR(0));
+    outb(PIC2_DATA, ISA_IRQ_VECTOR(8));
+    outb(PIC1_DATA, 0x04);  // Tell PIC slave at IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);  // 8086 mode
+    outb(PIC2_DATA, 0x01);
+    i8259A_write_imr();
+    
+    for (int irq = 0; irq < NR_LEGACY_IRQS; irq++) {
+        vector_irq[ISA_IRQ_VECTOR(irq)] = irq;
+        irq_set_chip(irq, &i8259A_chip);
+    }
+}
+
+/**
+ * Mask every PIC line and drop its vectors, once the I/O APIC has the
+ * ISA IRQs; called with interrupts disabled
+ */
+void disable_8259A(void) {
+    unsigned long flags;
+    
+    spin_lock_irqsave(&i8259A_lock, flags);
+    cached_irq_mask = 0xFFFF;
+    i8259A_write_imr();
+    spin_unlock_irqrestore(&i8259A_lock, flags);
+    
+    for (int irq = 0; irq < NR_LEGACY_IRQS; irq++) {
+        vector_irq[ISA_IRQ_VECTOR(irq)] = -1;
+    }
+}
+
+/**
+ * Vectors are handed out 8 apart so consecutive IRQs land in different
+ * local APIC priority classes (vector >> 4) and do not block each other
+ */
+int assign_irq_vector(unsigned int irq) {
+    static int current_vector = FIRST_DEVICE_VECTOR;
+    static int current_offset = 0;
+    int vector, offset;
+    unsigned long flags;
+    
+    if (irq >= NR_IRQS) return -EINVAL;
+    
+    spin_lock_irqsave(&vector_lock, flags);
+    
+    if (irq_vector[irq]) {
+        spin_unlock_irqrestore(&vector_lock, flags);
+        return irq_vector[irq];
+    }
+    
+    vector = current_vector;
+    offset = current_offset;
+    for (int tries = FIRST_SYSTEM_VECTOR - FIRST_DEVICE_VECTOR; tries > 0; tries--) {
+        vector += 8;
+        if (vector >= FIRST_SYSTEM_VECTOR) {
+            offset = (offset + 1) % 8;
+            vector = FIRST_DEVICE_VECTOR + offset;
+        }
+        if (vector == SYSCALL_INT || vector_irq[vector] >= 0) {
+            continue;
+        }
+        
+        current_vector = vector;
+        current_offset = offset;
+        vector_irq[vector] = irq;
+        irq_vector[irq] = vector;
+        spin_unlock_irqrestore(&vector_lock, flags);
+        return vector;
+    }
+    
+    spin_unlock_irqrestore(&vector_lock, flags);
+    return -ENOSPC;
+}
+
+void free_irq_vector(unsigned int irq) {
+    unsigned long flags;
+    
+    if (irq >= NR_IRQS) return;
+    
+    spin_lock_irqsave(&vector_lock, flags);
+    if (irq_vector[irq]) {
+        vector_irq[irq_vector[irq]] = -1;
+        irq_vector[irq] = 0;
+    }
+    spin_unlock_irqrestore(&vector_lock, flags);
+}
 
 // Initialize interrupt system
 void interrupts_init(void) {
@@ -49,7 +216,10 @@ void interrupts_init(void) {
     idt_set_gate(5, (uint32_t)isr5, 0x08, 0x8E);
     idt_set_gate(6, (uint32_t)isr6, 0x08, 0x8E);
     idt_set_gate(7, (uint32_t)isr7, 0x08, 0x8E);
-    idt_set_gate(8, (uint32_t)isr8, 0x08, 0x8E);
+    // A task gate: the double fault gets a fresh stack even when the
+    // kernel stack is what overflowed
+    doublefault_init_cpu(0);
+    idt_set_gate(8, 0, GDT_ENTRY_DOUBLEFAULT_TSS_SEL, 0x85);
     idt_set_gate(9, (uint32_t)isr9, 0x08, 0x8E);
     idt_set_gate(10, (uint32_t)isr10, 0x08, 0x8E);
     idt_set_gate(11, (uint32_t)isr11, 0x08, 0x8E);
@@ -62,46 +232,30 @@ void interrupts_init(void) {
     idt_set_gate(18, (uint32_t)isr18, 0x08, 0x8E);
     idt_set_gate(19, (uint32_t)isr19, 0x08, 0x8E);
     
-    // Set up IRQ handlers
-    idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E);
-    idt_set_gate(33, (uint32_t)irq1, 0x08, 0x8E);
-    idt_set_gate(34, (uint32_t)irq2, 0x08, 0x8E);
-    idt_set_gate(35, (uint32_t)irq3, 0x08, 0x8E);
-    idt_set_gate(36, (uint32_t)irq4, 0x08, 0x8E);
-    idt_set_gate(37, (uint32_t)irq5, 0x08, 0x8E);
-    idt_set_gate(38, (uint32_t)irq6, 0x08, 0x8E);
-    idt_set_gate(39, (uint32_t)irq7, 0x08, 0x8E);
-    idt_set_gate(40, (uint32_t)irq8, 0x08, 0x8E);
-    idt_set_gate(41, (uint32_t)irq9, 0x08, 0x8E);
-    idt_set_gate(42, (uint32_t)irq10, 0x08, 0x8E);
-    idt_set_gate(43, (uint32_t)irq11, 0x08, 0x8E);
-    idt_set_gate(44, (uint32_t)irq12, 0x08, 0x8E);
-    idt_set_gate(45, (uint32_t)irq13, 0x08, 0x8E);
-    idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
-    idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
-    
-    // Set up system call handler
-    idt_set_gate(SYSCALL_INT, (uint32_t)syscall_handler, 0x08, 0x8E);
+    // Every other vector goes through irq_handler()
+    for (int v = FIRST_EXTERNAL_VECTOR; v < NR_VECTORS; v++) {
+        vector_irq[v] = -1;
+        if (v != SYSCALL_INT) {
+            idt_set_gate(v, irq_entries[v - FIRST_EXTERNAL_VECTOR], 0x08, 0x8E);
+        }
+    }
+    
+    // System call gate, reachable from ring 3 (DPL 3)
+    idt_set_gate(SYSCALL_INT, (uint32_t)system_call, 0x08, 0xEE);
     
     // Set up IDT pointer
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base = (uint32_t)&idt;
     
     // Load IDT
-    __asm__ volatile("lidt %0" : : "m" (idt_ptr));
+    idt_load();
     
-    // Initialize PIC
-    // Remap IRQs
-    outb(0x20, 0x11);   // Start initialization sequence
-    outb(0xA0, 0x11);
-    outb(0x20, 0x20);   // Map IRQs to 32-47
-    outb(0xA0, 0x28);
-    outb(0x20, 0x04);   // Tell PIC slave at IRQ2
-    outb(0xA0, 0x02);
-    outb(0x20, 0x01);   // 8086 mode
-    outb(0xA0, 0x01);
-    outb(0x20, 0x00);   // Enable interrupts
-    outb(0xA0, 0x00);
+    init_8259A();
+}
+
+// Load the shared IDT on the calling CPU
+void idt_load(void) {
+    __asm__ volatile("lidt %0" : : "m" (idt_ptr));
 }
 
 // Set IDT gate
@@ -125,31 +279,102 @@ void exception_handler(uint8_t exc_num) {
         screen_print("Unknown exception\n");
     }
     
+    // A fault on a guard page means some task ran off its kernel stack;
+    // a push into it usually escalates to a double fault
+    if (exc_num == 14 || exc_num == 8) {
+        uint32_t cr2;
+        
+        __asm__ volatile("mov %%cr2, %0" : "=r" (cr2));
+        if (kstack_guard_page(cr2)) {
+            screen_print("Kernel stack overflow at 0x");
+            screen_print_hex(cr2);
+            screen_print("\n");
+        }
+    }
+    
     panic("Unrecoverable exception");
 }
 
-// IRQ handler
-void irq_handler(uint8_t irq) {
+// Double-fault task, entered through the vector 8 task gate. The
+// faulting state is in this CPU's main TSS, and the error code (always
+// 0) sits where a return address would be, so this never returns
+void doublefault_fn(void) {
+    const struct tss_struct *tss = cpu_tss_state(smp_processor_id());
+    
+    screen_print("\nDouble fault at EIP 0x");
+    screen_print_hex(tss->eip);
+    screen_print(", ESP 0x");
+    screen_print_hex(tss->esp);
+    exception_handler(8);
+}
+
+// Each CPU's periodic tick: the PIT on the boot CPU, the local APIC
+// timer on the others
+static inline bool irq_is_tick(int irq) {
+    return irq == IRQ_TIMER || irq == LOCAL_TIMER_IRQ;
+}
+
+// IRQ handler, entered with the vector the CPU took
+void irq_handler(uint32_t vector) {
+    int irq = vector_irq[vector & 0xFF];
+    
+    if (irq < 0) {
+        // Local APIC spurious interrupts take no EOI; anything else that
+        // reached the local APIC without an IRQ behind it still needs one
+        if (io_apic_enabled && vector != SPURIOUS_APIC_VECTOR) {
+            apic_eoi();
+        }
+        return;
+    }
+    
+    // The gate cleared IF; the window runs until the iret
+    trace_irq_enter();
+    rcu_irq_enter();
+    irq_enter();
+    
     // Call registered handler if exists
-    if (irq_handlers[irq]) {
+    if (irq < NR_LEGACY_IRQS && irq_handlers[irq]) {
+        uint64_t start = sched_clock();
+        
         irq_handlers[irq]();
+        irq_account_legacy(irq, start);
+    } else {
+        // Lines claimed with request_irq() or request_threaded_irq()
+        do_IRQ(irq, NULL);
     }
     
-    // Send EOI to PIC
-    if (irq >= 8) {
-        outb(0xA0, 0x20);  // Slave PIC
+    // EOI at whichever controller the IRQ came through
+    irq_eoi(irq);
+    
+    if (irq_is_tick(irq)) {
+        // Report this CPU's quiescent states; its expired RCU callbacks
+        // run as a softirq
+        rcu_check_callbacks();
     }
-    outb(0x20, 0x20);     // Master PIC
     
-    // Schedule next process on timer interrupt
-    if (irq == IRQ_TIMER) {
+    // Run timer, RCU and driver work deferred by the handlers
+    irq_exit();
+    rcu_irq_exit();
+    
+    // Schedule next process on a tick or a reschedule IPI, unless we
+    // interrupted an RCU reader, a lock holder or a softirq that this
+    // interrupt nested into. An idle CPU schedules from its idle loop
+    // once the interrupt returns
+    if ((irq_is_tick(irq) || irq == RESCHEDULE_IRQ) &&
+        preemptible() && !rcu_preempt_depth() && !in_interrupt() &&
+        !(current_process->flags & PF_IDLE)) {
         process_schedule();
     }
+    
+    trace_hardirqs_on();
 }
 
 // Register IRQ handler
 void irq_register_handler(uint8_t irq, interrupt_handler_t handler) {
     irq_handlers[irq] = handler;
+    
+    // Claims the line the way request_irq() does
+    irq_enable(irq);
 }
 
 // I/O port functions
@@ -162,29 +387,3 @@ uint8_t inb(uint16_t port) {
     __asm__ volatile("inb %1, %0" : "=a" (ret) : "dN" (port));
     return ret;
 }
-
-// System call handler
-void syscall_handler(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx) {
-    switch (eax) {
-        case SYS_EXIT:
-            process_exit(ebx);
-            break;
-        case SYS_FORK:
-            // Return child PID in EAX for parent, 0 for child
-            eax = process_create();
-            break;
-        case SYS_READ:
-            // Read from file descriptor EBX into buffer ECX, count EDX
-            // eax = sys_read(ebx, (void*)ecx, edx);
-            break;
-        case SYS_WRITE:
-            // Write to file descriptor EBX from buffer ECX, count EDX
-            // eax = sys_write(ebx, (void*)ecx, edx);
-            break;
-        default:
-            screen_print("Unknown system call: ");
-            screen_print_hex(eax);
-            screen_print("\n");
-            break;
-    }
-}
@@ -0,0 +1,247 @@
+#include "io_apic.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "irq.h"
+#include "mm.h"
+#include "printk.h"
+#include "spinlock.h"
+
+/**
+ * I/O APIC Interrupt Routing
+ * Pins are numbered by global system interrupt (GSI). ISA IRQs reach
+ * the pin firmware overrides name, defaulting to pin == IRQ, edge
+ * triggered and active high; everything else is a PCI line, level
+ * triggered and active low, with irq == GSI. Every routed IRQ gets its
+ * own vector, delivered in lowest-priority mode to the logical
+ * destination made from its affinity mask.
+ */
+
+// Where an IRQ's redirection table entry lives
+struct irq_pin {
+    int apic;               // Index into mp_ioapics
+    unsigned int pin;
+    uint32_t low;           // Entry minus the mask bit
+};
+
+bool io_apic_enabled;
+
+static volatile uint32_t *ioapic_base[MAX_IO_APICS];
+static unsigned int ioapic_nr_pins[MAX_IO_APICS];
+static struct irq_pin irq_pins[NR_IRQS];
+
+// Serializes the REGSEL/IOWIN pair; nests inside desc->lock
+static DEFINE_SPINLOCK(ioapic_lock);
+
+static uint32_t io_apic_read(int apic, uint32_t reg) {
+    ioapic_base[apic][IO_APIC_REGSEL] = reg;
+    return ioapic_base[apic][IO_APIC_IOWIN];
+}
+
+static void io_apic_write(int apic, uint32_t reg, uint32_t val) {
+    ioapic_base[apic][IO_APIC_REGSEL] = reg;
+    ioapic_base[apic][IO_APIC_IOWIN] = val;
+}
+
+static void io_apic_write_low(struct irq_pin *p, bool masked) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    io_apic_write(p->apic, IO_APIC_REDTBL(p->pin),
+                  p->low | (masked ? IO_APIC_MASKED : 0));
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+static void ioapic_mask(unsigned int irq) {
+    io_apic_write_low(IRQ_TO_DESC(irq)->chip_data, true);
+}
+
+static void ioapic_unmask(unsigned int irq) {
+    io_apic_write_low(IRQ_TO_DESC(irq)->chip_data, false);
+}
+
+static void ioapic_eoi(unsigned int irq) {
+    apic_eoi();
+}
+
+/**
+ * Flat logical mode: bit n of the destination is CPU n
+ */
+static int ioapic_set_affinity(unsigned int irq, const struct cpumask *dest) {
+    struct irq_pin *p = IRQ_TO_DESC(irq)->chip_data;
+    uint32_t cpus = cpumask_bits(dest) & 0xFF;
+    unsigned long flags;
+
+    if (!cpus) {
+        return -EINVAL;
+    }
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    io_apic_write(p->apic, IO_APIC_REDTBL(p->pin) + 1, IO_APIC_DEST(cpus));
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+
+    return 0;
+}
+
+static int ioapic_set_type(unsigned int irq, unsigned int type) {
+    struct irq_desc *desc = IRQ_TO_DESC(irq);
+    struct irq_pin *p = desc->chip_data;
+
+    p->low &= ~(IO_APIC_TRIGGER_LEVEL | IO_APIC_POLARITY_LOW);
+    if (type & (IRQ_TYPE_LEVEL_HIGH | IRQ_TYPE_LEVEL_LOW)) {
+        p->low |= IO_APIC_TRIGGER_LEVEL;
+    }
+    if (type & (IRQ_TYPE_LEVEL_LOW | IRQ_TYPE_EDGE_FALLING)) {
+        p->low |= IO_APIC_POLARITY_LOW;
+    }
+
+    io_apic_write_low(p, desc->status & (IRQ_DISABLED | IRQ_MASKED));
+    return 0;
+}
+
+static struct irq_chip ioapic_chip = {
+    .name = "IO-APIC",
+    .startup = ioapic_unmask,
+    .shutdown = ioapic_mask,
+    .enable = ioapic_unmask,
+    .disable = ioapic_mask,
+    .mask = ioapic_mask,
+    .unmask = ioapic_unmask,
+    .eoi = ioapic_eoi,
+    .set_type = ioapic_set_type,
+    .set_affinity = ioapic_set_affinity,
+};
+
+int io_apic_gsi_to_irq(uint32_t gsi) {
+    int i;
+
+    for (i = 0; i < nr_irq_overrides; i++) {
+        if (mp_irq_overrides[i].gsi == gsi) {
+            return mp_irq_overrides[i].bus_irq;
+        }
+    }
+
+    // An ISA IRQ moved elsewhere leaves its identity pin unused
+    if (gsi < NR_LEGACY_IRQS) {
+        for (i = 0; i < nr_irq_overrides; i++) {
+            if (mp_irq_overrides[i].bus_irq == gsi) {
+                return -1;
+            }
+        }
+    }
+
+    return gsi < APIC_ERROR_IRQ ? (int)gsi : -1;
+}
+
+/**
+ * Trigger and polarity bits of a pin, from its override if it has one
+ */
+static uint32_t io_apic_pin_mode(unsigned int irq, uint32_t gsi) {
+    bool isa = irq < NR_LEGACY_IRQS;
+    bool level = !isa, low = !isa;
+
+    for (int i = 0; i < nr_irq_overrides; i++) {
+        struct mp_irq_override *o = &mp_irq_overrides[i];
+
+        if (o->gsi != gsi) {
+            continue;
+        }
+        if ((o->flags & MP_IRQPOL_MASK) == MP_IRQPOL_ACTIVE_HIGH) {
+            low = false;
+        } else if ((o->flags & MP_IRQPOL_MASK) == MP_IRQPOL_ACTIVE_LOW) {
+            low = true;
+        }
+        if ((o->flags & MP_IRQTRIG_MASK) == MP_IRQTRIG_EDGE) {
+            level = false;
+        } else if ((o->flags & MP_IRQTRIG_MASK) == MP_IRQTRIG_LEVEL) {
+            level = true;
+        }
+        break;
+    }
+
+    return (level ? IO_APIC_TRIGGER_LEVEL : 0) | (low ? IO_APIC_POLARITY_LOW : 0);
+}
+
+/**
+ * Program one pin masked and move its IRQ onto the I/O APIC chip
+ * Returns true if the IRQ was in use and the pin should be unmasked
+ */
+static bool io_apic_setup_pin(int apic, unsigned int pin, unsigned int irq) {
+    struct irq_desc *desc = IRQ_TO_DESC(irq);
+    struct irq_pin *p = &irq_pins[irq];
+    struct cpumask dest;
+    int vector;
+    bool live;
+
+    vector = assign_irq_vector(irq);
+    if (vector < 0) {
+        pr_warn("ioapic: no vector for IRQ %d\n", irq);
+        return false;
+    }
+
+    p->apic = apic;
+    p->pin = pin;
+    p->low = vector | IO_APIC_DM_LOWEST | IO_APIC_DEST_LOGICAL |
+             io_apic_pin_mode(irq, mp_ioapics[apic].gsi_base + pin);
+
+    spin_lock(&desc->lock);
+    desc->chip = &ioapic_chip;
+    desc->chip_data = p;
+    if (!cpumask_and(&dest, &desc->affinity, cpu_online_mask)) {
+        cpumask_set_cpu(0, &dest);
+    }
+    io_apic_write(apic, IO_APIC_REDTBL(pin), p->low | IO_APIC_MASKED);
+    io_apic_write(apic, IO_APIC_REDTBL(pin) + 1, IO_APIC_DEST(cpumask_bits(&dest) & 0xFF));
+    live = desc->depth == 0 && !(desc->status & IRQ_MASKED);
+    spin_unlock(&desc->lock);
+
+    return live;
+}
+
+void setup_io_apic(void) {
+    unsigned long flags;
+    int apic, routed = 0;
+
+    if (!lapic_base || !nr_ioapics) {
+        pr_info("ioapic: none found, staying on the 8259 PIC\n");
+        return;
+    }
+
+    for (apic = 0; apic < nr_ioapics; apic++) {
+        ioapic_base[apic] = ioremap(mp_ioapics[apic].addr, PAGE_SIZE);
+        ioapic_nr_pins[apic] = ((io_apic_read(apic, IO_APIC_VER) >> 16) & 0xFF) + 1;
+    }
+
+    // The tick keeps jiffies and the boot CPU's scheduler going
+    cpumask_clear(&IRQ_TO_DESC(IRQ_TIMER)->affinity);
+    cpumask_set_cpu(0, &IRQ_TO_DESC(IRQ_TIMER)->affinity);
+
+    local_irq_save(flags);
+
+    // From here on the PIC is silent and LINT0 no longer carries it
+    disable_8259A();
+    apic_write(APIC_LVT0, APIC_LVT_MASKED);
+
+    for (apic = 0; apic < nr_ioapics; apic++) {
+        for (unsigned int pin = 0; pin < ioapic_nr_pins[apic]; pin++) {
+            int irq = io_apic_gsi_to_irq(mp_ioapics[apic].gsi_base + pin);
+
+            if (irq < 0) {
+                continue;
+            }
+            if (io_apic_setup_pin(apic, pin, irq)) {
+                io_apic_write_low(&irq_pins[irq], false);
+            }
+            routed++;
+        }
+    }
+
+    io_apic_enabled = true;
+    local_irq_restore(flags);
+
+    for (apic = 0; apic < nr_ioapics; apic++) {
+        pr_info("ioapic: ID %d at 0x%x, GSI %d-%d\n", mp_ioapics[apic].id,
+                mp_ioapics[apic].addr, mp_ioapics[apic].gsi_base,
+                mp_ioapics[apic].gsi_base + ioapic_nr_pins[apic] - 1);
+    }
+    pr_info("ioapic: %d IRQs routed, 8259 PIC disabled\n", routed);
+}
@@ -3,6 +3,12 @@
 #include "mm.h"
 #include "printk.h"
 #include "slab.h"
+#include "sched_isolation.h"
+#include "scheduler.h"
+#include "kthread.h"
+#include "ktime.h"
+#include "timer.h"
+#include "screen.h"
 
 /**
  * Linux-Inspired IRQ Subsystem Implementation
@@ -13,18 +19,28 @@
 // Global IRQ descriptor array
 struct irq_desc irq_desc[NR_IRQS];
 
-// IRQ statistics
-static struct {
+// IRQ statistics, per CPU so the interrupt path never shares a cache line
+struct irq_cpu_stats {
     unsigned int total_irqs;
     unsigned int spurious_irqs;
     unsigned int unhandled_irqs;
     unsigned int disabled_irqs;
     unsigned int masked_irqs;
-} irq_stats = {0};
+};
+
+static DEFINE_PER_CPU(struct irq_cpu_stats, irq_stats);
+
+// Interrupts of each IRQ taken by each CPU
+static DEFINE_PER_CPU(unsigned int, kstat_irqs[NR_IRQS]);
+
+// Interrupt rates are sampled once a second
+#define IRQ_RATE_INTERVAL   TIMER_FREQUENCY
+
+static struct timer_list irq_rate_timer;
 
 // IRQ domain list
 static LIST_HEAD(irq_domain_list);
-static spinlock_t irq_domain_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(irq_domain_lock);
 
 // Dummy IRQ chip for unassigned IRQs
 struct irq_chip dummy_irq_chip = {
@@ -139,9 +155,12 @@ void irq_init(void) {
         desc->handler_data = NULL;
         desc->chip_data = NULL;
         desc->flow_control = NULL;
-        desc->affinity = IRQ_AFFINITY_DEFAULT;
+        // Keep device interrupts off isolated CPUs by default
+        cpumask_copy(&desc->affinity, housekeeping_cpumask());
+        desc->thread_fn = NULL;
         desc->thread = NULL;
         desc->thread_flags = 0;
+        desc->irqflags = 0;
         desc->name = "unknown";
         desc->dev = NULL;
         desc->wake = 0;
@@ -170,6 +189,21 @@ void early_irq_init(void) {
     // These are needed for early boot
 }
 
+/**
+ * Turn each IRQ's count into interrupts per second
+ */
+static void irq_rate_sample(unsigned long data) {
+    for (int i = 0; i < NR_IRQS; i++) {
+        struct irq_desc_stats *st = &irq_desc[i].stats;
+        unsigned int irqs = st->irqs;
+        
+        st->rate = irqs - st->rate_base;
+        st->rate_base = irqs;
+    }
+    
+    mod_timer(&irq_rate_timer, timer_get_ticks() + IRQ_RATE_INTERVAL);
+}
+
 /**
  * Late IRQ initialization
  */
@@ -179,9 +213,9 @@ void late_irq_init(void) {
     
     pr_debug("Late IRQ initialization\n");
     
-    // Set up default flow control for common IRQ types
-    // Initialize IRQ domains
-    // Set up interrupt controllers
+    // Start sampling interrupt rates (needs the timer wheel)
+    setup_timer(&irq_rate_timer, irq_rate_sample, 0);
+    mod_timer(&irq_rate_timer, timer_get_ticks() + IRQ_RATE_INTERVAL);
 }
 
 /**
@@ -369,7 +403,7 @@ void irq_mask(unsigned int irq) {
         desc->flow_control->mask(desc);
     }
     
-    irq_stats.masked_irqs++;
+    this_cpu_inc(irq_stats.masked_irqs);
     
     spin_unlock_irqrestore(&desc->lock, flags);
     
@@ -452,113 +486,374 @@ void irq_eoi(unsigned int irq) {
     spin_unlock_irqrestore(&desc->lock, flags);
 }
 
+/**
+ * Primary handler for request_threaded_irq() without one
+ */
+static irqreturn_t irq_default_primary_handler(unsigned int irq, void *dev_id) {
+    return IRQ_WAKE_THREAD;
+}
+
+/**
+ * Sleep until the primary handler wakes us; nonzero once told to stop
+ * The state is set before the flag is tested, so a wakeup in between
+ * is not lost
+ */
+static int irq_wait_for_interrupt(struct irq_desc *desc) {
+    for (;;) {
+        current_process->pcb.state = PROCESS_BLOCKED;
+        
+        if (kthread_should_stop()) {
+            current_process->pcb.state = PROCESS_RUNNING;
+            return -1;
+        }
+        
+        if (__sync_fetch_and_and(&desc->thread_flags, ~IRQTF_RUNTHREAD) & IRQTF_RUNTHREAD) {
+            current_process->pcb.state = PROCESS_RUNNING;
+            return 0;
+        }
+        
+        process_sleep();
+    }
+}
+
+/**
+ * Move the thread to the CPUs the IRQ was last routed to
+ */
+static void irq_thread_check_affinity(struct irq_desc *desc) {
+    struct cpumask mask;
+    unsigned long flags;
+    
+    if (!(__sync_fetch_and_and(&desc->thread_flags, ~IRQTF_AFFINITY) & IRQTF_AFFINITY)) {
+        return;
+    }
+    
+    spin_lock_irqsave(&desc->lock, flags);
+    cpumask_copy(&mask, &desc->affinity);
+    spin_unlock_irqrestore(&desc->lock, flags);
+    
+    sched_setaffinity(0, &mask);
+}
+
+/**
+ * Handler thread: runs thread_fn each time the primary handler asks,
+ * then lets a oneshot line interrupt again
+ */
+static int irq_thread(void *data) {
+    struct irq_desc *desc = data;
+    
+    while (!irq_wait_for_interrupt(desc)) {
+        irq_thread_check_affinity(desc);
+        
+        desc->thread_fn(desc->irq, desc->handler_data);
+        
+        if (desc->status & IRQ_ONESHOT_MASKED) {
+            irq_clear_status_bit(desc->irq, IRQ_ONESHOT_MASKED);
+            irq_unmask(desc->irq);
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Create the handler thread of an IRQ, not yet started
+ * It gets its own real-time priority and follows the IRQ's affinity
+ */
+static process_t *irq_setup_thread(struct irq_desc *desc, const char *name) {
+    process_t *t;
+    char comm[32];
+    
+    snprintf(comm, sizeof(comm), "irq/%d-%s", desc->irq, name);
+    t = kthread_create(irq_thread, desc, comm);
+    if (!t) {
+        return NULL;
+    }
+    
+    sched_setscheduler(t, SCHED_FIFO, IRQ_THREAD_PRIO);
+    cpumask_and(&t->cpus_allowed, &desc->affinity, cpu_possible_mask);
+    
+    return t;
+}
+
 /**
  * Request IRQ
  */
 int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
                const char *name, void *dev) {
+    return request_threaded_irq(irq, handler, NULL, flags, name, dev);
+}
+
+/**
+ * Request an IRQ whose work is split in two
+ * handler runs in hard-IRQ context and should only quiet the device;
+ * returning IRQ_WAKE_THREAD runs thread_fn in a SCHED_FIFO thread of its
+ * own. With IRQF_ONESHOT the line stays masked until thread_fn returns.
+ * A NULL handler always wakes the thread and needs IRQF_ONESHOT
+ */
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+                         irq_handler_t thread_fn, unsigned long flags,
+                         const char *name, void *dev) {
     struct irq_desc *desc;
+    process_t *thread = NULL;
     unsigned long irq_flags;
+    bool enable;
     
     if (irq >= NR_IRQS) return -EINVAL;
-    if (!handler) return -EINVAL;
+    if (!handler) {
+        // A level-triggered line would fire again before the thread ran
+        if (!thread_fn || !(flags & IRQF_ONESHOT)) return -EINVAL;
+        handler = irq_default_primary_handler;
+    }
     if (!name) name = "unknown";
     
     desc = IRQ_TO_DESC(irq);
     
+    if (thread_fn) {
+        thread = irq_setup_thread(desc, name);
+        if (!thread) return -ENOMEM;
+    }
+    
     spin_lock_irqsave(&desc->lock, irq_flags);
     
     // Check if IRQ is already in use (unless shared)
     if (!(flags & IRQF_SHARED) && desc->handle_irq) {
         spin_unlock_irqrestore(&desc->lock, irq_flags);
+        if (thread) {
+            kthread_stop(thread);
+        }
         return -EBUSY;
     }
     
     // Set handler and data
     desc->handle_irq = handler;
+    desc->thread_fn = thread_fn;
+    desc->thread = thread;
+    desc->thread_flags = 0;
+    desc->irqflags = flags;
     desc->handler_data = dev;
     desc->name = name;
     
     // Enable IRQ if not already enabled
-    if (desc->depth > 0) {
+    enable = desc->depth > 0;
+    if (enable) {
         desc->depth = 1;
-        irq_enable(irq);
     }
     
     spin_unlock_irqrestore(&desc->lock, irq_flags);
     
-    pr_info("IRQ %d: requested by %s\n", irq, name);
+    if (thread) {
+        wake_up_process(thread);
+    }
+    if (enable) {
+        irq_enable(irq);
+    }
+    
+    pr_info("IRQ %d: requested by %s%s\n", irq, name, thread ? " (threaded)" : "");
     
     return 0;
 }
 
 /**
  * Free IRQ
+ * The handler thread is told to stop and exits once it wakes
  */
 void free_irq(unsigned int irq, void *dev_id) {
     struct irq_desc *desc;
+    process_t *thread;
     unsigned long flags;
     
     if (irq >= NR_IRQS) return;
     
     desc = IRQ_TO_DESC(irq);
     
+    // Disable IRQ
+    irq_disable(irq);
+    
     spin_lock_irqsave(&desc->lock, flags);
     
     // Clear handler and data
+    thread = desc->thread;
     desc->handle_irq = NULL;
+    desc->thread_fn = NULL;
+    desc->thread = NULL;
     desc->handler_data = NULL;
     desc->name = "freed";
     
-    // Disable IRQ
-    irq_disable(irq);
-    
     spin_unlock_irqrestore(&desc->lock, flags);
     
+    if (thread) {
+        kthread_stop(thread);
+    }
+    
     pr_info("IRQ %d: freed\n", irq);
 }
 
+/**
+ * Route an IRQ to a set of CPUs
+ * The mask must include an online CPU; the chip is programmed with the
+ * online subset and the full mask is kept for CPUs that come up later
+ */
+int irq_set_affinity(unsigned int irq, const struct cpumask *mask) {
+    struct irq_desc *desc;
+    struct cpumask effective;
+    unsigned long flags;
+    int ret = 0;
+    
+    if (irq >= NR_IRQS || !mask) return -EINVAL;
+    if (!cpumask_and(&effective, mask, cpu_online_mask)) return -EINVAL;
+    
+    desc = IRQ_TO_DESC(irq);
+    
+    spin_lock_irqsave(&desc->lock, flags);
+    
+    if (desc->chip && desc->chip->set_affinity) {
+        ret = desc->chip->set_affinity(irq, &effective);
+    }
+    
+    if (ret == 0) {
+        cpumask_and(&desc->affinity, mask, cpu_possible_mask);
+        if (desc->thread) {
+            __sync_fetch_and_or(&desc->thread_flags, IRQTF_AFFINITY);
+        }
+    }
+    
+    spin_unlock_irqrestore(&desc->lock, flags);
+    
+    if (ret == 0) {
+        pr_debug("IRQ %d: affinity 0x%x\n", irq, cpumask_bits(&desc->affinity));
+    }
+    
+    return ret;
+}
+
+/**
+ * Get the CPUs an IRQ may be delivered to
+ */
+const struct cpumask *irq_get_affinity(unsigned int irq) {
+    if (irq >= NR_IRQS) return NULL;
+    
+    return &IRQ_TO_DESC(irq)->affinity;
+}
+
+/**
+ * Run the primary handler and hand off to the thread if it asks
+ * A oneshot line stays masked until the thread has run
+ */
+static void handle_irq_event(struct irq_desc *desc) {
+    irqreturn_t ret;
+    
+    if (!desc->handle_irq) {
+        desc->stats.unhandled++;
+        this_cpu_inc(irq_stats.unhandled_irqs);
+        return;
+    }
+    
+    ret = desc->handle_irq(desc->irq, desc->handler_data);
+    
+    if (ret == IRQ_WAKE_THREAD && desc->thread) {
+        if (desc->irqflags & IRQF_ONESHOT) {
+            irq_mask(desc->irq);
+            irq_set_status_bit(desc->irq, IRQ_ONESHOT_MASKED);
+        }
+        __sync_fetch_and_or(&desc->thread_flags, IRQTF_RUNTHREAD);
+        wake_up_process(desc->thread);
+    } else if (ret == IRQ_NONE) {
+        desc->stats.unhandled++;
+        desc->irqs_unhandled++;
+    }
+}
+
+static inline uint32_t ns_to_us(uint64_t ns) {
+    uint64_t us = div_u64(ns, NSEC_PER_USEC);
+    return us > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t)us;
+}
+
+static inline unsigned int irq_time_bucket(uint64_t delta_ns) {
+    uint32_t us = ns_to_us(delta_ns);
+    unsigned int bucket;
+    
+    if (!us) return 0;
+    
+    bucket = 32 - __builtin_clz(us);
+    return bucket < IRQ_HIST_BUCKETS ? bucket : IRQ_HIST_BUCKETS - 1;
+}
+
+static inline void kstat_incr_irq(struct irq_desc *desc) {
+    desc->stats.irqs++;
+    this_cpu_inc(irq_stats.total_irqs);
+    this_cpu_inc(kstat_irqs[desc->irq]);
+}
+
+/**
+ * Fold one handler run into the IRQ's histogram and longest run
+ */
+static void irq_account_time(struct irq_desc *desc, uint64_t start) {
+    uint64_t delta = sched_clock() - start;
+    
+    desc->stats.time_ns += delta;
+    desc->stats.hist[irq_time_bucket(delta)]++;
+    
+    if (delta > desc->stats.max_ns) {
+        desc->stats.max_ns = delta;
+        desc->stats.max_stamp = start;
+        desc->stats.max_cpu = smp_processor_id();
+    }
+}
+
+void irq_account_legacy(unsigned int irq, uint64_t start) {
+    struct irq_desc *desc = IRQ_TO_DESC(irq);
+    
+    kstat_incr_irq(desc);
+    irq_account_time(desc, start);
+}
+
+unsigned int kstat_irqs_cpu(unsigned int irq, unsigned int cpu) {
+    return irq < NR_IRQS ? per_cpu(kstat_irqs[irq], cpu) : 0;
+}
+
 /**
  * Main IRQ handler
  */
 void do_IRQ(unsigned int irq, struct pt_regs *regs) {
     struct irq_desc *desc;
+    uint64_t start;
     
     if (irq >= NR_IRQS) {
         pr_warn("Spurious IRQ %d\n", irq);
-        irq_stats.spurious_irqs++;
+        this_cpu_inc(irq_stats.spurious_irqs);
         return;
     }
     
     desc = IRQ_TO_DESC(irq);
     
     // Update statistics
-    desc->stats.irqs++;
-    irq_stats.total_irqs++;
+    kstat_incr_irq(desc);
     
     // Check if IRQ is disabled
     if (desc->status & IRQ_DISABLED) {
         desc->stats.unhandled++;
-        irq_stats.unhandled_irqs++;
+        this_cpu_inc(irq_stats.unhandled_irqs);
         return;
     }
     
     // Mark IRQ as in progress
     desc->status |= IRQ_INPROGRESS;
+    start = sched_clock();
     
     // Handle the IRQ
     if (desc->flow_control && desc->flow_control->handle) {
         desc->flow_control->handle(desc);
     } else if (desc->handle_irq) {
-        desc->handle_irq(irq, desc->handler_data);
+        handle_irq_event(desc);
     } else {
         desc->stats.unhandled++;
-        irq_stats.unhandled_irqs++;
+        this_cpu_inc(irq_stats.unhandled_irqs);
         pr_warn("Unhandled IRQ %d\n", irq);
     }
     
     // Clear in progress flag
     desc->status &= ~IRQ_INPROGRESS;
+    irq_account_time(desc, start);
 }
 
 /**
@@ -574,9 +869,7 @@ void handle_edge_irq(struct irq_desc *desc) {
     irq_unmask(irq);
     
     // Call the handler
-    if (desc->handle_irq) {
-        desc->handle_irq(irq, desc->handler_data);
-    }
+    handle_irq_event(desc);
     
     // End of interrupt
     irq_eoi(irq);
@@ -595,27 +888,23 @@ void handle_level_irq(struct irq_desc *desc) {
     irq_ack(irq);
     
     // Call the handler
-    if (desc->handle_irq) {
-        desc->handle_irq(irq, desc->handler_data);
-    }
+    handle_irq_event(desc);
     
     // End of interrupt
     irq_eoi(irq);
     
-    // Unmask the IRQ
-    irq_unmask(irq);
+    // Unmask the IRQ, unless it waits for its handler thread
+    if (!(desc->status & IRQ_ONESHOT_MASKED)) {
+        irq_unmask(irq);
+    }
 }
 
 /**
  * Handle simple IRQ
  */
 void handle_simple_irq(struct irq_desc *desc) {
-    unsigned int irq = desc->irq;
-    
     // Call the handler
-    if (desc->handle_irq) {
-        desc->handle_irq(irq, desc->handler_data);
-    }
+    handle_irq_event(desc);
 }
 
 /**
@@ -625,9 +914,7 @@ void handle_percpu_irq(struct irq_desc *desc) {
     unsigned int irq = desc->irq;
     
     // Call the handler
-    if (desc->handle_irq) {
-        desc->handle_irq(irq, desc->handler_data);
-    }
+    handle_irq_event(desc);
     
     // End of interrupt
     irq_eoi(irq);
@@ -677,13 +964,10 @@ int generic_irq_set_type(unsigned int irq, unsigned int type) {
 }
 
 int generic_irq_set_affinity(unsigned int irq, const struct cpumask *dest) {
-    struct irq_desc *desc = IRQ_TO_DESC(irq);
-    
-    if (!desc->chip || !desc->chip->set_affinity) {
-        return -ENOTSUPP;
-    }
-    
-    return desc->chip->set_affinity(irq, dest);
+    // The generic chip has no routing hardware: all its IRQs arrive on
+    // the boot CPU, which is always a housekeeping CPU. Calling back
+    // into desc->chip here would recurse into this function.
+    return cpumask_test_cpu(0, dest) ? 0 : -EINVAL;
 }
 
 void generic_irq_retrigger(unsigned int irq) {
@@ -750,6 +1034,7 @@ void percpu_irq_retrigger(struct irq_desc *desc) { generic_irq_retrigger(desc->i
  */
 void irq_print_stats(unsigned int irq) {
     struct irq_desc *desc;
+    unsigned int cpu;
     
     if (irq >= NR_IRQS) return;
     
@@ -761,18 +1046,105 @@ void irq_print_stats(unsigned int irq) {
     printk("  Unhandled: %u\n", desc->stats.unhandled);
     printk("  Retriggered: %u\n", desc->stats.retriggered);
     printk("  Missed: %u\n", desc->stats.missed);
+    printk("  Rate: %u/s\n", desc->stats.rate);
+    printk("  Handler time: %u us\n", ns_to_us(desc->stats.time_ns));
+    printk("  Longest: %u us on CPU %u at %u ms\n",
+           ns_to_us(desc->stats.max_ns), desc->stats.max_cpu,
+           (uint32_t)div_u64(desc->stats.max_stamp, NSEC_PER_MSEC));
+    
+    for_each_online_cpu(cpu) {
+        printk("  CPU%u: %u\n", cpu, kstat_irqs_cpu(irq, cpu));
+    }
+    
+    // Bucket n holds runs of [2^(n-1), 2^n) us
+    for (int i = 0; i < IRQ_HIST_BUCKETS; i++) {
+        if (desc->stats.hist[i]) {
+            printk("  <%u us: %u\n", 1U << i, desc->stats.hist[i]);
+        }
+    }
+}
+
+static void print_field(uint32_t value) {
+    screen_print(" ");
+    screen_print_dec(value);
+}
+
+/**
+ * Dump per-IRQ statistics in a line-oriented, machine-readable format
+ * Times are in microseconds, max_at in milliseconds since boot
+ *
+ *   version <n>
+ *   cpus <online CPU ids>
+ *   irq <n> <count per online CPU> rate time max max_cpu max_at chip name
+ *   irq<n>_hist <IRQ_HIST_BUCKETS handler run-time counts>
+ *
+ * IRQs that never fired are left out
+ */
+void irqstat_show(void) {
+    unsigned int cpu;
+    
+    screen_print("version");
+    print_field(IRQSTAT_VERSION);
+    screen_print("\ncpus");
+    for_each_online_cpu(cpu) {
+        print_field(cpu);
+    }
+    screen_print("\n");
+    
+    for (unsigned int i = 0; i < NR_IRQS; i++) {
+        struct irq_desc *desc = IRQ_TO_DESC(i);
+        struct irq_desc_stats *st = &desc->stats;
+        
+        if (!st->irqs) continue;
+        
+        screen_print("irq");
+        print_field(i);
+        for_each_online_cpu(cpu) {
+            print_field(kstat_irqs_cpu(i, cpu));
+        }
+        print_field(st->rate);
+        print_field(ns_to_us(st->time_ns));
+        print_field(ns_to_us(st->max_ns));
+        print_field(st->max_cpu);
+        print_field((uint32_t)div_u64(st->max_stamp, NSEC_PER_MSEC));
+        screen_print(" ");
+        screen_print(desc->chip && desc->chip->name ? desc->chip->name : "-");
+        screen_print(" ");
+        screen_print(desc->name ? desc->name : "-");
+        
+        screen_print("\nirq");
+        screen_print_dec(i);
+        screen_print("_hist");
+        for (int b = 0; b < IRQ_HIST_BUCKETS; b++) {
+            print_field(st->hist[b]);
+        }
+        screen_print("\n");
+    }
 }
 
 /**
  * Debug show all IRQs
  */
 void irq_debug_show(void) {
+    struct irq_cpu_stats sum = {0};
+    unsigned int cpu;
+    
+    for_each_online_cpu(cpu) {
+        struct irq_cpu_stats *st = per_cpu_ptr(&irq_stats, cpu);
+        
+        sum.total_irqs += st->total_irqs;
+        sum.spurious_irqs += st->spurious_irqs;
+        sum.unhandled_irqs += st->unhandled_irqs;
+        sum.disabled_irqs += st->disabled_irqs;
+        sum.masked_irqs += st->masked_irqs;
+    }
+    
     printk("=== IRQ Statistics ===\n");
-    printk("Total IRQs: %u\n", irq_stats.total_irqs);
-    printk("Spurious IRQs: %u\n", irq_stats.spurious_irqs);
-    printk("Unhandled IRQs: %u\n", irq_stats.unhandled_irqs);
-    printk("Disabled IRQs: %u\n", irq_stats.disabled_irqs);
-    printk("Masked IRQs: %u\n", irq_stats.masked_irqs);
+    printk("Total IRQs: %u\n", sum.total_irqs);
+    printk("Spurious IRQs: %u\n", sum.spurious_irqs);
+    printk("Unhandled IRQs: %u\n", sum.unhandled_irqs);
+    printk("Disabled IRQs: %u\n", sum.disabled_irqs);
+    printk("Masked IRQs: %u\n", sum.masked_irqs);
     printk("\n");
     
     for (int i = 0; i < NR_IRQS; i++) {
@@ -0,0 +1,88 @@
+#include "sched_isolation.h"
+#include "kernel.h"
+#include "printk.h"
+
+/**
+ * CPU Isolation Implementation
+ * Housekeeping CPUs are every possible CPU not named in isolcpus=
+ */
+
+static struct cpumask housekeeping_mask = CPU_MASK_ALL;
+
+/**
+ * Find "name" as a whole word in the command line and return its value
+ */
+static const char *cmdline_find_option(const char *cmdline, const char *name) {
+    const char *p = cmdline;
+
+    while (p && *p) {
+        const char *n = name;
+        const char *q = p;
+
+        while (*n && *q == *n) {
+            q++;
+            n++;
+        }
+        if (!*n) {
+            return q;
+        }
+
+        // Skip to the next word
+        while (*p && *p != ' ') p++;
+        while (*p == ' ') p++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Parse isolcpus=<cpu-list> from the boot command line
+ */
+void housekeeping_init(const char *cmdline) {
+    const char *arg = cmdline_find_option(cmdline, "isolcpus=");
+    struct cpumask isolated;
+
+    if (!arg) {
+        return;
+    }
+
+    if (cpulist_parse(arg, &isolated) < 0) {
+        pr_warn("isolcpus: invalid CPU list, ignored\n");
+        return;
+    }
+
+    // The boot CPU runs init and the tick until secondaries come up
+    if (cpumask_test_cpu(0, &isolated)) {
+        pr_warn("isolcpus: boot CPU 0 cannot be isolated\n");
+        cpumask_clear_cpu(0, &isolated);
+    }
+
+    cpumask_andnot(&housekeeping_mask, cpu_possible_mask, &isolated);
+    pr_info("isolcpus: housekeeping CPUs 0x%x, isolated 0x%x\n",
+            cpumask_bits(&housekeeping_mask), cpumask_bits(&isolated));
+}
+
+const struct cpumask *housekeeping_cpumask(void) {
+    return &housekeeping_mask;
+}
+
+bool housekeeping_cpu(unsigned int cpu) {
+    return cpumask_test_cpu(cpu, &housekeeping_mask);
+}
+
+/**
+ * An online housekeeping CPU to hand unbound work to
+ */
+unsigned int housekeeping_any_cpu(void) {
+    struct cpumask mask;
+
+    if (housekeeping_cpu(smp_processor_id())) {
+        return smp_processor_id();
+    }
+
+    if (cpumask_and(&mask, &housekeeping_mask, cpu_online_mask)) {
+        return cpumask_first(&mask);
+    }
+
+    return smp_processor_id();
+}
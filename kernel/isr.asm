@@ -20,15 +20,6 @@ isr%1:
     jmp isr_common_stub
 %endmacro
 
-; Macro to create IRQ handler
-%macro IRQ 2
-global irq%1
-irq%1:
-    push 0      ; Push dummy error code
-    push %2     ; Push interrupt number
-    jmp irq_common_stub
-%endmacro
-
 ; Exception handlers (no error code)
 ISR_NOERR 0     ; Division by zero
 ISR_NOERR 1     ; Debug
@@ -53,23 +44,28 @@ ISR_ERR 17      ; Alignment check
 ISR_NOERR 18    ; Machine check
 ISR_NOERR 19    ; SIMD floating-point exception
 
-; IRQ handlers
-IRQ 0, 32       ; Timer
-IRQ 1, 33       ; Keyboard
-IRQ 2, 34       ; Cascade
-IRQ 3, 35       ; COM2/COM4
-IRQ 4, 36       ; COM1/COM3
-IRQ 5, 37       ; LPT2
-IRQ 6, 38       ; Floppy
-IRQ 7, 39       ; LPT1
-IRQ 8, 40       ; RTC
-IRQ 9, 41       ; Free
-IRQ 10, 42      ; Free
-IRQ 11, 43      ; Free
-IRQ 12, 44      ; Mouse
-IRQ 13, 45      ; FPU
-IRQ 14, 46      ; ATA1
-IRQ 15, 47      ; ATA2
+; Entry stubs for every vector past the exceptions; irq_handler() maps
+; the vector to an IRQ (fixed for the 8259, allocated for the I/O APIC)
+FIRST_EXTERNAL_VECTOR equ 0x20
+NR_VECTORS equ 256
+
+%assign vec FIRST_EXTERNAL_VECTOR
+%rep NR_VECTORS - FIRST_EXTERNAL_VECTOR
+irq_vector_%[vec]:
+    push 0      ; Push dummy error code
+    push vec    ; Push vector number
+    jmp irq_common_stub
+%assign vec vec + 1
+%endrep
+
+; Stub addresses indexed by vector - FIRST_EXTERNAL_VECTOR
+global irq_entries
+irq_entries:
+%assign vec FIRST_EXTERNAL_VECTOR
+%rep NR_VECTORS - FIRST_EXTERNAL_VECTOR
+    dd irq_vector_%[vec]
+%assign vec vec + 1
+%endrep
 
 ; Common interrupt handler stub
 extern exception_handler
@@ -87,8 +83,10 @@ isr_common_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
     mov gs, ax
+    ; Per-CPU segment (__KERNEL_PERCPU)
+    mov ax, 0x30
+    mov fs, ax
     
     ; Call exception handler
     call exception_handler
@@ -118,11 +116,15 @@ irq_common_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
     mov gs, ax
+    ; Per-CPU segment (__KERNEL_PERCPU)
+    mov ax, 0x30
+    mov fs, ax
     
-    ; Call IRQ handler
+    ; Call IRQ handler with the vector pushed by the entry stub
+    push dword [esp + 48]
     call irq_handler
+    add esp, 4
     
     ; Restore registers
     pop gs
@@ -136,3 +138,105 @@ irq_common_stub:
     
     ; Return from interrupt
     iret
+
+; System call entry; both paths save a struct pt_regs (syscall.h) and
+; call do_syscall(), which leaves the result in the saved EAX
+global system_call
+global sysenter_entry
+global ret_from_fork
+extern do_syscall
+extern sysenter_bad_frame
+extern schedule_tail
+
+%macro SAVE_ALL 0
+    push eax    ; orig_ax: the system call number
+    push gs
+    push fs
+    push es
+    push ds
+    push eax
+    push ebp
+    push edi
+    push esi
+    push edx
+    push ecx
+    push ebx
+    
+    ; Load kernel data segment
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov gs, ax
+    ; Per-CPU segment (__KERNEL_PERCPU)
+    mov ax, 0x30
+    mov fs, ax
+%endmacro
+
+%macro RESTORE_ALL 0
+    pop ebx
+    pop ecx
+    pop edx
+    pop esi
+    pop edi
+    pop ebp
+    pop eax
+    pop ds
+    pop es
+    pop fs
+    pop gs
+    add esp, 4  ; orig_ax
+%endmacro
+
+; int 0x80: the CPU pushed the interrupt frame
+system_call:
+    SAVE_ALL
+    push esp
+    call do_syscall
+    add esp, 4
+    RESTORE_ALL
+    iret
+
+; SYSENTER: CS, EIP and ESP come from the MSRs, IF is clear and nothing
+; was pushed. ESP points at this CPU's tss.esp0, EBP at the user stack
+; with the return address on top
+sysenter_entry:
+    mov esp, [esp]
+    
+    ; Build the frame int 0x80 would have
+    push dword 0x23         ; ss (__USER_DS)
+    push ebp                ; sp, past the return address
+    add dword [esp], 4
+    pushfd
+    or dword [esp], 0x200   ; IF, always set in user mode
+    push dword 0x1B         ; cs (__USER_CS)
+    
+    ; The return address is read only if EBP and the four bytes at it
+    ; lie below KERNEL_VIRTUAL_BASE
+    cmp ebp, 0xC0000000 - 4
+    ja .bad_frame
+    push dword [ebp]        ; ip
+    
+    SAVE_ALL
+    push esp
+    call do_syscall
+    add esp, 4
+    RESTORE_ALL
+    
+    ; SYSEXIT resumes at EDX on stack ECX
+    mov edx, [esp]          ; ip
+    mov ecx, [esp + 12]     ; sp
+    sti                     ; Takes effect after SYSEXIT
+    sysexit
+
+.bad_frame:
+    push dword 0            ; ip: there is none to resume at
+    SAVE_ALL
+    push esp
+    call sysenter_bad_frame ; Does not return
+
+; First code a forked task runs: its stack holds a copy of the parent's
+; frame with EAX cleared, left the int 0x80 way whichever way it entered
+ret_from_fork:
+    call schedule_tail
+    RESTORE_ALL
+    iret
@@ -2,6 +2,28 @@
 #include "../include/screen.h"
 #include "../include/keyboard.h"
 #include "../include/mm.h"
+#include "../include/clocksource.h"
+#include "../include/futex.h"
+#include "../include/sched_stats.h"
+#include "../include/sched_pelt.h"
+#include "../include/sched_group.h"
+#include "../include/rtmutex.h"
+#include "../include/sched_isolation.h"
+#include "../include/gdt.h"
+#include "../include/smp.h"
+#include "../include/rcupdate.h"
+#include "../include/idr.h"
+#include "../include/slab.h"
+#include "../include/kstack.h"
+#include "../include/irq.h"
+#include "../include/softirq.h"
+#include "../include/workqueue.h"
+#include "../include/kthread.h"
+#include "../include/pci.h"
+#include "../include/syscall.h"
+#include "../include/vdso.h"
+#include "../include/wait.h"
+#include "../include/timer.h"
 
 /**
  * SolixOS Kernel Implementation
@@ -9,10 +31,21 @@
  */
 
 // Kernel state
-process_t* current_process = NULL;
-uint32_t next_pid = 1;
-static process_t process_table[MAX_PROCESSES];
-static uint32_t process_bitmap[(MAX_PROCESSES + 31) / 32];
+DEFINE_PER_CPU(process_t*, current_task);
+
+// PID to process map; lookups are lockless under RCU
+static DEFINE_IDR(pid_idr);
+
+// Every live process, RCU-protected; writers hold tasklist_lock
+LIST_HEAD(task_list);
+static DEFINE_SPINLOCK(tasklist_lock);
+uint32_t nr_processes;
+
+// Task being switched away from, for schedule_tail() on the new stack
+static DEFINE_PER_CPU(process_t*, switch_prev);
+
+// Boot command line passed by the bootloader
+const char* boot_command_line = "";
 
 // Debug state
 struct debug_info debug_state = {
@@ -47,6 +80,11 @@ typedef struct multiboot_info {
  * Kernel entry point with enhanced initialization
  */
 void kmain(multiboot_info_t* mb_info) {
+    // Multiboot flag bit 2: cmdline is valid
+    if (mb_info && (mb_info->flags & 0x04) && mb_info->cmdline) {
+        boot_command_line = (const char*)mb_info->cmdline;
+    }
+    
     // Record boot time
     kernel_stats.boot_time = kernel_get_timestamp();
     
@@ -71,7 +109,7 @@ void kmain(multiboot_info_t* mb_info) {
     screen_print_dec(mb_info ? (mb_info->mem_lower + mb_info->mem_upper) : 128);
     screen_print(" MB\n");
     screen_print("Processes: ");
-    screen_print_dec(MAX_PROCESSES);
+    screen_print_dec(PID_MAX_DEFAULT - 1);
     screen_print(" max\n");
     
     // Start the shell
@@ -86,6 +124,11 @@ void kmain(multiboot_info_t* mb_info) {
  * Initialize all kernel subsystems with enhanced error handling
  */
 void kernel_init(void) {
+    // Per-CPU areas, then the boot CPU's GDT whose %fs segment maps them;
+    // nothing may touch a per-CPU variable before this
+    setup_per_cpu_areas();
+    gdt_init_cpu(0, 0);
+
     debug_print(DEBUG_INFO, "Initializing kernel subsystems...");
     screen_print("[*] Initializing kernel subsystems...\n");
 
@@ -93,9 +136,8 @@ void kernel_init(void) {
     debug_init();
     screen_print("[+] Debug system initialized\n");
 
-    // Initialize process management
-    process_init();
-    screen_print("[+] Process management initialized\n");
+    // Isolated CPUs must be known before init's affinity is set
+    housekeeping_init(boot_command_line);
 
     // Initialize memory management with validation
     mm_init();
@@ -104,9 +146,34 @@ void kernel_init(void) {
     }
     screen_print("[+] Memory management initialized\n");
 
+    // Object caches on top of the heap; processes come from pid_cache
+    kmem_cache_init();
+
+    // Initialize process management (kernel stacks need paging)
+    process_init();
+    tss_set_kernel_stack(0, current_process->pcb.kernel_stack + KERNEL_STACK_SIZE);
+    screen_print("[+] Process management initialized\n");
+
+    // Tasklet lists and ksoftirqd threads; handlers raise softirqs from
+    // the first interrupt on
+    softirq_init();
+
+    // RCU callback lists must be ready before the first tick
+    rcu_init();
+
+    // Worker pools for deferred process-context work
+    workqueue_init();
+
+    // IRQ descriptors for request_irq(); handler threads need processes
+    irq_init();
+    
     // Initialize interrupt system
     interrupts_init();
-    screen_print("[+] Interrupt system initialized\n");
+    if (syscall_init_cpu(0)) {
+        screen_print("[+] Interrupt system initialized (SYSENTER enabled)\n");
+    } else {
+        screen_print("[+] Interrupt system initialized\n");
+    }
 
     // Initialize filesystem
     vfs_init();
@@ -117,10 +184,36 @@ void kernel_init(void) {
     keyboard_init();
     screen_print("[+] Hardware drivers initialized\n");
 
+    // Initialize timekeeping (calibrates the TSC against the PIT)
+    timekeeping_init();
+    screen_print("[+] Clocksources and high-resolution timers initialized\n");
+
+    // User-readable clock, kept current by the tick from here on
+    vdso_init();
+
+    // Periodic slab reaping runs from the system workqueue
+    kmem_cache_init_late();
+
+    // Per-IRQ rate sampling runs off the timer wheel
+    late_irq_init();
+
+    // Initialize futex hash table
+    futex_init();
+
+    // Initialize task groups (needs hrtimers for bandwidth periods)
+    sched_group_init();
+
     // Enable interrupts
     __asm__ volatile("sti");
     screen_print("[+] Interrupts enabled\n");
 
+    // Start the other CPUs (startup delays need a running clock)
+    smp_init();
+
+    // Enumerate PCI once the APICs are set up, so MSI can be used
+    pci_init();
+    screen_print("[+] PCI bus enumerated\n");
+
     screen_print("[*] Kernel initialization complete\n\n");
     debug_print(DEBUG_INFO, "All kernel subsystems operational");
 }
@@ -170,121 +263,902 @@ void panic(const char* msg) {
     }
 }
 
-// Process initialization
-void process_init(void) {
-    // Clear process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].pcb.state = PROCESS_TERMINATED;
+// Scheduler bookkeeping on process state transitions
+static void task_queued(process_t* proc, bool wakeup) {
+    if (wakeup) {
+        task_group_place(proc);
+    }
+    update_task_load(proc, true, false);
+    sched_info_queued(proc, wakeup);
+}
+
+static void task_arrive(process_t* proc) {
+    proc->se.exec_start = sched_clock();
+    update_task_load(proc, true, true);
+    sched_info_arrive(proc);
+}
+
+static void task_depart(process_t* proc, bool voluntary) {
+    task_group_charge(proc);
+    update_task_load(proc, !voluntary, false);
+    sched_info_depart(proc, voluntary);
+}
+
+// Allocate a zeroed process with a PID and kernel stack; it stays
+// invisible to lookups until attach_process()
+process_t* alloc_process(void) {
+    process_t* proc = kmem_cache_alloc(pid_cache, GFP_KERNEL);
+    int pid;
+    
+    if (!proc) {
+        return NULL;
     }
+    memset(proc, 0, sizeof(*proc));
+    proc->usage = 1;
     
-    // Clear bitmap
-    for (int i = 0; i < (MAX_PROCESSES + 31) / 32; i++) {
-        process_bitmap[i] = 0;
+    // Reserve the PID now, publish the pointer once initialized
+    pid = idr_alloc_cyclic(&pid_idr, NULL, 1, PID_MAX_DEFAULT);
+    if (pid < 0) {
+        kmem_cache_free(pid_cache, proc);
+        return NULL;
     }
+    proc->pcb.pid = pid;
     
-    // Create init process (PID 1)
-    current_process = &process_table[0];
-    current_process->pcb.pid = next_pid++;
-    current_process->pcb.ppid = 0;
-    current_process->pcb.state = PROCESS_RUNNING;
-    current_process->pcb.kernel_stack = (uint32_t)kmalloc(KERNEL_STACK_SIZE);
-    current_process->pcb.user_stack = 0x7FFFF000; // Top of user space
-    
-    // Mark PID 1 as used
-    process_bitmap[0] |= 0x01;
-}
-
-// Find free PID
-static uint32_t find_free_pid(void) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        uint32_t bitmap_index = i / 32;
-        uint32_t bit_index = i % 32;
-        
-        if (!(process_bitmap[bitmap_index] & (1 << bit_index))) {
-            process_bitmap[bitmap_index] |= (1 << bit_index);
-            return i;
+    proc->pcb.kernel_stack = alloc_kernel_stack();
+    if (!proc->pcb.kernel_stack) {
+        idr_remove(&pid_idr, pid);
+        kmem_cache_free(pid_cache, proc);
+        return NULL;
+    }
+    
+    return proc;
+}
+
+// Make a fully initialized process visible by PID and on the task list
+void attach_process(process_t* proc) {
+    unsigned long flags;
+    
+    idr_replace(&pid_idr, proc, proc->pcb.pid);
+    
+    spin_lock_irqsave(&tasklist_lock, flags);
+    list_add_tail_rcu(&proc->tasks, &task_list);
+    nr_processes++;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+}
+
+// Hide a terminated process from lookups and the scheduler
+static void detach_process(process_t* proc) {
+    unsigned long flags;
+    
+    spin_lock_irqsave(&tasklist_lock, flags);
+    list_del_rcu(&proc->tasks);
+    nr_processes--;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    
+    idr_remove(&pid_idr, proc->pcb.pid);
+}
+
+// Drop a task's references to its shared resources; the last user of
+// each frees it
+static void mmput(struct mm_struct* mm) {
+    if (mm && __sync_sub_and_fetch(&mm->mm_users, 1) == 0) {
+        kmem_cache_free(mm_struct_cache, mm);
+    }
+}
+
+static void put_files_struct(struct files_struct* files) {
+    if (files && __sync_sub_and_fetch(&files->count, 1) == 0) {
+        kmem_cache_free(files_cache, files);
+    }
+}
+
+static void put_sighand(struct sighand_struct* sighand) {
+    if (sighand && __sync_sub_and_fetch(&sighand->count, 1) == 0) {
+        kmem_cache_free(sighand_cache, sighand);
+    }
+}
+
+static void exit_task_resources(process_t* proc) {
+    mmput(proc->mm);
+    put_files_struct(proc->files);
+    put_sighand(proc->sighand);
+    proc->mm = NULL;
+    proc->files = NULL;
+    proc->sighand = NULL;
+}
+
+static void free_process_rcu(struct rcu_head* head) {
+    process_t* proc = container_of(head, process_t, rcu);
+    
+    exit_task_resources(proc);
+    free_kernel_stack(proc->pcb.kernel_stack);
+    kmem_cache_free(pid_cache, proc);
+}
+
+// Free a detached process that no CPU is running, once lockless
+// walkers of the task list and PID map are done with it
+// A task killed in its sleep is still linked in from its own stack: on
+// a wait queue or futex, behind a timer, or as an rt_mutex waiter. It
+// is off every CPU by now, so nothing else moves those entries
+static void unlink_task_waits(process_t* proc) {
+    remove_wait_queue_task(proc);
+    futex_remove_task(proc);
+    if (proc->sleep_timer) {
+        del_timer_sync(proc->sleep_timer);
+        proc->sleep_timer = NULL;
+    }
+    rt_mutex_remove_task(proc);
+}
+
+static void free_process(process_t* proc) {
+    unlink_task_waits(proc);
+    put_task_struct(proc);
+}
+
+// Keep a process_t that may exit meanwhile from being freed; the
+// caller must know it is still live when taking the reference
+void get_task_struct(process_t* proc) {
+    __sync_add_and_fetch(&proc->usage, 1);
+}
+
+// The last reference, normally the exit path's, frees it after RCU
+void put_task_struct(process_t* proc) {
+    if (__sync_sub_and_fetch(&proc->usage, 1) == 0) {
+        call_rcu(&proc->rcu, free_process_rcu);
+    }
+}
+
+// Undo alloc_process() for a process that was never attached
+static void free_unattached_process(process_t* proc) {
+    exit_task_resources(proc);
+    idr_remove(&pid_idr, proc->pcb.pid);
+    free_kernel_stack(proc->pcb.kernel_stack);
+    kmem_cache_free(pid_cache, proc);
+}
+
+// Share or copy the creator's address space. There are no per-process
+// page tables yet, so a copy starts out on the same directory. A kernel
+// thread has none to share, so its child gets one on the kernel's
+static int copy_mm(uint32_t clone_flags, process_t* proc, process_t* parent) {
+    struct mm_struct* mm;
+    
+    if ((clone_flags & CLONE_VM) && parent && parent->mm) {
+        proc->mm = parent->mm;
+        __sync_fetch_and_add(&proc->mm->mm_users, 1);
+        return 0;
+    }
+    
+    mm = kmem_cache_alloc(mm_struct_cache, GFP_KERNEL);
+    if (!mm) {
+        return -ENOMEM;
+    }
+    mm->mm_users = 1;
+    if (parent && parent->mm) {
+        mm->pgd = parent->mm->pgd;
+    } else {
+        __asm__ volatile("mov %%cr3, %0" : "=r" (mm->pgd));
+    }
+    proc->mm = mm;
+    return 0;
+}
+
+// Share the creator's descriptor table or duplicate its open files
+static int copy_files(uint32_t clone_flags, process_t* proc, process_t* parent) {
+    struct files_struct* files;
+    unsigned long flags;
+    
+    if ((clone_flags & CLONE_FILES) && parent && parent->files) {
+        proc->files = parent->files;
+        __sync_fetch_and_add(&proc->files->count, 1);
+        return 0;
+    }
+    
+    files = kmem_cache_alloc(files_cache, GFP_KERNEL);
+    if (!files) {
+        return -ENOMEM;
+    }
+    memset(files, 0, sizeof(*files));
+    files->count = 1;
+    spin_lock_init(&files->file_lock);
+    
+    if (parent && parent->files) {
+        spin_lock_irqsave(&parent->files->file_lock, flags);
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            files->fd_array[i] = parent->files->fd_array[i];
+            if (files->fd_array[i].inode) {
+                files->fd_array[i].ref_count++;
+            }
         }
+        spin_unlock_irqrestore(&parent->files->file_lock, flags);
     }
-    return 0; // No free PIDs
+    
+    proc->files = files;
+    return 0;
 }
 
-// Create new process
-uint32_t process_create(void) {
-    uint32_t index = find_free_pid();
-    if (index == 0) {
-        return 0; // No free process slots
+// Share the creator's signal handlers or start from its current set
+static int copy_sighand(uint32_t clone_flags, process_t* proc, process_t* parent) {
+    struct sighand_struct* sighand;
+    unsigned long flags;
+    
+    if ((clone_flags & CLONE_SIGHAND) && parent && parent->sighand) {
+        proc->sighand = parent->sighand;
+        __sync_fetch_and_add(&proc->sighand->count, 1);
+        return 0;
     }
     
-    process_t* proc = &process_table[index];
+    sighand = kmem_cache_alloc(sighand_cache, GFP_KERNEL);
+    if (!sighand) {
+        return -ENOMEM;
+    }
+    memset(sighand, 0, sizeof(*sighand));
+    sighand->count = 1;
+    spin_lock_init(&sighand->siglock);
+    
+    if (parent && parent->sighand) {
+        spin_lock_irqsave(&parent->sighand->siglock, flags);
+        memcpy(sighand->action, parent->sighand->action, sizeof(sighand->action));
+        spin_unlock_irqrestore(&parent->sighand->siglock, flags);
+    }
+    
+    proc->sighand = sighand;
+    return 0;
+}
+
+// First code a kernel thread runs once switched to
+static void kthread_entry(void) {
+    process_t* self = current_process;
+    
+    schedule_tail();
+    local_irq_enable();
+    process_exit(self->kthread_fn(self->kthread_data));
+}
+
+// First code CPU 0's idle task runs, once init blocks with nothing ready
+static void idle_entry(void) {
+    schedule_tail();
+    local_irq_enable();
+    cpu_idle_loop();
+}
+
+// Make a task that has never run start at entry on an empty kernel stack
+static void prepare_task_stack(process_t* proc, void (*entry)(void)) {
+    uint32_t* sp = (uint32_t*)(proc->pcb.kernel_stack + KERNEL_STACK_SIZE);
+    
+    *--sp = 0;              // entry never returns
+    proc->pcb.esp = (uint32_t)sp;
+    proc->pcb.ebp = 0;      // Ends stack traces
+    proc->pcb.eip = (uint32_t)entry;
+}
+
+// Build a task from the current one; fn makes it a kernel thread with
+// no user resources, otherwise regs is the system call frame the child
+// returns through. The result is initialized but not yet attached
+static process_t* copy_process(uint32_t clone_flags, uint32_t user_stack,
+                               struct pt_regs* regs,
+                               int (*fn)(void* data), void* data) {
+    process_t* parent = current_process;
+    process_t* proc = alloc_process();
     
-    // Initialize PCB
-    proc->pcb.pid = next_pid++;
-    proc->pcb.ppid = current_process->pcb.pid;
+    if (!proc) {
+        return NULL; // Out of PIDs or memory
+    }
+    
+    // Initialize PCB; a thread joins its creator's group and parent
+    if (clone_flags & CLONE_THREAD) {
+        proc->pcb.tgid = parent->pcb.tgid;
+        proc->pcb.ppid = parent->pcb.ppid;
+    } else {
+        proc->pcb.tgid = proc->pcb.pid;
+        proc->pcb.ppid = parent->pcb.pid;
+    }
     proc->pcb.state = PROCESS_READY;
-    proc->pcb.kernel_stack = (uint32_t)kmalloc(KERNEL_STACK_SIZE);
-    proc->pcb.user_stack = 0x7FFFF000;
     proc->pcb.exit_code = 0;
     
-    // Initialize file descriptor table
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        proc->fd_table[i].inode = 0;
+    if (fn) {
+        // Runs kthread_entry() on its own kernel stack
+        proc->flags = PF_KTHREAD;
+        proc->kthread_fn = fn;
+        proc->kthread_data = data;
+        prepare_task_stack(proc, kthread_entry);
+        proc->pcb.cr3 = parent->pcb.cr3;
+    } else {
+        proc->pcb.user_stack = user_stack ? user_stack : parent->pcb.user_stack;
+        if (copy_mm(clone_flags, proc, parent) < 0 ||
+            copy_files(clone_flags, proc, parent) < 0 ||
+            copy_sighand(clone_flags, proc, parent) < 0) {
+            free_unattached_process(proc);
+            return NULL;
+        }
+        proc->pcb.cr3 = proc->mm->pgd;
+        
+        // The child leaves the same system call with EAX = 0. One created
+        // from inside the kernel has no frame to return through and is
+        // never picked
+        if (regs) {
+            struct pt_regs* child = (struct pt_regs*)(proc->pcb.kernel_stack +
+                                                      KERNEL_STACK_SIZE) - 1;
+            
+            *child = *regs;
+            child->ax = 0;
+            if (user_stack) {
+                child->sp = user_stack;
+            }
+            proc->pcb.esp = (uint32_t)child;
+            proc->pcb.eip = (uint32_t)ret_from_fork;
+        }
     }
     
+    // Inherit the scheduling policy, but not a PI boost; kernel threads
+    // start as ordinary fair tasks on the housekeeping CPUs
+    if (fn) {
+        proc->policy = SCHED_NORMAL;
+        proc->normal_prio = DEFAULT_PRIO;
+        cpumask_copy(&proc->cpus_allowed, housekeeping_cpumask());
+    } else {
+        proc->policy = parent->policy;
+        proc->normal_prio = parent->normal_prio;
+        cpumask_copy(&proc->cpus_allowed, &parent->cpus_allowed);
+    }
+    rt_mutex_init_task(proc);
+    
     // Set current working directory to root
     proc->cwd_inode = 1;
     
+    sched_info_init(proc);
+    pelt_init_task(proc);
+    sched_group_fork(proc, fn ? NULL : parent);
+    
+    return proc;
+}
+
+// Process initialization
+void process_init(void) {
+    uint32_t idle_stack;
+    
+    pelt_init();
+    
+    // Create init process (PID 1)
+    process_t* init = alloc_process();
+    if (!init) {
+        panic("Cannot allocate the init process");
+    }
+    if (copy_mm(0, init, NULL) < 0 || copy_files(0, init, NULL) < 0 ||
+        copy_sighand(0, init, NULL) < 0) {
+        panic("Cannot allocate the init process");
+    }
+    init->pcb.ppid = 0;
+    init->pcb.tgid = init->pcb.pid;
+    init->pcb.cr3 = init->mm->pgd;
+    init->pcb.state = PROCESS_RUNNING;
+    init->pcb.user_stack = 0x7FFFF000; // Top of user space
+    init->policy = SCHED_NORMAL;
+    init->normal_prio = DEFAULT_PRIO;
+    rt_mutex_init_task(init);
+    cpumask_copy(&init->cpus_allowed, housekeeping_cpumask());
+    sched_info_init(init);
+    pelt_init_task(init);
+    sched_group_fork(init, NULL);
+    task_arrive(init);
+    attach_process(init);
+    init->on_cpu = true;
+    this_cpu_write(current_task, init);
+    
+    // CPU 0's idle task runs whenever nothing else is ready
+    idle_stack = alloc_kernel_stack();
+    if (!idle_stack) {
+        panic("Cannot allocate the idle task");
+    }
+    init_idle(0, idle_stack);
+    prepare_task_stack(idle_task(0), idle_entry);
+}
+
+// Create a task sharing what clone_flags name with the current one;
+// user_stack, if set, is where the new task's user stack starts, and
+// regs is the caller's system call frame (NULL from inside the kernel).
+// Returns its PID, or -EINVAL/-ENOMEM
+int do_clone(uint32_t clone_flags, uint32_t user_stack, struct pt_regs* regs) {
+    process_t* proc;
+    
+    // Shared handlers only make sense in a shared address space, and a
+    // thread group shares its handlers
+    if ((clone_flags & CLONE_SIGHAND) && !(clone_flags & CLONE_VM)) {
+        return -EINVAL;
+    }
+    if ((clone_flags & CLONE_THREAD) && !(clone_flags & CLONE_SIGHAND)) {
+        return -EINVAL;
+    }
+    
+    proc = copy_process(clone_flags, user_stack, regs, NULL, NULL);
+    if (!proc) {
+        return -ENOMEM;
+    }
+    
+    task_queued(proc, false);
+    attach_process(proc);
+    
     return proc->pcb.pid;
 }
 
+// Create new process
+uint32_t process_create(void) {
+    int pid = do_clone(0, 0, NULL);
+    
+    return pid < 0 ? 0 : pid;
+}
+
+// Create a kernel thread running fn(data); it starts blocked, so the
+// caller finishes setting it up before wake_up_process()
+process_t* kernel_thread(int (*fn)(void* data), void* data) {
+    process_t* proc = copy_process(0, 0, NULL, fn, data);
+    
+    if (!proc) {
+        return NULL;
+    }
+    
+    proc->pcb.state = PROCESS_BLOCKED;
+    attach_process(proc);
+    
+    return proc;
+}
+
 // Process exit
 void process_exit(uint32_t exit_code) {
+    bool killed;
+    
     if (!current_process) return;
     
-    current_process->pcb.exit_code = exit_code;
+    // A tick must not switch away before the process is detached
+    local_irq_disable();
+    
+    // process_kill() may have got here first and detached it already
+    spin_lock(&tasklist_lock);
+    killed = current_process->pcb.state == PROCESS_TERMINATED;
     current_process->pcb.state = PROCESS_TERMINATED;
+    spin_unlock(&tasklist_lock);
+    if (killed) {
+        process_schedule();
+    }
     
-    // Free kernel stack
-    kfree((void*)current_process->pcb.kernel_stack);
+    current_process->pcb.exit_code = exit_code;
+    update_task_load(current_process, false, false);
+    sched_group_exit(current_process);
+    
+    // Release the PID; the process and its kernel stack are freed once
+    // it has been switched out
+    detach_process(current_process);
     
-    // Mark PID as free
-    uint32_t index = current_process - process_table;
-    uint32_t bitmap_index = index / 32;
-    uint32_t bit_index = index % 32;
-    process_bitmap[bitmap_index] &= ~(1 << bit_index);
+    if (current_process->kthread_exit) {
+        kthread_exited(current_process, exit_code);
+    }
     
-    // Schedule next process
+    // Never returns; the switch frees this process
     process_schedule();
 }
 
-// Simple round-robin scheduler
+// Terminate a process by PID; one that is running on some CPU is freed
+// once it is switched out
+int process_kill(uint32_t pid) {
+    process_t* p;
+    unsigned long flags;
+    uint32_t state;
+    bool free_now;
+    
+    rcu_read_lock();
+    p = process_by_pid(pid);
+    if (!p) {
+        rcu_read_unlock();
+        return -ESRCH;
+    }
+    
+    // tasklist_lock orders this against a second kill, process_exit()
+    // and schedule_tail()'s on_cpu update. The state changes atomically,
+    // since wake_up_process() and the scheduler's claim do not take the
+    // lock; a task claimed but not yet on its CPU is RUNNING, and is
+    // freed when it switches out like one already there
+    spin_lock_irqsave(&tasklist_lock, flags);
+    do {
+        state = p->pcb.state;
+        if (state == PROCESS_TERMINATED) {
+            spin_unlock_irqrestore(&tasklist_lock, flags);
+            rcu_read_unlock();
+            return -ESRCH;
+        }
+    } while (!__sync_bool_compare_and_swap(&p->pcb.state, state, PROCESS_TERMINATED));
+    free_now = state != PROCESS_RUNNING && !p->on_cpu;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    
+    update_task_load(p, false, false);
+    sched_group_exit(p);
+    detach_process(p);
+    
+    if (free_now) {
+        free_process(p);
+    }
+    
+    rcu_read_unlock();
+    return 0;
+}
+
+// Real-time priorities order strictly; all fair processes share one level
+static int sched_prio(process_t* proc) {
+    return proc->prio < MAX_RT_PRIO ? proc->prio : MAX_RT_PRIO;
+}
+
+// Whether a process may be picked on this CPU right now
+static bool task_can_run(process_t* proc) {
+    return cpumask_test_cpu(smp_processor_id(), &proc->cpus_allowed) &&
+           !task_group_throttled(proc);
+}
+
+// Save prev's stack and resume point and continue next from its own.
+// EFLAGS and EBP ride on prev's stack, the compiler saves the other
+// registers around the asm. A task that never ran starts at its entry
+// with the EBP its PCB holds
+static void __attribute__((noinline)) switch_to(process_t* prev, process_t* next) {
+    __asm__ volatile("pushfl\n\t"
+                     "pushl %%ebp\n\t"
+                     "movl %%esp, %c[sp](%%eax)\n\t"
+                     "movl $1f, %c[ip](%%eax)\n\t"
+                     "movl %c[sp](%%edx), %%esp\n\t"
+                     "movl %c[bp](%%edx), %%ebp\n\t"
+                     "jmp *%c[ip](%%edx)\n"
+                     "1:\t"
+                     "popl %%ebp\n\t"
+                     "popfl"
+                     : "+a" (prev), "+d" (next)
+                     : [sp] "i" (offsetof(process_t, pcb.esp)),
+                       [ip] "i" (offsetof(process_t, pcb.eip)),
+                       [bp] "i" (offsetof(process_t, pcb.ebp))
+                     : "ebx", "ecx", "esi", "edi", "memory", "cc");
+}
+
+// Hand this CPU to next; returns once something switches back to prev
+static void context_switch(process_t* prev, process_t* next) {
+    uint32_t cr3;
+    
+    next->on_cpu = true;
+    this_cpu_write(switch_prev, prev);
+    this_cpu_write(current_task, next);
+    kernel_stats.context_switches++;
+    rcu_note_context_switch();
+    
+    // Entries from user mode land on next's stack; kernel threads and
+    // idle tasks borrow whatever directory is loaded
+    tss_set_kernel_stack(smp_processor_id(), next->pcb.kernel_stack + KERNEL_STACK_SIZE);
+    __asm__ volatile("mov %%cr3, %0" : "=r" (cr3));
+    if (next->pcb.cr3 && next->pcb.cr3 != cr3) {
+        __asm__ volatile("mov %0, %%cr3" : : "r" (next->pcb.cr3) : "memory");
+    }
+    
+    switch_to(prev, next);
+    schedule_tail();
+}
+
+// Finish a switch on the new task's stack: the previous task is off this
+// CPU now, so another CPU may pick it up, or it is freed if it exited
+void schedule_tail(void) {
+    process_t* prev = this_cpu_read(switch_prev);
+    unsigned long flags;
+    bool dead;
+    
+    spin_lock_irqsave(&tasklist_lock, flags);
+    prev->on_cpu = false;
+    dead = prev->pcb.state == PROCESS_TERMINATED;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    
+    if (dead) {
+        free_process(prev);
+    }
+}
+
+// Real-time first, then group-fair round-robin scheduler. A current
+// process that blocked or exited is always switched away from, to the
+// idle task if nothing else is ready
 void process_schedule(void) {
-    static uint32_t current_index = 0;
+    process_t* prev = current_process;
+    process_t* idle = idle_task(smp_processor_id());
+    process_t* next = NULL;
+    struct list_head* start;
+    struct list_head* pos;
+    uint64_t next_vruntime = 0;
+    int next_prio = MAX_RT_PRIO;
+    bool prev_idle = prev->flags & PF_IDLE;
+    bool curr_running;
+    unsigned long flags;
+    
+    // Picking and switching must not race with this CPU's interrupts
+    local_irq_save(flags);
+    
+    // Woken again before it got off the CPU: keep running
+    if (!prev_idle && __sync_bool_compare_and_swap(&prev->pcb.state, PROCESS_READY,
+                                                   PROCESS_RUNNING)) {
+        task_arrive(prev);
+        local_irq_restore(flags);
+        return;
+    }
+    curr_running = !prev_idle && prev->pcb.state == PROCESS_RUNNING;
+    
+    // Keep load signals decaying across ticks without a switch
+    if (!prev_idle) {
+        pelt_tick(prev);
+    }
+    
+    // Charge the tick to the running group; may throttle it
+    if (curr_running) {
+        task_group_charge(prev);
+    }
     
-    // Find next ready process
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        current_index = (current_index + 1) % MAX_PROCESSES;
+    // Find the most urgent ready process, or among fair processes the
+    // one whose group is furthest behind its share; scanning from the
+    // current process keeps equals in round-robin order. An exited
+    // current process is off the list, so scan from the head instead.
+    // Skip one still being switched out on another CPU, and one with no
+    // saved context to resume
+    rcu_read_lock();
+    start = !prev_idle && prev->pcb.state != PROCESS_TERMINATED ? &prev->tasks : &task_list;
+    for (pos = rcu_dereference(start->next); pos != start;
+         pos = rcu_dereference(pos->next)) {
+        process_t* proc;
+        int prio;
         
-        if (process_table[current_index].pcb.state == PROCESS_READY) {
-            process_t* next = &process_table[current_index];
-            
-            if (current_process && current_process->pcb.state == PROCESS_RUNNING) {
-                current_process->pcb.state = PROCESS_READY;
-            }
-            
-            next->pcb.state = PROCESS_RUNNING;
-            current_process = next;
-            process_switch();
+        if (pos == &task_list) {
+            continue;
+        }
+        proc = container_of(pos, process_t, tasks);
+        
+        if (proc->pcb.state != PROCESS_READY || proc->on_cpu || !proc->pcb.eip ||
+            !task_can_run(proc)) {
+            continue;
+        }
+        
+        prio = sched_prio(proc);
+        if (!next || prio < next_prio ||
+            (prio == next_prio && prio == MAX_RT_PRIO &&
+             task_group_vruntime(proc) < next_vruntime)) {
+            next = proc;
+            next_prio = prio;
+            next_vruntime = task_group_vruntime(proc);
+        }
+    }
+    rcu_read_unlock();
+    
+    if (!next) {
+        // Nothing else is ready: keep running unless throttled or
+        // migrated away, otherwise idle
+        if (prev_idle || (curr_running && task_can_run(prev))) {
+            local_irq_restore(flags);
+            return;
+        }
+        next = idle;
+    } else if (curr_running && task_can_run(prev)) {
+        // Keep the current process if it is more urgent, is SCHED_FIFO
+        // at the same level, or its group is still behind
+        int prio = sched_prio(prev);
+        
+        if (prio < next_prio ||
+            (prio == next_prio && prio < MAX_RT_PRIO && prev->policy == SCHED_FIFO) ||
+            (prio == next_prio && prio == MAX_RT_PRIO &&
+             task_group_vruntime(prev) < next_vruntime)) {
+            local_irq_restore(flags);
             return;
         }
     }
     
-    // No ready processes found
-    panic("No runnable processes");
+    // Another CPU may have claimed it since the scan; keep running, or
+    // idle until the next chance
+    if (next != idle && !__sync_bool_compare_and_swap(&next->pcb.state, PROCESS_READY,
+                                                      PROCESS_RUNNING)) {
+        next = idle;
+        if (curr_running && task_can_run(prev)) {
+            local_irq_restore(flags);
+            return;
+        }
+    }
+    if (next == prev) {
+        local_irq_restore(flags);
+        return;
+    }
+    
+    if (curr_running) {
+        prev->pcb.state = PROCESS_READY;
+        task_depart(prev, false);
+        task_queued(prev, false);
+    } else if (prev->pcb.state == PROCESS_BLOCKED) {
+        task_depart(prev, true);
+    }
+    
+    if (next != idle) {
+        if (next_prio == MAX_RT_PRIO) {
+            task_group_set_min_vruntime(next_vruntime);
+        }
+        task_arrive(next);
+    }
+    
+    context_switch(prev, next);
+    local_irq_restore(flags);
+}
+
+// Change a process's scheduling policy; SCHED_FIFO and SCHED_RR take a
+// real-time priority from 1 (lowest) to MAX_RT_PRIO - 1
+int sched_setscheduler(process_t* p, uint32_t policy, uint32_t rt_priority) {
+    if (!p) {
+        return -EINVAL;
+    }
+    
+    switch (policy) {
+        case SCHED_FIFO:
+        case SCHED_RR:
+            if (rt_priority < 1 || rt_priority > MAX_RT_PRIO - 1) {
+                return -EINVAL;
+            }
+            p->normal_prio = MAX_RT_PRIO - 1 - rt_priority;
+            break;
+        case SCHED_NORMAL:
+        case SCHED_BATCH:
+        case SCHED_IDLE:
+            if (rt_priority) {
+                return -EINVAL;
+            }
+            p->normal_prio = DEFAULT_PRIO;
+            break;
+        default:
+            return -EINVAL;
+    }
+    
+    p->policy = policy;
+    
+    // Keeps any PI boost and requeues p on the lock it waits for
+    rt_mutex_adjust_pi(p);
+    return 0;
 }
 
-// Context switch (simplified)
-void process_switch(void) {
-    // In a real implementation, this would save/restore registers
-    // For now, we just return to continue execution
-    return;
+// Look up a live process by PID; 0 means the current process. Callers
+// hold rcu_read_lock() unless the process cannot exit under them
+process_t* process_by_pid(uint32_t pid) {
+    process_t* p;
+    
+    if (!pid) {
+        return current_process;
+    }
+    
+    p = idr_find(&pid_idr, pid);
+    if (p && p->pcb.state == PROCESS_TERMINATED) {
+        return NULL;
+    }
+    return p;
+}
+
+// Restrict a process to a set of CPUs, which must include an online one;
+// isolated CPUs are only used when named explicitly
+int sched_setaffinity(uint32_t pid, const struct cpumask* new_mask) {
+    process_t* p;
+    struct cpumask allowed;
+    
+    cpumask_and(&allowed, new_mask, cpu_possible_mask);
+    if (!cpumask_intersects(&allowed, cpu_online_mask)) {
+        return -EINVAL;
+    }
+    
+    rcu_read_lock();
+    p = process_by_pid(pid);
+    if (!p) {
+        rcu_read_unlock();
+        return -ESRCH;
+    }
+    
+    // Takes effect at the next pick; a running process off its mask is
+    // switched out on the next tick
+    cpumask_copy(&p->cpus_allowed, &allowed);
+    rcu_read_unlock();
+    return 0;
+}
+
+int sched_getaffinity(uint32_t pid, struct cpumask* mask) {
+    process_t* p;
+    
+    rcu_read_lock();
+    p = process_by_pid(pid);
+    if (!p) {
+        rcu_read_unlock();
+        return -ESRCH;
+    }
+    
+    cpumask_and(mask, &p->cpus_allowed, cpu_possible_mask);
+    rcu_read_unlock();
+    return 0;
+}
+
+// Block the current process until wake_up_process() makes it ready
+void process_sleep(void) {
+    process_t* self = current_process;
+    
+    if (!self || self->pcb.state != PROCESS_BLOCKED) {
+        return;
+    }
+    
+    // A blocking kworker lets its pool start another
+    if (self->flags & PF_WQ_WORKER) {
+        wq_worker_sleeping(self);
+    }
+    
+    // Switch to another process or the idle task; returns once woken
+    // and picked again
+    process_schedule();
+    
+    if (self->flags & PF_WQ_WORKER) {
+        wq_worker_waking_up(self);
+    }
+}
+
+// Have a CPU that may run a newly ready process look at it now rather
+// than at its next tick: an idle one if there is one, otherwise any
+// allowed one when this CPU is not. Whichever claims it first runs it
+static void wake_up_cpu_for(process_t* proc) {
+    unsigned int this_cpu = smp_processor_id();
+    bool local_ok = cpumask_test_cpu(this_cpu, &proc->cpus_allowed);
+    unsigned int target = NR_CPUS;
+    unsigned int cpu;
+    
+    // An interrupt that woke it from this CPU's idle loop returns there
+    if (local_ok && (current_process->flags & PF_IDLE)) {
+        return;
+    }
+    
+    for_each_online_cpu(cpu) {
+        if (cpu == this_cpu || !cpumask_test_cpu(cpu, &proc->cpus_allowed)) {
+            continue;
+        }
+        if (per_cpu(current_task, cpu)->flags & PF_IDLE) {
+            target = cpu;
+            break;
+        }
+        if (!local_ok && target == NR_CPUS) {
+            target = cpu;
+        }
+    }
+    
+    if (target != NR_CPUS) {
+        smp_send_reschedule(target);
+    }
+}
+
+// Make a blocked process ready; returns 1 if it was blocked
+int wake_up_process(process_t* proc) {
+    if (!proc) {
+        return 0;
+    }
+    
+    if (!__sync_bool_compare_and_swap(&proc->pcb.state, PROCESS_BLOCKED,
+                                      PROCESS_READY)) {
+        return 0;
+    }
+    
+    task_queued(proc, true);
+    wake_up_cpu_for(proc);
+    return 1;
+}
+
+// Body of every CPU's idle task: run whatever is ready, otherwise halt
+// until an interrupt. The tick does not preempt an idle CPU; this loop
+// picks up whatever the interrupt made ready
+void cpu_idle_loop(void) {
+    for (;;) {
+        process_schedule();
+        
+        // Softirqs an interrupt left over past its time budget run here
+        // rather than waiting for ksoftirqd to be picked; checked with
+        // interrupts off so none is left pending across the hlt
+        local_irq_disable();
+        if (local_softirq_pending()) {
+            local_irq_enable();
+            do_softirq();
+            continue;
+        }
+        
+        // sti's one-instruction shadow closes the window before hlt
+        rcu_idle_enter();
+        __asm__ volatile("sti; hlt");
+        rcu_idle_exit();
+    }
 }
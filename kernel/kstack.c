@@ -0,0 +1,144 @@
+#include "kstack.h"
+#include "kernel.h"
+#include "mm.h"
+#include "spinlock.h"
+
+/**
+ * Guarded Kernel Stacks
+ * Slots come from a next-fit bitmap under kstack_lock. Only the stack
+ * pages of a slot are ever mapped; its first page stays unmapped as the
+ * guard. A slot's pages are never unmapped again: any CPU may hold
+ * translations for a stack a task ran on, and there is no TLB shootdown.
+ * Free slots that are still mapped are handed out first, so the region
+ * only grows to the peak number of stacks. The per-CPU cache is touched
+ * with interrupts off, since stacks are freed from RCU callbacks run by
+ * the tick
+ */
+
+#define KSTACK_WORDS    ((KSTACK_SLOTS + 31) / 32)
+
+static uint32_t kstack_bitmap[KSTACK_WORDS];    // Slots in use
+static uint32_t kstack_mapped[KSTACK_WORDS];    // Slots with stack pages mapped
+static uint32_t kstack_next;
+static DEFINE_SPINLOCK(kstack_lock);
+
+static DEFINE_PER_CPU(uint32_t, cached_stacks[NR_CACHED_STACKS]);
+
+static inline uint32_t kstack_slot_base(uint32_t slot) {
+    return KSTACK_START + slot * KSTACK_SLOT_SIZE + KSTACK_GUARD_SIZE;
+}
+
+static int kstack_slot_alloc(bool *mapped) {
+    unsigned long flags;
+    int slot = -1;
+
+    spin_lock_irqsave(&kstack_lock, flags);
+
+    // A free slot that is still mapped needs no new frames
+    for (uint32_t w = 0; w < KSTACK_WORDS; w++) {
+        uint32_t reusable = kstack_mapped[w] & ~kstack_bitmap[w];
+
+        if (reusable) {
+            slot = w * 32 + __builtin_ctz(reusable);
+            kstack_bitmap[w] |= 1U << (slot % 32);
+            *mapped = true;
+            spin_unlock_irqrestore(&kstack_lock, flags);
+            return slot;
+        }
+    }
+
+    *mapped = false;
+    for (uint32_t i = 0; i < KSTACK_SLOTS; i++) {
+        uint32_t n = (kstack_next + i) % KSTACK_SLOTS;
+
+        if (!(kstack_bitmap[n / 32] & (1U << (n % 32)))) {
+            kstack_bitmap[n / 32] |= 1U << (n % 32);
+            kstack_next = n + 1;
+            slot = n;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&kstack_lock, flags);
+
+    return slot;
+}
+
+static void kstack_slot_free(uint32_t slot) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&kstack_lock, flags);
+    kstack_bitmap[slot / 32] &= ~(1U << (slot % 32));
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+static void kstack_slot_set_mapped(uint32_t slot) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&kstack_lock, flags);
+    kstack_mapped[slot / 32] |= 1U << (slot % 32);
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+uint32_t alloc_kernel_stack(void) {
+    uint32_t *cache;
+    uint32_t stack = 0;
+    unsigned long flags;
+    bool mapped;
+    int slot;
+
+    // A recently freed stack is still mapped and likely cache-hot
+    local_irq_save(flags);
+    cache = this_cpu_ptr(&cached_stacks[0]);
+    for (int i = 0; i < NR_CACHED_STACKS; i++) {
+        if (cache[i]) {
+            stack = cache[i];
+            cache[i] = 0;
+            break;
+        }
+    }
+    local_irq_restore(flags);
+
+    if (stack) {
+        return stack;
+    }
+
+    slot = kstack_slot_alloc(&mapped);
+    if (slot < 0) {
+        return 0;
+    }
+
+    stack = kstack_slot_base(slot);
+    if (!mapped) {
+        if (map_kernel_range(stack, KERNEL_STACK_SIZE / PAGE_SIZE) < 0) {
+            kstack_slot_free(slot);
+            return 0;
+        }
+        kstack_slot_set_mapped(slot);
+    }
+
+    return stack;
+}
+
+void free_kernel_stack(uint32_t stack) {
+    uint32_t *cache;
+    unsigned long flags;
+
+    if (!stack) {
+        return;
+    }
+
+    local_irq_save(flags);
+    cache = this_cpu_ptr(&cached_stacks[0]);
+    for (int i = 0; i < NR_CACHED_STACKS; i++) {
+        if (!cache[i]) {
+            cache[i] = stack;
+            local_irq_restore(flags);
+            return;
+        }
+    }
+    local_irq_restore(flags);
+
+    // Cache full: free the slot but keep its pages mapped, as other CPUs
+    // may still cache translations for them
+    kstack_slot_free((stack - KSTACK_START) / KSTACK_SLOT_SIZE);
+}
@@ -0,0 +1,73 @@
+#include "kthread.h"
+#include "kernel.h"
+#include "printk.h"
+#include "wait.h"
+
+/**
+ * Kernel Thread Helpers
+ * kernel_thread() in kernel.c builds the task; these name, place and
+ * stop it
+ */
+
+/**
+ * Handshake between kthread_stop() and the exiting thread, on the
+ * stopper's stack; the thread's last store is done
+ */
+struct kthread_exit {
+    int ret;
+    volatile bool done;
+};
+
+// kthread_stop() callers sleep here until their thread has exited
+static DECLARE_WAIT_QUEUE_HEAD(kthread_exit_wq);
+
+process_t* kthread_create(int (*threadfn)(void* data), void* data, const char* name) {
+    process_t* k = kernel_thread(threadfn, data);
+    int i;
+
+    if (!k) {
+        pr_err("kthread: cannot create %s\n", name);
+        return NULL;
+    }
+
+    for (i = 0; name[i] && i < (int)sizeof(k->name) - 1; i++) {
+        k->name[i] = name[i];
+    }
+    k->name[i] = '\0';
+
+    return k;
+}
+
+void kthread_bind(process_t* k, unsigned int cpu) {
+    cpumask_clear(&k->cpus_allowed);
+    cpumask_set_cpu(cpu, &k->cpus_allowed);
+}
+
+int kthread_stop(process_t* k) {
+    struct kthread_exit exit = { .ret = 0, .done = false };
+
+    // k may exit as soon as it is woken, before wake_up_process()
+    // returns; the reference keeps it allocated until then
+    get_task_struct(k);
+    k->kthread_exit = &exit;
+    wmb();
+    k->kthread_should_stop = true;
+    wake_up_process(k);
+
+    wait_event(kthread_exit_wq, exit.done);
+    put_task_struct(k);
+    return exit.ret;
+}
+
+void kthread_exited(process_t* k, int ret) {
+    struct kthread_exit* exit = k->kthread_exit;
+
+    exit->ret = ret;
+    wmb();
+    exit->done = true;
+    wake_up_all(&kthread_exit_wq);
+}
+
+bool kthread_should_stop(void) {
+    return current_process->kthread_should_stop;
+}
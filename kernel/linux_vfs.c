@@ -13,11 +13,11 @@
 
 // Global VFS state
 static struct list_head file_systems;
-static spinlock_t file_systems_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(file_systems_lock);
 
 // Mount table
 static struct list_head mount_list;
-static spinlock_t mount_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(mount_lock);
 
 // Inode cache
 static kmem_cache_t *inode_cache;
@@ -27,11 +27,11 @@ static kmem_cache_t *file_cache;
 // Inode hash table
 #define INODE_HASH_SIZE 256
 static struct list_head inode_hashtable[INODE_HASH_SIZE];
-static spinlock_t inode_hash_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(inode_hash_lock);
 
 // Dentry cache
 static struct list_head dentry_unused;
-static spinlock_t dentry_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(dentry_lock);
 
 // Global counters
 static unsigned long next_ino = 1;
@@ -130,7 +130,7 @@ struct inode *alloc_inode(struct super_block *sb) {
     // Add to hash table
     unsigned long hash = inode_hash(sb, inode->i_ino);
     spin_lock(&inode_hash_lock);
-    list_add(&inode->i_hash, &inode_hashtable[hash]);
+    list_add_rcu(&inode->i_hash, &inode_hashtable[hash]);
     spin_unlock(&inode_hash_lock);
     
     nr_inodes++;
@@ -138,16 +138,21 @@ struct inode *alloc_inode(struct super_block *sb) {
     return inode;
 }
 
+static void i_callback(struct rcu_head *head) {
+    kmem_cache_free(inode_cache, container_of(head, struct inode, i_rcu));
+}
+
 /**
  * Free an inode
+ * iget() may still be walking past it, so the memory goes back only
+ * after a grace period
  */
 void destroy_inode(struct inode *inode) {
     if (!inode) return;
     
     // Remove from hash table
-    unsigned long hash = inode_hash(inode->i_sb, inode->i_ino);
     spin_lock(&inode_hash_lock);
-    list_del(&inode->i_hash);
+    list_del_rcu(&inode->i_hash);
     spin_unlock(&inode_hash_lock);
     
     // Remove from superblock list
@@ -157,7 +162,7 @@ void destroy_inode(struct inode *inode) {
     
     nr_inodes--;
     
-    kmem_cache_free(inode_cache, inode);
+    call_rcu(&inode->i_rcu, i_callback);
 }
 
 /**
@@ -169,16 +174,17 @@ struct inode *iget(struct super_block *sb, unsigned long ino) {
     
     hash = inode_hash(sb, ino);
     
-    // Search in hash table
-    spin_lock(&inode_hash_lock);
-    list_for_each_entry(inode, &inode_hashtable[hash], i_hash) {
-        if (inode->i_ino == ino && inode->i_sb == sb) {
-            inode->i_count++;
-            spin_unlock(&inode_hash_lock);
+    // Search in hash table; an inode whose count hit zero is being
+    // destroyed and is treated as absent
+    rcu_read_lock();
+    list_for_each_entry_rcu(inode, &inode_hashtable[hash], i_hash) {
+        if (inode->i_ino == ino && inode->i_sb == sb &&
+            refcount_inc_not_zero(&inode->i_count)) {
+            rcu_read_unlock();
             return inode;
         }
     }
-    spin_unlock(&inode_hash_lock);
+    rcu_read_unlock();
     
     // Not found, allocate new one
     if (sb->s_op && sb->s_op->alloc_inode) {
@@ -204,19 +210,14 @@ struct inode *iget(struct super_block *sb, unsigned long ino) {
 void iput(struct inode *inode) {
     if (!inode) return;
     
-    spin_lock(&inode->i_lock);
-    inode->i_count--;
-    if (inode->i_count == 0) {
-        spin_unlock(&inode->i_lock);
-        
+    // Atomic, since iget() takes references without any lock
+    if (__sync_sub_and_fetch(&inode->i_count, 1) == 0) {
         // Call filesystem cleanup
         if (inode->i_sb->s_op && inode->i_sb->s_op->evict_inode) {
             inode->i_sb->s_op->evict_inode(inode);
         }
         
         destroy_inode(inode);
-    } else {
-        spin_unlock(&inode->i_lock);
     }
 }
 
@@ -249,7 +250,7 @@ struct dentry *d_alloc(struct dentry *parent, const struct qstr *name) {
     
     if (parent) {
         spin_lock(&parent->d_lock);
-        list_add(&dentry->d_child, &parent->d_subdirs);
+        list_add_rcu(&dentry->d_child, &parent->d_subdirs);
         spin_unlock(&parent->d_lock);
         dentry->d_sb = parent->d_sb;
     }
@@ -259,8 +260,12 @@ struct dentry *d_alloc(struct dentry *parent, const struct qstr *name) {
     return dentry;
 }
 
+static void d_callback(struct rcu_head *head) {
+    kmem_cache_free(dentry_cache, container_of(head, struct dentry, d_rcu));
+}
+
 /**
- * Free a dentry
+ * Free a dentry once lockless d_lookup() walkers are done with it
  */
 void d_free(struct dentry *dentry) {
     if (!dentry) return;
@@ -268,13 +273,25 @@ void d_free(struct dentry *dentry) {
     // Remove from parent
     if (dentry->d_parent) {
         spin_lock(&dentry->d_parent->d_lock);
-        list_del(&dentry->d_child);
+        list_del_rcu(&dentry->d_child);
         spin_unlock(&dentry->d_parent->d_lock);
     }
     
     nr_dentries--;
     
-    kmem_cache_free(dentry_cache, dentry);
+    call_rcu(&dentry->d_rcu, d_callback);
+}
+
+/**
+ * Put dentry (decrement reference count)
+ */
+void dput(struct dentry *dentry) {
+    if (!dentry) return;
+    
+    // Atomic, since d_lookup() takes references without any lock
+    if (__sync_sub_and_fetch(&dentry->d_count, 1) == 0) {
+        d_free(dentry);
+    }
 }
 
 /**
@@ -295,6 +312,7 @@ int d_add(struct dentry *dentry, struct inode *inode) {
 
 /**
  * Lookup dentry in directory
+ * The caller owns a reference to the result and drops it with dput()
  */
 struct dentry *d_lookup(struct dentry *parent, struct qstr *name) {
     struct dentry *dentry;
@@ -302,16 +320,16 @@ struct dentry *d_lookup(struct dentry *parent, struct qstr *name) {
     
     if (!parent || !name) return NULL;
     
-    spin_lock(&parent->d_lock);
-    list_for_each_entry(dentry, &parent->d_subdirs, d_child) {
+    rcu_read_lock();
+    list_for_each_entry_rcu(dentry, &parent->d_subdirs, d_child) {
         if (dentry->d_name_len == name->len &&
-            strncmp(dentry->d_name, name->name, name->len) == 0) {
+            strncmp(dentry->d_name, name->name, name->len) == 0 &&
+            refcount_inc_not_zero(&dentry->d_count)) {
             found = dentry;
-            dentry->d_count++;
             break;
         }
     }
-    spin_unlock(&parent->d_lock);
+    rcu_read_unlock();
     
     return found;
 }
@@ -333,9 +351,9 @@ int register_filesystem(struct file_system_type *fs) {
         }
     }
     
-    // Add to list
-    list_add(&fs->next, &file_systems);
+    // Publish fully initialized
     INIT_HLIST_HEAD(&fs->fs_supers);
+    list_add_rcu(&fs->next, &file_systems);
     
     spin_unlock(&file_systems_lock);
     
@@ -358,10 +376,13 @@ int unregister_filesystem(struct file_system_type *fs) {
     }
     
     // Remove from list
-    list_del(&fs->next);
+    list_del_rcu(&fs->next);
     
     spin_unlock(&file_systems_lock);
     
+    // The owner may free fs once get_fs_type() callers are past it
+    synchronize_rcu();
+    
     pr_info("Unregistered filesystem '%s'\n", fs->name);
     return 0;
 }
@@ -374,14 +395,14 @@ struct file_system_type *get_fs_type(const char *name) {
     
     if (!name) return NULL;
     
-    spin_lock(&file_systems_lock);
-    list_for_each_entry(fs, &file_systems, next) {
+    rcu_read_lock();
+    list_for_each_entry_rcu(fs, &file_systems, next) {
         if (strcmp(fs->name, name) == 0) {
-            spin_unlock(&file_systems_lock);
+            rcu_read_unlock();
             return fs;
         }
     }
-    spin_unlock(&file_systems_lock);
+    rcu_read_unlock();
     
     return NULL;
 }
@@ -1,5 +1,6 @@
 #include "mm.h"
 #include "kernel.h"
+#include "spinlock.h"
 
 // Memory management state
 static uint32_t kernel_heap_start;
@@ -11,19 +12,25 @@ static uint32_t* frame_bitmap;
 static uint32_t total_frames;
 static uint32_t used_frames;
 static uint32_t last_alloc_frame;  // Optimization: start search from last allocation
+static DEFINE_SPINLOCK(frame_lock);
 
 // Current page directory
 static page_directory_t* current_directory;
 
-// Memory statistics
+// Memory statistics; usage follows the shared heap, event counters are per CPU
 static struct {
-    uint32_t total_allocations;
-    uint32_t total_frees;
     uint32_t peak_usage;
     uint32_t current_usage;
-    uint32_t fragmentation_count;
 } mem_stats = {0};
 
+struct mem_cpu_stats {
+    uint32_t total_allocations;
+    uint32_t total_frees;
+    uint32_t fragmentation_count;
+};
+
+static DEFINE_PER_CPU(struct mem_cpu_stats, mem_events);
+
 // Heap block header with magic numbers for corruption detection
 #define HEAP_BLOCK_MAGIC 0xDEADBEEF
 #define HEAP_BLOCK_FREE_MAGIC 0xFEEDFACE
@@ -40,6 +47,10 @@ typedef struct heap_block {
 static heap_block_t* heap_head = NULL;
 static heap_block_t* heap_tail = NULL;
 
+// Guards the block list and mem_stats; kfree() is reached from softirq
+// context (RCU callbacks), so it is always taken with interrupts off
+static DEFINE_SPINLOCK(heap_lock);
+
 // Initialize memory management
 void mm_init(void) {
     // Initialize heap
@@ -104,11 +115,8 @@ void heap_init(void) {
     update_block_checksum(heap_head);
     
     // Initialize statistics
-    mem_stats.total_allocations = 0;
-    mem_stats.total_frees = 0;
     mem_stats.current_usage = 0;
     mem_stats.peak_usage = 0;
-    mem_stats.fragmentation_count = 0;
 }
 
 // Enhanced kernel memory allocator with first-fit strategy and integrity checks
@@ -119,6 +127,9 @@ void* kmalloc(size_t size) {
     size = (size + 3) & ~3;
     if (size < 16) size = 16;  // Minimum allocation size
 
+    unsigned long flags;
+    spin_lock_irqsave(&heap_lock, flags);
+
     heap_block_t* block = heap_head;
     heap_block_t* best_fit = NULL;
     size_t best_fit_size = SIZE_MAX;
@@ -138,7 +149,8 @@ void* kmalloc(size_t size) {
     }
 
     if (!best_fit) {
-        mem_stats.fragmentation_count++;
+        this_cpu_inc(mem_events.fragmentation_count);
+        spin_unlock_irqrestore(&heap_lock, flags);
         return NULL; // Out of memory
     }
 
@@ -177,12 +189,14 @@ void* kmalloc(size_t size) {
     update_block_checksum(block);
 
     // Update statistics
-    mem_stats.total_allocations++;
+    this_cpu_inc(mem_events.total_allocations);
     mem_stats.current_usage += size;
     if (mem_stats.current_usage > mem_stats.peak_usage) {
         mem_stats.peak_usage = mem_stats.current_usage;
     }
 
+    spin_unlock_irqrestore(&heap_lock, flags);
+
     return (void*)((uint32_t)block + sizeof(heap_block_t));
 }
 
@@ -191,6 +205,9 @@ void kfree(void* ptr) {
     if (!ptr) return;
 
     heap_block_t* block = (heap_block_t*)((uint32_t)ptr - sizeof(heap_block_t));
+    unsigned long flags;
+    
+    spin_lock_irqsave(&heap_lock, flags);
     
     // Verify block integrity
     if (!verify_block_integrity(block)) {
@@ -235,8 +252,10 @@ void kfree(void* ptr) {
     }
 
     // Update statistics
-    mem_stats.total_frees++;
+    this_cpu_inc(mem_events.total_frees);
     mem_stats.current_usage -= freed_size;
+
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 // Enhanced paging initialization with better error handling
@@ -262,6 +281,14 @@ void paging_init(uint32_t mem_size) {
         frame_bitmap[i] = 0;
     }
 
+    // Frames below the end of the heap hold the kernel image, the heap and
+    // the page tables carved from it; never hand them out
+    for (uint32_t i = 0; i < kernel_heap_end / PAGE_SIZE && i < total_frames; i++) {
+        frame_bitmap[i / 32] |= 1 << (i % 32);
+        used_frames++;
+        last_alloc_frame = i;
+    }
+
     // Create kernel page directory
     current_directory = (page_directory_t*)kmalloc_aligned(sizeof(page_directory_t), PAGE_SIZE);
     
@@ -301,6 +328,10 @@ void paging_init(uint32_t mem_size) {
 
 // Optimized frame allocation with next-fit strategy
 void* alloc_frame(void) {
+    unsigned long flags;
+    
+    spin_lock_irqsave(&frame_lock, flags);
+    
     // Start search from last allocation position for better locality
     uint32_t start_frame = last_alloc_frame;
     
@@ -313,10 +344,12 @@ void* alloc_frame(void) {
             frame_bitmap[bitmap_index] |= (1 << bit_index);
             used_frames++;
             last_alloc_frame = frame_index;
+            spin_unlock_irqrestore(&frame_lock, flags);
             return (void*)(frame_index * PAGE_SIZE);
         }
     }
 
+    spin_unlock_irqrestore(&frame_lock, flags);
     return NULL; // Out of frames
 }
 
@@ -326,9 +359,12 @@ void free_frame(void* frame) {
     uint32_t frame_index = frame_addr / PAGE_SIZE;
     uint32_t bitmap_index = frame_index / 32;
     uint32_t bit_index = frame_index % 32;
+    unsigned long flags;
     
+    spin_lock_irqsave(&frame_lock, flags);
     frame_bitmap[bitmap_index] &= ~(1 << bit_index);
     used_frames--;
+    spin_unlock_irqrestore(&frame_lock, flags);
 }
 
 // Map a virtual page to a physical frame
@@ -353,16 +389,45 @@ void map_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uin
         dir->entries[table_index].user = 0;
     }
     
+    // User access needs the bit in both levels; the PTE still decides
+    if (flags & PAGE_USER) {
+        dir->entries[table_index].user = 1;
+    }
+    
     // Map the page
     dir->tables[table_index]->pages[entry_index].frame = phys_addr >> 12;
     dir->tables[table_index]->pages[entry_index].present = (flags & 0x01) ? 1 : 0;
     dir->tables[table_index]->pages[entry_index].rw = (flags & 0x02) ? 1 : 0;
     dir->tables[table_index]->pages[entry_index].user = (flags & 0x04) ? 1 : 0;
+    dir->tables[table_index]->pages[entry_index].pwt = (flags & 0x08) ? 1 : 0;
+    dir->tables[table_index]->pages[entry_index].pcd = (flags & 0x10) ? 1 : 0;
     
     // Invalidate TLB
     __asm__ volatile("invlpg (%0)" : : "r" (virt_addr));
 }
 
+// Expose a kernel page to user mode at a fixed address; every process
+// shares the kernel's page directory, so this maps it for all of them
+void map_user_page(uint32_t virt_addr, uint32_t phys_addr, bool writable) {
+    map_page(current_directory, virt_addr, phys_addr,
+             PAGE_PRESENT | PAGE_USER | (writable ? PAGE_WRITE : 0));
+}
+
+// Identity-map a physical range uncached, for device registers and
+// firmware tables outside the boot mapping
+void* ioremap(uint32_t phys_addr, uint32_t size) {
+    if (current_directory && size) {
+        uint32_t addr = phys_addr & ~(PAGE_SIZE - 1);
+        uint32_t pages = (phys_addr - addr + size + PAGE_SIZE - 1) / PAGE_SIZE;
+        
+        for (uint32_t i = 0; i < pages; i++, addr += PAGE_SIZE) {
+            map_page(current_directory, addr, addr, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD);
+        }
+    }
+    
+    return (void*)phys_addr;
+}
+
 // Unmap a virtual page
 void unmap_page(page_directory_t* dir, uint32_t virt_addr) {
     uint32_t page_index = virt_addr / PAGE_SIZE;
@@ -377,6 +442,42 @@ void unmap_page(page_directory_t* dir, uint32_t virt_addr) {
     }
 }
 
+// Back a page-aligned kernel virtual range with fresh frames; on failure
+// nothing stays mapped
+int map_kernel_range(uint32_t virt_addr, uint32_t pages) {
+    for (uint32_t i = 0; i < pages; i++) {
+        void* frame = alloc_frame();
+        
+        if (!frame) {
+            unmap_kernel_range(virt_addr, i);
+            return -ENOMEM;
+        }
+        map_page(current_directory, virt_addr + i * PAGE_SIZE, (uint32_t)frame,
+                 PAGE_PRESENT | PAGE_WRITE);
+    }
+    
+    return 0;
+}
+
+// Unmap a range set up by map_kernel_range() and free its frames
+// Only this CPU's TLB is flushed
+void unmap_kernel_range(uint32_t virt_addr, uint32_t pages) {
+    for (uint32_t i = 0; i < pages; i++, virt_addr += PAGE_SIZE) {
+        uint32_t page_index = virt_addr / PAGE_SIZE;
+        page_table_t* table = current_directory->tables[page_index / PAGE_ENTRIES];
+        page_entry_t* pte;
+        
+        if (!table) {
+            continue;
+        }
+        pte = &table->pages[page_index % PAGE_ENTRIES];
+        if (pte->present) {
+            unmap_page(current_directory, virt_addr);
+            free_frame((void*)(pte->frame << 12));
+        }
+    }
+}
+
 // Enhanced aligned memory allocation with overflow protection
 void* kmalloc_aligned(size_t size, size_t alignment) {
     if (size == 0 || alignment == 0) return NULL;
@@ -429,17 +530,28 @@ void kfree_aligned(void* ptr) {
 
 // Memory statistics and diagnostics
 void print_memory_stats(void) {
+    struct mem_cpu_stats sum = {0};
+    unsigned int cpu;
+
+    for_each_online_cpu(cpu) {
+        struct mem_cpu_stats *st = per_cpu_ptr(&mem_events, cpu);
+
+        sum.total_allocations += st->total_allocations;
+        sum.total_frees += st->total_frees;
+        sum.fragmentation_count += st->fragmentation_count;
+    }
+
     screen_print("\n=== Memory Statistics ===\n");
     screen_print("Total allocations: ");
-    screen_print_dec(mem_stats.total_allocations);
+    screen_print_dec(sum.total_allocations);
     screen_print("\nTotal frees: ");
-    screen_print_dec(mem_stats.total_frees);
+    screen_print_dec(sum.total_frees);
     screen_print("\nCurrent usage: ");
     screen_print_dec(mem_stats.current_usage);
     screen_print(" bytes\nPeak usage: ");
     screen_print_dec(mem_stats.peak_usage);
     screen_print(" bytes\nFragmentation events: ");
-    screen_print_dec(mem_stats.fragmentation_count);
+    screen_print_dec(sum.fragmentation_count);
     screen_print("\nFrames used: ");
     screen_print_dec(used_frames);
     screen_print("/");
@@ -449,22 +561,28 @@ void print_memory_stats(void) {
 
 // Heap integrity check
 bool verify_heap_integrity(void) {
-    heap_block_t* block = heap_head;
+    heap_block_t* block;
     uint32_t block_count = 0;
+    unsigned long flags;
+    bool ok = true;
     
-    while (block) {
+    spin_lock_irqsave(&heap_lock, flags);
+    
+    for (block = heap_head; block; block = block->next) {
         if (!verify_block_integrity(block)) {
-            return false;
+            ok = false;
+            break;
         }
         
         // Check for circular references
         if (block_count > total_frames) {
-            return false;
+            ok = false;
+            break;
         }
         
         block_count++;
-        block = block->next;
     }
     
-    return true;
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ok;
 }
@@ -13,11 +13,11 @@
 
 // Global module list
 static LIST_HEAD(module_list);
-static spinlock_t module_list_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(module_list_lock);
 
 // Module symbol table
 static LIST_HEAD(symbol_table);
-static spinlock_t symbol_table_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(symbol_table_lock);
 
 // Module caches
 static kmem_cache_t *module_cache;
@@ -245,6 +245,10 @@ static struct module *module_alloc(void) {
     return mod;
 }
 
+static void module_symbol_free_rcu(struct rcu_head *head) {
+    kmem_cache_free(module_symbol_cache, container_of(head, struct module_symbol, rcu));
+}
+
 /**
  * Free module structure
  */
@@ -285,12 +289,18 @@ static void module_free(struct module *mod) {
     }
     
     if (mod->symbols) {
-        // Free symbol list
-        struct module_symbol *symbol, *symbol_tmp;
-        list_for_each_entry_safe(symbol, symbol_tmp, &mod->symbols->list, list) {
-            list_del(&symbol->list);
-            kmem_cache_free(module_symbol_cache, symbol);
+        // Free symbol list; resolve_symbol() may still be looking at an
+        // exported one, so defer the free past a grace period. The list
+        // member belongs to symbol_table; the module's own chain is next
+        struct module_symbol *symbol = mod->symbols, *symbol_next;
+        spin_lock(&symbol_table_lock);
+        while (symbol) {
+            symbol_next = symbol->next;
+            list_del_rcu(&symbol->list);
+            call_rcu(&symbol->rcu, module_symbol_free_rcu);
+            symbol = symbol_next;
         }
+        spin_unlock(&symbol_table_lock);
     }
     
     if (mod->deps) {
@@ -598,7 +608,7 @@ int export_symbol(struct module_symbol *sym) {
     if (!sym || !sym->name || !sym->value) return -EINVAL;
     
     spin_lock(&symbol_table_lock);
-    list_add(&sym->list, &symbol_table);
+    list_add_rcu(&sym->list, &symbol_table);
     spin_unlock(&symbol_table_lock);
     
     module_stats.total_symbols++;
@@ -625,14 +635,15 @@ void *resolve_symbol(const char *name) {
     
     if (!name) return NULL;
     
-    spin_lock(&symbol_table_lock);
-    list_for_each_entry(sym, &symbol_table, list) {
+    rcu_read_lock();
+    list_for_each_entry_rcu(sym, &symbol_table, list) {
         if (strcmp(sym->name, name) == 0) {
-            spin_unlock(&symbol_table_lock);
-            return sym->value;
+            void *value = sym->value;
+            rcu_read_unlock();
+            return value;
         }
     }
-    spin_unlock(&symbol_table_lock);
+    rcu_read_unlock();
     
     return NULL;
 }
@@ -0,0 +1,232 @@
+#include "apic.h"
+#include "kernel.h"
+#include "mm.h"
+#include "printk.h"
+
+/**
+ * Intel MultiProcessor Specification Table Parsing
+ * Fallback for machines without an ACPI MADT: locates the MP floating
+ * pointer and registers the processors, I/O APICs and ISA interrupt
+ * routing listed in its configuration table
+ */
+
+// MP configuration table entry types
+#define MP_PROCESSOR    0
+#define MP_BUS          1
+#define MP_IOAPIC       2
+#define MP_INTSRC       3
+#define MP_LINTSRC      4
+
+#define CPU_ENABLED     (1 << 0)
+#define MPC_APIC_USABLE (1 << 0)
+#define MP_INT_VECTORED 0
+
+#define MAX_MP_BUSSES   32
+
+struct mpf_intel {
+    char signature[4];          // "_MP_"
+    uint32_t physptr;           // Configuration table address
+    uint8_t length;             // In 16-byte units
+    uint8_t specification;
+    uint8_t checksum;
+    uint8_t feature1;           // Default configuration type if nonzero
+    uint8_t feature2;
+    uint8_t feature3;
+    uint8_t feature4;
+    uint8_t feature5;
+} __attribute__((packed));
+
+struct mpc_table {
+    char signature[4];          // "PCMP"
+    uint16_t length;
+    uint8_t spec;
+    uint8_t checksum;
+    char oem[8];
+    char productid[12];
+    uint32_t oemptr;
+    uint16_t oemsize;
+    uint16_t oemcount;
+    uint32_t lapic;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct mpc_cpu {
+    uint8_t type;
+    uint8_t apicid;
+    uint8_t apicver;
+    uint8_t cpuflag;
+    uint32_t cpufeature;
+    uint32_t featureflag;
+    uint32_t reserved[2];
+} __attribute__((packed));
+
+struct mpc_bus {
+    uint8_t type;
+    uint8_t busid;
+    char bustype[6];
+} __attribute__((packed));
+
+struct mpc_ioapic {
+    uint8_t type;
+    uint8_t apicid;
+    uint8_t apicver;
+    uint8_t flags;
+    uint32_t apicaddr;
+} __attribute__((packed));
+
+struct mpc_intsrc {
+    uint8_t type;
+    uint8_t irqtype;
+    uint16_t irqflag;
+    uint8_t srcbus;
+    uint8_t srcbusirq;
+    uint8_t dstapic;
+    uint8_t dstirq;
+} __attribute__((packed));
+
+// Buses whose interrupts follow ISA numbering
+static bool mp_bus_is_isa[MAX_MP_BUSSES];
+
+static bool mpf_checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+
+    while (len--) {
+        sum += *b++;
+    }
+    return sum == 0;
+}
+
+static struct mpf_intel *mp_scan(uint32_t start, uint32_t length) {
+    for (uint32_t addr = start; addr < start + length; addr += 16) {
+        struct mpf_intel *mpf = (struct mpf_intel *)addr;
+
+        if (mpf->signature[0] == '_' && mpf->signature[1] == 'M' &&
+            mpf->signature[2] == 'P' && mpf->signature[3] == '_' &&
+            mpf->length == 1 && mpf_checksum_ok(mpf, 16)) {
+            return mpf;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Search the first KB of the EBDA, the last KB of base memory, then
+ * the BIOS ROM
+ */
+static struct mpf_intel *mp_find_floating_pointer(void) {
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t *)0x40E) << 4;
+    struct mpf_intel *mpf = NULL;
+
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        mpf = mp_scan(ebda, 1024);
+    }
+    if (!mpf) {
+        mpf = mp_scan(0x9FC00, 1024);
+    }
+    if (!mpf) {
+        mpf = mp_scan(0xF0000, 0x10000);
+    }
+    return mpf;
+}
+
+static void mp_parse_intsrc(struct mpc_intsrc *m) {
+    if (m->irqtype != MP_INT_VECTORED || m->srcbus >= MAX_MP_BUSSES ||
+        !mp_bus_is_isa[m->srcbus]) {
+        return;
+    }
+
+    // Identity-mapped ISA IRQs with default polarity need no override
+    if (m->srcbusirq == m->dstirq && m->irqflag == 0) {
+        return;
+    }
+
+    apic_register_override(m->srcbusirq, m->dstirq, m->irqflag);
+}
+
+/**
+ * Register CPUs and interrupt routing from the MP configuration table
+ * Returns the number of enabled CPUs found, or -ENODEV without one
+ */
+int mp_parse_tables(void) {
+    struct mpf_intel *mpf = mp_find_floating_pointer();
+    struct mpc_table *mpc;
+    uint8_t *p, *end;
+    int cpus = 0;
+
+    if (!mpf) {
+        return -ENODEV;
+    }
+
+    // Default configurations (no table) describe a plain two-CPU system
+    if (mpf->feature1 || !mpf->physptr) {
+        pr_warn("mptable: default configuration %d not supported\n", mpf->feature1);
+        return -ENODEV;
+    }
+
+    mpc = ioremap(mpf->physptr, sizeof(struct mpc_table));
+    ioremap(mpf->physptr, mpc->length);
+
+    if (mpc->signature[0] != 'P' || mpc->signature[1] != 'C' ||
+        mpc->signature[2] != 'M' || mpc->signature[3] != 'P' ||
+        !mpf_checksum_ok(mpc, mpc->length)) {
+        pr_warn("mptable: bad configuration table at 0x%x\n", mpf->physptr);
+        return -ENODEV;
+    }
+
+    mp_lapic_addr = mpc->lapic;
+
+    p = (uint8_t *)(mpc + 1);
+    end = (uint8_t *)mpc + mpc->length;
+
+    while (p < end) {
+        switch (*p) {
+            case MP_PROCESSOR: {
+                struct mpc_cpu *m = (struct mpc_cpu *)p;
+
+                if ((m->cpuflag & CPU_ENABLED) && apic_register_cpu(m->apicid) >= 0) {
+                    cpus++;
+                }
+                p += sizeof(*m);
+                break;
+            }
+            case MP_BUS: {
+                struct mpc_bus *m = (struct mpc_bus *)p;
+
+                if (m->busid < MAX_MP_BUSSES) {
+                    mp_bus_is_isa[m->busid] = m->bustype[0] == 'I' &&
+                                              m->bustype[1] == 'S' &&
+                                              m->bustype[2] == 'A';
+                }
+                p += sizeof(*m);
+                break;
+            }
+            case MP_IOAPIC: {
+                struct mpc_ioapic *m = (struct mpc_ioapic *)p;
+
+                if (m->flags & MPC_APIC_USABLE) {
+                    // MP tables carry no GSI base; I/O APICs are numbered
+                    // consecutively at 24 pins apiece
+                    apic_register_ioapic(m->apicid, m->apicaddr, nr_ioapics * 24);
+                }
+                p += sizeof(*m);
+                break;
+            }
+            case MP_INTSRC:
+                mp_parse_intsrc((struct mpc_intsrc *)p);
+                p += sizeof(struct mpc_intsrc);
+                break;
+            case MP_LINTSRC:
+                p += sizeof(struct mpc_intsrc);
+                break;
+            default:
+                pr_warn("mptable: unknown entry type %d, stopping\n", *p);
+                p = end;
+                break;
+        }
+    }
+
+    pr_info("mptable: %d CPUs, %d I/O APICs, %d overrides\n",
+            cpus, nr_ioapics, nr_irq_overrides);
+    return cpus;
+}
@@ -0,0 +1,49 @@
+#include "percpu.h"
+#include "kernel.h"
+#include "printk.h"
+
+/**
+ * Per-CPU Area Setup
+ * Copies the link-time .data..percpu image once per CPU. The areas are
+ * reserved statically so the copy can be made before the heap exists,
+ * ahead of the first write to any per-CPU variable; the image itself is
+ * never written.
+ */
+
+// Room reserved per CPU for the per-CPU section
+#define PERCPU_ENOUGH_ROOM  32768
+
+static char percpu_areas[NR_CPUS][PERCPU_ENOUGH_ROOM] __attribute__((aligned(64)));
+
+// Zero until setup_per_cpu_areas(): everyone shares the link-time image
+uint32_t __per_cpu_offset[NR_CPUS];
+
+DEFINE_PER_CPU(uint32_t, this_cpu_off);
+DEFINE_PER_CPU(unsigned int, cpu_number);
+
+/**
+ * Fill a copy of the per-CPU section for every CPU
+ * Firmware tables are parsed later, so all NR_CPUS get an area. Must run
+ * before anything writes a per-CPU variable and before any CPU loads its
+ * per-CPU segment.
+ */
+void setup_per_cpu_areas(void) {
+    uint32_t size = __per_cpu_end - __per_cpu_start;
+    unsigned int cpu;
+
+    if (size > PERCPU_ENOUGH_ROOM) {
+        panic("percpu: .data..percpu exceeds PERCPU_ENOUGH_ROOM");
+    }
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        char *area = percpu_areas[cpu];
+
+        memcpy(area, __per_cpu_start, size);
+        __per_cpu_offset[cpu] = (uint32_t)area - (uint32_t)__per_cpu_start;
+
+        per_cpu(this_cpu_off, cpu) = __per_cpu_offset[cpu];
+        per_cpu(cpu_number, cpu) = cpu;
+    }
+
+    pr_info("percpu: %d bytes per CPU for %d CPUs\n", size, NR_CPUS);
+}
@@ -3,6 +3,7 @@
 #include "screen.h"
 #include "mm.h"
 #include "slab.h"
+#include "ktime.h"
 
 /**
  * Linux-Inspired printk System Implementation
@@ -17,7 +18,7 @@ struct printk_ctrl printk_ctrl = {
     .minimum_console_loglevel = LOGLEVEL_EMERG,
     .printk_time = 1,
     .console_drivers = NULL,
-    .lock = SPIN_LOCK_UNLOCKED
+    .lock = __SPIN_LOCK_UNLOCKED("printk_ctrl.lock")
 };
 
 // Global log buffer
@@ -270,9 +271,11 @@ static int vsnprintf_internal(char *buf, size_t size, const char *fmt, va_list a
  * Add message to log buffer
  */
 static void log_buf_add(const char *msg, int len) {
+    unsigned long flags;
+    
     if (!msg || len <= 0) return;
     
-    spin_lock(&printk_ctrl.lock);
+    spin_lock_irqsave(&printk_ctrl.lock, flags);
     
     // Copy message to circular buffer
     for (int i = 0; i < len && log_buf.len < LOG_BUF_LEN; i++) {
@@ -289,7 +292,7 @@ static void log_buf_add(const char *msg, int len) {
     
     log_buf.sequence++;
     
-    spin_unlock(&printk_ctrl.lock);
+    spin_unlock_irqrestore(&printk_ctrl.lock, flags);
 }
 
 /**
@@ -364,9 +367,20 @@ int vprintk(const char *fmt, va_list args) {
     
     // Add timestamp if enabled
     if (printk_ctrl.printk_time) {
-        unsigned long timestamp = printk_timestamp();
+        uint32_t rem_ns;
+        uint32_t secs = (uint32_t)div_u64_rem(printk_timestamp(), NSEC_PER_SEC, &rem_ns);
+        uint32_t usecs = rem_ns / NSEC_PER_USEC;
+        char usec_str[7];
+        
+        // vsnprintf_internal has no width support, so zero-pad by hand
+        for (int i = 5; i >= 0; i--) {
+            usec_str[i] = '0' + (usecs % 10);
+            usecs /= 10;
+        }
+        usec_str[6] = '\0';
+        
         final_len += snprintf(final_buf + final_len, sizeof(final_buf) - final_len, 
-                             "[%lu.%03lu] ", timestamp / 1000, timestamp % 1000);
+                             "[%u.%s] ", secs, usec_str);
     }
     
     // Add log level prefix
@@ -466,10 +480,10 @@ void emergency_printk(const char *fmt, ...) {
 }
 
 /**
- * Get timestamp for printk
+ * Get timestamp for printk in nanoseconds since boot
  */
-unsigned long printk_timestamp(void) {
-    return kernel_get_timestamp();
+uint64_t printk_timestamp(void) {
+    return ktime_get_ns();
 }
 
 /**
@@ -522,15 +536,17 @@ int message_loglevel_get(void) {
  * Register console driver
  */
 void register_console(struct console *console) {
+    unsigned long flags;
+    
     if (!console) return;
     
-    spin_lock(&printk_ctrl.lock);
+    spin_lock_irqsave(&printk_ctrl.lock, flags);
     
     // Add to beginning of list
     console->next = printk_ctrl.console_drivers;
     printk_ctrl.console_drivers = console;
     
-    spin_unlock(&printk_ctrl.lock);
+    spin_unlock_irqrestore(&printk_ctrl.lock, flags);
     
     pr_info("Console '%s' registered\n", console->name);
 }
@@ -540,10 +556,11 @@ void register_console(struct console *console) {
  */
 void unregister_console(struct console *console) {
     struct console **con;
+    unsigned long flags;
     
     if (!console) return;
     
-    spin_lock(&printk_ctrl.lock);
+    spin_lock_irqsave(&printk_ctrl.lock, flags);
     
     // Find and remove from list
     con = &printk_ctrl.console_drivers;
@@ -556,7 +573,7 @@ void unregister_console(struct console *console) {
         console->next = NULL;
     }
     
-    spin_unlock(&printk_ctrl.lock);
+    spin_unlock_irqrestore(&printk_ctrl.lock, flags);
     
     if (*con) {
         pr_info("Console '%s' unregistered\n", console->name);
@@ -567,7 +584,9 @@ void unregister_console(struct console *console) {
  * Clear log buffer
  */
 void log_buf_clear(void) {
-    spin_lock(&printk_ctrl.lock);
+    unsigned long flags;
+    
+    spin_lock_irqsave(&printk_ctrl.lock, flags);
     
     log_buf.head = 0;
     log_buf.tail = 0;
@@ -575,7 +594,7 @@ void log_buf_clear(void) {
     log_buf.sequence = 0;
     memset(log_buf.buf, 0, sizeof(log_buf.buf));
     
-    spin_unlock(&printk_ctrl.lock);
+    spin_unlock_irqrestore(&printk_ctrl.lock, flags);
 }
 
 /**
@@ -583,10 +602,11 @@ void log_buf_clear(void) {
  */
 int log_buf_copy(char *buf, int len) {
     int copied = 0;
+    unsigned long flags;
     
     if (!buf || len <= 0) return 0;
     
-    spin_lock(&printk_ctrl.lock);
+    spin_lock_irqsave(&printk_ctrl.lock, flags);
     
     int to_copy = (len < log_buf.len) ? len : log_buf.len;
     int pos = log_buf.tail;
@@ -597,7 +617,7 @@ int log_buf_copy(char *buf, int len) {
         copied++;
     }
     
-    spin_unlock(&printk_ctrl.lock);
+    spin_unlock_irqrestore(&printk_ctrl.lock, flags);
     
     return copied;
 }
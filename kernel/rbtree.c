@@ -0,0 +1,314 @@
+#include "rbtree.h"
+
+/**
+ * Red-Black Tree Implementation
+ * Insert and erase rebalancing with parent pointers
+ * Based on the classic CLRS algorithms used by Linux lib/rbtree.c
+ */
+
+static inline bool rb_is_red(const struct rb_node *node) {
+    return node && node->rb_color == RB_RED;
+}
+
+static inline bool rb_is_black(const struct rb_node *node) {
+    return !node || node->rb_color == RB_BLACK;
+}
+
+/**
+ * Replace old with new in the parent's child slot (or the root)
+ */
+static void rb_change_child(struct rb_node *old, struct rb_node *new,
+                            struct rb_node *parent, struct rb_root *root) {
+    if (parent) {
+        if (parent->rb_left == old) {
+            parent->rb_left = new;
+        } else {
+            parent->rb_right = new;
+        }
+    } else {
+        root->rb_node = new;
+    }
+}
+
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *right = node->rb_right;
+    struct rb_node *parent = node->rb_parent;
+
+    node->rb_right = right->rb_left;
+    if (right->rb_left) {
+        right->rb_left->rb_parent = node;
+    }
+
+    right->rb_left = node;
+    right->rb_parent = parent;
+    rb_change_child(node, right, parent, root);
+    node->rb_parent = right;
+}
+
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *left = node->rb_left;
+    struct rb_node *parent = node->rb_parent;
+
+    node->rb_left = left->rb_right;
+    if (left->rb_right) {
+        left->rb_right->rb_parent = node;
+    }
+
+    left->rb_right = node;
+    left->rb_parent = parent;
+    rb_change_child(node, left, parent, root);
+    node->rb_parent = left;
+}
+
+/**
+ * Rebalance after rb_link_node()
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *parent, *gparent, *uncle;
+
+    while ((parent = node->rb_parent) && rb_is_red(parent)) {
+        gparent = parent->rb_parent;
+
+        if (parent == gparent->rb_left) {
+            uncle = gparent->rb_right;
+
+            // Case 1: uncle is red - recolor and move up
+            if (rb_is_red(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            // Case 2: node is a right child - rotate into case 3
+            if (parent->rb_right == node) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+
+            // Case 3: node is a left child
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            uncle = gparent->rb_left;
+
+            if (rb_is_red(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (parent->rb_left == node) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+
+    root->rb_node->rb_color = RB_BLACK;
+}
+
+/**
+ * Restore black height after removing a black node
+ */
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent,
+                           struct rb_root *root) {
+    struct rb_node *sibling;
+
+    while (rb_is_black(node) && node != root->rb_node) {
+        if (parent->rb_left == node) {
+            sibling = parent->rb_right;
+
+            if (rb_is_red(sibling)) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->rb_right;
+            }
+
+            if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (rb_is_black(sibling->rb_right)) {
+                    sibling->rb_left->rb_color = RB_BLACK;
+                    sibling->rb_color = RB_RED;
+                    rb_rotate_right(sibling, root);
+                    sibling = parent->rb_right;
+                }
+                sibling->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                sibling->rb_right->rb_color = RB_BLACK;
+                rb_rotate_left(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        } else {
+            sibling = parent->rb_left;
+
+            if (rb_is_red(sibling)) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->rb_left;
+            }
+
+            if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (rb_is_black(sibling->rb_left)) {
+                    sibling->rb_right->rb_color = RB_BLACK;
+                    sibling->rb_color = RB_RED;
+                    rb_rotate_left(sibling, root);
+                    sibling = parent->rb_left;
+                }
+                sibling->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                sibling->rb_left->rb_color = RB_BLACK;
+                rb_rotate_right(parent, root);
+                node = root->rb_node;
+                break;
+            }
+        }
+    }
+
+    if (node) {
+        node->rb_color = RB_BLACK;
+    }
+}
+
+/**
+ * Remove a node from the tree
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *child, *parent;
+    unsigned int color;
+
+    if (!node->rb_left) {
+        child = node->rb_right;
+    } else if (!node->rb_right) {
+        child = node->rb_left;
+    } else {
+        // Two children: splice out the in-order successor instead
+        struct rb_node *old = node;
+
+        node = node->rb_right;
+        while (node->rb_left) {
+            node = node->rb_left;
+        }
+
+        rb_change_child(old, node, old->rb_parent, root);
+
+        child = node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+
+        if (parent == old) {
+            // Successor was old's direct right child and keeps its subtree
+            parent = node;
+        } else {
+            if (child) {
+                child->rb_parent = parent;
+            }
+            parent->rb_left = child;
+            node->rb_right = old->rb_right;
+            old->rb_right->rb_parent = node;
+        }
+
+        node->rb_parent = old->rb_parent;
+        node->rb_color = old->rb_color;
+        node->rb_left = old->rb_left;
+        old->rb_left->rb_parent = node;
+
+        goto color;
+    }
+
+    parent = node->rb_parent;
+    color = node->rb_color;
+
+    if (child) {
+        child->rb_parent = parent;
+    }
+    rb_change_child(node, child, parent, root);
+
+color:
+    if (color == RB_BLACK) {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+/**
+ * In-order traversal helpers
+ */
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *n = root->rb_node;
+
+    if (!n) return NULL;
+    while (n->rb_left) {
+        n = n->rb_left;
+    }
+    return n;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *n = root->rb_node;
+
+    if (!n) return NULL;
+    while (n->rb_right) {
+        n = n->rb_right;
+    }
+    return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (RB_EMPTY_NODE(node)) return NULL;
+
+    // Leftmost node of the right subtree
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left) {
+            node = node->rb_left;
+        }
+        return (struct rb_node *)node;
+    }
+
+    // Otherwise climb until we come up from a left child
+    while ((parent = node->rb_parent) && node == parent->rb_right) {
+        node = parent;
+    }
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (RB_EMPTY_NODE(node)) return NULL;
+
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right) {
+            node = node->rb_right;
+        }
+        return (struct rb_node *)node;
+    }
+
+    while ((parent = node->rb_parent) && node == parent->rb_left) {
+        node = parent;
+    }
+    return parent;
+}
@@ -0,0 +1,318 @@
+#include "rcupdate.h"
+#include "spinlock.h"
+#include "cpumask.h"
+#include "kernel.h"
+#include "wait.h"
+#include "printk.h"
+#include "softirq.h"
+
+/**
+ * Classic RCU Grace-Period Machinery
+ * One global grace period is in flight at a time. Each CPU notices a new
+ * one from its tick, waits for a quiescent state and clears itself from
+ * cpumask; the last CPU to report completes it. Idle CPUs are left out of
+ * cpumask since they hold no read-side references, so a CPU halted
+ * without a tick never stalls a grace period.
+ */
+
+static struct {
+    spinlock_t lock;
+    unsigned long cur;          // Latest grace period started
+    unsigned long completed;    // Latest grace period completed
+    bool next_pending;          // Callbacks wait for a grace period not yet started
+    struct cpumask cpumask;     // CPUs that still owe a quiescent state
+} rcu_ctrl = {
+    .lock = __SPIN_LOCK_UNLOCKED("rcu_ctrl.lock"),
+};
+
+DEFINE_PER_CPU(struct rcu_data, rcu_data);
+DEFINE_PER_CPU(int, rcu_read_lock_nesting);
+
+// Set while the CPU sits in its idle loop outside interrupt handlers
+static DEFINE_PER_CPU(bool, rcu_in_idle);
+
+// Interrupt taken from idle; rcu_irq_exit() goes back to idle
+static DEFINE_PER_CPU(bool, rcu_irq_from_idle);
+
+// Grace period a is no earlier than b, robust to wrap
+static inline bool rcu_batch_after_eq(unsigned long a, unsigned long b) {
+    return (long)(a - b) >= 0;
+}
+
+/**
+ * Start the next grace period if one is wanted and none is running
+ * Called with rcu_ctrl.lock held
+ */
+static void rcu_start_batch(void) {
+    unsigned int cpu;
+
+    if (!rcu_ctrl.next_pending || rcu_ctrl.completed != rcu_ctrl.cur) {
+        return;
+    }
+
+    rcu_ctrl.next_pending = false;
+    rcu_ctrl.cur++;
+
+    // Removals before this point must be visible to readers that start
+    // on CPUs we are about to skip as idle
+    mb();
+
+    cpumask_clear(&rcu_ctrl.cpumask);
+    for_each_online_cpu(cpu) {
+        if (!per_cpu(rcu_in_idle, cpu)) {
+            cpumask_set_cpu(cpu, &rcu_ctrl.cpumask);
+        }
+    }
+
+    if (cpumask_empty(&rcu_ctrl.cpumask)) {
+        rcu_ctrl.completed = rcu_ctrl.cur;
+    }
+}
+
+/**
+ * A CPU passed a quiescent state in the current grace period
+ * Called with rcu_ctrl.lock held
+ */
+static void rcu_cpu_quiet(unsigned int cpu) {
+    if (!cpumask_test_cpu(cpu, &rcu_ctrl.cpumask)) {
+        return;
+    }
+
+    cpumask_clear_cpu(cpu, &rcu_ctrl.cpumask);
+    if (cpumask_empty(&rcu_ctrl.cpumask)) {
+        rcu_ctrl.completed = rcu_ctrl.cur;
+        rcu_start_batch();
+    }
+}
+
+/**
+ * Track the current grace period and report our quiescent state once
+ */
+static void rcu_check_quiescent_state(struct rcu_data *rdp) {
+    unsigned long flags;
+
+    if (rdp->quiescbatch != rcu_ctrl.cur) {
+        // New grace period: a quiescent state only counts from now on
+        rdp->qs_pending = true;
+        rdp->passed_quiesce = false;
+        rdp->quiescbatch = rcu_ctrl.cur;
+        return;
+    }
+
+    if (!rdp->qs_pending || !rdp->passed_quiesce) {
+        return;
+    }
+    rdp->qs_pending = false;
+
+    spin_lock_irqsave(&rcu_ctrl.lock, flags);
+    if (rdp->quiescbatch == rcu_ctrl.cur) {
+        rcu_cpu_quiet(smp_processor_id());
+    }
+    spin_unlock_irqrestore(&rcu_ctrl.lock, flags);
+}
+
+/**
+ * RCU_SOFTIRQ action
+ * Advance this CPU's callbacks and invoke those whose grace period ended
+ */
+static void rcu_process_callbacks(struct softirq_action *h) {
+    struct rcu_data *rdp = this_cpu_ptr(&rcu_data);
+    struct rcu_head *list, *next;
+    unsigned long flags;
+    uint32_t count = 0;
+
+    local_irq_save(flags);
+
+    if (rdp->curlist && rcu_batch_after_eq(rcu_ctrl.completed, rdp->batch)) {
+        *rdp->donetail = rdp->curlist;
+        rdp->donetail = rdp->curtail;
+        rdp->curlist = NULL;
+        rdp->curtail = &rdp->curlist;
+    }
+
+    if (rdp->nxtlist && !rdp->curlist) {
+        rdp->curlist = rdp->nxtlist;
+        rdp->curtail = rdp->nxttail;
+        rdp->nxtlist = NULL;
+        rdp->nxttail = &rdp->nxtlist;
+
+        // The grace period after the current one covers these
+        spin_lock(&rcu_ctrl.lock);
+        rdp->batch = rcu_ctrl.cur + 1;
+        rcu_ctrl.next_pending = true;
+        rcu_start_batch();
+        spin_unlock(&rcu_ctrl.lock);
+    }
+
+    rcu_check_quiescent_state(rdp);
+
+    list = rdp->donelist;
+    rdp->donelist = NULL;
+    rdp->donetail = &rdp->donelist;
+
+    local_irq_restore(flags);
+
+    while (list) {
+        next = list->next;
+        list->func(list);
+        list = next;
+        count++;
+    }
+
+    if (count) {
+        local_irq_save(flags);
+        rdp->qlen -= count;
+        local_irq_restore(flags);
+    }
+}
+
+// Anything for this CPU to do on this tick
+static bool rcu_pending(struct rcu_data *rdp) {
+    if (rdp->curlist && rcu_batch_after_eq(rcu_ctrl.completed, rdp->batch)) {
+        return true;
+    }
+    if (rdp->nxtlist && !rdp->curlist) {
+        return true;
+    }
+    if (rdp->donelist) {
+        return true;
+    }
+    if (rdp->quiescbatch != rcu_ctrl.cur) {
+        return true;
+    }
+    return rdp->qs_pending && rdp->passed_quiesce;
+}
+
+/**
+ * Queue func to run after a grace period
+ * Safe from any context; the callback runs on this CPU, from the
+ * RCU_SOFTIRQ its own tick raises
+ */
+void call_rcu(struct rcu_head *head, rcu_callback_t func) {
+    struct rcu_data *rdp;
+    unsigned long flags;
+
+    head->func = func;
+    head->next = NULL;
+
+    local_irq_save(flags);
+    rdp = this_cpu_ptr(&rcu_data);
+    *rdp->nxttail = head;
+    rdp->nxttail = &head->next;
+    rdp->qlen++;
+    local_irq_restore(flags);
+}
+
+struct rcu_synchronize {
+    struct rcu_head head;
+    wait_queue_head_t wait;
+    volatile bool done;
+};
+
+static void wakeme_after_rcu(struct rcu_head *head) {
+    struct rcu_synchronize *rs = container_of(head, struct rcu_synchronize, head);
+
+    rs->done = true;
+    wake_up(&rs->wait);
+}
+
+/**
+ * Wait until all read-side critical sections running now have finished
+ * Must not be called inside one
+ */
+void synchronize_rcu(void) {
+    struct rcu_synchronize rs;
+
+    // Blocking here is itself a quiescent state, and no other CPU can
+    // hold a reference
+    if (num_online_cpus() <= 1) {
+        return;
+    }
+
+    init_waitqueue_head(&rs.wait);
+    rs.done = false;
+    call_rcu(&rs.head, wakeme_after_rcu);
+    wait_event(rs.wait, rs.done);
+}
+
+/**
+ * The scheduler is switching tasks on this CPU
+ */
+void rcu_note_context_switch(void) {
+    this_cpu_write(rcu_data.passed_quiesce, true);
+}
+
+/**
+ * Timer tick hook, called on every CPU from its own tick
+ * The tick never preempts a read-side critical section, so one that
+ * interrupted code with a zero nesting count is a quiescent state
+ */
+void rcu_check_callbacks(void) {
+    struct rcu_data *rdp = this_cpu_ptr(&rcu_data);
+
+    if (!this_cpu_read(rcu_read_lock_nesting)) {
+        rcu_note_context_switch();
+    }
+
+    if (rcu_pending(rdp)) {
+        raise_softirq(RCU_SOFTIRQ);
+    }
+}
+
+/**
+ * Enter or leave the idle loop
+ * An idle CPU is an extended quiescent state: grace periods started
+ * while it idles skip it, and one already waiting for it is released
+ */
+void rcu_idle_enter(void) {
+    unsigned long flags;
+
+    this_cpu_write(rcu_in_idle, true);
+    mb();
+
+    spin_lock_irqsave(&rcu_ctrl.lock, flags);
+    rcu_cpu_quiet(smp_processor_id());
+    spin_unlock_irqrestore(&rcu_ctrl.lock, flags);
+}
+
+void rcu_idle_exit(void) {
+    this_cpu_write(rcu_in_idle, false);
+    mb();
+}
+
+/**
+ * Interrupt handlers may be readers, so an interrupt taken from idle
+ * leaves the extended quiescent state for its duration
+ */
+void rcu_irq_enter(void) {
+    if (this_cpu_read(rcu_in_idle)) {
+        this_cpu_write(rcu_irq_from_idle, true);
+        rcu_idle_exit();
+    }
+}
+
+void rcu_irq_exit(void) {
+    if (this_cpu_read(rcu_irq_from_idle)) {
+        this_cpu_write(rcu_irq_from_idle, false);
+        rcu_idle_enter();
+    }
+}
+
+/**
+ * Set up the callback lists of every CPU
+ */
+void rcu_init(void) {
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct rcu_data *rdp = per_cpu_ptr(&rcu_data, cpu);
+
+        rdp->nxttail = &rdp->nxtlist;
+        rdp->curtail = &rdp->curlist;
+        rdp->donetail = &rdp->donelist;
+    }
+
+    open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
+
+    pr_info("rcu: classic RCU, %d CPUs\n", NR_CPUS);
+}
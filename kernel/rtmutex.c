@@ -0,0 +1,339 @@
+#include "rtmutex.h"
+#include "kernel.h"
+#include "printk.h"
+
+/**
+ * Priority-Inheritance Mutex Implementation
+ * The top waiter of every lock a task owns is kept on the task's
+ * pi_waiters list; the task runs at the most urgent of those priorities
+ * and its own. When a waiter's priority changes, the boost is propagated
+ * down the chain of owners that are themselves blocked on rt_mutexes.
+ * One lock serializes all PI state, which keeps the chain walk simple
+ * for the handful of CPUs this kernel supports.
+ */
+
+static DEFINE_SPINLOCK(rt_mutex_pi_lock);
+
+static inline bool rt_mutex_has_waiters(struct rt_mutex *lock) {
+    return !list_empty(&lock->waiters);
+}
+
+static inline struct rt_mutex_waiter *rt_mutex_top_waiter(struct rt_mutex *lock) {
+    return list_first_entry(&lock->waiters, struct rt_mutex_waiter, list_entry);
+}
+
+/**
+ * Insert a waiter behind all waiters of equal or higher priority
+ */
+static void rt_mutex_enqueue(struct rt_mutex *lock, struct rt_mutex_waiter *waiter) {
+    struct rt_mutex_waiter *pos;
+
+    list_for_each_entry(pos, &lock->waiters, list_entry) {
+        if (waiter->prio < pos->prio) {
+            break;
+        }
+    }
+    list_add_tail(&waiter->list_entry, &pos->list_entry);
+}
+
+static void rt_mutex_enqueue_pi(process_t *task, struct rt_mutex_waiter *waiter) {
+    struct rt_mutex_waiter *pos;
+
+    list_for_each_entry(pos, &task->pi_waiters, pi_list_entry) {
+        if (waiter->prio < pos->prio) {
+            break;
+        }
+    }
+    list_add_tail(&waiter->pi_list_entry, &pos->pi_list_entry);
+}
+
+/**
+ * Priority a task should run at: its own, or its most urgent PI waiter's
+ */
+int rt_mutex_getprio(process_t *p) {
+    struct rt_mutex_waiter *top;
+
+    if (list_empty(&p->pi_waiters)) {
+        return p->normal_prio;
+    }
+
+    top = list_first_entry(&p->pi_waiters, struct rt_mutex_waiter, pi_list_entry);
+    return top->prio < p->normal_prio ? top->prio : p->normal_prio;
+}
+
+/**
+ * Set the effective priority; the scheduler compares it on every pick
+ */
+void rt_mutex_setprio(process_t *p, int prio) {
+    p->prio = prio;
+}
+
+/**
+ * Propagate a priority change from task through the owners it waits on
+ * Called with rt_mutex_pi_lock held
+ */
+static int rt_mutex_adjust_prio_chain(process_t *task) {
+    int depth = 0;
+
+    for (;;) {
+        struct rt_mutex_waiter *waiter, *top;
+        struct rt_mutex *lock;
+        int prio = rt_mutex_getprio(task);
+
+        if (prio == task->prio) {
+            return 0;
+        }
+        rt_mutex_setprio(task, prio);
+
+        waiter = task->pi_blocked_on;
+        if (!waiter) {
+            return 0;
+        }
+
+        // A cycle of owners never settles; stop rather than spin forever
+        if (++depth > RT_MUTEX_MAX_LOCK_DEPTH) {
+            pr_warn("rt_mutex: lock chain too deep, possible deadlock on %s\n",
+                    waiter->lock->name);
+            return -EDEADLK;
+        }
+
+        // Requeue the waiter at its new priority
+        lock = waiter->lock;
+        top = rt_mutex_top_waiter(lock);
+        list_del(&waiter->list_entry);
+        waiter->prio = task->prio;
+        rt_mutex_enqueue(lock, waiter);
+
+        // Released but not yet taken: the woken waiter picks up the boost
+        if (!lock->owner) {
+            return 0;
+        }
+
+        // The owner only inherits from the top waiter
+        if (waiter != top && waiter != rt_mutex_top_waiter(lock)) {
+            return 0;
+        }
+
+        list_del_init(&top->pi_list_entry);
+        rt_mutex_enqueue_pi(lock->owner, rt_mutex_top_waiter(lock));
+
+        task = lock->owner;
+    }
+}
+
+/**
+ * Make task the owner, inheriting from the remaining top waiter
+ */
+static void rt_mutex_take(struct rt_mutex *lock, process_t *task) {
+    lock->owner = task;
+    list_add(&lock->held_entry, &task->pi_held_locks);
+
+    if (rt_mutex_has_waiters(lock)) {
+        rt_mutex_enqueue_pi(task, rt_mutex_top_waiter(lock));
+        rt_mutex_setprio(task, rt_mutex_getprio(task));
+    }
+}
+
+/**
+ * Drop the owner and wake the top waiter to take the lock
+ */
+static void rt_mutex_release(struct rt_mutex *lock) {
+    lock->owner = NULL;
+    list_del_init(&lock->held_entry);
+
+    if (rt_mutex_has_waiters(lock)) {
+        struct rt_mutex_waiter *top = rt_mutex_top_waiter(lock);
+
+        list_del_init(&top->pi_list_entry);
+        wake_up_process(top->task);
+    }
+}
+
+/**
+ * A free lock may be taken ahead of its waiters only by a more urgent task
+ */
+static bool rt_mutex_can_steal(struct rt_mutex *lock, process_t *task) {
+    return !lock->owner &&
+           (!rt_mutex_has_waiters(lock) ||
+            task->prio < rt_mutex_top_waiter(lock)->prio);
+}
+
+/**
+ * Initialize an rt_mutex
+ */
+void rt_mutex_init(struct rt_mutex *lock, const char *name) {
+    lock->owner = NULL;
+    INIT_LIST_HEAD(&lock->held_entry);
+    INIT_LIST_HEAD(&lock->waiters);
+    lock->name = name;
+}
+
+/**
+ * Initialize the PI state of a new process
+ */
+void rt_mutex_init_task(process_t *p) {
+    INIT_LIST_HEAD(&p->pi_waiters);
+    INIT_LIST_HEAD(&p->pi_held_locks);
+    p->pi_blocked_on = NULL;
+    p->prio = p->normal_prio;
+}
+
+/**
+ * Acquire the lock, sleeping and boosting the owner while it is held
+ */
+void rt_mutex_lock(struct rt_mutex *lock) {
+    process_t *self = current_process;
+    struct rt_mutex_waiter waiter;
+    unsigned long flags;
+
+    spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+
+    if (rt_mutex_can_steal(lock, self)) {
+        rt_mutex_take(lock, self);
+        spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+        return;
+    }
+
+    if (lock->owner == self) {
+        spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+        panic("rt_mutex: recursive lock");
+    }
+
+    waiter.task = self;
+    waiter.lock = lock;
+    waiter.prio = self->prio;
+    INIT_LIST_HEAD(&waiter.pi_list_entry);
+
+    if (lock->owner) {
+        struct rt_mutex_waiter *top = rt_mutex_has_waiters(lock) ?
+                                      rt_mutex_top_waiter(lock) : NULL;
+
+        rt_mutex_enqueue(lock, &waiter);
+
+        // A new top waiter boosts the owner and everything it waits on
+        if (rt_mutex_top_waiter(lock) == &waiter) {
+            if (top) {
+                list_del_init(&top->pi_list_entry);
+            }
+            rt_mutex_enqueue_pi(lock->owner, &waiter);
+            rt_mutex_adjust_prio_chain(lock->owner);
+        }
+    } else {
+        rt_mutex_enqueue(lock, &waiter);
+    }
+
+    self->pi_blocked_on = &waiter;
+
+    // The owner wakes the top waiter on unlock and only the top waiter
+    // takes a free lock. One overtaken by a boosted waiter after its
+    // wakeup passes the wakeup on, so the new top is never stranded
+    while (lock->owner || rt_mutex_top_waiter(lock) != &waiter) {
+        if (!lock->owner) {
+            wake_up_process(rt_mutex_top_waiter(lock)->task);
+        }
+        self->pcb.state = PROCESS_BLOCKED;
+        spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+        process_sleep();
+        spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+    }
+
+    list_del(&waiter.list_entry);
+    list_del_init(&waiter.pi_list_entry);
+    self->pi_blocked_on = NULL;
+    rt_mutex_take(lock, self);
+
+    spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+}
+
+/**
+ * Try to acquire the lock without sleeping
+ * Returns 1 on success, 0 if it is held or more urgent tasks wait for it
+ */
+int rt_mutex_trylock(struct rt_mutex *lock) {
+    unsigned long flags;
+    int ret = 0;
+
+    spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+    if (rt_mutex_can_steal(lock, current_process)) {
+        rt_mutex_take(lock, current_process);
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+
+    return ret;
+}
+
+/**
+ * Release the lock, wake its top waiter and drop the inherited boost
+ */
+void rt_mutex_unlock(struct rt_mutex *lock) {
+    process_t *self = current_process;
+    unsigned long flags;
+
+    spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+
+    if (lock->owner != self) {
+        spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+        pr_warn("rt_mutex: %s released by non-owner\n", lock->name);
+        return;
+    }
+
+    rt_mutex_release(lock);
+    rt_mutex_setprio(self, rt_mutex_getprio(self));
+
+    spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+}
+
+/**
+ * Re-evaluate p's priority after its normal priority changed
+ */
+void rt_mutex_adjust_pi(process_t *p) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+    rt_mutex_adjust_prio_chain(p);
+    spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+}
+
+/**
+ * Detach a killed task from the rt_mutex state it is part of
+ * Its waiter lives on its stack, which is about to be freed, so it
+ * leaves the lock it waits for. Every lock it owns is released, to
+ * the top waiter if there is one; nobody else could ever unlock them
+ */
+void rt_mutex_remove_task(process_t *p) {
+    struct rt_mutex_waiter *waiter, *top;
+    struct rt_mutex *lock;
+    unsigned long flags;
+
+    spin_lock_irqsave(&rt_mutex_pi_lock, flags);
+
+    waiter = p->pi_blocked_on;
+    if (waiter) {
+        lock = waiter->lock;
+        top = rt_mutex_top_waiter(lock);
+        list_del(&waiter->list_entry);
+        list_del_init(&waiter->pi_list_entry);
+        p->pi_blocked_on = NULL;
+
+        // The owner inherited from the waiter that left; the next one
+        // takes its place, or wakes to take a free lock
+        if (waiter == top && rt_mutex_has_waiters(lock)) {
+            if (lock->owner) {
+                rt_mutex_enqueue_pi(lock->owner, rt_mutex_top_waiter(lock));
+            } else {
+                wake_up_process(rt_mutex_top_waiter(lock)->task);
+            }
+        }
+        if (lock->owner) {
+            rt_mutex_adjust_prio_chain(lock->owner);
+        }
+    }
+
+    while (!list_empty(&p->pi_held_locks)) {
+        lock = list_first_entry(&p->pi_held_locks, struct rt_mutex, held_entry);
+        rt_mutex_release(lock);
+    }
+
+    spin_unlock_irqrestore(&rt_mutex_pi_lock, flags);
+}
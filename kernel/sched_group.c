@@ -0,0 +1,461 @@
+#include "sched_group.h"
+#include "kernel.h"
+#include "ktime.h"
+#include "screen.h"
+#include "mm.h"
+#include "printk.h"
+
+/**
+ * CPU Task Groups and Bandwidth Control
+ * Each group's own tasks receive a share of the CPU equal to the product
+ * of the group's weight fractions down the hierarchy; the scheduler picks
+ * the group with the least runtime scaled by that share. A group with a
+ * quota is throttled once it has used its runtime for the period and is
+ * refilled by a per-group period timer.
+ */
+
+struct task_group root_task_group = {
+    .name = "root",
+    .shares = ROOT_TASK_GROUP_SHARES,
+    .h_weight = 1 << TG_WEIGHT_SHIFT,
+    .h_own_weight = 1 << TG_WEIGHT_SHIFT,
+    .cfs_b = {
+        .quota = RUNTIME_INF,
+    },
+};
+
+// Guards the hierarchy and every group's vruntime and nr_tasks, which
+// all CPUs update from the scheduler
+static DEFINE_SPINLOCK(task_group_lock);
+
+// The boot CPU always has a tick to run the period timers
+#define CFS_PERIOD_CPU  0
+
+// Highest group vruntime picked so far; waking groups are placed near it
+static uint64_t min_vruntime;
+
+/**
+ * Recompute the hierarchical weights of a subtree
+ * A group's own tasks compete with its child groups as if they were one
+ * more child of weight NICE_0_LOAD
+ */
+static void tg_update_weights(struct task_group *tg) {
+    struct task_group *child;
+    uint32_t total = tg->children_shares + 1024;
+
+    if (tg->parent) {
+        uint32_t parent_total = tg->parent->children_shares + 1024;
+        tg->h_weight = (uint32_t)div_u64((uint64_t)tg->parent->h_weight * tg->shares,
+                                         parent_total);
+    }
+
+    tg->h_own_weight = (uint32_t)div_u64((uint64_t)tg->h_weight * 1024, total);
+    if (!tg->h_own_weight) {
+        tg->h_own_weight = 1;
+    }
+
+    list_for_each_entry(child, &tg->children, siblings) {
+        tg_update_weights(child);
+    }
+}
+
+/**
+ * Refill a group's runtime at the start of each period
+ */
+static enum hrtimer_restart sched_cfs_period_timer(struct hrtimer *timer) {
+    struct cfs_bandwidth *cfs_b = container_of(timer, struct cfs_bandwidth, period_timer);
+    unsigned long flags;
+
+    spin_lock_irqsave(&cfs_b->lock, flags);
+
+    if (cfs_b->quota == RUNTIME_INF) {
+        spin_unlock_irqrestore(&cfs_b->lock, flags);
+        return HRTIMER_NORESTART;
+    }
+
+    hrtimer_forward(timer, ktime_get(), (ktime_t)cfs_b->period);
+
+    cfs_b->nr_periods++;
+    cfs_b->runtime = (int64_t)cfs_b->quota;
+
+    // Unthrottled tasks are picked up again by the next schedule
+    if (cfs_b->throttled) {
+        cfs_b->throttled = false;
+        cfs_b->throttled_time += sched_clock() - cfs_b->throttled_clock;
+    }
+
+    spin_unlock_irqrestore(&cfs_b->lock, flags);
+
+    return HRTIMER_RESTART;
+}
+
+static void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b) {
+    spin_lock_init(&cfs_b->lock);
+    cfs_b->period = (uint64_t)DEFAULT_CFS_PERIOD_US * NSEC_PER_USEC;
+    cfs_b->quota = RUNTIME_INF;
+    cfs_b->runtime = 0;
+    cfs_b->throttled = false;
+    cfs_b->nr_periods = 0;
+    cfs_b->nr_throttled = 0;
+    cfs_b->throttled_time = 0;
+    hrtimer_init(&cfs_b->period_timer, sched_cfs_period_timer);
+}
+
+/**
+ * Initialize the root task group
+ */
+void sched_group_init(void) {
+    INIT_LIST_HEAD(&root_task_group.siblings);
+    INIT_LIST_HEAD(&root_task_group.children);
+    init_cfs_bandwidth(&root_task_group.cfs_b);
+    tg_update_weights(&root_task_group);
+
+    pr_info("sched: task groups initialized\n");
+}
+
+/**
+ * Create a child group with default weight and no bandwidth limit
+ */
+struct task_group *sched_create_group(struct task_group *parent, const char *name) {
+    struct task_group *tg;
+    unsigned long flags;
+    int i;
+
+    if (!name || !name[0] || sched_find_group(name)) {
+        return NULL;
+    }
+
+    tg = kmalloc(sizeof(struct task_group));
+    if (!tg) {
+        return NULL;
+    }
+    memset(tg, 0, sizeof(struct task_group));
+
+    for (i = 0; i < TASK_GROUP_NAME_LEN - 1 && name[i]; i++) {
+        tg->name[i] = name[i];
+    }
+    tg->name[i] = '\0';
+
+    tg->parent = parent ? parent : &root_task_group;
+    tg->shares = ROOT_TASK_GROUP_SHARES;
+    INIT_LIST_HEAD(&tg->children);
+    init_cfs_bandwidth(&tg->cfs_b);
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    tg->vruntime = min_vruntime;
+    list_add_tail(&tg->siblings, &tg->parent->children);
+    tg->parent->children_shares += tg->shares;
+    tg_update_weights(tg->parent);
+    spin_unlock_irqrestore(&task_group_lock, flags);
+
+    return tg;
+}
+
+/**
+ * Destroy an empty group
+ */
+int sched_destroy_group(struct task_group *tg) {
+    unsigned long flags;
+
+    if (!tg || tg == &root_task_group) return -EINVAL;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    if (tg->nr_tasks || !list_empty(&tg->children)) {
+        spin_unlock_irqrestore(&task_group_lock, flags);
+        return -EBUSY;
+    }
+    list_del(&tg->siblings);
+    tg->parent->children_shares -= tg->shares;
+    tg_update_weights(tg->parent);
+    spin_unlock_irqrestore(&task_group_lock, flags);
+
+    hrtimer_cancel(&tg->cfs_b.period_timer);
+    kfree(tg);
+    return 0;
+}
+
+static struct task_group *__find_group(struct task_group *tg, const char *name) {
+    struct task_group *child, *found;
+    int i;
+
+    for (i = 0; tg->name[i] && tg->name[i] == name[i]; i++);
+    if (tg->name[i] == name[i]) {
+        return tg;
+    }
+
+    list_for_each_entry(child, &tg->children, siblings) {
+        found = __find_group(child, name);
+        if (found) {
+            return found;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Look up a group by name
+ */
+struct task_group *sched_find_group(const char *name) {
+    return name ? __find_group(&root_task_group, name) : NULL;
+}
+
+/**
+ * Change a group's weight relative to its siblings
+ */
+int sched_group_set_shares(struct task_group *tg, uint32_t shares) {
+    unsigned long flags;
+
+    if (!tg || tg == &root_task_group) return -EINVAL;
+
+    if (shares < MIN_SHARES) shares = MIN_SHARES;
+    if (shares > MAX_SHARES) shares = MAX_SHARES;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    tg->parent->children_shares += shares - tg->shares;
+    tg->shares = shares;
+    tg_update_weights(tg->parent);
+    spin_unlock_irqrestore(&task_group_lock, flags);
+
+    return 0;
+}
+
+/**
+ * Limit a group to quota_us of runtime every period_us
+ * A negative quota removes the limit
+ */
+int tg_set_cfs_bandwidth(struct task_group *tg, uint32_t period_us, int64_t quota_us) {
+    struct cfs_bandwidth *cfs_b;
+    unsigned long flags;
+    uint64_t quota;
+
+    if (!tg || tg == &root_task_group) return -EINVAL;
+    if (period_us < MIN_CFS_PERIOD_US || period_us > MAX_CFS_PERIOD_US) return -EINVAL;
+
+    if (quota_us < 0) {
+        quota = RUNTIME_INF;
+    } else if (quota_us < MIN_CFS_QUOTA_US) {
+        return -EINVAL;
+    } else {
+        quota = (uint64_t)quota_us * NSEC_PER_USEC;
+    }
+
+    cfs_b = &tg->cfs_b;
+
+    spin_lock_irqsave(&cfs_b->lock, flags);
+    cfs_b->period = (uint64_t)period_us * NSEC_PER_USEC;
+    cfs_b->quota = quota;
+    cfs_b->runtime = quota == RUNTIME_INF ? 0 : (int64_t)quota;
+    if (cfs_b->throttled) {
+        cfs_b->throttled = false;
+        cfs_b->throttled_time += sched_clock() - cfs_b->throttled_clock;
+    }
+    spin_unlock_irqrestore(&cfs_b->lock, flags);
+
+    if (quota == RUNTIME_INF) {
+        hrtimer_cancel(&cfs_b->period_timer);
+    } else {
+        hrtimer_start_on(&cfs_b->period_timer, CFS_PERIOD_CPU,
+                         (ktime_t)cfs_b->period, HRTIMER_MODE_REL);
+    }
+
+    return 0;
+}
+
+/**
+ * Move a process to another group, charging its old group first
+ */
+int sched_move_task(process_t *p, struct task_group *tg) {
+    struct task_group *old;
+    unsigned long flags;
+
+    if (!p || !tg) return -EINVAL;
+
+    old = task_group(p);
+    if (old == tg) return 0;
+
+    if (p->pcb.state == PROCESS_RUNNING) {
+        task_group_charge(p);
+    }
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    old->nr_tasks--;
+    tg->nr_tasks++;
+    p->sched_task_group = tg;
+    spin_unlock_irqrestore(&task_group_lock, flags);
+
+    return 0;
+}
+
+/**
+ * Inherit the parent's group
+ */
+void sched_group_fork(process_t *p, process_t *parent) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    p->sched_task_group = parent ? task_group(parent) : &root_task_group;
+    p->se.exec_start = 0;
+    p->sched_task_group->nr_tasks++;
+    spin_unlock_irqrestore(&task_group_lock, flags);
+}
+
+void sched_group_exit(process_t *p) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    task_group(p)->nr_tasks--;
+    p->sched_task_group = NULL;
+    spin_unlock_irqrestore(&task_group_lock, flags);
+}
+
+/**
+ * Consume runtime from a group's quota, throttling it when exhausted
+ */
+static void account_cfs_runtime(struct task_group *tg, uint64_t delta, uint64_t now) {
+    struct cfs_bandwidth *cfs_b = &tg->cfs_b;
+    unsigned long flags;
+
+    if (cfs_b->quota == RUNTIME_INF) return;
+
+    spin_lock_irqsave(&cfs_b->lock, flags);
+    cfs_b->runtime -= (int64_t)delta;
+    if (cfs_b->runtime <= 0 && !cfs_b->throttled) {
+        cfs_b->throttled = true;
+        cfs_b->throttled_clock = now;
+        cfs_b->nr_throttled++;
+    }
+    spin_unlock_irqrestore(&cfs_b->lock, flags);
+}
+
+/**
+ * Charge the time since exec_start to the task's group and its ancestors
+ */
+void task_group_charge(process_t *p) {
+    struct task_group *tg;
+    uint64_t now = sched_clock();
+    uint64_t delta;
+    unsigned long flags;
+
+    if (!p->se.exec_start || now <= p->se.exec_start) {
+        p->se.exec_start = now;
+        return;
+    }
+
+    delta = now - p->se.exec_start;
+    p->se.exec_start = now;
+    p->se.sum_exec_runtime += delta;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    tg = task_group(p);
+
+    // Clamp so the fixed-point shift cannot overflow after a long stall
+    tg->vruntime += div_u64((delta < NSEC_PER_SEC ? delta : NSEC_PER_SEC)
+                            << TG_WEIGHT_SHIFT, tg->h_own_weight);
+
+    for (; tg; tg = tg->parent) {
+        tg->usage += delta;
+        account_cfs_runtime(tg, delta, now);
+    }
+    spin_unlock_irqrestore(&task_group_lock, flags);
+}
+
+/**
+ * Keep a group that slept from building up credit over busy groups
+ */
+void task_group_place(process_t *p) {
+    struct task_group *tg;
+    uint64_t lag = (uint64_t)TIMESLICE_MS * NSEC_PER_MSEC;
+    unsigned long flags;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    tg = task_group(p);
+    if (min_vruntime > lag && tg->vruntime < min_vruntime - lag) {
+        tg->vruntime = min_vruntime - lag;
+    }
+    spin_unlock_irqrestore(&task_group_lock, flags);
+}
+
+/**
+ * A task is throttled if any group on its path is
+ */
+bool task_group_throttled(process_t *p) {
+    struct task_group *tg;
+
+    for (tg = task_group(p); tg; tg = tg->parent) {
+        if (tg->cfs_b.throttled) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t task_group_vruntime(process_t *p) {
+    uint64_t vruntime;
+    unsigned long flags;
+
+    // A 64-bit load is two on this CPU
+    spin_lock_irqsave(&task_group_lock, flags);
+    vruntime = task_group(p)->vruntime;
+    spin_unlock_irqrestore(&task_group_lock, flags);
+
+    return vruntime;
+}
+
+void task_group_set_min_vruntime(uint64_t vruntime) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&task_group_lock, flags);
+    if (vruntime > min_vruntime) {
+        min_vruntime = vruntime;
+    }
+    spin_unlock_irqrestore(&task_group_lock, flags);
+}
+
+static void print_group(struct task_group *tg, int depth) {
+    struct task_group *child;
+    struct cfs_bandwidth *cfs_b = &tg->cfs_b;
+
+    for (int i = 0; i < depth; i++) {
+        screen_print("  ");
+    }
+
+    screen_print(tg->name);
+    screen_print(": shares ");
+    screen_print_dec(tg->shares);
+    screen_print(" tasks ");
+    screen_print_dec(tg->nr_tasks);
+    screen_print(" usage ");
+    screen_print_dec((uint32_t)ktime_to_ms((ktime_t)tg->usage));
+    screen_print("ms");
+
+    if (cfs_b->quota != RUNTIME_INF) {
+        screen_print(" quota ");
+        screen_print_dec((uint32_t)ktime_to_us((ktime_t)cfs_b->quota));
+        screen_print("/");
+        screen_print_dec((uint32_t)ktime_to_us((ktime_t)cfs_b->period));
+        screen_print("us periods ");
+        screen_print_dec(cfs_b->nr_periods);
+        screen_print(" throttled ");
+        screen_print_dec(cfs_b->nr_throttled);
+        screen_print(" (");
+        screen_print_dec((uint32_t)ktime_to_ms((ktime_t)cfs_b->throttled_time));
+        screen_print("ms)");
+        if (cfs_b->throttled) {
+            screen_print(" [throttled]");
+        }
+    }
+    screen_print("\n");
+
+    list_for_each_entry(child, &tg->children, siblings) {
+        print_group(child, depth + 1);
+    }
+}
+
+/**
+ * Print the group hierarchy with weights and bandwidth statistics
+ */
+void sched_group_print(void) {
+    print_group(&root_task_group, 0);
+}
@@ -0,0 +1,220 @@
+#include "sched_pelt.h"
+#include "kernel.h"
+#include "ktime.h"
+
+/**
+ * Per-Entity Load Tracking
+ * Time is accrued in 1024ns "microseconds" and folded into 1024us
+ * periods; each elapsed period multiplies the running sums by y, with
+ * y^32 = 0.5. The averages are the sums over the series maximum.
+ */
+
+static struct pelt_rq pelt_rqs[CPU_COUNT];
+
+// y^n * 2^32 for n = 0..LOAD_AVG_PERIOD-1
+static const uint32_t runnable_avg_yN_inv[LOAD_AVG_PERIOD] = {
+    0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a,
+    0xeac0c6e6, 0xe5b906e6, 0xe0ccdeeb, 0xdbfbb796,
+    0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+    0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46,
+    0xb504f333, 0xb123f581, 0xad583ee9, 0xa9a15ab4,
+    0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+    0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a,
+    0x8b95c1e3, 0x88980e80, 0x85aac367, 0x82cd8698,
+};
+
+/**
+ * val * y^n
+ */
+static uint64_t decay_load(uint64_t val, uint64_t n) {
+    uint32_t local_n;
+
+    if (n > LOAD_AVG_PERIOD * 63) {
+        return 0;
+    }
+
+    // y^32 = 1/2, so whole half-lives are shifts
+    local_n = (uint32_t)n;
+    if (local_n >= LOAD_AVG_PERIOD) {
+        val >>= local_n / LOAD_AVG_PERIOD;
+        local_n %= LOAD_AVG_PERIOD;
+    }
+
+    return mul_u64_u32_shr(val, runnable_avg_yN_inv[local_n], 32);
+}
+
+/**
+ * Contribution of a span crossing period boundaries:
+ * the decayed tail of the old period (d1), the full periods in between
+ * and the head of the current period (d3)
+ */
+static uint32_t __accumulate_pelt_segments(uint64_t periods, uint32_t d1, uint32_t d3) {
+    uint32_t c1, c2, c3 = d3;
+
+    c1 = (uint32_t)decay_load(d1, periods);
+    c2 = LOAD_AVG_MAX - (uint32_t)decay_load(LOAD_AVG_MAX, periods) - 1024;
+
+    return c1 + c2 + c3;
+}
+
+static uint64_t accumulate_sum(uint64_t delta, struct sched_avg *sa,
+                               uint32_t load, bool running) {
+    uint32_t contrib = (uint32_t)delta;
+    uint64_t periods;
+
+    delta += sa->period_contrib;
+    periods = delta >> 10;
+
+    if (periods) {
+        sa->load_sum = decay_load(sa->load_sum, periods);
+        sa->util_sum = (uint32_t)decay_load(sa->util_sum, periods);
+
+        delta &= 1023;
+        if (load) {
+            contrib = __accumulate_pelt_segments(periods,
+                                                 1024 - sa->period_contrib,
+                                                 (uint32_t)delta);
+        }
+    }
+    sa->period_contrib = (uint32_t)delta;
+
+    if (load) {
+        sa->load_sum += (uint64_t)load * contrib;
+    }
+    if (running) {
+        sa->util_sum += contrib << SCHED_CAPACITY_SHIFT;
+    }
+
+    return periods;
+}
+
+/**
+ * Accrue time since the last update
+ * Returns true if a period boundary was crossed and the averages need
+ * recomputing
+ */
+static bool ___update_load_sum(uint64_t now, struct sched_avg *sa,
+                               uint32_t load, bool running) {
+    uint64_t delta;
+
+    if (now < sa->last_update_time) {
+        sa->last_update_time = now;
+        return false;
+    }
+
+    delta = (now - sa->last_update_time) >> 10;
+    if (!delta) {
+        return false;
+    }
+
+    sa->last_update_time += delta << 10;
+
+    // Running implies runnable
+    if (!load) {
+        running = false;
+    }
+
+    return accumulate_sum(delta, sa, load, running) != 0;
+}
+
+static void ___update_load_avg(struct sched_avg *sa, uint32_t load) {
+    uint32_t divider = LOAD_AVG_MAX - 1024 + sa->period_contrib;
+
+    sa->load_avg = (uint32_t)div_u64((uint64_t)load * sa->load_sum, divider);
+    sa->util_avg = sa->util_sum / divider;
+}
+
+static void update_rq_load(struct pelt_rq *prq, uint64_t now) {
+    struct sched_avg *sa = &prq->avg;
+
+    // The rq sum already carries the task weights, so average with load 1
+    if (___update_load_sum(now, sa, prq->runnable_weight, prq->nr_running != 0)) {
+        ___update_load_avg(sa, 1);
+    }
+}
+
+static void update_task_avg(struct sched_avg *sa, uint64_t now) {
+    if (___update_load_sum(now, sa, sa->runnable ? 1 : 0, sa->running)) {
+        ___update_load_avg(sa, PELT_TASK_WEIGHT);
+    }
+}
+
+/**
+ * Age one CPU's signals, then add a change in its runnable weight and
+ * running count
+ */
+static void pelt_rq_adjust(unsigned int cpu, uint64_t now, int32_t weight, int32_t running) {
+    struct pelt_rq *prq = &pelt_rqs[cpu];
+    unsigned long flags;
+
+    spin_lock_irqsave(&prq->lock, flags);
+    update_rq_load(prq, now);
+    prq->runnable_weight += weight;
+    prq->nr_running += running;
+    spin_unlock_irqrestore(&prq->lock, flags);
+}
+
+void pelt_init(void) {
+    for (int cpu = 0; cpu < CPU_COUNT; cpu++) {
+        spin_lock_init(&pelt_rqs[cpu].lock);
+    }
+}
+
+/**
+ * Start tracking a new task, on the CPU creating it
+ */
+void pelt_init_task(process_t *p) {
+    memset(&p->avg, 0, sizeof(struct sched_avg));
+    p->avg.last_update_time = sched_clock();
+    p->avg.cpu = smp_processor_id();
+}
+
+/**
+ * Age a task's and its CPU's signals, then switch the task's state
+ * Called on every transition between blocked, runnable and running,
+ * possibly from another CPU. The task's weight stays on the rq of the
+ * CPU it last ran on, and moves when it starts running on a new one
+ */
+void update_task_load(process_t *p, bool runnable, bool running) {
+    struct sched_avg *sa = &p->avg;
+    unsigned int cpu = running ? smp_processor_id() : sa->cpu;
+    int32_t old_weight = sa->runnable ? PELT_TASK_WEIGHT : 0;
+    int32_t new_weight = runnable ? PELT_TASK_WEIGHT : 0;
+    uint64_t now = sched_clock();
+
+    update_task_avg(sa, now);
+
+    if (cpu != sa->cpu) {
+        if (old_weight || sa->running) {
+            pelt_rq_adjust(sa->cpu, now, -old_weight, -(int32_t)sa->running);
+        }
+        pelt_rq_adjust(cpu, now, new_weight, running);
+        sa->cpu = cpu;
+    } else {
+        pelt_rq_adjust(cpu, now, new_weight - old_weight,
+                       (int32_t)running - (int32_t)sa->running);
+    }
+
+    sa->runnable = runnable;
+    sa->running = running;
+}
+
+/**
+ * Periodic update so long-running and idle CPUs keep decaying
+ */
+void pelt_tick(process_t *curr) {
+    uint64_t now = sched_clock();
+
+    pelt_rq_adjust(smp_processor_id(), now, 0, 0);
+    if (curr) {
+        update_task_avg(&curr->avg, now);
+    }
+}
+
+uint32_t cpu_load_avg(unsigned int cpu) {
+    return cpu < CPU_COUNT ? pelt_rqs[cpu].avg.load_avg : 0;
+}
+
+uint32_t cpu_util_avg(unsigned int cpu) {
+    return cpu < CPU_COUNT ? pelt_rqs[cpu].avg.util_avg : 0;
+}
@@ -0,0 +1,183 @@
+#include "sched_stats.h"
+#include "kernel.h"
+#include "ktime.h"
+#include "screen.h"
+
+#ifdef CONFIG_SCHEDSTATS
+
+/**
+ * Scheduler Statistics Implementation
+ * A task is stamped when it becomes runnable and when it gets the CPU;
+ * the difference is its run delay, bucketed by log2 microseconds
+ */
+
+static struct rq_sched_info rq_sched_info[CPU_COUNT];
+
+static inline uint32_t ns_to_us(uint64_t ns) {
+    uint64_t us = div_u64(ns, NSEC_PER_USEC);
+    return us > 0xFFFFFFFFULL ? 0xFFFFFFFF : (uint32_t)us;
+}
+
+static inline unsigned int latency_bucket(uint64_t delta_ns) {
+    uint32_t us = ns_to_us(delta_ns);
+    unsigned int bucket;
+
+    if (!us) return 0;
+
+    bucket = 32 - __builtin_clz(us);
+    return bucket < SCHED_HIST_BUCKETS ? bucket : SCHED_HIST_BUCKETS - 1;
+}
+
+/**
+ * Reset a task's statistics
+ */
+void sched_info_init(process_t *p) {
+    memset(&p->sched_info, 0, sizeof(struct sched_info));
+}
+
+/**
+ * Task became runnable
+ */
+void sched_info_queued(process_t *p, bool wakeup) {
+    struct sched_info *si = &p->sched_info;
+
+    if (si->last_queued) return;
+
+    si->last_queued = sched_clock();
+    si->from_wakeup = wakeup;
+
+    if (wakeup) {
+        si->nr_wakeups++;
+        rq_sched_info[smp_processor_id()].nr_wakeups++;
+    }
+}
+
+/**
+ * Task was put on the CPU
+ */
+void sched_info_arrive(process_t *p) {
+    struct sched_info *si = &p->sched_info;
+    struct rq_sched_info *rqi = &rq_sched_info[smp_processor_id()];
+    uint64_t now = sched_clock();
+
+    if (si->last_queued && now > si->last_queued) {
+        uint64_t delta = now - si->last_queued;
+        unsigned int bucket = latency_bucket(delta);
+
+        si->run_delay += delta;
+        if (delta > si->max_run_delay) si->max_run_delay = delta;
+        if (si->from_wakeup) si->wakeup_hist[bucket]++;
+
+        rqi->run_delay += delta;
+        if (delta > rqi->max_run_delay) rqi->max_run_delay = delta;
+        rqi->delay_hist[bucket]++;
+    }
+
+    si->last_queued = 0;
+    si->last_arrival = now;
+    si->pcount++;
+    rqi->pcount++;
+}
+
+/**
+ * Task left the CPU, either blocking or preempted
+ */
+void sched_info_depart(process_t *p, bool voluntary) {
+    struct sched_info *si = &p->sched_info;
+    struct rq_sched_info *rqi = &rq_sched_info[smp_processor_id()];
+    uint64_t now = sched_clock();
+
+    if (si->last_arrival && now > si->last_arrival) {
+        uint64_t slice = now - si->last_arrival;
+
+        si->cpu_time += slice;
+        if (slice > si->max_slice) si->max_slice = slice;
+    }
+    si->last_arrival = 0;
+
+    if (voluntary) {
+        si->nvcsw++;
+        rqi->nvcsw++;
+    } else {
+        si->nivcsw++;
+        rqi->nivcsw++;
+    }
+}
+
+static void print_field(uint32_t value) {
+    screen_print(" ");
+    screen_print_dec(value);
+}
+
+static void print_hist(const uint32_t *hist) {
+    for (int i = 0; i < SCHED_HIST_BUCKETS; i++) {
+        print_field(hist[i]);
+    }
+    screen_print("\n");
+}
+
+/**
+ * Dump statistics in a line-oriented, machine-readable format
+ * All times are in microseconds
+ *
+ *   version <n>
+ *   cpu<n> pcount wakeups nvcsw nivcsw run_delay max_run_delay
+ *   cpu<n>_hist <SCHED_HIST_BUCKETS queue-to-run counts>
+ *   task pid name cpu_time run_delay max_run_delay pcount wakeups
+ *        nvcsw nivcsw avg_slice max_slice
+ *   task_hist pid <SCHED_HIST_BUCKETS wakeup-to-run counts>
+ */
+void schedstat_show(void) {
+    process_t *p;
+
+    screen_print("version");
+    print_field(SCHEDSTAT_VERSION);
+    screen_print("\n");
+
+    for (int cpu = 0; cpu < CPU_COUNT; cpu++) {
+        struct rq_sched_info *rqi = &rq_sched_info[cpu];
+
+        screen_print("cpu");
+        screen_print_dec(cpu);
+        print_field(rqi->pcount);
+        print_field(rqi->nr_wakeups);
+        print_field(rqi->nvcsw);
+        print_field(rqi->nivcsw);
+        print_field(ns_to_us(rqi->run_delay));
+        print_field(ns_to_us(rqi->max_run_delay));
+        screen_print("\ncpu");
+        screen_print_dec(cpu);
+        screen_print("_hist");
+        print_hist(rqi->delay_hist);
+    }
+
+    rcu_read_lock();
+    for_each_process(p) {
+        struct sched_info *si = &p->sched_info;
+        uint32_t avg_slice;
+
+        if (p->pcb.state == PROCESS_TERMINATED) continue;
+
+        avg_slice = si->pcount ? ns_to_us(div_u64(si->cpu_time, si->pcount)) : 0;
+
+        screen_print("task");
+        print_field(p->pcb.pid);
+        screen_print(" ");
+        screen_print(p->name[0] ? p->name : "-");
+        print_field(ns_to_us(si->cpu_time));
+        print_field(ns_to_us(si->run_delay));
+        print_field(ns_to_us(si->max_run_delay));
+        print_field(si->pcount);
+        print_field(si->nr_wakeups);
+        print_field(si->nvcsw);
+        print_field(si->nivcsw);
+        print_field(avg_slice);
+        print_field(ns_to_us(si->max_slice));
+        screen_print("\ntask_hist");
+        print_field(p->pcb.pid);
+        print_hist(si->wakeup_hist);
+    }
+    rcu_read_unlock();
+}
+
+#endif
@@ -1,7 +1,10 @@
 #include "scheduler.h"
 #include "kernel.h"
 #include "mm.h"
+#include "kstack.h"
 #include "screen.h"
+#include "sched_pelt.h"
+#include "rcupdate.h"
 
 /**
  * Linux-Inspired O(1) Scheduler Implementation
@@ -9,18 +12,15 @@
  * Enhanced with CFS concepts for better fairness
  */
 
-// Global runqueue (single CPU for now)
-static runqueue_t rq;
+// One runqueue per CPU
+static DEFINE_PER_CPU(runqueue_t, runqueues);
+#define this_rq()   this_cpu_ptr(&runqueues)
 
 // Idle process
 static process_t idle_process;
 
-// Load tracking
-static uint32_t avenrun[3];
-static uint32_t calc_load;
-
 // Scheduler statistics
-static struct {
+struct sched_cpu_stats {
     uint32_t total_switches;
     uint32_t context_switches;
     uint32_t involuntary_context_switches;
@@ -28,39 +28,40 @@ static struct {
     uint32_t idle_time;
     uint32_t active_time;
     uint32_t load_avg;
-} sched_stats = {0};
+};
+
+static DEFINE_PER_CPU(struct sched_cpu_stats, sched_stats);
 
 /**
  * Initialize the scheduler
  */
 void scheduler_init(void) {
+    runqueue_t *rq = this_rq();
+    
     // Initialize runqueue
-    memset(&rq, 0, sizeof(runqueue_t));
+    memset(rq, 0, sizeof(runqueue_t));
     
     // Initialize priority arrays
     for (int i = 0; i < MAX_PRIO; i++) {
-        INIT_LIST_HEAD(&rq.active.queue[i]);
-        INIT_LIST_HEAD(&rq.expired.queue[i]);
+        INIT_LIST_HEAD(&rq->active.queue[i]);
+        INIT_LIST_HEAD(&rq->expired.queue[i]);
     }
     
     // Clear bitmaps
-    memset(rq.active.bitmap, 0, sizeof(rq.active.bitmap));
-    memset(rq.expired.bitmap, 0, sizeof(rq.expired.bitmap));
-    
-    // Initialize load tracking
-    calc_load = 0;
-    avenrun[0] = avenrun[1] = avenrun[2] = 0;
+    memset(rq->active.bitmap, 0, sizeof(rq->active.bitmap));
+    memset(rq->expired.bitmap, 0, sizeof(rq->expired.bitmap));
     
     // Create idle process
     init_idle_process();
     
-    rq.curr = &idle_process;
-    rq.nr_running = 0;
-    rq.nr_switches = 0;
-    rq.expired_timestamp = 0;
-    rq.best_expired_prio = MAX_PRIO;
-    rq.cpu_load = 0;
-    rq.nr_uninterruptible = 0;
+    rq->curr = &idle_process;
+    rq->nr_running = 0;
+    rq->nr_switches = 0;
+    rq->expired_timestamp = 0;
+    rq->best_expired_prio = MAX_PRIO;
+    rq->cpu_load = 0;
+    rq->cpu_util = 0;
+    rq->nr_uninterruptible = 0;
     
     debug_print(DEBUG_INFO, "Linux-inspired O(1) scheduler initialized");
 }
@@ -75,7 +76,7 @@ void init_idle_process(void) {
     idle_process.pcb.pid = 0;
     idle_process.pcb.ppid = 0;
     idle_process.pcb.state = TASK_RUNNING;
-    idle_process.pcb.kernel_stack = (uint32_t)kmalloc(KERNEL_STACK_SIZE);
+    idle_process.pcb.kernel_stack = alloc_kernel_stack();
     
     // Set up scheduling entity
     struct sched_entity *se = sched_entity(&idle_process);
@@ -84,7 +85,7 @@ void init_idle_process(void) {
     se->static_prio = MAX_PRIO;
     se->normal_prio = MAX_PRIO;
     se->time_slice = 0;
-    se->rq = &rq;
+    se->rq = this_rq();
     se->load_weight = 1;
     se->inv_weight = 1;
     
@@ -236,7 +237,7 @@ void enqueue_task(process_t *p, int head) {
     runqueue_t *rq = se->rq;
     
     if (!rq) {
-        rq = &rq;
+        rq = this_rq();
         se->rq = rq;
     }
     
@@ -319,17 +320,17 @@ process_t* pick_next_task(runqueue_t *rq) {
  */
 void schedule(void) {
     process_t *prev, *next;
-    runqueue_t *rq = &rq;
+    runqueue_t *rq = this_rq();
     unsigned long flags;
     
-    sched_stats.schedule_count++;
+    this_cpu_inc(sched_stats.schedule_count);
     
     prev = rq->curr;
     
     if (prev == &idle_process) {
-        sched_stats.idle_time++;
+        this_cpu_inc(sched_stats.idle_time);
     } else {
-        sched_stats.active_time++;
+        this_cpu_inc(sched_stats.active_time);
     }
     
     // Pick next task
@@ -341,7 +342,7 @@ void schedule(void) {
     
     // Update statistics
     rq->nr_switches++;
-    sched_stats.context_switches++;
+    this_cpu_inc(sched_stats.context_switches);
     
     // Update runqueue
     rq->curr = next;
@@ -358,7 +359,7 @@ void schedule(void) {
     if (next && next != &idle_process) {
         // Restore next process state
         next->pcb.state = TASK_RUNNING;
-        current_process = next;
+        this_cpu_write(current_task, next);
     }
     
     // Update load tracking
@@ -369,7 +370,8 @@ void schedule(void) {
  * Scheduler tick handler
  */
 void scheduler_tick(void) {
-    process_t *curr = rq.curr;
+    runqueue_t *rq = this_rq();
+    process_t *curr = rq->curr;
     struct sched_entity *se;
     
     if (!curr || curr == &idle_process) {
@@ -394,16 +396,16 @@ void scheduler_tick(void) {
         // Move to expired array if not real-time
         if (!rt_task(curr)) {
             dequeue_task(curr);
-            list_add_tail(&se->run_list, &rq.expired.queue[se->prio]);
-            rq.expired.bitmap[BITMAP_WORD(se->prio)] |= BITMAP_BIT(se->prio);
+            list_add_tail(&se->run_list, &rq->expired.queue[se->prio]);
+            rq->expired.bitmap[BITMAP_WORD(se->prio)] |= BITMAP_BIT(se->prio);
             
             // Check if we need to swap active and expired arrays
-            if (rq.nr_running == 0) {
+            if (rq->nr_running == 0) {
                 // Swap arrays
-                struct prio_array temp = rq.active;
-                rq.active = rq.expired;
-                rq.expired = temp;
-                rq.expired_timestamp = kernel_get_timestamp();
+                struct prio_array temp = rq->active;
+                rq->active = rq->expired;
+                rq->expired = temp;
+                rq->expired_timestamp = kernel_get_timestamp();
             }
         }
         
@@ -413,18 +415,15 @@ void scheduler_tick(void) {
 }
 
 /**
- * Update CPU load
+ * Update CPU load from the PELT signals
+ * cpu_load keeps its scale of 1000 per fully runnable task
  */
 void update_cpu_load(runqueue_t *rq) {
-    uint32_t this_load = rq->nr_running * 1000;
+    unsigned int cpu = smp_processor_id();
     
-    // Exponential moving average
-    avenrun[0] = (avenrun[0] * 3 + this_load) / 4;
-    avenrun[1] = (avenrun[1] * 15 + this_load) / 16;
-    avenrun[2] = (avenrun[2] * 63 + this_load) / 64;
-    
-    rq->cpu_load = avenrun[0];
-    sched_stats.load_avg = avenrun[0];
+    rq->cpu_load = cpu_load_avg(cpu) * 1000 / PELT_TASK_WEIGHT;
+    rq->cpu_util = cpu_util_avg(cpu);
+    this_cpu_write(sched_stats.load_avg, rq->cpu_load);
 }
 
 /**
@@ -445,35 +444,50 @@ void yield_task(process_t *p) {
  * Get number of running processes
  */
 uint32_t nr_running(void) {
-    return rq.nr_running;
+    return this_rq()->nr_running;
 }
 
 /**
  * Get number of uninterruptible processes
  */
 uint32_t nr_uninterruptible(void) {
-    return rq.nr_uninterruptible;
+    return this_rq()->nr_uninterruptible;
 }
 
 /**
  * Print scheduler statistics
  */
 void print_scheduler_stats(void) {
+    runqueue_t *rq = this_rq();
+    struct sched_cpu_stats sum = {0};
+    unsigned int cpu;
+    
+    for_each_online_cpu(cpu) {
+        struct sched_cpu_stats *st = per_cpu_ptr(&sched_stats, cpu);
+        
+        sum.context_switches += st->context_switches;
+        sum.schedule_count += st->schedule_count;
+        sum.active_time += st->active_time;
+        sum.idle_time += st->idle_time;
+    }
+    
     screen_print("\n=== Scheduler Statistics ===\n");
     screen_print("Total switches: ");
-    screen_print_dec(sched_stats.context_switches);
+    screen_print_dec(sum.context_switches);
     screen_print("\nSchedule calls: ");
-    screen_print_dec(sched_stats.schedule_count);
+    screen_print_dec(sum.schedule_count);
     screen_print("\nRunning processes: ");
-    screen_print_dec(rq.nr_running);
+    screen_print_dec(rq->nr_running);
     screen_print("\nCPU load: ");
-    screen_print_dec(rq.cpu_load / 1000);
+    screen_print_dec(rq->cpu_load / 1000);
     screen_print(".");
-    screen_print_dec((rq.cpu_load % 1000) / 100);
-    screen_print("\nActive time: ");
-    screen_print_dec(sched_stats.active_time);
+    screen_print_dec((rq->cpu_load % 1000) / 100);
+    screen_print("\nCPU utilization: ");
+    screen_print_dec(rq->cpu_util * 100 / SCHED_CAPACITY_SCALE);
+    screen_print("%\nActive time: ");
+    screen_print_dec(sum.active_time);
     screen_print("\nIdle time: ");
-    screen_print_dec(sched_stats.idle_time);
+    screen_print_dec(sum.idle_time);
     screen_print("\n");
 }
 
@@ -510,26 +524,6 @@ void dump_runqueue(runqueue_t *rq) {
     }
 }
 
-/**
- * CPU idle loop
- */
-void cpu_idle_loop(void) {
-    while (1) {
-        // Check if there are runnable processes
-        if (rq.nr_running > 0) {
-            schedule();
-            continue;
-        }
-        
-        // Enable interrupts and halt
-        __asm__ volatile("sti");
-        __asm__ volatile("hlt");
-        __asm__ volatile("cli");
-        
-        sched_stats.idle_time++;
-    }
-}
-
 // Fair scheduler class implementation
 const struct sched_class sched_fair_class = {
     .name = "fair",
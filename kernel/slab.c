@@ -2,6 +2,7 @@
 #include "kernel.h"
 #include "mm.h"
 #include "screen.h"
+#include "workqueue.h"
 
 /**
  * Linux-Inspired SLAB Allocator Implementation
@@ -10,8 +11,10 @@
  */
 
 // Global cache list for management
+// RCU callbacks free objects from softirq context on the tick's way out,
+// so the lock is only ever taken with interrupts off
 static LIST_HEAD(cache_chain);
-static spinlock_t cache_chain_lock = SPIN_LOCK_UNLOCKED;
+static DEFINE_SPINLOCK(cache_chain_lock);
 
 // Common kernel caches
 kmem_cache_t *kmalloc_caches[12];
@@ -165,6 +168,7 @@ static void free_slab(kmem_cache_t *cachep, struct slab *slabp) {
  */
 static int cache_grow(kmem_cache_t *cachep, unsigned long flags) {
     struct slab *slabp;
+    unsigned long irqflags;
     
     slabp = alloc_slab(cachep, flags);
     if (!slabp) {
@@ -172,7 +176,7 @@ static int cache_grow(kmem_cache_t *cachep, unsigned long flags) {
     }
     
     // Add to appropriate list
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, irqflags);
     
     if (slabp->inuse == 0) {
         list_add(&slabp->list, &cachep->slabs_free);
@@ -182,7 +186,7 @@ static int cache_grow(kmem_cache_t *cachep, unsigned long flags) {
         list_add(&slabp->list, &cachep->slabs_partial);
     }
     
-    spin_unlock(&cache_chain_lock);
+    spin_unlock_irqrestore(&cache_chain_lock, irqflags);
     
     return 0;
 }
@@ -194,6 +198,7 @@ kmem_cache_t* kmem_cache_create(const char *name, size_t size,
                                size_t align, unsigned long flags,
                                void (*ctor)(void *), void (*dtor)(void *)) {
     kmem_cache_t *cachep;
+    unsigned long irqflags;
     
     if (!name || size == 0 || size > KMALLOC_MAX_SIZE) {
         return NULL;
@@ -237,9 +242,9 @@ kmem_cache_t* kmem_cache_create(const char *name, size_t size,
     }
     
     // Add to cache chain
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, irqflags);
     list_add(&cachep->list, &cache_chain);
-    spin_unlock(&cache_chain_lock);
+    spin_unlock_irqrestore(&cache_chain_lock, irqflags);
     
     debug_print(DEBUG_INFO, "Created cache '%s': objsize=%d, objs=%d, order=%d",
                 name, size, cachep->num, cachep->gfporder);
@@ -252,11 +257,12 @@ kmem_cache_t* kmem_cache_create(const char *name, size_t size,
  */
 void kmem_cache_destroy(kmem_cache_t *cachep) {
     struct slab *slabp, *tmp;
+    unsigned long flags;
     
     if (!cachep) return;
     
     // Free all slabs
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, flags);
     
     list_for_each_entry_safe(slabp, tmp, &cachep->slabs_full, list) {
         list_del(&slabp->list);
@@ -276,7 +282,7 @@ void kmem_cache_destroy(kmem_cache_t *cachep) {
     // Remove from cache chain
     list_del(&cachep->list);
     
-    spin_unlock(&cache_chain_lock);
+    spin_unlock_irqrestore(&cache_chain_lock, flags);
     
     debug_print(DEBUG_INFO, "Destroyed cache '%s'", cachep->name);
     
@@ -289,10 +295,11 @@ void kmem_cache_destroy(kmem_cache_t *cachep) {
 void* kmem_cache_alloc(kmem_cache_t *cachep, unsigned long flags) {
     struct slab *slabp;
     void *objp;
+    unsigned long irqflags;
     
     if (!cachep) return NULL;
     
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, irqflags);
     
     // Try to find object in partial slabs first
     if (!list_empty(&cachep->slabs_partial)) {
@@ -301,21 +308,21 @@ void* kmem_cache_alloc(kmem_cache_t *cachep, unsigned long flags) {
         slabp = list_first_entry(&cachep->slabs_free, struct slab, list);
     } else {
         // Need to grow cache
-        spin_unlock(&cache_chain_lock);
+        spin_unlock_irqrestore(&cache_chain_lock, irqflags);
         
         if (cache_grow(cachep, flags) < 0) {
             cachep->stats.errors++;
             return NULL;
         }
         
-        spin_lock(&cache_chain_lock);
+        spin_lock_irqsave(&cache_chain_lock, irqflags);
         slabp = list_first_entry(&cachep->slabs_free, struct slab, list);
     }
     
     // Get object from freelist
     objp = slabp->freelist;
     if (!objp) {
-        spin_unlock(&cache_chain_lock);
+        spin_unlock_irqrestore(&cache_chain_lock, irqflags);
         cachep->stats.errors++;
         return NULL;
     }
@@ -333,19 +340,19 @@ void* kmem_cache_alloc(kmem_cache_t *cachep, unsigned long flags) {
         list_add(&slabp->list, &cachep->slabs_partial);
     }
     
-    spin_unlock(&cache_chain_lock);
-    
-    // Clear poison if debugging enabled
-    if (cachep->flags & SLAB_POISON) {
-        memset(objp, 0, cachep->object_size);
-    }
-    
     // Update statistics
     cachep->stats.active++;
     if (cachep->stats.active > cachep->stats.max_active) {
         cachep->stats.max_active = cachep->stats.active;
     }
     
+    spin_unlock_irqrestore(&cache_chain_lock, irqflags);
+    
+    // Clear poison if debugging enabled
+    if (cachep->flags & SLAB_POISON) {
+        memset(objp, 0, cachep->object_size);
+    }
+    
     return objp;
 }
 
@@ -354,6 +361,7 @@ void* kmem_cache_alloc(kmem_cache_t *cachep, unsigned long flags) {
  */
 void kmem_cache_free(kmem_cache_t *cachep, void *objp) {
     struct slab *slabp;
+    unsigned long flags;
     
     if (!cachep || !objp) return;
     
@@ -371,7 +379,7 @@ void kmem_cache_free(kmem_cache_t *cachep, void *objp) {
         memset(objp, SLAB_POISON_BYTE, cachep->object_size);
     }
     
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, flags);
     
     // Add object to freelist
     *((void **)objp) = slabp->freelist;
@@ -390,7 +398,7 @@ void kmem_cache_free(kmem_cache_t *cachep, void *objp) {
     // Update statistics
     cachep->stats.active--;
     
-    spin_unlock(&cache_chain_lock);
+    spin_unlock_irqrestore(&cache_chain_lock, flags);
 }
 
 /**
@@ -504,6 +512,9 @@ void kmem_cache_init(void) {
     mm_struct_cache = kmem_cache_create("mm_struct", sizeof(struct mm_struct), 
                                        0, SLAB_HWCACHE_ALIGN, NULL, NULL);
     
+    sighand_cache = kmem_cache_create("sighand_cache", sizeof(struct sighand_struct), 
+                                      0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+    
     inode_cache = kmem_cache_create("inode", sizeof(struct inode), 
                                     0, SLAB_HWCACHE_ALIGN, NULL, NULL);
     
@@ -513,25 +524,109 @@ void kmem_cache_init(void) {
     names_cache = kmem_cache_create("names_cache", 256, 
                                     0, SLAB_HWCACHE_ALIGN, NULL, NULL);
     
-    pid_cache = kmem_cache_create("pid", sizeof(struct pid), 
+    pid_cache = kmem_cache_create("pid", sizeof(process_t), 
                                   0, SLAB_HWCACHE_ALIGN, NULL, NULL);
     
     debug_print(DEBUG_INFO, "Common kernel caches initialized");
 }
 
+/**
+ * Move a cache's empty slabs beyond keep onto list
+ * Called with cache_chain_lock held
+ */
+static void drain_free_slabs(kmem_cache_t *cachep, unsigned int keep,
+                             struct list_head *list) {
+    struct slab *slabp, *tmp;
+    
+    list_for_each_entry_safe(slabp, tmp, &cachep->slabs_free, list) {
+        if (keep) {
+            keep--;
+            continue;
+        }
+        list_del(&slabp->list);
+        list_add(&slabp->list, list);
+    }
+}
+
+static void free_slab_list(struct list_head *list) {
+    struct slab *slabp, *tmp;
+    
+    list_for_each_entry_safe(slabp, tmp, list, list) {
+        list_del(&slabp->list);
+        free_slab(slabp->slab_cache, slabp);
+    }
+}
+
+/**
+ * Release every empty slab of a cache
+ */
+void kmem_cache_shrink(kmem_cache_t *cachep) {
+    LIST_HEAD(list);
+    unsigned long flags;
+    
+    if (!cachep) return;
+    
+    spin_lock_irqsave(&cache_chain_lock, flags);
+    drain_free_slabs(cachep, 0, &list);
+    spin_unlock_irqrestore(&cache_chain_lock, flags);
+    
+    free_slab_list(&list);
+}
+
+/**
+ * Trim every cache to one empty slab
+ * The one kept absorbs the next allocation without growing again
+ */
+void kmem_cache_reap(void) {
+    kmem_cache_t *cachep;
+    LIST_HEAD(list);
+    unsigned long flags;
+    
+    spin_lock_irqsave(&cache_chain_lock, flags);
+    list_for_each_entry(cachep, &cache_chain, list) {
+        drain_free_slabs(cachep, 1, &list);
+    }
+    spin_unlock_irqrestore(&cache_chain_lock, flags);
+    
+    free_slab_list(&list);
+}
+
+// Empty slabs are given back from the system workqueue this often
+#define REAPTIMEOUT (2 * TIMER_FREQUENCY)
+
+// Reaping stays on the boot CPU, which always has a tick to run the timer
+#define REAP_CPU    0
+
+static struct delayed_work cache_reap_work;
+
+static void cache_reap(struct work_struct *work) {
+    kmem_cache_reap();
+    queue_delayed_work_on(REAP_CPU, system_wq, &cache_reap_work, REAPTIMEOUT);
+}
+
+/**
+ * Start periodic reaping; needs workqueues and timers
+ * The work runs on the boot CPU's kworker
+ */
+void kmem_cache_init_late(void) {
+    INIT_DELAYED_WORK(&cache_reap_work, cache_reap);
+    queue_delayed_work_on(REAP_CPU, system_wq, &cache_reap_work, REAPTIMEOUT);
+}
+
 /**
  * Print SLAB debug information
  */
 void slab_debug_info(void) {
     kmem_cache_t *cachep;
+    unsigned long flags;
     
     screen_print("\n=== SLAB Allocator Debug Info ===\n");
     
-    spin_lock(&cache_chain_lock);
+    spin_lock_irqsave(&cache_chain_lock, flags);
     
     list_for_each_entry(cachep, &cache_chain, list) {
         kmem_cache_info(cachep);
     }
     
-    spin_unlock(&cache_chain_lock);
+    spin_unlock_irqrestore(&cache_chain_lock, flags);
 }
@@ -0,0 +1,210 @@
+#include "smp.h"
+#include "apic.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "io_apic.h"
+#include "ktime.h"
+#include "kstack.h"
+#include "mm.h"
+#include "printk.h"
+#include "scheduler.h"
+#include "syscall.h"
+
+/**
+ * Application Processor Bring-up
+ * The boot CPU copies the real-mode trampoline below 1MB and wakes each
+ * AP with the INIT-SIPI-SIPI sequence. An AP loads its own GDT, TSS,
+ * per-CPU segment and the shared IDT, enables its local APIC and starts
+ * its APIC timer tick, marks itself online and drops into the common
+ * idle loop.
+ */
+
+// Delays from the MP specification's universal startup algorithm
+#define INIT_DEASSERT_DELAY_US  10000
+#define STARTUP_DELAY_US        200
+#define CPU_ONLINE_TIMEOUT_US   1000000
+
+// One idle task per CPU
+static process_t idle_tasks[NR_CPUS];
+
+// CPU being started; read by start_secondary() before it marks itself online
+static volatile unsigned int smp_booting_cpu;
+
+void udelay(uint32_t usecs) {
+    ktime_t end = ktime_add_us(ktime_get(), usecs);
+
+    while (ktime_get() < end) {
+        __asm__ volatile("pause");
+    }
+}
+
+/**
+ * Pointer to a trampoline variable in the copy at TRAMPOLINE_BASE
+ */
+static volatile uint32_t *trampoline_var(uint32_t *var) {
+    return (volatile uint32_t *)(TRAMPOLINE_BASE +
+                                 ((uint32_t)var - (uint32_t)trampoline_start));
+}
+
+process_t* idle_task(unsigned int cpu) {
+    return cpu < NR_CPUS ? &idle_tasks[cpu] : NULL;
+}
+
+void init_idle(unsigned int cpu, uint32_t kernel_stack) {
+    process_t *idle = &idle_tasks[cpu];
+
+    memset(idle, 0, sizeof(*idle));
+    idle->flags = PF_IDLE;
+    idle->pcb.pid = 0;
+    idle->pcb.state = PROCESS_RUNNING;
+    idle->pcb.kernel_stack = kernel_stack;
+    idle->policy = SCHED_IDLE;
+    idle->normal_prio = MAX_PRIO;
+    idle->prio = MAX_PRIO;
+    INIT_LIST_HEAD(&idle->pi_waiters);
+    cpumask_clear(&idle->cpus_allowed);
+    cpumask_set_cpu(cpu, &idle->cpus_allowed);
+
+    memcpy(idle->name, "idle/", 5);
+    idle->name[5] = '0' + cpu;
+}
+
+/**
+ * C entry point of an application processor, called by the trampoline
+ * on the stack do_boot_cpu() allocated for it
+ */
+static void __attribute__((noreturn)) start_secondary(void) {
+    unsigned int cpu = smp_booting_cpu;
+    uint32_t stack = idle_tasks[cpu].pcb.kernel_stack + KERNEL_STACK_SIZE;
+
+    // Loads this CPU's per-CPU segment; no per-CPU access before this
+    gdt_init_cpu(cpu, stack);
+    idle_tasks[cpu].on_cpu = true;
+    this_cpu_write(current_task, &idle_tasks[cpu]);
+    doublefault_init_cpu(cpu);
+    idt_load();
+    syscall_init_cpu(cpu);
+    apic_setup_local();
+    apic_timer_setup_cpu();
+
+    pr_info("smp: CPU%d (APIC ID %d) online\n", cpu, read_apic_id());
+
+    // Everything above must be visible before the boot CPU moves on
+    __asm__ volatile("" ::: "memory");
+    set_cpu_online(cpu, true);
+
+    // Runs whatever becomes ready here, looking again on every tick and
+    // whenever a wakeup sends it a reschedule IPI
+    cpu_idle_loop();
+}
+
+/**
+ * Make another CPU run its scheduler
+ */
+void smp_send_reschedule(unsigned int cpu) {
+    apic_send_ipi(cpu, RESCHEDULE_VECTOR);
+}
+
+/**
+ * Give up on an AP that did not come online
+ * INIT parks it waiting for STARTUP wherever it got to, so it can no
+ * longer touch the stack, and a stray STARTUP finds the trampoline
+ * disarmed
+ */
+static void abort_boot_cpu(unsigned int cpu, uint8_t apicid, uint32_t stack) {
+    apic_send_init(apicid);
+    set_cpu_online(cpu, false);     // In case it got there after the timeout
+    *trampoline_var(&trampoline_entry) = 0;
+    *trampoline_var(&trampoline_stack) = 0;
+    idle_tasks[cpu].pcb.kernel_stack = 0;
+    free_kernel_stack(stack);
+}
+
+/**
+ * Start one AP and wait for it to come online
+ */
+static int do_boot_cpu(unsigned int cpu) {
+    uint8_t apicid = x86_cpu_to_apicid[cpu];
+    uint32_t stack = alloc_kernel_stack();
+    ktime_t timeout;
+
+    if (!stack) {
+        return -ENOMEM;
+    }
+
+    init_idle(cpu, stack);
+    smp_booting_cpu = cpu;
+    *trampoline_var(&trampoline_stack) = stack + KERNEL_STACK_SIZE;
+    *trampoline_var(&trampoline_entry) = (uint32_t)start_secondary;
+
+    if (apic_send_init(apicid) < 0) {
+        pr_err("smp: CPU%d did not accept INIT\n", cpu);
+        abort_boot_cpu(cpu, apicid, stack);
+        return -ETIMEDOUT;
+    }
+    udelay(INIT_DEASSERT_DELAY_US);
+
+    // Send STARTUP twice unless the first one already woke it
+    for (int i = 0; i < 2 && !cpu_online(cpu); i++) {
+        apic_send_startup(apicid, TRAMPOLINE_BASE >> 12);
+        udelay(STARTUP_DELAY_US);
+    }
+
+    timeout = ktime_add_us(ktime_get(), CPU_ONLINE_TIMEOUT_US);
+    while (!cpu_online(cpu)) {
+        if (ktime_get() > timeout) {
+            pr_err("smp: CPU%d (APIC ID %d) failed to start\n", cpu, apicid);
+            abort_boot_cpu(cpu, apicid, stack);
+            return -ETIMEDOUT;
+        }
+        __asm__ volatile("pause");
+    }
+
+    return 0;
+}
+
+/**
+ * Find the CPUs in the ACPI MADT (or MP tables) and start them
+ * Runs on the boot CPU once interrupts are on, as the startup delays are
+ * timed with ktime_get()
+ */
+void smp_init(void) {
+    unsigned int cpu;
+    uint32_t cr3;
+    int found;
+
+    if (apic_init() < 0) {
+        pr_info("smp: no local APIC, running uniprocessor\n");
+        return;
+    }
+
+    found = acpi_parse_madt();
+    if (found < 0) {
+        found = mp_parse_tables();
+    }
+    if (found < 0) {
+        pr_info("smp: no MADT or MP table, running uniprocessor\n");
+    }
+
+    // Only CPUs firmware reported can ever come online
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        set_cpu_possible(cpu, cpu < nr_cpu_ids);
+    }
+
+    apic_setup_local();
+    apic_timer_init();
+
+    memcpy((void *)TRAMPOLINE_BASE, trampoline_start,
+           trampoline_end - trampoline_start);
+    __asm__ volatile("mov %%cr3, %0" : "=r" (cr3));
+    *trampoline_var(&trampoline_cr3) = cr3;
+
+    for (cpu = 1; cpu < nr_cpu_ids; cpu++) {
+        do_boot_cpu(cpu);
+    }
+
+    pr_info("smp: %d of %d CPUs online\n", num_online_cpus(), nr_cpu_ids);
+
+    // Device interrupts can now be spread over every CPU
+    setup_io_apic();
+}
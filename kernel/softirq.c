@@ -0,0 +1,342 @@
+#include "softirq.h"
+#include "kernel.h"
+#include "spinlock.h"
+#include "kthread.h"
+#include "ktime.h"
+#include "printk.h"
+#include "screen.h"
+
+/**
+ * Softirq Processing and ksoftirqd
+ * __do_softirq() runs with the softirq count raised, so an interrupt
+ * taken while a handler runs only marks its own softirqs pending; the
+ * loop in progress picks them up. After MAX_SOFTIRQ_RESTART passes or
+ * MAX_SOFTIRQ_TIME the rest is left to ksoftirqd.
+ */
+
+#define MAX_SOFTIRQ_RESTART 10
+#define MAX_SOFTIRQ_TIME    (2 * NSEC_PER_MSEC)
+
+static struct softirq_action softirq_vec[NR_SOFTIRQS];
+
+// Padded to one column width for softirq_show()
+static const char *softirq_names[NR_SOFTIRQS] = {
+    "HI       ", "TIMER    ", "NET_TX   ", "NET_RX   ",
+    "BLOCK    ", "TASKLET  ", "RCU      ",
+};
+
+DEFINE_PER_CPU(uint32_t, softirq_pending);
+DEFINE_PER_CPU(uint32_t, hardirq_count);
+DEFINE_PER_CPU(uint32_t, softirq_count);
+
+static DEFINE_PER_CPU(process_t *, ksoftirqd);
+static DEFINE_PER_CPU(uint32_t, softirq_stat[NR_SOFTIRQS]);
+
+struct tasklet_head {
+    struct tasklet_struct *head;
+    struct tasklet_struct **tail;
+};
+
+static DEFINE_PER_CPU(struct tasklet_head, tasklet_vec);
+static DEFINE_PER_CPU(struct tasklet_head, tasklet_hi_vec);
+
+static void wakeup_softirqd(void) {
+    process_t *tsk = this_cpu_read(ksoftirqd);
+
+    if (tsk) {
+        wake_up_process(tsk);
+    }
+}
+
+void open_softirq(int nr, void (*action)(struct softirq_action *h)) {
+    softirq_vec[nr].action = action;
+}
+
+void raise_softirq_irqoff(unsigned int nr) {
+    this_cpu_write(softirq_pending, this_cpu_read(softirq_pending) | (1U << nr));
+
+    // Interrupt exit will run it; from a task only ksoftirqd will
+    if (!in_interrupt()) {
+        wakeup_softirqd();
+    }
+}
+
+void raise_softirq(unsigned int nr) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    raise_softirq_irqoff(nr);
+    local_irq_restore(flags);
+}
+
+/**
+ * Run pending softirqs; called with interrupts disabled
+ */
+static void __do_softirq(void) {
+    uint64_t end = sched_clock() + MAX_SOFTIRQ_TIME;
+    int restart = MAX_SOFTIRQ_RESTART;
+    uint32_t pending;
+
+    this_cpu_inc(softirq_count);
+
+    for (;;) {
+        struct softirq_action *h = softirq_vec;
+        uint32_t *stat = this_cpu_ptr(&softirq_stat[0]);
+
+        pending = this_cpu_read(softirq_pending);
+        this_cpu_write(softirq_pending, 0);
+
+        local_irq_enable();
+
+        for (; pending; pending >>= 1, h++) {
+            if ((pending & 1) && h->action) {
+                stat[h - softirq_vec]++;
+                h->action(h);
+            }
+        }
+
+        local_irq_disable();
+
+        if (!this_cpu_read(softirq_pending)) {
+            break;
+        }
+        if (--restart == 0 || sched_clock() >= end) {
+            wakeup_softirqd();
+            break;
+        }
+    }
+
+    this_cpu_dec(softirq_count);
+}
+
+void do_softirq(void) {
+    unsigned long flags;
+
+    if (in_interrupt()) {
+        return;
+    }
+
+    local_irq_save(flags);
+    if (local_softirq_pending()) {
+        __do_softirq();
+    }
+    local_irq_restore(flags);
+}
+
+void irq_enter(void) {
+    this_cpu_inc(hardirq_count);
+}
+
+/**
+ * Leave a hard interrupt handler; interrupts are still disabled
+ * Whatever is pending runs even if ksoftirqd is queued too, since it
+ * only finds what is left
+ */
+void irq_exit(void) {
+    this_cpu_dec(hardirq_count);
+
+    if (!in_interrupt() && local_softirq_pending()) {
+        __do_softirq();
+    }
+}
+
+void local_bh_disable(void) {
+    this_cpu_inc(softirq_count);
+    __asm__ volatile("" ::: "memory");
+}
+
+void local_bh_enable(void) {
+    __asm__ volatile("" ::: "memory");
+    this_cpu_dec(softirq_count);
+
+    if (!in_interrupt() && local_softirq_pending()) {
+        do_softirq();
+    }
+}
+
+/**
+ * Per-CPU softirq thread: runs what interrupt exit left over
+ */
+static int run_ksoftirqd(void *data) {
+    unsigned long flags;
+
+    while (!kthread_should_stop()) {
+        current_process->pcb.state = PROCESS_BLOCKED;
+        if (!local_softirq_pending()) {
+            process_sleep();
+            continue;
+        }
+        current_process->pcb.state = PROCESS_RUNNING;
+
+        local_irq_save(flags);
+        if (!in_interrupt() && local_softirq_pending()) {
+            __do_softirq();
+        }
+        local_irq_restore(flags);
+    }
+
+    current_process->pcb.state = PROCESS_RUNNING;
+    return 0;
+}
+
+/**
+ * Tasklets
+ */
+static void __tasklet_schedule(struct tasklet_struct *t, struct tasklet_head *head,
+                               unsigned int nr) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    head = this_cpu_ptr(head);
+    t->next = NULL;
+    *head->tail = t;
+    head->tail = &t->next;
+    raise_softirq_irqoff(nr);
+    local_irq_restore(flags);
+}
+
+void tasklet_schedule(struct tasklet_struct *t) {
+    if (!(__sync_fetch_and_or(&t->state, TASKLET_STATE_SCHED) & TASKLET_STATE_SCHED)) {
+        __tasklet_schedule(t, &tasklet_vec, TASKLET_SOFTIRQ);
+    }
+}
+
+void tasklet_hi_schedule(struct tasklet_struct *t) {
+    if (!(__sync_fetch_and_or(&t->state, TASKLET_STATE_SCHED) & TASKLET_STATE_SCHED)) {
+        __tasklet_schedule(t, &tasklet_hi_vec, HI_SOFTIRQ);
+    }
+}
+
+/**
+ * Run every tasklet queued on this CPU; one that is disabled or running
+ * elsewhere goes back on the list for the next pass
+ */
+static void tasklet_action_common(struct tasklet_head *head, unsigned int nr) {
+    struct tasklet_struct *list;
+
+    local_irq_disable();
+    head = this_cpu_ptr(head);
+    list = head->head;
+    head->head = NULL;
+    head->tail = &head->head;
+    local_irq_enable();
+
+    while (list) {
+        struct tasklet_struct *t = list;
+
+        list = list->next;
+
+        if (!(__sync_fetch_and_or(&t->state, TASKLET_STATE_RUN) & TASKLET_STATE_RUN)) {
+            if (!t->count) {
+                __sync_fetch_and_and(&t->state, ~TASKLET_STATE_SCHED);
+                t->func(t->data);
+                __sync_fetch_and_and(&t->state, ~TASKLET_STATE_RUN);
+                continue;
+            }
+            __sync_fetch_and_and(&t->state, ~TASKLET_STATE_RUN);
+        }
+
+        local_irq_disable();
+        t->next = NULL;
+        *head->tail = t;
+        head->tail = &t->next;
+        raise_softirq_irqoff(nr);
+        local_irq_enable();
+    }
+}
+
+static void tasklet_action(struct softirq_action *h) {
+    tasklet_action_common(&tasklet_vec, TASKLET_SOFTIRQ);
+}
+
+static void tasklet_hi_action(struct softirq_action *h) {
+    tasklet_action_common(&tasklet_hi_vec, HI_SOFTIRQ);
+}
+
+void tasklet_init(struct tasklet_struct *t, void (*func)(unsigned long data),
+                  unsigned long data) {
+    t->next = NULL;
+    t->state = 0;
+    t->count = 0;
+    t->func = func;
+    t->data = data;
+}
+
+void tasklet_disable(struct tasklet_struct *t) {
+    __sync_fetch_and_add(&t->count, 1);
+    while (t->state & TASKLET_STATE_RUN) {
+        cpu_relax();
+    }
+}
+
+void tasklet_enable(struct tasklet_struct *t) {
+    __sync_fetch_and_sub(&t->count, 1);
+}
+
+void tasklet_kill(struct tasklet_struct *t) {
+    while (__sync_fetch_and_or(&t->state, TASKLET_STATE_SCHED) & TASKLET_STATE_SCHED) {
+        while (t->state & TASKLET_STATE_SCHED) {
+            cpu_relax();
+        }
+    }
+    while (t->state & TASKLET_STATE_RUN) {
+        cpu_relax();
+    }
+    __sync_fetch_and_and(&t->state, ~TASKLET_STATE_SCHED);
+}
+
+/**
+ * Print how often each softirq ran on each CPU
+ */
+void softirq_show(void) {
+    unsigned int cpu;
+
+    screen_print("         ");
+    for_each_online_cpu(cpu) {
+        screen_print("  CPU");
+        screen_print_dec(cpu);
+    }
+    screen_print("\n");
+
+    for (int nr = 0; nr < NR_SOFTIRQS; nr++) {
+        screen_print(softirq_names[nr]);
+        for_each_online_cpu(cpu) {
+            screen_print("  ");
+            screen_print_dec(per_cpu(softirq_stat[nr], cpu));
+        }
+        screen_print("\n");
+    }
+}
+
+/**
+ * Set up tasklet lists and start one ksoftirqd per CPU
+ * Needs processes; runs before anything raises a softirq
+ */
+void softirq_init(void) {
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct tasklet_head *tv = per_cpu_ptr(&tasklet_vec, cpu);
+        struct tasklet_head *thv = per_cpu_ptr(&tasklet_hi_vec, cpu);
+
+        tv->tail = &tv->head;
+        thv->tail = &thv->head;
+    }
+
+    open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+    open_softirq(HI_SOFTIRQ, tasklet_hi_action);
+
+    for_each_possible_cpu(cpu) {
+        char name[16];
+        process_t *tsk;
+
+        snprintf(name, sizeof(name), "ksoftirqd/%d", cpu);
+        tsk = kthread_create(run_ksoftirqd, NULL, name);
+        if (!tsk) {
+            continue;
+        }
+        kthread_bind(tsk, cpu);
+        per_cpu(ksoftirqd, cpu) = tsk;
+        wake_up_process(tsk);
+    }
+}
@@ -0,0 +1,190 @@
+#include "spinlock.h"
+#include "kernel.h"
+#include "ktime.h"
+#include "clocksource.h"
+#include "screen.h"
+
+/**
+ * Lock Slow Paths and Contention Statistics
+ * The uncontended paths are inline in spinlock.h; waiting, debugging
+ * checks and statistics bookkeeping live here
+ */
+
+// Locks and preempt_disable() sections held on each CPU
+DEFINE_PER_CPU(uint32_t, __preempt_count);
+
+#ifdef CONFIG_LOCK_STAT
+// Locks that have been contended at least once
+static struct lock_class_stats *lock_stat_list;
+static volatile uint32_t lock_stat_list_lock;
+
+/**
+ * Add a lock to the contention list on its first contention
+ * Uses a bare test-and-set lock: a spinlock_t here would recurse
+ */
+static void lock_stat_register(struct lock_class_stats *stat) {
+    while (__sync_lock_test_and_set(&lock_stat_list_lock, 1)) {
+        cpu_relax();
+    }
+    if (!stat->registered) {
+        stat->registered = true;
+        stat->next = lock_stat_list;
+        lock_stat_list = stat;
+    }
+    __sync_lock_release(&lock_stat_list_lock);
+}
+#endif
+
+/**
+ * Wait for our ticket to come up
+ * Each waiter only reads head, which changes once per release
+ */
+void spin_lock_slowpath(spinlock_t *lock, uint16_t ticket) {
+#ifdef CONFIG_LOCK_STAT
+    uint64_t start = rdtsc();
+    uint64_t waited;
+#endif
+
+    while (lock->tickets.head != ticket) {
+        cpu_relax();
+    }
+
+#ifdef CONFIG_LOCK_STAT
+    // We own the lock now, so the counters need no further protection
+    waited = rdtsc() - start;
+    lock->stat.contentions++;
+    lock->stat.wait_cycles += waited;
+    if (waited > lock->stat.max_wait_cycles) {
+        lock->stat.max_wait_cycles = waited;
+    }
+    if (!lock->stat.registered) {
+        lock_stat_register(&lock->stat);
+    }
+#endif
+}
+
+#ifdef CONFIG_DEBUG_SPINLOCK
+void spin_debug_lock(spinlock_t *lock) {
+    if (lock->magic != SPINLOCK_MAGIC) {
+        panic("spinlock: bad magic (uninitialized lock?)");
+    }
+    lock->owner_cpu = smp_processor_id();
+}
+
+void spin_debug_unlock(spinlock_t *lock) {
+    if (lock->magic != SPINLOCK_MAGIC) {
+        panic("spinlock: bad magic on unlock");
+    }
+    if (!spin_is_locked(lock)) {
+        panic("spinlock: unlocking a lock that is not held");
+    }
+    if (lock->owner_cpu != (int)smp_processor_id()) {
+        panic("spinlock: released on a different CPU than it was taken");
+    }
+    lock->owner_cpu = -1;
+}
+#endif
+
+/**
+ * A reader found a writer holding or waiting for the lock
+ * Back out, queue behind the writer and wait for it to finish
+ */
+void queued_read_lock_slowpath(rwlock_t *lock) {
+    __sync_fetch_and_sub(&lock->cnts, _QR_BIAS);
+
+    spin_lock(&lock->wait_lock);
+    __sync_fetch_and_add(&lock->cnts, _QR_BIAS);
+
+    // The queue head only waits for the lock holder to drop
+    while ((lock->cnts & _QW_WMASK) == _QW_LOCKED) {
+        cpu_relax();
+    }
+
+    spin_unlock(&lock->wait_lock);
+}
+
+/**
+ * A writer found the lock busy
+ * Queue, announce ourselves so new readers back off, then wait for the
+ * current readers to drain
+ */
+void queued_write_lock_slowpath(rwlock_t *lock) {
+    uint32_t cnts;
+
+    spin_lock(&lock->wait_lock);
+
+    if (!lock->cnts && __sync_bool_compare_and_swap(&lock->cnts, 0, _QW_LOCKED)) {
+        goto unlock;
+    }
+
+    // Set the waiting flag once no other writer holds the lock
+    for (;;) {
+        cnts = lock->cnts;
+        if (!(cnts & _QW_WMASK) &&
+            __sync_bool_compare_and_swap(&lock->cnts, cnts, cnts | _QW_WAITING)) {
+            break;
+        }
+        cpu_relax();
+    }
+
+    // Take it once the readers are gone
+    while (!__sync_bool_compare_and_swap(&lock->cnts, _QW_WAITING, _QW_LOCKED)) {
+        cpu_relax();
+    }
+
+unlock:
+    spin_unlock(&lock->wait_lock);
+}
+
+#ifdef CONFIG_LOCK_STAT
+static void print_cycles_us(uint64_t cycles) {
+    if (tsc_khz) {
+        screen_print_dec((uint32_t)div_u64(tsc_delta_to_ns(cycles), NSEC_PER_USEC));
+        screen_print("us");
+    } else {
+        screen_print_dec((uint32_t)cycles);
+        screen_print("cyc");
+    }
+}
+
+/**
+ * Print every lock that has seen contention
+ */
+void lock_stat_show(void) {
+    struct lock_class_stats *stat;
+
+    screen_print("name                     contended/acquired  wait-total  wait-max\n");
+
+    for (stat = lock_stat_list; stat; stat = stat->next) {
+        if (stat->name) {
+            screen_print(stat->name);
+        } else {
+            screen_print("0x");
+            screen_print_hex((uint32_t)stat);
+        }
+        screen_print("  ");
+        screen_print_dec(stat->contentions);
+        screen_print("/");
+        screen_print_dec(stat->acquisitions);
+        screen_print("  ");
+        print_cycles_us(stat->wait_cycles);
+        screen_print("  ");
+        print_cycles_us(stat->max_wait_cycles);
+        screen_print("\n");
+    }
+}
+
+/**
+ * Zero the counters of every listed lock
+ */
+void lock_stat_reset(void) {
+    struct lock_class_stats *stat;
+
+    for (stat = lock_stat_list; stat; stat = stat->next) {
+        stat->acquisitions = 0;
+        stat->contentions = 0;
+        stat->wait_cycles = 0;
+        stat->max_wait_cycles = 0;
+    }
+}
+#endif
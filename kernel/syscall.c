@@ -0,0 +1,168 @@
+#include "syscall.h"
+#include "kernel.h"
+#include "gdt.h"
+#include "apic.h"
+#include "futex.h"
+#include "vfs.h"
+
+/**
+ * System Call Dispatch
+ * Every handler takes the saved frame and picks its own arguments out
+ * of it, so the table needs no casts and both entry paths share it
+ */
+
+#define X86_FEATURE_SEP     (1 << 11)
+
+// Longest path sys_open() accepts, terminator included
+#define SYS_PATH_MAX        512
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid"
+                     : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                     : "a" (leaf), "c" (0));
+}
+
+/**
+ * Pentium Pro steppings before 0x633 report SEP without implementing it
+ */
+static bool cpu_has_sep(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & X86_FEATURE_SEP)) {
+        return false;
+    }
+    return (eax & 0xFFF) >= 0x633 || ((eax >> 8) & 0xF) != 6;
+}
+
+static int sys_exit(struct pt_regs *regs) {
+    process_exit(regs->bx);
+    return 0;
+}
+
+static int sys_fork(struct pt_regs *regs) {
+    // Child PID for the parent, 0 for the child
+    return do_clone(0, 0, regs);
+}
+
+/**
+ * Check that a user path is terminated within SYS_PATH_MAX bytes, all
+ * of them below the kernel; returns 0, -EFAULT or -ENAMETOOLONG
+ */
+static int user_path_ok(const char *path) {
+    for (uint32_t i = 0; i < SYS_PATH_MAX; i++) {
+        if (!access_ok(path + i, 1)) {
+            return -EFAULT;
+        }
+        if (!path[i]) {
+            return 0;
+        }
+    }
+    return -ENAMETOOLONG;
+}
+
+static int sys_read(struct pt_regs *regs) {
+    // File descriptor EBX, buffer ECX, count EDX
+    if (!access_ok((void*)regs->cx, regs->dx)) {
+        return -EFAULT;
+    }
+    return vfs_read(regs->bx, (void*)regs->cx, regs->dx);
+}
+
+static int sys_write(struct pt_regs *regs) {
+    if (!access_ok((const void*)regs->cx, regs->dx)) {
+        return -EFAULT;
+    }
+    return vfs_write(regs->bx, (const void*)regs->cx, regs->dx);
+}
+
+static int sys_open(struct pt_regs *regs) {
+    // Path EBX, flags ECX
+    int ret = user_path_ok((const char*)regs->bx);
+    
+    if (ret) {
+        return ret;
+    }
+    return vfs_open((const char*)regs->bx, regs->cx);
+}
+
+static int sys_close(struct pt_regs *regs) {
+    return vfs_close(regs->bx);
+}
+
+static int sys_getpid(struct pt_regs *regs) {
+    // Threads of one process share its thread group ID
+    return current_process->pcb.tgid;
+}
+
+static int sys_clone(struct pt_regs *regs) {
+    // Clone flags EBX, new user stack ECX (0 keeps the caller's)
+    return do_clone(regs->bx, regs->cx, regs);
+}
+
+static int sys_futex_call(struct pt_regs *regs) {
+    // Futex word EBX, operation ECX, value EDX
+    return sys_futex((uint32_t*)regs->bx, regs->cx, regs->dx);
+}
+
+static int sys_sched_setaffinity(struct pt_regs *regs) {
+    // PID EBX (0 for self), CPU mask ECX
+    struct cpumask mask = { regs->cx };
+    return sched_setaffinity(regs->bx, &mask);
+}
+
+static int sys_sched_getaffinity(struct pt_regs *regs) {
+    // PID EBX; returns the CPU mask or a negative error
+    struct cpumask mask;
+    int ret = sched_getaffinity(regs->bx, &mask);
+    return ret < 0 ? ret : (int)cpumask_bits(&mask);
+}
+
+const sys_call_ptr_t sys_call_table[NR_syscalls] = {
+    [SYS_EXIT]              = sys_exit,
+    [SYS_FORK]              = sys_fork,
+    [SYS_READ]              = sys_read,
+    [SYS_WRITE]             = sys_write,
+    [SYS_OPEN]              = sys_open,
+    [SYS_CLOSE]             = sys_close,
+    [SYS_GETPID]            = sys_getpid,
+    [SYS_CLONE]             = sys_clone,
+    [SYS_FUTEX]             = sys_futex_call,
+    [SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity,
+    [SYS_SCHED_GETAFFINITY] = sys_sched_getaffinity,
+};
+
+void do_syscall(struct pt_regs *regs) {
+    uint32_t nr = regs->orig_ax;
+    sys_call_ptr_t fn;
+
+    // Both gates arrive with interrupts off; handlers may sleep
+    local_irq_enable();
+
+    fn = nr < NR_syscalls ? sys_call_table[nr] : NULL;
+    regs->ax = fn ? (uint32_t)fn(regs) : (uint32_t)-ENOSYS;
+}
+
+/**
+ * SYSENTER with EBP outside user space: the return address cannot be
+ * read, so the call fails with -EFAULT, and with nowhere to resume the
+ * caller it ends the process
+ */
+void sysenter_bad_frame(struct pt_regs *regs) {
+    local_irq_enable();
+    process_exit((uint32_t)-EFAULT);
+}
+
+bool syscall_init_cpu(unsigned int cpu) {
+    if (!cpu_has_sep()) {
+        return false;
+    }
+
+    // The entry stub does "mov esp, [esp]" to pick up tss.esp0, so the
+    // MSRs never change on a context switch
+    wrmsr(MSR_IA32_SYSENTER_CS, __KERNEL_CS);
+    wrmsr(MSR_IA32_SYSENTER_ESP, (uint32_t)tss_esp0_ptr(cpu));
+    wrmsr(MSR_IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    return true;
+}
@@ -0,0 +1,343 @@
+#include "clocksource.h"
+#include "hrtimer.h"
+#include "kernel.h"
+#include "timer.h"
+#include "printk.h"
+#include "slab.h"
+#include "vdso.h"
+
+/**
+ * Timekeeping, Clocksource and Clockevent Core
+ * Nanosecond monotonic time built on the best registered counter
+ * Based on Linux kernel/time design principles
+ */
+
+// Registered clocksources, sorted by rating (best first)
+static struct clocksource *clocksource_list;
+static DEFINE_SPINLOCK(clocksource_lock);
+
+// Registered clockevent devices
+static struct clock_event_device *clockevent_list;
+static struct clock_event_device *tick_device;     // Drives the periodic tick
+static struct clock_event_device *oneshot_device;  // Programmed by hrtimers
+
+// CPUs with a running periodic tick, whose timer wheels expire
+static struct cpumask tick_cpus;
+
+/**
+ * Timekeeper state
+ * Guarded by a seqlock: readers retry if an update overlapped them, so
+ * the tick interrupt can fold elapsed cycles without readers taking a lock
+ */
+static struct {
+    seqlock_t lock;
+    struct clocksource *clock;
+    uint64_t cycle_last;        // Counter value at last update
+    uint64_t base_ns;           // Monotonic ns at cycle_last
+    uint64_t frac;              // Sub-ns remainder in clock shift units
+} tk = {
+    .lock = __SEQLOCK_UNLOCKED("timekeeper"),
+};
+
+/**
+ * Jiffies clocksource - always available, PIT tick resolution
+ */
+static uint64_t jiffies_read(struct clocksource *cs) {
+    return timer_get_ticks();
+}
+
+static struct clocksource clocksource_jiffies = {
+    .name = "jiffies",
+    .read = jiffies_read,
+    .mask = CLOCKSOURCE_MASK(32),
+    .mult = NSEC_PER_SEC / TIMER_FREQUENCY,
+    .shift = 0,
+    .rating = CLOCKSOURCE_RATING_JIFFIES,
+    .flags = 0,
+};
+
+/**
+ * Compute mult/shift so that ns = (cycles * mult) >> shift stays exact
+ * to within rounding for intervals up to maxsec seconds
+ */
+void clocksource_calc_mult_shift(struct clocksource *cs, uint32_t freq_khz,
+                                 uint32_t maxsec) {
+    uint64_t tmp;
+    uint32_t sft, sftacc = 32;
+
+    // Bits of headroom needed to hold maxsec worth of cycles
+    tmp = ((uint64_t)maxsec * freq_khz * MSEC_PER_SEC) >> 32;
+    while (tmp) {
+        tmp >>= 1;
+        sftacc--;
+    }
+
+    // Largest shift whose multiplier still fits the headroom
+    for (sft = 32; sft > 0; sft--) {
+        tmp = (uint64_t)NSEC_PER_MSEC << sft;
+        tmp += freq_khz / 2;
+        tmp = div_u64(tmp, freq_khz);
+        if ((tmp >> sftacc) == 0) {
+            break;
+        }
+    }
+
+    cs->mult = (uint32_t)tmp;
+    cs->shift = sft;
+    cs->max_idle_ns = (uint64_t)maxsec * NSEC_PER_SEC;
+}
+
+static inline uint64_t clocksource_delta(struct clocksource *cs, uint64_t now,
+                                         uint64_t last) {
+    return (now - last) & cs->mask;
+}
+
+/**
+ * Fold cycles elapsed since the last update into base_ns
+ * Called from the tick; must run more often than max_idle_ns
+ */
+void timekeeping_update(void) {
+    struct clocksource *cs = tk.clock;
+    uint64_t now, delta;
+    unsigned long flags;
+
+    if (!cs) return;
+
+    write_seqlock_irqsave(&tk.lock, flags);
+
+    now = cs->read(cs);
+    delta = clocksource_delta(cs, now, tk.cycle_last);
+    delta = delta * cs->mult + tk.frac;
+
+    tk.base_ns += delta >> cs->shift;
+    tk.frac = delta & ((1ULL << cs->shift) - 1);
+    tk.cycle_last = now;
+    update_vsyscall(cs, tk.cycle_last, tk.base_ns, tk.frac);
+
+    write_sequnlock_irqrestore(&tk.lock, flags);
+}
+
+/**
+ * Switch the timekeeper to a new clocksource without a time jump
+ */
+static void timekeeping_change_clocksource(struct clocksource *cs) {
+    unsigned long flags;
+
+    timekeeping_update();
+
+    write_seqlock_irqsave(&tk.lock, flags);
+    tk.clock = cs;
+    tk.cycle_last = cs->read(cs);
+    tk.frac = 0;
+    update_vsyscall(cs, tk.cycle_last, tk.base_ns, tk.frac);
+    write_sequnlock_irqrestore(&tk.lock, flags);
+
+    pr_info("clocksource: switched to %s (mult %u shift %u)\n",
+            cs->name, cs->mult, cs->shift);
+}
+
+/**
+ * Register a clocksource; the highest rated one drives timekeeping
+ */
+int clocksource_register(struct clocksource *cs) {
+    struct clocksource **pos;
+    unsigned long flags;
+
+    if (!cs || !cs->read || !cs->mult) return -EINVAL;
+
+    spin_lock_irqsave(&clocksource_lock, flags);
+    pos = &clocksource_list;
+    while (*pos && (*pos)->rating >= cs->rating) {
+        pos = &(*pos)->next;
+    }
+    cs->next = *pos;
+    *pos = cs;
+    spin_unlock_irqrestore(&clocksource_lock, flags);
+
+    pr_info("clocksource: registered %s (rating %u)\n", cs->name, cs->rating);
+
+    if (!tk.clock || cs->rating > tk.clock->rating) {
+        timekeeping_change_clocksource(cs);
+    }
+
+    return 0;
+}
+
+struct clocksource *clocksource_current(void) {
+    return tk.clock;
+}
+
+/**
+ * Monotonic time since boot in nanoseconds
+ */
+ktime_t ktime_get(void) {
+    struct clocksource *cs;
+    uint32_t seq;
+    uint64_t base, delta;
+
+    do {
+        seq = read_seqbegin(&tk.lock);
+
+        cs = tk.clock;
+        if (!cs) return 0;
+
+        delta = clocksource_delta(cs, cs->read(cs), tk.cycle_last);
+        delta = delta * cs->mult + tk.frac;
+        base = tk.base_ns + (delta >> cs->shift);
+    } while (read_seqretry(&tk.lock, seq));
+
+    return (ktime_t)base;
+}
+
+uint64_t ktime_get_ns(void) {
+    return (uint64_t)ktime_get();
+}
+
+/**
+ * Fast local clock for scheduler accounting
+ * Uses the TSC directly when calibrated; falls back to ktime_get()
+ */
+uint64_t sched_clock(void) {
+    if (tsc_khz) {
+        return tsc_cycles_to_ns(rdtsc());
+    }
+    return (uint64_t)ktime_get();
+}
+
+/**
+ * Program a oneshot device to fire at an absolute time
+ */
+int clockevents_program_event(struct clock_event_device *dev, ktime_t expires) {
+    int64_t delta;
+
+    if (!dev || !dev->set_next_event) return -EINVAL;
+    if (dev->state != CLOCK_EVT_STATE_ONESHOT) return -EINVAL;
+
+    dev->next_event = expires;
+
+    delta = ktime_sub(expires, ktime_get());
+    if (delta < (int64_t)dev->min_delta_ns) delta = dev->min_delta_ns;
+    if ((uint64_t)delta > dev->max_delta_ns) delta = dev->max_delta_ns;
+
+    return dev->set_next_event((uint64_t)delta, dev);
+}
+
+/**
+ * Periodic tick handler
+ * The global tick device advances timekeeping; every tick device marks
+ * its CPU's timer wheel due and expires its hrtimers, unless the
+ * oneshot device (which interrupts the boot CPU only) does that there
+ */
+void tick_handle_periodic(struct clock_event_device *dev) {
+    dev->event_count++;
+
+    if (dev == tick_device) {
+        timekeeping_update();
+    }
+    run_local_timers();
+
+    if (!oneshot_device || dev != tick_device) {
+        hrtimer_run_queues();
+    }
+}
+
+/**
+ * Register a clockevent device
+ * A oneshot-capable device takes over hrtimer expiry; a periodic one
+ * takes over the tick if it is rated higher than the current one
+ */
+void clockevents_register_device(struct clock_event_device *dev) {
+    if (!dev) return;
+
+    dev->state = CLOCK_EVT_STATE_DETACHED;
+    dev->next = clockevent_list;
+    clockevent_list = dev;
+
+    if ((dev->features & CLOCK_EVT_FEAT_ONESHOT) && dev->set_next_event &&
+        (!oneshot_device || dev->rating > oneshot_device->rating)) {
+        if (oneshot_device && oneshot_device->set_state_shutdown) {
+            oneshot_device->set_state_shutdown(oneshot_device);
+            oneshot_device->state = CLOCK_EVT_STATE_SHUTDOWN;
+        }
+
+        if (dev->set_state_oneshot) {
+            dev->set_state_oneshot(dev);
+        }
+        dev->state = CLOCK_EVT_STATE_ONESHOT;
+        dev->event_handler = hrtimer_interrupt;
+        dev->next_event = KTIME_MAX;
+        oneshot_device = dev;
+
+        pr_info("clockevents: %s drives high-resolution timers\n", dev->name);
+        return;
+    }
+
+    if ((dev->features & CLOCK_EVT_FEAT_PERIODIC) &&
+        (!tick_device || dev->rating > tick_device->rating)) {
+        if (tick_device && tick_device->set_state_shutdown) {
+            tick_device->set_state_shutdown(tick_device);
+            tick_device->state = CLOCK_EVT_STATE_SHUTDOWN;
+        }
+
+        dev->event_handler = tick_handle_periodic;
+        if (dev->set_state_periodic) {
+            dev->set_state_periodic(dev);
+        }
+        dev->state = CLOCK_EVT_STATE_PERIODIC;
+        tick_device = dev;
+
+        for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+            if (dev->cpumask & (1U << cpu)) {
+                cpumask_set_cpu(cpu, &tick_cpus);
+            }
+        }
+
+        pr_info("clockevents: %s drives the periodic tick\n", dev->name);
+    }
+}
+
+/**
+ * Start the calling CPU's own periodic tick device
+ * It drives that CPU's timers and preemption; time is still kept by
+ * the global tick device
+ */
+void clockevents_register_percpu_device(struct clock_event_device *dev) {
+    dev->event_handler = tick_handle_periodic;
+    if (dev->set_state_periodic) {
+        dev->set_state_periodic(dev);
+    }
+    dev->state = CLOCK_EVT_STATE_PERIODIC;
+    cpumask_set_cpu(smp_processor_id(), &tick_cpus);
+
+    pr_info("clockevents: %s drives the CPU%d tick\n", dev->name, smp_processor_id());
+}
+
+/**
+ * Whether cpu has a running tick; timers armed on the wheel of one
+ * without it would never expire
+ */
+bool tick_cpu_running(unsigned int cpu) {
+    return cpumask_test_cpu(cpu, &tick_cpus);
+}
+
+struct clock_event_device *clockevents_tick_device(void) {
+    return tick_device;
+}
+
+struct clock_event_device *clockevents_oneshot_device(void) {
+    return oneshot_device;
+}
+
+/**
+ * Initialize timekeeping
+ * Starts on jiffies, then upgrades to the TSC once it is calibrated
+ */
+void timekeeping_init(void) {
+    memset(&tk, 0, sizeof(tk));
+
+    clocksource_register(&clocksource_jiffies);
+    tsc_init();
+
+    hrtimers_init();
+    init_timers();
+}
@@ -0,0 +1,338 @@
+#include "timer.h"
+#include "kernel.h"
+#include "clocksource.h"
+#include "sched_isolation.h"
+#include "printk.h"
+#include "softirq.h"
+
+/**
+ * Cascading Timer Wheel
+ * Timers are hashed by expiry into one of five wheels; only the root
+ * wheel is scanned per tick and the outer wheels cascade down one slot
+ * each time the wheel below wraps
+ */
+
+#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
+
+static struct tvec_base timer_bases[CPU_COUNT];
+
+static inline struct tvec_base *this_cpu_base(void) {
+    return &timer_bases[smp_processor_id()];
+}
+
+static void run_timer_softirq(struct softirq_action *h);
+
+/**
+ * Wheel for a newly armed timer; isolated CPUs hand theirs to
+ * housekeeping. A CPU without a running tick never expires its wheel,
+ * so its timers go to the boot CPU, which always ticks
+ */
+static inline struct tvec_base *timer_target_base(void) {
+    unsigned int cpu = housekeeping_any_cpu();
+
+    if (!tick_cpu_running(cpu)) {
+        cpu = 0;
+    }
+    return &timer_bases[cpu];
+}
+
+/**
+ * Move every entry of one list onto an empty list head
+ */
+static void timer_list_splice(struct list_head *from, struct list_head *to) {
+    if (list_empty(from)) {
+        INIT_LIST_HEAD(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    INIT_LIST_HEAD(from);
+}
+
+/**
+ * Hash a timer into the slot matching its distance from timer_jiffies
+ */
+static void internal_add_timer(struct tvec_base *base, struct timer_list *timer) {
+    uint32_t expires = timer->expires;
+    uint32_t idx = expires - base->timer_jiffies;
+    struct list_head *vec;
+
+    if (idx < TVR_SIZE) {
+        vec = base->tv1 + (expires & TVR_MASK);
+    } else if (idx < 1U << (TVR_BITS + TVN_BITS)) {
+        vec = base->tv2 + ((expires >> TVR_BITS) & TVN_MASK);
+    } else if (idx < 1U << (TVR_BITS + 2 * TVN_BITS)) {
+        vec = base->tv3 + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+    } else if (idx < 1U << (TVR_BITS + 3 * TVN_BITS)) {
+        vec = base->tv4 + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+    } else if ((int32_t)idx < 0) {
+        // Already expired: run on the next tick processed
+        vec = base->tv1 + (base->timer_jiffies & TVR_MASK);
+    } else {
+        vec = base->tv5 + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+    }
+
+    list_add_tail(&timer->entry, vec);
+}
+
+static inline void detach_timer(struct tvec_base *base, struct timer_list *timer) {
+    list_del_init(&timer->entry);
+    base->nr_active--;
+}
+
+/**
+ * Re-hash one slot of an outer wheel into the wheels below it
+ * Returns the slot index so the caller knows when this wheel wrapped
+ */
+static int cascade(struct tvec_base *base, struct list_head *tv, int index) {
+    struct timer_list *timer, *tmp;
+    struct list_head tv_list;
+
+    timer_list_splice(tv + index, &tv_list);
+
+    list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
+        internal_add_timer(base, timer);
+    }
+
+    base->nr_cascades++;
+    return index;
+}
+
+/**
+ * Initialize the per-CPU wheels
+ */
+void init_timers(void) {
+    uint32_t now = timer_get_ticks();
+
+    for (int cpu = 0; cpu < CPU_COUNT; cpu++) {
+        struct tvec_base *base = &timer_bases[cpu];
+        int j;
+
+        spin_lock_init(&base->lock);
+        for (j = 0; j < TVN_SIZE; j++) {
+            INIT_LIST_HEAD(base->tv5 + j);
+            INIT_LIST_HEAD(base->tv4 + j);
+            INIT_LIST_HEAD(base->tv3 + j);
+            INIT_LIST_HEAD(base->tv2 + j);
+        }
+        for (j = 0; j < TVR_SIZE; j++) {
+            INIT_LIST_HEAD(base->tv1 + j);
+        }
+
+        base->running_timer = NULL;
+        base->timer_jiffies = now;
+        base->nr_active = 0;
+        base->nr_expired = 0;
+        base->nr_cascades = 0;
+    }
+
+    open_softirq(TIMER_SOFTIRQ, run_timer_softirq);
+
+    pr_info("timer: %d per-CPU timer wheels initialized\n", CPU_COUNT);
+}
+
+/**
+ * Initialize a timer before first use
+ */
+void init_timer(struct timer_list *timer) {
+    INIT_LIST_HEAD(&timer->entry);
+    timer->base = NULL;
+}
+
+void setup_timer(struct timer_list *timer, void (*function)(unsigned long),
+                 unsigned long data) {
+    init_timer(timer);
+    timer->function = function;
+    timer->data = data;
+}
+
+/**
+ * Modify a timer's expiry, arming it if it was inactive
+ * Returns 1 if the timer was pending, 0 otherwise
+ */
+int mod_timer(struct timer_list *timer, uint32_t expires) {
+    struct tvec_base *base = timer->base ? timer->base : timer_target_base();
+    unsigned long flags;
+    int ret;
+
+    // Re-arming with the same expiry is common for network timeouts
+    if (timer_pending(timer) && timer->expires == expires) {
+        return 1;
+    }
+
+    spin_lock_irqsave(&base->lock, flags);
+
+    ret = timer_pending(timer);
+    if (ret) {
+        detach_timer(base, timer);
+    }
+
+    timer->expires = expires;
+    timer->base = base;
+    internal_add_timer(base, timer);
+    base->nr_active++;
+
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    return ret;
+}
+
+/**
+ * Arm an inactive timer at timer->expires
+ */
+void add_timer(struct timer_list *timer) {
+    mod_timer(timer, timer->expires);
+}
+
+/**
+ * Deactivate a timer
+ * Returns 1 if it was pending, 0 otherwise
+ */
+int del_timer(struct timer_list *timer) {
+    struct tvec_base *base = timer->base;
+    unsigned long flags;
+    int ret = 0;
+
+    if (!base) return 0;
+
+    spin_lock_irqsave(&base->lock, flags);
+    if (timer_pending(timer)) {
+        detach_timer(base, timer);
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    return ret;
+}
+
+/**
+ * Deactivate a timer and wait for a running callback to finish
+ * Must not be called from the timer's own callback
+ */
+int del_timer_sync(struct timer_list *timer) {
+    struct tvec_base *base = timer->base;
+    int ret;
+
+    if (!base) return 0;
+
+    for (;;) {
+        ret = del_timer(timer);
+        if (base->running_timer != timer) {
+            return ret;
+        }
+        __asm__ volatile("pause");
+    }
+}
+
+/**
+ * Expire every timer due up to the current tick
+ */
+static void __run_timers(struct tvec_base *base) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&base->lock, flags);
+
+    while (time_after_eq(timer_get_ticks(), base->timer_jiffies)) {
+        struct list_head work_list;
+        int index = base->timer_jiffies & TVR_MASK;
+
+        // Root wheel wrapped: pull the next slot of each outer wheel down
+        if (!index &&
+            !cascade(base, base->tv2, INDEX(0)) &&
+            !cascade(base, base->tv3, INDEX(1)) &&
+            !cascade(base, base->tv4, INDEX(2))) {
+            cascade(base, base->tv5, INDEX(3));
+        }
+
+        base->timer_jiffies++;
+
+        // Callbacks may re-arm into this same slot, so drain a private list
+        timer_list_splice(base->tv1 + index, &work_list);
+
+        while (!list_empty(&work_list)) {
+            struct timer_list *timer;
+            void (*fn)(unsigned long);
+            unsigned long data;
+
+            timer = list_first_entry(&work_list, struct timer_list, entry);
+            fn = timer->function;
+            data = timer->data;
+
+            detach_timer(base, timer);
+            base->running_timer = timer;
+            base->nr_expired++;
+
+            spin_unlock_irqrestore(&base->lock, flags);
+            fn(data);
+            spin_lock_irqsave(&base->lock, flags);
+        }
+    }
+
+    base->running_timer = NULL;
+
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/**
+ * Tick hook: defer expiry to TIMER_SOFTIRQ
+ */
+void run_local_timers(void) {
+    struct tvec_base *base = this_cpu_base();
+
+    if (time_after_eq(timer_get_ticks(), base->timer_jiffies)) {
+        raise_softirq(TIMER_SOFTIRQ);
+    }
+}
+
+/**
+ * TIMER_SOFTIRQ action
+ * Callbacks run with interrupts enabled; nested ticks only re-raise the
+ * softirq and are picked up by the loop already in progress
+ */
+static void run_timer_softirq(struct softirq_action *h) {
+    __run_timers(this_cpu_base());
+}
+
+static void process_timeout(unsigned long data) {
+    wake_up_process((process_t*)data);
+}
+
+/**
+ * Sleep until woken or timeout ticks elapse
+ * The caller sets the blocked state first, as with wait queues
+ * Returns the ticks left, 0 if the timeout expired
+ */
+long schedule_timeout(long timeout) {
+    struct timer_list timer;
+    uint32_t expire;
+
+    if (timeout == MAX_SCHEDULE_TIMEOUT) {
+        process_sleep();
+        return timeout;
+    }
+
+    if (timeout <= 0) {
+        current_process->pcb.state = PROCESS_RUNNING;
+        return 0;
+    }
+
+    expire = timer_get_ticks() + timeout;
+
+    setup_timer(&timer, process_timeout, (unsigned long)current_process);
+    mod_timer(&timer, expire);
+    current_process->sleep_timer = &timer;
+    process_sleep();
+    current_process->sleep_timer = NULL;
+    del_timer_sync(&timer);
+
+    timeout = (long)(expire - timer_get_ticks());
+    return timeout < 0 ? 0 : timeout;
+}
+
+long schedule_timeout_uninterruptible(long timeout) {
+    current_process->pcb.state = PROCESS_BLOCKED;
+    return schedule_timeout(timeout);
+}
@@ -0,0 +1,265 @@
+#include "trace_irqsoff.h"
+#include "kernel.h"
+#include "ktime.h"
+#include "clocksource.h"
+#include "screen.h"
+
+/**
+ * Critical Section Latency Tracer
+ * Each CPU has at most one open window of each type; nested disables
+ * and nested locks keep the outermost start. When a window closes its
+ * length is compared against the shortest entry of the worst-windows
+ * table, so only new worst cases pay for the stack walk and the table
+ * lock. The hooks run from inside local_irq_*() and spin_lock(), so
+ * this file must not use either: it uses the untraced arch_ helpers
+ * and a bare test-and-set lock.
+ */
+
+struct latency_window {
+    uint64_t start;             // TSC when it opened, 0 while closed
+    uint32_t start_ip;
+};
+
+struct latency_cpu {
+    struct latency_window irqsoff;
+    struct latency_window preemptoff;
+};
+
+static DEFINE_PER_CPU(struct latency_cpu, latency_cpu);
+
+volatile unsigned int latency_tracers;
+
+// Worst windows, longest first
+static struct latency_entry latency_table[LATENCY_MAX_ENTRIES];
+static unsigned int nr_latency_entries;
+static uint64_t latency_threshold;     // Shortest entry once the table is full
+static volatile uint32_t latency_table_lock;
+
+static inline void latency_table_acquire(void) {
+    while (__sync_lock_test_and_set(&latency_table_lock, 1)) {
+        cpu_relax();
+    }
+}
+
+static inline void latency_table_release(void) {
+    __sync_lock_release(&latency_table_lock);
+}
+
+/**
+ * Enter a window in the table
+ * Windows between the same two sites share one entry, so a single hot
+ * path cannot push everything else out
+ */
+static __attribute__((noinline)) void latency_record(unsigned int type, uint32_t start_ip,
+                                                     uint32_t end_ip, uint64_t cycles) {
+    struct latency_entry e, tmp;
+    unsigned long flags;
+    unsigned int i;
+
+    e.type = type;
+    e.start_ip = start_ip;
+    e.end_ip = end_ip;
+    e.cycles = cycles;
+    e.stamp = rdtsc();
+    e.cpu = smp_processor_id();
+    // Skip ourselves, stop_critical_timing() and the tracer_*() hook
+    e.nr_frames = debug_save_stack(e.stack, LATENCY_STACK_DEPTH, 3);
+
+    flags = arch_local_irq_save();
+    latency_table_acquire();
+
+    for (i = 0; i < nr_latency_entries; i++) {
+        struct latency_entry *old = &latency_table[i];
+
+        if (old->type == type && old->start_ip == start_ip && old->end_ip == end_ip) {
+            break;
+        }
+    }
+
+    if (i == nr_latency_entries) {
+        if (nr_latency_entries < LATENCY_MAX_ENTRIES) {
+            nr_latency_entries++;
+        } else {
+            i = LATENCY_MAX_ENTRIES - 1;    // Evict the shortest
+        }
+    } else if (cycles <= latency_table[i].cycles) {
+        goto out;
+    }
+
+    latency_table[i] = e;
+    while (i > 0 && latency_table[i].cycles > latency_table[i - 1].cycles) {
+        tmp = latency_table[i - 1];
+        latency_table[i - 1] = latency_table[i];
+        latency_table[i] = tmp;
+        i--;
+    }
+
+    if (nr_latency_entries == LATENCY_MAX_ENTRIES) {
+        latency_threshold = latency_table[LATENCY_MAX_ENTRIES - 1].cycles;
+    }
+
+out:
+    latency_table_release();
+    arch_local_irq_restore(flags);
+}
+
+static inline void start_critical_timing(struct latency_window *w, uint32_t ip) {
+    if (w->start) {
+        return;
+    }
+    w->start_ip = ip;
+    w->start = rdtsc();
+}
+
+static __attribute__((noinline)) void stop_critical_timing(unsigned int type,
+                                                           struct latency_window *w,
+                                                           uint32_t ip) {
+    uint64_t delta;
+
+    if (!w->start) {
+        return;
+    }
+
+    delta = rdtsc() - w->start;
+    if (delta > latency_threshold) {
+        latency_record(type, w->start_ip, ip, delta);
+    }
+    w->start = 0;
+}
+
+void tracer_hardirqs_off(void) {
+    start_critical_timing(&this_cpu_ptr(&latency_cpu)->irqsoff,
+                          (uint32_t)__builtin_return_address(0));
+}
+
+void tracer_hardirqs_on(void) {
+    stop_critical_timing(TRACE_IRQSOFF, &this_cpu_ptr(&latency_cpu)->irqsoff,
+                         (uint32_t)__builtin_return_address(0));
+}
+
+/**
+ * Interrupts were on when this one arrived, so a window still open was
+ * ended by an untraced sti or popf; drop it rather than report it
+ */
+void tracer_irq_enter(void) {
+    struct latency_cpu *lc = this_cpu_ptr(&latency_cpu);
+
+    lc->irqsoff.start = 0;
+    start_critical_timing(&lc->irqsoff, (uint32_t)__builtin_return_address(0));
+}
+
+/**
+ * Called with the preempt count already raised and not yet dropped, so
+ * a count of one is the outermost section. Hooks may run with
+ * interrupts on, and an interrupt handler can take locks of its own, so
+ * the window is updated with them off
+ */
+void tracer_preempt_off(void) {
+    unsigned long flags = arch_local_irq_save();
+    struct latency_cpu *lc = this_cpu_ptr(&latency_cpu);
+
+    if (preempt_count() == 1) {
+        start_critical_timing(&lc->preemptoff, (uint32_t)__builtin_return_address(0));
+    }
+    arch_local_irq_restore(flags);
+}
+
+void tracer_preempt_on(void) {
+    unsigned long flags = arch_local_irq_save();
+    struct latency_cpu *lc = this_cpu_ptr(&latency_cpu);
+
+    // A section opened before the tracer started has no window
+    if (preempt_count() == 1) {
+        stop_critical_timing(TRACE_PREEMPTOFF, &lc->preemptoff,
+                             (uint32_t)__builtin_return_address(0));
+    }
+    arch_local_irq_restore(flags);
+}
+
+int latency_trace_start(unsigned int tracers) {
+    unsigned int cpu;
+
+    if (!tsc_khz) {
+        return -ENODEV;
+    }
+
+    // Windows and lock depths from an earlier run mean nothing now
+    latency_tracers = 0;
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(&latency_cpu, cpu), 0, sizeof(struct latency_cpu));
+    }
+    latency_trace_reset();
+
+    latency_tracers = tracers & (TRACE_IRQSOFF | TRACE_PREEMPTOFF);
+    return 0;
+}
+
+void latency_trace_stop(void) {
+    latency_tracers = 0;
+}
+
+void latency_trace_reset(void) {
+    unsigned long flags = arch_local_irq_save();
+
+    latency_table_acquire();
+    nr_latency_entries = 0;
+    latency_threshold = 0;
+    latency_table_release();
+    arch_local_irq_restore(flags);
+}
+
+static void print_cycles_us(uint64_t cycles) {
+    screen_print_dec((uint32_t)div_u64(tsc_delta_to_ns(cycles), NSEC_PER_USEC));
+    screen_print("us");
+}
+
+/**
+ * Print the worst windows, longest first, each with the stack where it
+ * closed; the first frame is the caller of local_irq_*() or spin_unlock()
+ */
+void latency_trace_show(void) {
+    struct latency_entry snap[LATENCY_MAX_ENTRIES];
+    unsigned int tracers = latency_tracers;
+    unsigned long flags;
+    unsigned int n;
+
+    // Copy first: printing takes locks, which would call back in here
+    flags = arch_local_irq_save();
+    latency_table_acquire();
+    n = nr_latency_entries;
+    for (unsigned int i = 0; i < n; i++) {
+        snap[i] = latency_table[i];
+    }
+    latency_table_release();
+    arch_local_irq_restore(flags);
+
+    screen_print("tracers:");
+    if (tracers & TRACE_IRQSOFF) screen_print(" irqsoff");
+    if (tracers & TRACE_PREEMPTOFF) screen_print(" preemptoff");
+    if (!tracers) screen_print(" none");
+    screen_print("\n");
+
+    for (unsigned int i = 0; i < n; i++) {
+        struct latency_entry *e = &snap[i];
+
+        screen_print(e->type == TRACE_IRQSOFF ? "irqsoff     " : "preemptoff  ");
+        print_cycles_us(e->cycles);
+        screen_print("  cpu ");
+        screen_print_dec(e->cpu);
+        screen_print("  at ");
+        screen_print_dec((uint32_t)div_u64(tsc_cycles_to_ns(e->stamp), NSEC_PER_MSEC));
+        screen_print("ms  0x");
+        screen_print_hex(e->start_ip);
+        screen_print(" -> 0x");
+        screen_print_hex(e->end_ip);
+        screen_print("\n");
+
+        for (unsigned int f = 0; f < e->nr_frames; f++) {
+            screen_print("    [");
+            screen_print_dec(f);
+            screen_print("] 0x");
+            screen_print_hex(e->stack[f]);
+            screen_print("\n");
+        }
+    }
+}
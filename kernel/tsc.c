@@ -0,0 +1,152 @@
+#include "clocksource.h"
+#include "interrupts.h"
+#include "kernel.h"
+#include "printk.h"
+
+/**
+ * Time Stamp Counter Support
+ * Detects the TSC, calibrates its frequency against PIT channel 2 and
+ * registers it as the preferred clocksource
+ */
+
+// Calibration window and number of attempts
+#define TSC_CALIBRATE_MS    10
+#define TSC_CALIBRATE_RUNS  3
+
+// PIT channel 2 / speaker gate port
+#define PIT_CH2_PORT        0x42
+#define PIT_CMD_PORT        0x43
+#define PIT_GATE_PORT       0x61
+#define PIT_GATE_OUT2       0x20
+
+// Port reads per calibration run: a read costs about 1us on real
+// hardware, so fewer than the minimum means OUT2 was already high and
+// more than the maximum means channel 2 is not counting at all
+#define PIT_CALIBRATE_MIN_LOOPS     (TSC_CALIBRATE_MS * 100)
+#define PIT_CALIBRATE_MAX_LOOPS     (TSC_CALIBRATE_MS * 100000)
+
+// CPUID feature bit
+#define X86_FEATURE_TSC     (1 << 4)
+
+// Calibrated TSC frequency; zero while the TSC is unusable
+uint32_t tsc_khz;
+
+// Cycle to ns conversion for sched_clock()
+static uint32_t cyc2ns_mult;
+static uint32_t cyc2ns_shift;
+static uint64_t cyc2ns_offset;   // TSC value at calibration, so time starts near 0
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid"
+                     : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                     : "a" (leaf), "c" (0));
+}
+
+static bool cpu_has_tsc(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & X86_FEATURE_TSC) != 0;
+}
+
+/**
+ * Count TSC cycles across one PIT channel 2 countdown
+ * Channel 2 is gated through port 0x61 and never raises an interrupt,
+ * so this works before interrupts are enabled. Returns ~0 if OUT2 did
+ * not go high within a sane number of reads
+ */
+static uint64_t pit_calibrate_tsc(void) {
+    uint32_t latch = PIT_TICK_RATE / (MSEC_PER_SEC / TSC_CALIBRATE_MS);
+    uint32_t loops = 0;
+    uint64_t t1, t2;
+
+    // Gate high, speaker off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count), binary
+    outb(PIT_CMD_PORT, 0xB0);
+    outb(PIT_CH2_PORT, latch & 0xFF);
+    outb(PIT_CH2_PORT, (latch >> 8) & 0xFF);
+
+    t1 = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_GATE_OUT2)) {
+        // Wait for OUT2 to go high at terminal count
+        if (++loops == PIT_CALIBRATE_MAX_LOOPS) {
+            return ~0ULL;
+        }
+    }
+    t2 = rdtsc();
+
+    if (loops < PIT_CALIBRATE_MIN_LOOPS) {
+        return ~0ULL;
+    }
+
+    return t2 - t1;
+}
+
+static uint64_t tsc_read(struct clocksource *cs) {
+    return rdtsc();
+}
+
+static struct clocksource clocksource_tsc = {
+    .name = "tsc",
+    .read = tsc_read,
+    .mask = CLOCKSOURCE_MASK(64),
+    .rating = CLOCKSOURCE_RATING_TSC,
+    .flags = CLOCK_SOURCE_IS_CONTINUOUS,
+    .vdso_clock_mode = VDSO_CLOCKMODE_TSC,
+};
+
+/**
+ * Convert a raw TSC reading to ns since calibration
+ */
+uint64_t tsc_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles - cyc2ns_offset, cyc2ns_mult, cyc2ns_shift);
+}
+
+/**
+ * Convert a difference of two TSC readings to ns
+ */
+uint64_t tsc_delta_to_ns(uint64_t delta) {
+    return mul_u64_u32_shr(delta, cyc2ns_mult, cyc2ns_shift);
+}
+
+/**
+ * Detect, calibrate and register the TSC
+ */
+bool tsc_init(void) {
+    uint64_t best = ~0ULL;
+    uint32_t khz;
+
+    if (!cpu_has_tsc()) {
+        pr_info("tsc: not present, staying on jiffies\n");
+        return false;
+    }
+
+    // Keep the shortest run; SMIs and emulation hiccups only ever add cycles
+    for (int i = 0; i < TSC_CALIBRATE_RUNS; i++) {
+        uint64_t cycles = pit_calibrate_tsc();
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+
+    if (!best || best == ~0ULL) {
+        pr_warn("tsc: PIT calibration failed, staying on jiffies\n");
+        return false;
+    }
+
+    khz = (uint32_t)div_u64(best, TSC_CALIBRATE_MS);
+    clocksource_calc_mult_shift(&clocksource_tsc, khz, 600);
+
+    cyc2ns_mult = clocksource_tsc.mult;
+    cyc2ns_shift = clocksource_tsc.shift;
+    cyc2ns_offset = rdtsc();
+    tsc_khz = khz;
+
+    pr_info("tsc: detected %u.%03u MHz processor\n", tsc_khz / 1000, tsc_khz % 1000);
+
+    clocksource_register(&clocksource_tsc);
+    return true;
+}
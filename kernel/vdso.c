@@ -0,0 +1,98 @@
+#include "vdso.h"
+#include "kernel.h"
+#include "mm.h"
+#include "timer.h"
+#include "printk.h"
+
+/**
+ * vDSO Pages
+ * Both pages live in the kernel image and are aliased into user space,
+ * each alone in its page so nothing else is exposed. The code page is a
+ * copy of the .vdso.text section: those functions run in user mode at
+ * another address, so they may only touch the data page by its fixed
+ * address and must not call into the kernel or be instrumented.
+ */
+
+#define __vdso  __attribute__((section(".vdso.text"), used, noinline,       \
+                               no_instrument_function,                      \
+                               no_profile_instrument_function,              \
+                               no_sanitize_address, no_sanitize("undefined")))
+
+static union {
+    struct vdso_data data;
+    uint8_t page[PAGE_SIZE];
+} vdso_data_page __attribute__((aligned(PAGE_SIZE)));
+
+static uint8_t vdso_text_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+// Bounds of .vdso.text (linker.ld)
+extern uint8_t __vdso_text_start[];
+extern uint8_t __vdso_text_end[];
+
+static struct vdso_data *const vdso = &vdso_data_page.data;
+
+__vdso uint64_t __vdso_monotonic_ns(void) {
+    const volatile struct vdso_data *vd = (const volatile struct vdso_data *)VDSO_DATA_ADDR;
+    uint32_t seq, lo, hi;
+    uint64_t ns, delta;
+
+    do {
+        while ((seq = vd->seq.sequence) & 1) {
+            __asm__ volatile("pause" ::: "memory");
+        }
+        __asm__ volatile("" ::: "memory");
+
+        ns = vd->base_ns;
+        if (vd->clock_mode == VDSO_CLOCKMODE_TSC) {
+            __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+            delta = (((uint64_t)hi << 32) | lo) - vd->cycle_last;
+            ns += (delta * vd->mult + vd->frac) >> vd->shift;
+        }
+
+        __asm__ volatile("" ::: "memory");
+    } while (vd->seq.sequence != seq);
+
+    return ns;
+}
+
+__vdso uint32_t __vdso_ticks(void) {
+    return ((const volatile struct vdso_data *)VDSO_DATA_ADDR)->tick;
+}
+
+static uint32_t vdso_entry(void *fn) {
+    return VDSO_TEXT_ADDR + ((uint8_t *)fn - __vdso_text_start);
+}
+
+void vdso_init(void) {
+    uint32_t len = __vdso_text_end - __vdso_text_start;
+
+    if (len > PAGE_SIZE) {
+        panic("vdso: .vdso.text does not fit in a page");
+    }
+
+    memcpy(vdso_text_page, __vdso_text_start, len);
+    vdso->hz = TIMER_FREQUENCY;
+    vdso->entry[VDSO_ENTRY_MONOTONIC_NS] = vdso_entry(__vdso_monotonic_ns);
+    vdso->entry[VDSO_ENTRY_TICKS] = vdso_entry(__vdso_ticks);
+
+    map_user_page(VDSO_DATA_ADDR, (uint32_t)&vdso_data_page, false);
+    map_user_page(VDSO_TEXT_ADDR, (uint32_t)vdso_text_page, false);
+
+    pr_info("vdso: data at 0x%x, %u bytes of code at 0x%x\n",
+            VDSO_DATA_ADDR, len, VDSO_TEXT_ADDR);
+}
+
+void update_vsyscall(const struct clocksource *cs, uint64_t cycle_last,
+                     uint64_t base_ns, uint64_t frac) {
+    struct vdso_data *vd = vdso;
+
+    write_seqcount_begin(&vd->seq);
+    vd->clock_mode = cs->vdso_clock_mode;
+    vd->cycle_last = cycle_last;
+    vd->base_ns = base_ns;
+    vd->frac = frac;
+    vd->mult = cs->mult;
+    vd->shift = cs->shift;
+    vd->tick = timer_get_ticks();
+    write_seqcount_end(&vd->seq);
+}
@@ -0,0 +1,151 @@
+#include "wait.h"
+#include "kernel.h"
+
+/**
+ * Wait Queue Implementation
+ * Non-exclusive waiters sit at the head and are all woken; exclusive
+ * waiters sit at the tail and are woken nr_exclusive at a time
+ */
+
+/**
+ * Initialize a wait queue head
+ */
+void init_waitqueue_head(wait_queue_head_t *wq_head) {
+    spin_lock_init(&wq_head->lock);
+    INIT_LIST_HEAD(&wq_head->head);
+}
+
+/**
+ * Initialize an entry that wakes p and stays queued
+ */
+void init_waitqueue_entry(wait_queue_entry_t *wq_entry, process_t *p) {
+    wq_entry->flags = 0;
+    wq_entry->private = p;
+    wq_entry->func = default_wake_function;
+    INIT_LIST_HEAD(&wq_entry->entry);
+}
+
+void add_wait_queue(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    wq_entry->flags &= ~WQ_FLAG_EXCLUSIVE;
+    spin_lock_irqsave(&wq_head->lock, flags);
+    list_add(&wq_entry->entry, &wq_head->head);
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
+
+void add_wait_queue_exclusive(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    wq_entry->flags |= WQ_FLAG_EXCLUSIVE;
+    spin_lock_irqsave(&wq_head->lock, flags);
+    list_add_tail(&wq_entry->entry, &wq_head->head);
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
+
+void remove_wait_queue(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&wq_head->lock, flags);
+    list_del_init(&wq_entry->entry);
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
+
+/**
+ * Queue the current process (if not already queued) and mark it blocked
+ * Marking under the queue lock means a concurrent wake-up either sees the
+ * entry or happens before the caller re-checks its condition
+ */
+void prepare_to_wait(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    wq_entry->flags &= ~WQ_FLAG_EXCLUSIVE;
+    spin_lock_irqsave(&wq_head->lock, flags);
+    if (list_empty(&wq_entry->entry)) {
+        list_add(&wq_entry->entry, &wq_head->head);
+    }
+    current_process->wait_head = wq_head;
+    current_process->wait_entry = wq_entry;
+    current_process->pcb.state = PROCESS_BLOCKED;
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
+
+void prepare_to_wait_exclusive(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    wq_entry->flags |= WQ_FLAG_EXCLUSIVE;
+    spin_lock_irqsave(&wq_head->lock, flags);
+    if (list_empty(&wq_entry->entry)) {
+        list_add_tail(&wq_entry->entry, &wq_head->head);
+    }
+    current_process->wait_head = wq_head;
+    current_process->wait_entry = wq_entry;
+    current_process->pcb.state = PROCESS_BLOCKED;
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
+
+/**
+ * Mark the current process running and dequeue the entry if still queued
+ */
+void finish_wait(wait_queue_head_t *wq_head, wait_queue_entry_t *wq_entry) {
+    unsigned long flags;
+
+    current_process->pcb.state = PROCESS_RUNNING;
+    current_process->wait_head = NULL;
+
+    if (!list_empty(&wq_entry->entry)) {
+        spin_lock_irqsave(&wq_head->lock, flags);
+        list_del_init(&wq_entry->entry);
+        spin_unlock_irqrestore(&wq_head->lock, flags);
+    }
+}
+
+/**
+ * Dequeue a killed process that went to sleep in prepare_to_wait()
+ * The entry lives on its stack, which is about to be freed
+ */
+void remove_wait_queue_task(process_t *p) {
+    if (p->wait_head) {
+        remove_wait_queue(p->wait_head, p->wait_entry);
+        p->wait_head = NULL;
+    }
+}
+
+int default_wake_function(wait_queue_entry_t *wq_entry, void *key) {
+    return wake_up_process(wq_entry->private);
+}
+
+/**
+ * Wake and dequeue, so the waiter does not receive a second wake-up
+ * before it gets to run
+ */
+int autoremove_wake_function(wait_queue_entry_t *wq_entry, void *key) {
+    int ret = default_wake_function(wq_entry, key);
+
+    if (ret) {
+        list_del_init(&wq_entry->entry);
+    }
+    return ret;
+}
+
+/**
+ * Wake all non-exclusive waiters and up to nr_exclusive exclusive ones
+ * nr_exclusive == 0 wakes everybody
+ */
+void __wake_up(wait_queue_head_t *wq_head, int nr_exclusive, void *key) {
+    wait_queue_entry_t *curr, *next;
+    unsigned long flags;
+
+    spin_lock_irqsave(&wq_head->lock, flags);
+
+    list_for_each_entry_safe(curr, next, &wq_head->head, entry) {
+        unsigned int wq_flags = curr->flags;
+
+        if (curr->func(curr, key) && (wq_flags & WQ_FLAG_EXCLUSIVE) &&
+            !--nr_exclusive) {
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&wq_head->lock, flags);
+}
@@ -0,0 +1,889 @@
+#include "workqueue.h"
+#include "kernel.h"
+#include "kthread.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "mm.h"
+#include "printk.h"
+#include "screen.h"
+
+/**
+ * Concurrency-Managed Worker Pools
+ * Each pool's lock covers its worklist, its workers' state and the
+ * counters and delayed lists of every pool_workqueue feeding it. Work
+ * items are queued from interrupts and timers, so it is always taken
+ * with interrupts off. A bound pool counts its workers that are busy and
+ * not blocked in nr_running; new work wakes an idle worker only when
+ * that count is zero. The worker that takes the last idle slot first
+ * creates a replacement, so a spare is always ready to take over from
+ * one that blocks.
+ */
+
+#define MAX_WORKERS_PER_POOL    16
+#define MAX_IDLE_WORKERS_RATIO  4                       // 1/4 of busy can be idle
+#define IDLE_WORKER_TIMEOUT     (300 * TIMER_FREQUENCY) // Keep idle workers 5 minutes
+
+// Worker flags
+#define WORKER_DIE          0x01    // Reaped, exit on wake-up
+#define WORKER_IDLE         0x02    // On the pool's idle list
+#define WORKER_RUNNING      0x04    // Counted in nr_running
+#define WORKER_SLEEPING     0x08    // Blocked while counted
+#define WORKER_UNBOUND      0x10    // Never counted in nr_running
+
+struct worker_pool {
+    spinlock_t lock;
+    int cpu;                        // Bound CPU, -1 for the unbound pool
+    struct list_head worklist;      // Work ready to run
+    struct list_head workers;       // Every worker
+    struct list_head idle_list;     // Idle workers, most recent first
+    int nr_workers;
+    int nr_idle;
+    int nr_running;                 // Busy workers not blocked
+    int next_id;                    // For kworker names
+    bool manager_active;            // A worker is creating another
+    struct timer_list idle_timer;   // Reaps surplus idle workers
+
+    // Statistics
+    unsigned int nr_processed;
+    unsigned int nr_created;
+    unsigned int nr_reaped;
+};
+
+struct worker {
+    struct list_head node;          // pool->workers
+    struct list_head idle_entry;    // pool->idle_list
+    struct list_head scheduled;     // Work handed over on collision
+    process_t *task;
+    struct worker_pool *pool;
+    unsigned int flags;             // WORKER_*
+    uint32_t last_active;           // Tick it last went idle
+    struct work_struct *current_work;
+    work_func_t current_func;
+    struct pool_workqueue *current_pwq;
+};
+
+/**
+ * Link between a workqueue and the pool running its items
+ */
+struct pool_workqueue {
+    struct worker_pool *pool;
+    struct workqueue_struct *wq;
+    int nr_in_flight;               // Queued, delayed or running
+    int nr_active;                  // Queued on the pool or running
+    int max_active;
+    struct list_head delayed_works; // Over max_active, in queue order
+};
+
+struct workqueue_struct {
+    char name[24];
+    unsigned int flags;
+    struct pool_workqueue *pwqs[NR_CPUS];   // All the same one if unbound
+    struct list_head list;
+};
+
+static struct worker_pool cpu_worker_pools[NR_CPUS];
+static struct worker_pool unbound_pool;
+
+static LIST_HEAD(workqueues);
+static DEFINE_SPINLOCK(wq_list_lock);
+
+// Woken whenever an item finishes or is cancelled
+static DECLARE_WAIT_QUEUE_HEAD(work_done_wait);
+
+struct workqueue_struct *system_wq;
+struct workqueue_struct *system_unbound_wq;
+
+static inline bool need_more_worker(struct worker_pool *pool) {
+    return !list_empty(&pool->worklist) && !pool->nr_running;
+}
+
+static inline bool may_start_working(struct worker_pool *pool) {
+    return pool->nr_idle > 0;
+}
+
+// A worker keeps going while it is the only one running
+static inline bool keep_working(struct worker_pool *pool) {
+    return !list_empty(&pool->worklist) && pool->nr_running <= 1;
+}
+
+static inline bool too_many_workers(struct worker_pool *pool) {
+    int nr_idle = pool->nr_idle;
+    int nr_busy = pool->nr_workers - nr_idle;
+
+    return nr_idle > 2 && (nr_idle - 2) * MAX_IDLE_WORKERS_RATIO >= nr_busy;
+}
+
+static void wake_up_worker(struct worker_pool *pool) {
+    struct worker *worker;
+
+    if (list_empty(&pool->idle_list)) {
+        return;
+    }
+
+    worker = list_first_entry(&pool->idle_list, struct worker, idle_entry);
+    wake_up_process(worker->task);
+}
+
+static struct worker *find_worker_executing_work(struct worker_pool *pool,
+                                                 struct work_struct *work) {
+    struct worker *worker;
+
+    list_for_each_entry(worker, &pool->workers, node) {
+        if (worker->current_work == work && worker->current_func == work->func) {
+            return worker;
+        }
+    }
+    return NULL;
+}
+
+static void worker_enter_idle(struct worker *worker) {
+    struct worker_pool *pool = worker->pool;
+
+    worker->flags |= WORKER_IDLE;
+    worker->last_active = timer_get_ticks();
+    pool->nr_idle++;
+    list_add(&worker->idle_entry, &pool->idle_list);
+
+    if (too_many_workers(pool) && !timer_pending(&pool->idle_timer)) {
+        mod_timer(&pool->idle_timer, worker->last_active + IDLE_WORKER_TIMEOUT);
+    }
+}
+
+static void worker_leave_idle(struct worker *worker) {
+    worker->flags &= ~WORKER_IDLE;
+    worker->pool->nr_idle--;
+    list_del_init(&worker->idle_entry);
+}
+
+static void worker_set_running(struct worker *worker) {
+    if (!(worker->flags & WORKER_UNBOUND)) {
+        worker->flags |= WORKER_RUNNING;
+        worker->pool->nr_running++;
+    }
+}
+
+static void worker_clr_running(struct worker *worker) {
+    if (worker->flags & WORKER_RUNNING) {
+        worker->flags &= ~WORKER_RUNNING;
+        worker->pool->nr_running--;
+    }
+}
+
+/**
+ * Drop an item from its pwq's counts and let a held-back one in
+ * Called with the pool lock held
+ */
+static void pwq_dec_nr_in_flight(struct pool_workqueue *pwq, bool was_delayed) {
+    struct worker_pool *pool = pwq->pool;
+
+    pwq->nr_in_flight--;
+    if (!was_delayed) {
+        pwq->nr_active--;
+    }
+
+    if (!list_empty(&pwq->delayed_works) && pwq->nr_active < pwq->max_active) {
+        struct work_struct *work = list_first_entry(&pwq->delayed_works,
+                                                    struct work_struct, entry);
+
+        work->flags &= ~WORK_STRUCT_DELAYED;
+        list_del(&work->entry);
+        list_add_tail(&work->entry, &pool->worklist);
+        pwq->nr_active++;
+        if (need_more_worker(pool)) {
+            wake_up_worker(pool);
+        }
+    }
+
+    if (waitqueue_active(&work_done_wait)) {
+        wake_up_all(&work_done_wait);
+    }
+}
+
+static void worker_thread_exit(struct worker *worker);
+static int worker_thread(void *data);
+
+/**
+ * Start a worker and park it on the idle list; it runs once woken
+ * Process context, pool lock not held
+ */
+static struct worker *create_worker(struct worker_pool *pool) {
+    struct worker *worker;
+    unsigned long flags;
+    char name[16];
+    int id;
+
+    worker = kmalloc(sizeof(*worker));
+    if (!worker) {
+        return NULL;
+    }
+
+    memset(worker, 0, sizeof(*worker));
+    INIT_LIST_HEAD(&worker->node);
+    INIT_LIST_HEAD(&worker->idle_entry);
+    INIT_LIST_HEAD(&worker->scheduled);
+    worker->pool = pool;
+    if (pool->cpu < 0) {
+        worker->flags = WORKER_UNBOUND;
+    }
+
+    spin_lock_irqsave(&pool->lock, flags);
+    id = pool->next_id++;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (pool->cpu >= 0) {
+        snprintf(name, sizeof(name), "kworker/%d:%d", pool->cpu, id);
+    } else {
+        snprintf(name, sizeof(name), "kworker/u:%d", id);
+    }
+
+    worker->task = kthread_create(worker_thread, worker, name);
+    if (!worker->task) {
+        kfree(worker);
+        return NULL;
+    }
+    worker->task->flags |= PF_WQ_WORKER;
+    if (pool->cpu >= 0) {
+        kthread_bind(worker->task, pool->cpu);
+    }
+
+    spin_lock_irqsave(&pool->lock, flags);
+    list_add_tail(&worker->node, &pool->workers);
+    pool->nr_workers++;
+    pool->nr_created++;
+    worker_enter_idle(worker);
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    return worker;
+}
+
+/**
+ * Keep a spare worker around before taking the pool's last idle slot
+ * Called with the pool lock held, which is dropped meanwhile. Returns
+ * true if the lock was dropped and the pool must be rechecked
+ */
+static bool manage_workers(struct worker *worker) {
+    struct worker_pool *pool = worker->pool;
+
+    if (pool->manager_active || pool->nr_workers >= MAX_WORKERS_PER_POOL) {
+        return false;
+    }
+
+    pool->manager_active = true;
+    spin_unlock_irq(&pool->lock);
+
+    if (!create_worker(pool)) {
+        pr_warn("workqueue: cannot create worker for pool %d\n", pool->cpu);
+    }
+
+    spin_lock_irq(&pool->lock);
+    pool->manager_active = false;
+
+    return true;
+}
+
+/**
+ * Run one work item; called and returns with the pool lock held
+ * An item still running on another worker of the pool is handed to that
+ * worker instead, so an item never runs concurrently with itself
+ */
+static void process_one_work(struct worker *worker, struct work_struct *work) {
+    struct worker_pool *pool = worker->pool;
+    struct pool_workqueue *pwq = work->pwq;
+    struct worker *collision;
+
+    collision = find_worker_executing_work(pool, work);
+    if (collision) {
+        list_del(&work->entry);
+        list_add_tail(&work->entry, &collision->scheduled);
+        return;
+    }
+
+    list_del_init(&work->entry);
+    worker->current_work = work;
+    worker->current_func = work->func;
+    worker->current_pwq = pwq;
+
+    // From here on the item may be queued again
+    __sync_fetch_and_and(&work->flags, ~WORK_STRUCT_PENDING);
+
+    spin_unlock_irq(&pool->lock);
+
+    worker->current_func(work);
+
+    spin_lock_irq(&pool->lock);
+
+    worker->current_work = NULL;
+    worker->current_func = NULL;
+    worker->current_pwq = NULL;
+    pool->nr_processed++;
+    pwq_dec_nr_in_flight(pwq, false);
+}
+
+static void process_scheduled_works(struct worker *worker) {
+    while (!list_empty(&worker->scheduled)) {
+        process_one_work(worker, list_first_entry(&worker->scheduled,
+                                                  struct work_struct, entry));
+    }
+}
+
+/**
+ * kworker main loop
+ */
+static int worker_thread(void *data) {
+    struct worker *worker = data;
+    struct worker_pool *pool = worker->pool;
+    bool manage_tried;
+
+    spin_lock_irq(&pool->lock);
+
+    for (;;) {
+        if (worker->flags & WORKER_DIE) {
+            spin_unlock_irq(&pool->lock);
+            worker_thread_exit(worker);
+            return 0;
+        }
+
+        if (worker->flags & WORKER_IDLE) {
+            worker_leave_idle(worker);
+        }
+
+        manage_tried = false;
+        while (need_more_worker(pool)) {
+            if (!may_start_working(pool) && !manage_tried) {
+                manage_tried = true;
+                if (manage_workers(worker)) {
+                    continue;
+                }
+            }
+
+            worker_set_running(worker);
+            do {
+                process_one_work(worker, list_first_entry(&pool->worklist,
+                                                          struct work_struct, entry));
+                process_scheduled_works(worker);
+            } while (keep_working(pool));
+            worker_clr_running(worker);
+            break;
+        }
+
+        worker_enter_idle(worker);
+        current_process->pcb.state = PROCESS_BLOCKED;
+        spin_unlock_irq(&pool->lock);
+        process_sleep();
+        spin_lock_irq(&pool->lock);
+    }
+}
+
+static void worker_thread_exit(struct worker *worker) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&worker->pool->lock, flags);
+    list_del(&worker->node);
+    spin_unlock_irqrestore(&worker->pool->lock, flags);
+
+    current_process->flags &= ~PF_WQ_WORKER;
+    kfree(worker);
+}
+
+/**
+ * Reap workers idle for longer than IDLE_WORKER_TIMEOUT, oldest first,
+ * while the pool has more idle workers than it needs
+ */
+static void idle_worker_timeout(unsigned long data) {
+    struct worker_pool *pool = (struct worker_pool *)data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&pool->lock, flags);
+
+    while (too_many_workers(pool)) {
+        struct worker *worker = list_entry(pool->idle_list.prev, struct worker,
+                                           idle_entry);
+        uint32_t expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+        if (time_before(timer_get_ticks(), expires)) {
+            mod_timer(&pool->idle_timer, expires);
+            break;
+        }
+
+        worker->flags = (worker->flags & ~WORKER_IDLE) | WORKER_DIE;
+        list_del_init(&worker->idle_entry);
+        pool->nr_idle--;
+        pool->nr_workers--;
+        pool->nr_reaped++;
+        wake_up_process(worker->task);
+    }
+
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+void wq_worker_sleeping(process_t *task) {
+    struct worker *worker = task->kthread_data;
+    struct worker_pool *pool = worker->pool;
+    unsigned long flags;
+
+    if (!(worker->flags & WORKER_RUNNING)) {
+        return;
+    }
+
+    spin_lock_irqsave(&pool->lock, flags);
+    worker->flags |= WORKER_SLEEPING;
+    worker_clr_running(worker);
+    if (need_more_worker(pool)) {
+        wake_up_worker(pool);
+    }
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+void wq_worker_waking_up(process_t *task) {
+    struct worker *worker = task->kthread_data;
+    struct worker_pool *pool = worker->pool;
+    unsigned long flags;
+
+    if (!(worker->flags & WORKER_SLEEPING)) {
+        return;
+    }
+
+    spin_lock_irqsave(&pool->lock, flags);
+    worker->flags &= ~WORKER_SLEEPING;
+    worker_set_running(worker);
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/**
+ * Put work on a pwq; the caller owns its PENDING bit
+ * Called with interrupts off
+ */
+static void __queue_work(int cpu, struct workqueue_struct *wq,
+                         struct work_struct *work) {
+    struct pool_workqueue *pwq;
+    struct pool_workqueue *last = work->pwq;
+    struct worker_pool *pool;
+
+    if (cpu == WORK_CPU_UNBOUND) {
+        cpu = smp_processor_id();
+    }
+    pwq = wq->pwqs[cpu];
+
+    // Still running on another pool: queue behind it there so it does
+    // not run concurrently with itself
+    if (last && last->pool != pwq->pool) {
+        struct worker *worker;
+
+        spin_lock(&last->pool->lock);
+        worker = find_worker_executing_work(last->pool, work);
+        if (worker && worker->current_pwq->wq == wq) {
+            pwq = worker->current_pwq;
+        }
+        spin_unlock(&last->pool->lock);
+    }
+
+    pool = pwq->pool;
+    spin_lock(&pool->lock);
+
+    work->pwq = pwq;
+    pwq->nr_in_flight++;
+
+    if (pwq->nr_active < pwq->max_active) {
+        pwq->nr_active++;
+        list_add_tail(&work->entry, &pool->worklist);
+        if (need_more_worker(pool)) {
+            wake_up_worker(pool);
+        }
+    } else {
+        work->flags |= WORK_STRUCT_DELAYED;
+        list_add_tail(&work->entry, &pwq->delayed_works);
+    }
+
+    spin_unlock(&pool->lock);
+}
+
+bool queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work) {
+    unsigned long flags;
+    bool ret = false;
+
+    local_irq_save(flags);
+    if (!(__sync_fetch_and_or(&work->flags, WORK_STRUCT_PENDING) & WORK_STRUCT_PENDING)) {
+        __queue_work(cpu, wq, work);
+        ret = true;
+    }
+    local_irq_restore(flags);
+
+    return ret;
+}
+
+void delayed_work_timer_fn(unsigned long data) {
+    struct delayed_work *dwork = (struct delayed_work *)data;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    __queue_work(dwork->cpu, dwork->wq, &dwork->work);
+    local_irq_restore(flags);
+}
+
+static void __queue_delayed_work(int cpu, struct workqueue_struct *wq,
+                                 struct delayed_work *dwork, uint32_t delay) {
+    if (!delay) {
+        __queue_work(cpu, wq, &dwork->work);
+        return;
+    }
+
+    // The timer runs on this CPU's wheel
+    dwork->wq = wq;
+    dwork->cpu = cpu;
+    mod_timer(&dwork->timer, timer_get_ticks() + delay);
+}
+
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                           struct delayed_work *dwork, uint32_t delay) {
+    struct work_struct *work = &dwork->work;
+    unsigned long flags;
+    bool ret = false;
+
+    local_irq_save(flags);
+    if (!(__sync_fetch_and_or(&work->flags, WORK_STRUCT_PENDING) & WORK_STRUCT_PENDING)) {
+        __queue_delayed_work(cpu, wq, dwork, delay);
+        ret = true;
+    }
+    local_irq_restore(flags);
+
+    return ret;
+}
+
+/**
+ * Take ownership of work's PENDING bit
+ * Returns 1 if it was pending and has been dequeued or its timer
+ * stopped, 0 if it was idle, -EAGAIN if it is between its timer and its
+ * queue and the caller must retry. Called with interrupts off
+ */
+static int try_to_grab_pending(struct work_struct *work, bool is_dwork) {
+    struct pool_workqueue *pwq;
+    int ret = -EAGAIN;
+
+    if (is_dwork && del_timer(&to_delayed_work(work)->timer)) {
+        return 1;
+    }
+
+    if (!(__sync_fetch_and_or(&work->flags, WORK_STRUCT_PENDING) & WORK_STRUCT_PENDING)) {
+        return 0;
+    }
+
+    pwq = work->pwq;
+    if (!pwq) {
+        return -EAGAIN;
+    }
+
+    spin_lock(&pwq->pool->lock);
+    if (work->pwq == pwq && !list_empty(&work->entry)) {
+        bool was_delayed = work->flags & WORK_STRUCT_DELAYED;
+
+        work->flags &= ~WORK_STRUCT_DELAYED;
+        list_del_init(&work->entry);
+        pwq_dec_nr_in_flight(pwq, was_delayed);
+        ret = 1;
+    }
+    spin_unlock(&pwq->pool->lock);
+
+    return ret;
+}
+
+static int grab_pending(struct work_struct *work, bool is_dwork) {
+    unsigned long flags;
+    int ret;
+
+    for (;;) {
+        local_irq_save(flags);
+        ret = try_to_grab_pending(work, is_dwork);
+        local_irq_restore(flags);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+        cpu_relax();
+    }
+}
+
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                         struct delayed_work *dwork, uint32_t delay) {
+    unsigned long flags;
+    int ret;
+
+    for (;;) {
+        local_irq_save(flags);
+        ret = try_to_grab_pending(&dwork->work, true);
+        if (ret != -EAGAIN) {
+            break;
+        }
+        local_irq_restore(flags);
+        cpu_relax();
+    }
+
+    __queue_delayed_work(cpu, wq, dwork, delay);
+    local_irq_restore(flags);
+
+    return ret;
+}
+
+static bool work_running(struct work_struct *work) {
+    struct pool_workqueue *pwq = work->pwq;
+    unsigned long flags;
+    bool running;
+
+    if (!pwq) {
+        return false;
+    }
+
+    spin_lock_irqsave(&pwq->pool->lock, flags);
+    running = find_worker_executing_work(pwq->pool, work) != NULL;
+    spin_unlock_irqrestore(&pwq->pool->lock, flags);
+
+    return running;
+}
+
+bool flush_work(struct work_struct *work) {
+    bool busy = work_pending(work) || work_running(work);
+
+    wait_event(work_done_wait, !work_pending(work) && !work_running(work));
+
+    return busy;
+}
+
+bool flush_delayed_work(struct delayed_work *dwork) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    if (del_timer(&dwork->timer)) {
+        __queue_work(dwork->cpu, dwork->wq, &dwork->work);
+    }
+    local_irq_restore(flags);
+
+    return flush_work(&dwork->work);
+}
+
+static bool __cancel_work(struct work_struct *work, bool is_dwork, bool sync) {
+    int ret = grab_pending(work, is_dwork);
+
+    // PENDING stays set until here, so nobody can queue it meanwhile
+    if (sync) {
+        wait_event(work_done_wait, !work_running(work));
+    }
+    __sync_fetch_and_and(&work->flags, ~WORK_STRUCT_PENDING);
+
+    return ret;
+}
+
+bool cancel_work_sync(struct work_struct *work) {
+    return __cancel_work(work, false, true);
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork) {
+    return __cancel_work(&dwork->work, true, false);
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork) {
+    return __cancel_work(&dwork->work, true, true);
+}
+
+static bool workqueue_idle(struct workqueue_struct *wq) {
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu) {
+        if (wq->pwqs[cpu]->nr_in_flight) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Wait until nothing is queued on or running from wq
+ * Work queued meanwhile is waited for too
+ */
+void flush_workqueue(struct workqueue_struct *wq) {
+    wait_event(work_done_wait, workqueue_idle(wq));
+}
+
+static struct pool_workqueue *alloc_pwq(struct workqueue_struct *wq,
+                                        struct worker_pool *pool, int max_active) {
+    struct pool_workqueue *pwq = kmalloc(sizeof(*pwq));
+
+    if (!pwq) {
+        return NULL;
+    }
+
+    pwq->pool = pool;
+    pwq->wq = wq;
+    pwq->nr_in_flight = 0;
+    pwq->nr_active = 0;
+    pwq->max_active = max_active;
+    INIT_LIST_HEAD(&pwq->delayed_works);
+
+    return pwq;
+}
+
+static void free_pwqs(struct workqueue_struct *wq) {
+    unsigned int cpu;
+
+    if (wq->flags & WQ_UNBOUND) {
+        kfree(wq->pwqs[0]);
+        return;
+    }
+
+    for_each_possible_cpu(cpu) {
+        kfree(wq->pwqs[cpu]);
+    }
+}
+
+struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags,
+                                         int max_active) {
+    struct workqueue_struct *wq;
+    unsigned long irqflags;
+    unsigned int cpu;
+    int i;
+
+    if (max_active <= 0) {
+        max_active = WQ_DFL_ACTIVE;
+    } else if (max_active > WQ_MAX_ACTIVE) {
+        max_active = WQ_MAX_ACTIVE;
+    }
+
+    wq = kmalloc(sizeof(*wq));
+    if (!wq) {
+        return NULL;
+    }
+
+    memset(wq, 0, sizeof(*wq));
+    for (i = 0; name[i] && i < (int)sizeof(wq->name) - 1; i++) {
+        wq->name[i] = name[i];
+    }
+    wq->name[i] = '\0';
+    wq->flags = flags;
+
+    if (flags & WQ_UNBOUND) {
+        struct pool_workqueue *pwq = alloc_pwq(wq, &unbound_pool, max_active);
+
+        if (!pwq) {
+            kfree(wq);
+            return NULL;
+        }
+        for (cpu = 0; cpu < NR_CPUS; cpu++) {
+            wq->pwqs[cpu] = pwq;
+        }
+    } else {
+        for_each_possible_cpu(cpu) {
+            wq->pwqs[cpu] = alloc_pwq(wq, &cpu_worker_pools[cpu], max_active);
+            if (!wq->pwqs[cpu]) {
+                free_pwqs(wq);
+                kfree(wq);
+                return NULL;
+            }
+        }
+    }
+
+    spin_lock_irqsave(&wq_list_lock, irqflags);
+    list_add_tail(&wq->list, &workqueues);
+    spin_unlock_irqrestore(&wq_list_lock, irqflags);
+
+    return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq) {
+    unsigned long flags;
+
+    flush_workqueue(wq);
+
+    spin_lock_irqsave(&wq_list_lock, flags);
+    list_del(&wq->list);
+    spin_unlock_irqrestore(&wq_list_lock, flags);
+
+    free_pwqs(wq);
+    kfree(wq);
+}
+
+static void show_pool(struct worker_pool *pool) {
+    if (pool->cpu >= 0) {
+        screen_print("cpu");
+        screen_print_dec(pool->cpu);
+        screen_print("     ");
+    } else {
+        screen_print("unbound  ");
+    }
+    screen_print_dec(pool->nr_workers);
+    screen_print("        ");
+    screen_print_dec(pool->nr_idle);
+    screen_print("     ");
+    screen_print_dec(pool->nr_running);
+    screen_print("        ");
+    screen_print_dec(pool->nr_processed);
+    screen_print("          ");
+    screen_print_dec(pool->nr_created);
+    screen_print("        ");
+    screen_print_dec(pool->nr_reaped);
+    screen_print("\n");
+}
+
+/**
+ * Print pool sizes and workqueue backlogs
+ */
+void workqueue_show(void) {
+    struct workqueue_struct *wq;
+    unsigned long flags;
+    unsigned int cpu;
+
+    screen_print("Pool     Workers  Idle  Running  Processed  Created  Reaped\n");
+    for_each_possible_cpu(cpu) {
+        show_pool(&cpu_worker_pools[cpu]);
+    }
+    show_pool(&unbound_pool);
+
+    screen_print("\nWorkqueue  In flight\n");
+    spin_lock_irqsave(&wq_list_lock, flags);
+    list_for_each_entry(wq, &workqueues, list) {
+        int in_flight = 0;
+
+        if (wq->flags & WQ_UNBOUND) {
+            in_flight = wq->pwqs[0]->nr_in_flight;
+        } else {
+            for_each_possible_cpu(cpu) {
+                in_flight += wq->pwqs[cpu]->nr_in_flight;
+            }
+        }
+        screen_print(wq->name);
+        screen_print("  ");
+        screen_print_dec(in_flight);
+        screen_print(wq->flags & __WQ_ORDERED ? " (ordered)\n" :
+                     wq->flags & WQ_UNBOUND ? " (unbound)\n" : "\n");
+    }
+    spin_unlock_irqrestore(&wq_list_lock, flags);
+}
+
+static void init_worker_pool(struct worker_pool *pool, int cpu) {
+    spin_lock_init(&pool->lock);
+    pool->cpu = cpu;
+    INIT_LIST_HEAD(&pool->worklist);
+    INIT_LIST_HEAD(&pool->workers);
+    INIT_LIST_HEAD(&pool->idle_list);
+    setup_timer(&pool->idle_timer, idle_worker_timeout, (unsigned long)pool);
+}
+
+/**
+ * Set up the pools with one worker each and the system queues
+ * Needs kernel threads
+ */
+void workqueue_init(void) {
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu) {
+        init_worker_pool(&cpu_worker_pools[cpu], cpu);
+        create_worker(&cpu_worker_pools[cpu]);
+    }
+    init_worker_pool(&unbound_pool, -1);
+    create_worker(&unbound_pool);
+
+    system_wq = alloc_workqueue("events", 0, 0);
+    system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND, WQ_MAX_ACTIVE);
+    if (!system_wq || !system_unbound_wq) {
+        panic("Failed to create system workqueues");
+    }
+
+    pr_info("workqueue: %d per-CPU pools and an unbound pool\n",
+            cpumask_weight(cpu_possible_mask));
+}
@@ -1,7 +1,10 @@
 #include "net.h"
 #include "screen.h"
 #include "mm.h"
+#include "kernel.h"
 #include "timer.h"
+#include "softirq.h"
+#include "printk.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -19,17 +22,67 @@ typedef struct arp_entry {
 
 static arp_entry_t arp_cache[64];
 static int arp_cache_size = 0;
+static struct timer_list arp_gc_timer;
 
 // Sockets
 static socket_t sockets[256];
 static int num_sockets = 0;
 
+// Per-CPU receive state. netif_rx() frames wait in the backlog, which
+// is polled like any driver's NAPI instance
+#define NETDEV_BACKLOG  16      // Frames queued per CPU before dropping
+#define NETDEV_BUDGET   300     // Frames handled per softirq run
+#define NETDEV_BUDGET_TICKS 2   // Ticks per softirq run
+
+struct backlog_frame {
+    net_device_t* dev;
+    uint16_t len;
+    uint8_t data[ETH_HDR_SIZE + ETH_MTU];
+};
+
+struct softnet_data {
+    struct list_head poll_list; // Scheduled NAPI instances
+    struct napi_struct backlog;
+    struct backlog_frame queue[NETDEV_BACKLOG];
+    uint32_t head;              // Next frame to process
+    uint32_t tail;              // Next free slot
+    uint32_t processed;
+    uint32_t dropped;           // Backlog full or frame too long
+    uint32_t time_squeeze;      // Runs that ended with polls left
+};
+
+static struct softnet_data softnet_data[CPU_COUNT];
+
+static void arp_cache_expire(unsigned long data);
+static void tcp_retransmit_timer(unsigned long data);
+static void net_rx_action(struct softirq_action *h);
+static int process_backlog(struct napi_struct* napi, int quota);
+
 // Initialize networking
 void net_init(void) {
     memset(devices, 0, sizeof(devices));
     memset(arp_cache, 0, sizeof(arp_cache));
     memset(sockets, 0, sizeof(sockets));
     
+    for (int i = 0; i < 256; i++) {
+        setup_timer(&sockets[i].retransmit_timer, tcp_retransmit_timer,
+                    (unsigned long)&sockets[i]);
+    }
+    
+    // Start ARP cache aging
+    setup_timer(&arp_gc_timer, arp_cache_expire, 0);
+    mod_timer(&arp_gc_timer, timer_get_ticks() + ARP_GC_INTERVAL);
+    
+    for (int cpu = 0; cpu < CPU_COUNT; cpu++) {
+        struct softnet_data* sd = &softnet_data[cpu];
+        
+        INIT_LIST_HEAD(&sd->poll_list);
+        netif_napi_add(NULL, &sd->backlog, process_backlog, NAPI_POLL_WEIGHT);
+        napi_enable(&sd->backlog);
+    }
+    
+    open_softirq(NET_RX_SOFTIRQ, net_rx_action);
+    
     screen_print("Network stack initialized\n");
 }
 
@@ -123,6 +176,171 @@ void eth_receive(net_device_t* dev, void* data, size_t len) {
     }
 }
 
+// Queue a received frame for NET_RX_SOFTIRQ; callable from any context.
+// The frame is copied so the driver can reuse its ring slot at once
+int netif_rx(net_device_t* dev, void* data, size_t len) {
+    struct softnet_data* sd;
+    struct backlog_frame* frame;
+    unsigned long flags;
+    
+    local_irq_save(flags);
+    sd = &softnet_data[smp_processor_id()];
+    
+    if (len > sizeof(frame->data) || sd->tail - sd->head >= NETDEV_BACKLOG) {
+        sd->dropped++;
+        local_irq_restore(flags);
+        return NET_RX_DROP;
+    }
+    
+    frame = &sd->queue[sd->tail % NETDEV_BACKLOG];
+    frame->dev = dev;
+    frame->len = len;
+    memcpy(frame->data, data, len);
+    sd->tail++;
+    
+    napi_schedule(&sd->backlog);
+    local_irq_restore(flags);
+    
+    return NET_RX_SUCCESS;
+}
+
+int netif_receive_skb(net_device_t* dev, void* data, size_t len) {
+    softnet_data[smp_processor_id()].processed++;
+    eth_receive(dev, data, len);
+    return NET_RX_SUCCESS;
+}
+
+// Poll routine of the per-CPU backlog. A frame's slot stays claimed
+// until it has been processed
+static int process_backlog(struct napi_struct* napi, int quota) {
+    struct softnet_data* sd = container_of(napi, struct softnet_data, backlog);
+    int work = 0;
+    
+    while (work < quota) {
+        struct backlog_frame* frame;
+        
+        local_irq_disable();
+        if (sd->head == sd->tail) {
+            // Drained: netif_rx() reschedules for the next frame
+            napi_complete_done(napi, work);
+            local_irq_enable();
+            break;
+        }
+        local_irq_enable();
+        
+        frame = &sd->queue[sd->head % NETDEV_BACKLOG];
+        eth_receive(frame->dev, frame->data, frame->len);
+        work++;
+        
+        local_irq_disable();
+        sd->head++;
+        sd->processed++;
+        local_irq_enable();
+    }
+    
+    return work;
+}
+
+/**
+ * NAPI
+ */
+void netif_napi_add(net_device_t* dev, struct napi_struct* napi,
+                    int (*poll)(struct napi_struct* napi, int budget), int weight) {
+    INIT_LIST_HEAD(&napi->poll_list);
+    napi->dev = dev;
+    napi->poll = poll;
+    napi->weight = weight;
+    // Starts disabled; napi_enable() once the device can interrupt
+    napi->state = NAPI_STATE_SCHED;
+}
+
+void netif_napi_del(struct napi_struct* napi) {
+    napi_disable(napi);
+    INIT_LIST_HEAD(&napi->poll_list);
+}
+
+bool napi_schedule_prep(struct napi_struct* napi) {
+    if (napi->state & NAPI_STATE_DISABLE) {
+        return false;
+    }
+    return !(__sync_fetch_and_or(&napi->state, NAPI_STATE_SCHED) & NAPI_STATE_SCHED);
+}
+
+// Queue on this CPU; the poll runs where the interrupt was taken
+void __napi_schedule(struct napi_struct* napi) {
+    unsigned long flags;
+    
+    local_irq_save(flags);
+    list_add_tail(&napi->poll_list, &softnet_data[smp_processor_id()].poll_list);
+    raise_softirq_irqoff(NET_RX_SOFTIRQ);
+    local_irq_restore(flags);
+}
+
+bool napi_complete_done(struct napi_struct* napi, int work_done) {
+    unsigned long flags;
+    
+    local_irq_save(flags);
+    list_del_init(&napi->poll_list);
+    local_irq_restore(flags);
+    
+    // Once SCHED is clear a pending napi_disable() can take it
+    return !(__sync_fetch_and_and(&napi->state, ~NAPI_STATE_SCHED) & NAPI_STATE_DISABLE);
+}
+
+void napi_disable(struct napi_struct* napi) {
+    __sync_fetch_and_or(&napi->state, NAPI_STATE_DISABLE);
+    
+    // A scheduled poll keeps SCHED until it completes
+    while (__sync_fetch_and_or(&napi->state, NAPI_STATE_SCHED) & NAPI_STATE_SCHED) {
+        cpu_relax();
+    }
+    
+    __sync_fetch_and_and(&napi->state, ~NAPI_STATE_DISABLE);
+}
+
+void napi_enable(struct napi_struct* napi) {
+    __sync_fetch_and_and(&napi->state, ~NAPI_STATE_SCHED);
+}
+
+// NET_RX_SOFTIRQ: poll scheduled instances round robin, each for up to
+// its weight. An instance that used its whole weight goes to the back of
+// the list; whatever is left past the budget or time limit waits for the
+// next run (or ksoftirqd), so a flood cannot hold the CPU
+static void net_rx_action(struct softirq_action* h) {
+    struct softnet_data* sd = &softnet_data[smp_processor_id()];
+    uint32_t time_limit = timer_get_ticks() + NETDEV_BUDGET_TICKS;
+    int budget = NETDEV_BUDGET;
+    
+    local_irq_disable();
+    
+    while (!list_empty(&sd->poll_list)) {
+        struct napi_struct* napi;
+        int work;
+        
+        if (budget <= 0 || time_before(time_limit, timer_get_ticks())) {
+            sd->time_squeeze++;
+            raise_softirq_irqoff(NET_RX_SOFTIRQ);
+            break;
+        }
+        
+        napi = list_first_entry(&sd->poll_list, struct napi_struct, poll_list);
+        local_irq_enable();
+        
+        work = napi->poll(napi, napi->weight);
+        budget -= work;
+        
+        local_irq_disable();
+        
+        // Still scheduled after a full quota: more frames are waiting
+        if (work >= napi->weight && !list_empty(&napi->poll_list)) {
+            list_del(&napi->poll_list);
+            list_add_tail(&napi->poll_list, &sd->poll_list);
+        }
+    }
+    
+    local_irq_enable();
+}
+
 // IP transmit
 int ip_transmit(uint32_t src, uint32_t dest, uint8_t protocol, void* data, size_t len) {
     // Find suitable device
@@ -368,6 +586,40 @@ void icmp_receive(net_device_t* dev, void* data, size_t len) {
     }
 }
 
+// Send SYN+ACK for a socket in SYN_RECEIVED
+static void tcp_send_synack(socket_t* sock) {
+    tcp_hdr_t reply;
+    reply.source = htons(sock->local_port);
+    reply.dest = htons(sock->remote_port);
+    reply.seq = 0;
+    reply.ack_seq = htonl(sock->rcv_nxt);
+    reply.data_off = 5 << 4;
+    reply.flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+    reply.window = htons(TCP_MAX_WINDOW);
+    reply.check = 0;
+    reply.urg_ptr = 0;
+    
+    ip_transmit(sock->local_ip, sock->remote_ip, IPPROTO_TCP, &reply, sizeof(reply));
+}
+
+// Retransmit timeout: resend with exponential backoff, then give up
+static void tcp_retransmit_timer(unsigned long data) {
+    socket_t* sock = (socket_t*)data;
+    
+    if (sock->state != TCP_SYN_RECEIVED) {
+        return;
+    }
+    
+    if (++sock->retries > TCP_SYNACK_RETRIES) {
+        sock->state = TCP_CLOSED;
+        return;
+    }
+    
+    tcp_send_synack(sock);
+    mod_timer(&sock->retransmit_timer,
+              timer_get_ticks() + (TCP_TIMEOUT_INIT << sock->retries));
+}
+
 // TCP receive packet
 void tcp_receive_packet(net_device_t* dev, void* data, size_t len) {
     if (len < sizeof(tcp_hdr_t)) {
@@ -393,23 +645,19 @@ void tcp_receive_packet(net_device_t* dev, void* data, size_t len) {
     
     // Handle TCP state machine
     if (tcp->flags & TCP_FLAG_SYN) {
-        // Send SYN+ACK
-        tcp_hdr_t reply;
-        reply.source = htons(sock->local_port);
-        reply.dest = htons(src_port);
-        reply.seq = 0;
-        reply.ack_seq = htonl(ntohl(tcp->seq) + 1);
-        reply.data_off = 5 << 4;
-        reply.flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-        reply.window = htons(TCP_MAX_WINDOW);
-        reply.check = 0;
-        reply.urg_ptr = 0;
+        // Send SYN+ACK and arm the retransmit timer until the peer ACKs
+        sock->local_ip = dev->ip_addr;
+        sock->remote_ip = ntohl(((ip_hdr_t*)(data - sizeof(ip_hdr_t)))->saddr);
+        sock->remote_port = src_port;
+        sock->rcv_nxt = ntohl(tcp->seq) + 1;
+        sock->retries = 0;
+        sock->state = TCP_SYN_RECEIVED;
         
-        ip_transmit(dev->ip_addr, ntohl(((ip_hdr_t*)(data - sizeof(ip_hdr_t)))->saddr),
-                   IPPROTO_TCP, &reply, sizeof(reply));
-        sock->state = 1;  // SYN_RECEIVED
+        tcp_send_synack(sock);
+        mod_timer(&sock->retransmit_timer, timer_get_ticks() + TCP_TIMEOUT_INIT);
     } else if (tcp->flags & TCP_FLAG_ACK) {
-        sock->state = 2;  // ESTABLISHED
+        del_timer(&sock->retransmit_timer);
+        sock->state = TCP_ESTABLISHED;
     }
     
     // TODO: Handle data transfer
@@ -523,8 +771,14 @@ void arp_cache_add(uint32_t ip, uint8_t* mac) {
 }
 
 bool arp_lookup(uint32_t ip, uint8_t* mac) {
+    uint32_t now = timer_get_ticks();
+    
     for (int i = 0; i < arp_cache_size; i++) {
         if (arp_cache[i].ip == ip) {
+            // Stale entries are left for the aging timer to reap
+            if (now - arp_cache[i].timestamp >= ARP_ENTRY_TIMEOUT) {
+                return false;
+            }
             mac_copy(mac, arp_cache[i].mac);
             return true;
         }
@@ -532,6 +786,22 @@ bool arp_lookup(uint32_t ip, uint8_t* mac) {
     return false;
 }
 
+// Periodic ARP cache aging
+static void arp_cache_expire(unsigned long data) {
+    uint32_t now = timer_get_ticks();
+    int i = 0;
+    
+    while (i < arp_cache_size) {
+        if (now - arp_cache[i].timestamp >= ARP_ENTRY_TIMEOUT) {
+            arp_cache[i] = arp_cache[--arp_cache_size];
+        } else {
+            i++;
+        }
+    }
+    
+    mod_timer(&arp_gc_timer, now + ARP_GC_INTERVAL);
+}
+
 // htons/ntohs functions
 uint16_t htons(uint16_t hostshort) {
     return ((hostshort & 0xFF) << 8) | ((hostshort >> 8) & 0xFF);
@@ -5,6 +5,16 @@
 #include "kernel.h"
 #include "mm.h"
 #include "timer.h"
+#include "sched_stats.h"
+#include "sched_pelt.h"
+#include "sched_group.h"
+#include "scheduler.h"
+#include "irq.h"
+#include "spinlock.h"
+#include "trace_irqsoff.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "pci.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -31,6 +41,17 @@ void shell_start(void) {
     shell_register_command("touch", cmd_touch, "Create empty file");
     shell_register_command("rm", cmd_rm, "Remove file or directory");
     shell_register_command("ps", cmd_ps, "List processes");
+    shell_register_command("schedstat", cmd_schedstat, "Dump scheduler statistics");
+    shell_register_command("cgroup", cmd_cgroup, "Manage CPU task groups");
+    shell_register_command("chrt", cmd_chrt, "Set real-time scheduling policy");
+    shell_register_command("taskset", cmd_taskset, "Show or set process CPU affinity");
+    shell_register_command("irqaffinity", cmd_irqaffinity, "Show or set IRQ CPU affinity");
+    shell_register_command("irqstat", cmd_irqstat, "Dump per-IRQ counts, rates and handler times");
+    shell_register_command("lockstat", cmd_lockstat, "Show or reset lock contention statistics");
+    shell_register_command("latency", cmd_latency, "Trace interrupts-off and lock-held sections");
+    shell_register_command("softirqs", cmd_softirqs, "Show softirq counts per CPU");
+    shell_register_command("workqueues", cmd_workqueues, "Show worker pools and workqueues");
+    shell_register_command("lspci", cmd_lspci, "List PCI devices");
     shell_register_command("kill", cmd_kill, "Terminate process");
     shell_register_command("reboot", cmd_reboot, "Reboot system");
     shell_register_command("halt", cmd_halt, "Halt system");
@@ -377,14 +398,17 @@ char cmd_rm(int argc, char** argv) {
 }
 
 char cmd_ps(int argc, char** argv) {
-    screen_print("PID  STATE  PPID  COMMAND\n");
+    process_t* p;
     
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pcb.state != PROCESS_TERMINATED) {
-            screen_print_dec(process_table[i].pcb.pid);
+    screen_print("PID  STATE  PPID  %CPU  LOAD  COMMAND\n");
+    
+    rcu_read_lock();
+    for_each_process(p) {
+        if (p->pcb.state != PROCESS_TERMINATED) {
+            screen_print_dec(p->pcb.pid);
             screen_print("   ");
             
-            switch (process_table[i].pcb.state) {
+            switch (p->pcb.state) {
                 case PROCESS_RUNNING:
                     screen_print("RUN  ");
                     break;
@@ -400,11 +424,312 @@ char cmd_ps(int argc, char** argv) {
             }
             
             screen_print("   ");
-            screen_print_dec(process_table[i].pcb.ppid);
+            screen_print_dec(p->pcb.ppid);
+            screen_print("   ");
+            screen_print_dec(task_util(p) * 100 / SCHED_CAPACITY_SCALE);
+            screen_print("   ");
+            screen_print_dec(task_load(p));
             screen_print("   [kernel]\n");
         }
     }
+    rcu_read_unlock();
+    
+    screen_print_dec(nr_processes);
+    screen_print(" processes\n");
+    return 0;
+}
+
+char cmd_schedstat(int argc, char** argv) {
+    schedstat_show();
+    return 0;
+}
+
+char cmd_cgroup(int argc, char** argv) {
+    struct task_group* tg;
+    int ret;
+    
+    if (argc < 2) {
+        sched_group_print();
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "create") == 0 && (argc == 3 || argc == 4)) {
+        struct task_group* parent = argc == 4 ? sched_find_group(argv[3]) : NULL;
+        
+        if (argc == 4 && !parent) {
+            screen_print("Group not found: ");
+            screen_print(argv[3]);
+            screen_print("\n");
+            return 1;
+        }
+        
+        if (!sched_create_group(parent, argv[2])) {
+            screen_print("Cannot create group: ");
+            screen_print(argv[2]);
+            screen_print("\n");
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (argc < 3 || !(tg = sched_find_group(argv[2]))) {
+        screen_print("Usage: cgroup [create <name> [parent] | destroy <name> |\n");
+        screen_print("       shares <name> <shares> | quota <name> <us|-1> [period_us] |\n");
+        screen_print("       attach <name> <pid>]\n");
+        return 1;
+    }
+    
+    if (strcmp(argv[1], "destroy") == 0 && argc == 3) {
+        ret = sched_destroy_group(tg);
+    } else if (strcmp(argv[1], "shares") == 0 && argc == 4) {
+        ret = sched_group_set_shares(tg, atoi(argv[3]));
+    } else if (strcmp(argv[1], "quota") == 0 && (argc == 4 || argc == 5)) {
+        uint32_t period = argc == 5 ? atoi(argv[4]) : DEFAULT_CFS_PERIOD_US;
+        ret = tg_set_cfs_bandwidth(tg, period, atoi(argv[3]));
+    } else if (strcmp(argv[1], "attach") == 0 && argc == 4) {
+        process_t* p;
+        
+        rcu_read_lock();
+        p = process_by_pid(atoi(argv[3]));
+        ret = p ? sched_move_task(p, tg) : -ESRCH;
+        rcu_read_unlock();
+    } else {
+        screen_print("Unknown cgroup command: ");
+        screen_print(argv[1]);
+        screen_print("\n");
+        return 1;
+    }
+    
+    if (ret < 0) {
+        screen_print("cgroup: operation failed (");
+        screen_print_dec(-ret);
+        screen_print(")\n");
+        return 1;
+    }
+    
+    return 0;
+}
+
+char cmd_chrt(int argc, char** argv) {
+    uint32_t policy;
+    uint32_t rt_priority = 0;
+    
+    if (argc < 3 || argc > 4) {
+        screen_print("Usage: chrt <pid> <fifo|rr|other> [priority]\n");
+        return 1;
+    }
+    
+    if (strcmp(argv[2], "fifo") == 0) {
+        policy = SCHED_FIFO;
+    } else if (strcmp(argv[2], "rr") == 0) {
+        policy = SCHED_RR;
+    } else if (strcmp(argv[2], "other") == 0) {
+        policy = SCHED_NORMAL;
+    } else {
+        screen_print("Unknown policy: ");
+        screen_print(argv[2]);
+        screen_print("\n");
+        return 1;
+    }
+    
+    if (argc == 4) {
+        rt_priority = atoi(argv[3]);
+    }
+    
+    uint32_t pid = atoi(argv[1]);
+    process_t* p;
+    int ret;
+    
+    rcu_read_lock();
+    p = process_by_pid(pid);
+    ret = p ? sched_setscheduler(p, policy, rt_priority) : -ESRCH;
+    rcu_read_unlock();
+    
+    if (ret == 0) {
+        return 0;
+    }
+    if (ret != -ESRCH) {
+        screen_print("chrt: invalid priority for policy\n");
+        return 1;
+    }
+    
+    screen_print("Process not found: ");
+    screen_print_dec(pid);
+    screen_print("\n");
+    return 1;
+}
+
+char cmd_taskset(int argc, char** argv) {
+    struct cpumask mask;
+    
+    if (argc < 2 || argc > 3) {
+        screen_print("Usage: taskset <pid> [cpu-list]\n");
+        return 1;
+    }
+    
+    uint32_t pid = atoi(argv[1]);
+    
+    if (argc == 3) {
+        if (cpulist_parse(argv[2], &mask) < 0) {
+            screen_print("Invalid CPU list: ");
+            screen_print(argv[2]);
+            screen_print("\n");
+            return 1;
+        }
+        
+        if (sched_setaffinity(pid, &mask) < 0) {
+            screen_print("taskset: no such process or no online CPU in list\n");
+            return 1;
+        }
+    }
+    
+    if (sched_getaffinity(pid, &mask) < 0) {
+        screen_print("Process not found: ");
+        screen_print_dec(pid);
+        screen_print("\n");
+        return 1;
+    }
+    
+    screen_print("pid ");
+    screen_print_dec(pid);
+    screen_print(" affinity mask: ");
+    screen_print_hex(cpumask_bits(&mask));
+    screen_print("\n");
+    return 0;
+}
+
+char cmd_irqaffinity(int argc, char** argv) {
+    struct cpumask mask;
+    
+    if (argc < 2 || argc > 3) {
+        screen_print("Usage: irqaffinity <irq> [cpu-list]\n");
+        return 1;
+    }
+    
+    uint32_t irq = atoi(argv[1]);
+    
+    if (argc == 3) {
+        if (cpulist_parse(argv[2], &mask) < 0 || irq_set_affinity(irq, &mask) < 0) {
+            screen_print("irqaffinity: invalid IRQ or CPU list\n");
+            return 1;
+        }
+    }
+    
+    if (!irq_get_affinity(irq)) {
+        screen_print("Invalid IRQ\n");
+        return 1;
+    }
+    
+    screen_print("IRQ ");
+    screen_print_dec(irq);
+    screen_print(" affinity mask: ");
+    screen_print_hex(cpumask_bits(irq_get_affinity(irq)));
+    screen_print("\n");
+    return 0;
+}
+
+char cmd_irqstat(int argc, char** argv) {
+    if (argc > 2) {
+        screen_print("Usage: irqstat [irq]\n");
+        return 1;
+    }
+    
+    if (argc == 1) {
+        irqstat_show();
+        return 0;
+    }
+    
+    uint32_t irq = atoi(argv[1]);
+    
+    if (irq >= NR_IRQS) {
+        screen_print("Invalid IRQ\n");
+        return 1;
+    }
+    
+    irq_print_stats(irq);
+    return 0;
+}
+
+char cmd_lockstat(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        lock_stat_reset();
+        screen_print("Lock statistics cleared\n");
+        return 0;
+    }
     
+    if (argc != 1) {
+        screen_print("Usage: lockstat [reset]\n");
+        return 1;
+    }
+    
+    lock_stat_show();
+    return 0;
+}
+
+char cmd_latency(int argc, char** argv) {
+    unsigned int tracers = 0;
+    
+    if (argc == 1) {
+        latency_trace_show();
+        return 0;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        latency_trace_stop();
+        return 0;
+    }
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        latency_trace_reset();
+        screen_print("Latency table cleared\n");
+        return 0;
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "irqsoff") == 0) {
+            tracers |= TRACE_IRQSOFF;
+        } else if (strcmp(argv[i], "preemptoff") == 0) {
+            tracers |= TRACE_PREEMPTOFF;
+        } else {
+            screen_print("Usage: latency [irqsoff] [preemptoff] | off | reset\n");
+            return 1;
+        }
+    }
+    
+    if (latency_trace_start(tracers) < 0) {
+        screen_print("latency: needs a calibrated TSC\n");
+        return 1;
+    }
+    return 0;
+}
+
+char cmd_softirqs(int argc, char** argv) {
+    if (argc != 1) {
+        screen_print("Usage: softirqs\n");
+        return 1;
+    }
+    
+    softirq_show();
+    return 0;
+}
+
+char cmd_workqueues(int argc, char** argv) {
+    if (argc != 1) {
+        screen_print("Usage: workqueues\n");
+        return 1;
+    }
+    
+    workqueue_show();
+    return 0;
+}
+
+char cmd_lspci(int argc, char** argv) {
+    if (argc != 1) {
+        screen_print("Usage: lspci\n");
+        return 1;
+    }
+    
+    pci_show();
     return 0;
 }
 
@@ -416,15 +741,11 @@ char cmd_kill(int argc, char** argv) {
     
     uint32_t pid = atoi(argv[1]);
     
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pcb.pid == pid && 
-            process_table[i].pcb.state != PROCESS_TERMINATED) {
-            process_table[i].pcb.state = PROCESS_TERMINATED;
-            screen_print("Process ");
-            screen_print_dec(pid);
-            screen_print(" terminated\n");
-            return 0;
-        }
+    if (process_kill(pid) == 0) {
+        screen_print("Process ");
+        screen_print_dec(pid);
+        screen_print(" terminated\n");
+        return 0;
     }
     
     screen_print("Process not found: ");